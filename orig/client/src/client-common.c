@@ -1,12 +1,27 @@
 #include "client-common.h"
+#include <sys/uio.h>
 
 #define HOME_PATH_LENGTH        4096
 #define PRINTF_BUF_LENGTH       128
 
+/*! \brief How much of what the server's sent us we can hold on to before the game gets around to reading it;
+ * needs to be bigger than the biggest message the server sends (the lobby list). */
+#define COMMON_RX_BUFFER_SIZE   8192
+
 /*! \brief For network-aware apps, the TCP connection to the server. Kept private - client code should user
  * COMMON_connect(), COMMON_send(), COMMON_recv() and COMMON_disconnect(). */
 static int common_connection_fd = -1;
 
+/*! \defgroup common_rx_priv
+ * \brief Bytes that have come in from the server but haven't been handed out by COMMON_recv() yet.  TCP
+ * doesn't keep messages apart, so this is where they get split back up.
+ * \{ */
+static char     common_rx_buffer[COMMON_RX_BUFFER_SIZE];
+static int      common_rx_used = 0;
+/*! \brief How much of the last message COMMON_recv() handed out was copied out. */
+static uint16_t common_last_recv_length = 0;
+/*! \} */
+
 /*! \defgroup dumb_priv_data
  * \brief Module-player management stuff; you really shouldn't need to worry about this at all.
  * \{ */
@@ -123,17 +138,34 @@ BOOL COMMON_connect(uint32_t remote_address, uint16_t remote_port)
 
 /****************************************************************************************************************/
 /*!
- * @brief Sends out a chunk of data across the network. The connection has to have been opened
+ * @brief Sends out a message across the network. The connection has to have been opened
  * already.
  */
 BOOL COMMON_send(void *data, uint16_t length)
 {
+    unsigned char   header[FRAME_HEADER_SIZE];
+    struct iovec    iov[2];
+    struct msghdr   out;
+
     if (common_connection_fd == -1)
         return FALSE;
 
-    int bytes_sent = send(common_connection_fd, data, length, MSG_DONTWAIT);
+    // every message goes out behind its length, so the server can tell where it ends
+    header[0] = (length >> 8) & 0xff;
+    header[1] = (length     ) & 0xff;
+
+    iov[0].iov_base = header;
+    iov[0].iov_len  = FRAME_HEADER_SIZE;
+    iov[1].iov_base = data;
+    iov[1].iov_len  = length;
 
-    if (bytes_sent != length)
+    memset(&out, 0, sizeof(out));
+    out.msg_iov     = iov;
+    out.msg_iovlen  = 2;
+
+    int bytes_sent = sendmsg(common_connection_fd, &out, MSG_DONTWAIT);
+
+    if (bytes_sent != (FRAME_HEADER_SIZE + length))
         return FALSE;
 
     return TRUE;
@@ -141,22 +173,62 @@ BOOL COMMON_send(void *data, uint16_t length)
 
 /****************************************************************************************************************/
 /*!
- * @brief Grabs an incoming chunk of data if one is available. The connection has to have been
+ * @brief Grabs the next incoming message if a whole one is available. The connection has to have been
  * opened already.
+ * @note If the message is longer than length, the rest of it is thrown away.
  */
 BOOL COMMON_recv(void *data, uint16_t length)
 {
+    int received;
+    int msg_length;
+
     if (common_connection_fd == -1)
         return FALSE;
 
-    if (recv(common_connection_fd, data, length, MSG_DONTWAIT) == -1)
+    // top up with whatever's arrived since last time
+    received = recv(common_connection_fd, &common_rx_buffer[common_rx_used],
+        COMMON_RX_BUFFER_SIZE - common_rx_used, MSG_DONTWAIT);
+
+    if (received > 0)
+        common_rx_used += received;
+
+    if (common_rx_used < FRAME_HEADER_SIZE)
+        return FALSE;
+
+    msg_length = ((unsigned char)common_rx_buffer[0] << 8) | (unsigned char)common_rx_buffer[1];
+
+    if ((FRAME_HEADER_SIZE + msg_length) > COMMON_RX_BUFFER_SIZE)
     {
+        // the server's sending us something we can never hold; there's no recovering from that
+        DUH_WHERE_AM_I("Got a %d byte message from the server, which is too big to handle.", msg_length);
+        COMMON_disconnect();
         return FALSE;
     }
 
+    // not all here yet?
+    if (common_rx_used < (FRAME_HEADER_SIZE + msg_length))
+        return FALSE;
+
+    common_last_recv_length = (msg_length < length) ? msg_length : length;
+    memcpy(data, &common_rx_buffer[FRAME_HEADER_SIZE], common_last_recv_length);
+
+    // slide whatever's left (usually nothing) down to the front
+    common_rx_used -= FRAME_HEADER_SIZE + msg_length;
+    memmove(common_rx_buffer, &common_rx_buffer[FRAME_HEADER_SIZE + msg_length], common_rx_used);
+
     return TRUE;
 }
 
+/****************************************************************************************************************/
+/*!
+ * @brief How many bytes the last message COMMON_recv() handed out was (or as many as there was room for).
+ * Most messages are a fixed size, but some (like the lobby's) aren't.
+ */
+uint16_t COMMON_last_recv_length(void)
+{
+    return common_last_recv_length;
+}
+
 /****************************************************************************************************************/
 /*!
  * @brief Closes a connection, if there's one open, or fails silently if not.
@@ -166,7 +238,8 @@ void COMMON_disconnect(void)
     if (common_connection_fd != -1)
         close(common_connection_fd);
 
-    common_connection_fd = -1;
+    common_connection_fd    = -1;
+    common_rx_used          = 0;
 }
 
 /****************************************************************************************************************/
@@ -160,6 +160,7 @@
     BOOL    COMMON_connect(uint32_t remote_address, uint16_t remote_port);
     BOOL    COMMON_send(void *data, uint16_t length);
     BOOL    COMMON_recv(void *data, uint16_t length);
+    uint16_t COMMON_last_recv_length(void);
     void    COMMON_disconnect(void);
     char    *COMMON_load_file_to_char_array(const char *filename);
 
@@ -56,6 +56,8 @@ static SAMPLE *                 gameplay_chat_noise;
 static BOOL                     gameplay_my_turn = FALSE;
 static int                     gameplay_side = 0;
 static int                      gameplay_board[3][3];
+/*! \brief The number of the last move we've heard about; see MSGTYPE_GAME_UPDATE. */
+static uint32_t                 gameplay_seq;
 /*! \} */
 
 /****************************************************************************************************************/
@@ -105,6 +107,7 @@ void GAMEPLAY_init(void)
     gameplay_chatbox_slide = -GAMEPLAY_CHATWIDGET_H;
     COMMON_set_bgm(BGM_ID_INGAME);
     gameplay_side = 0;
+    gameplay_seq = 0;
 
     int x_index;
     int y_index;
@@ -141,25 +144,21 @@ void GAMEPLAY_tick(void)
     {
         if (had_msg_waiting == FALSE)
             return;
-        else
+
+        if ((communication_buffer[0] == MSGTYPE_YOU_ARE_X) || (communication_buffer[0] == MSGTYPE_YOU_ARE_O))
         {
-            DUH_WHERE_AM_I("here 1. %c", communication_buffer[0]);
+            gameplay_side = communication_buffer[0];
+            had_msg_waiting = FALSE;
 
-            if ((communication_buffer[0] == MSGTYPE_YOU_ARE_X) || (communication_buffer[0] == MSGTYPE_YOU_ARE_O))
-            {
-                gameplay_side = communication_buffer[0];
-                had_msg_waiting = FALSE;
+            if (gameplay_side == MSGTYPE_YOU_ARE_X)
+                gameplay_my_turn = TRUE;
 
-                if (gameplay_side == MSGTYPE_YOU_ARE_X)
-                    gameplay_my_turn = TRUE;
-            }
-            else
-            {
-                DUH_WHERE_AM_I("here 1. %c", communication_buffer[0]);
-                // the server is supposed to send which side we're on; if they don't, we kinda can't proceed
-                return;
-            }
+            // let the server know we heard, or it'll keep telling us
+            communication_buffer[0] = MSGTYPE_START_GAME;
+            COMMON_send(communication_buffer, 1);
         }
+
+        // anything else (say, our opponent quitting before we got going) still gets handled below
     }
 
     if (had_msg_waiting)
@@ -167,29 +166,56 @@ void GAMEPLAY_tick(void)
         switch (communication_buffer[0])
         {
             case MSGTYPE_CHAT:
-                strncpy(gameplay_incoming_chat,  &communication_buffer[1], OUTGOING_CHAT_MESSAGE_LENGTH);
+            {
+                PROTO_CHAT_LINE chat;
+
+                PROTO_decode_CHAT_LINE(&chat, communication_buffer, COMMON_last_recv_length());
+                strcpy(gameplay_incoming_chat, chat.text);
                 play_sample(gameplay_chat_noise, 255, 128, 1000, 0);
                 gameplay_chat_timer = INCOMING_CHAT_TIMEOUT;
+            }
             break;
 
             //--------------------
 
-            case MSGTYPE_ITS_YOUR_TURN:
+            case MSGTYPE_GAME_UPDATE:
             {
-                gameplay_my_turn = TRUE;
-                DUH_WHERE_AM_I("my turn now...");
+                PROTO_GAME_UPDATE update;
+
+                PROTO_decode_GAME_UPDATE(&update, communication_buffer, COMMON_last_recv_length());
+
+                // missed one somewhere - ask for the whole board rather than guess
+                if ((update.seq != gameplay_seq + 1) || (update.cell >= BOARD_WIDTH * BOARD_HEIGHT))
+                {
+                    DUH_WHERE_AM_I("expected move %u, got %u; resyncing", gameplay_seq + 1, update.seq);
+                    communication_buffer[0] = MSGTYPE_RESYNC;
+                    COMMON_send(communication_buffer, 1);
+                    break;
+                }
+
+                gameplay_seq = update.seq;
+                gameplay_board[update.cell / BOARD_WIDTH][update.cell % BOARD_WIDTH] = update.mark;
+
+                // whoever didn't just move is up
+                gameplay_my_turn = (update.mark != gameplay_side);
+            }
+            break;
+
+            //--------------------
 
-                gameplay_board[0][0] = communication_buffer[1];
-                gameplay_board[0][1] = communication_buffer[2];
-                gameplay_board[0][2] = communication_buffer[3];
+            case MSGTYPE_GAME_CHECKPOINT:
+            {
+                PROTO_GAME_CHECKPOINT   checkpoint;
+                int                     cell;
 
-                gameplay_board[1][0] = communication_buffer[4];
-                gameplay_board[1][1] = communication_buffer[5];
-                gameplay_board[1][2] = communication_buffer[6];
+                PROTO_decode_GAME_CHECKPOINT(&checkpoint, communication_buffer, COMMON_last_recv_length());
 
-                gameplay_board[2][0] = communication_buffer[7];
-                gameplay_board[2][1] = communication_buffer[8];
-                gameplay_board[2][2] = communication_buffer[9];
+                gameplay_seq = checkpoint.seq;
+
+                for (cell = 0; cell < BOARD_WIDTH * BOARD_HEIGHT; cell++)
+                    gameplay_board[cell / BOARD_WIDTH][cell % BOARD_WIDTH] = checkpoint.cells[cell];
+
+                gameplay_my_turn = (checkpoint.to_move == gameplay_side);
             }
             break;
 
@@ -221,6 +247,10 @@ void GAMEPLAY_tick(void)
         }
     }
 
+    // no moving until we know which side we're on
+    if (gameplay_side == 0)
+        return;
+
     // are we still animating?
     if (SCRNWIPE_check_active())
     {
@@ -257,11 +287,13 @@ void GAMEPLAY_tick(void)
                                     PARTICLE_HEART, 255,  rand() % NUM_PARTICLE_COLOURS);
                             }
 
-                            communication_buffer[0] = MSGTYPE_MOVE;
-                            communication_buffer[1] = column;
-                            communication_buffer[2] = row;
+                            PROTO_MOVE move;
+
+                            move.column = column;
+                            move.row    = row;
 
-                            COMMON_send(communication_buffer, 3);
+                            COMMON_send(communication_buffer,
+                                PROTO_encode_MOVE(communication_buffer, sizeof(communication_buffer), &move));
                             gameplay_my_turn = FALSE;
                         }
                     }
@@ -318,10 +350,13 @@ void GAMEPLAY_chat_helper(void)
         if (TEWI_get_string()[0] != 0)
         {
             // send it to the server as a chat message
-            char buf[OUTGOING_CHAT_MESSAGE_LENGTH];
+            PROTO_CHAT_LINE chat;
+            char            buf[OUTGOING_CHAT_MESSAGE_LENGTH];
+
+            snprintf(chat.text, sizeof(chat.text), "%s", TEWI_get_string());
+            chat.avatar = 0;
 
-            snprintf(buf, OUTGOING_CHAT_MESSAGE_LENGTH, "%c%s", MSGTYPE_CHAT, TEWI_get_string());
-            COMMON_send(buf, OUTGOING_CHAT_MESSAGE_LENGTH);
+            COMMON_send(buf, PROTO_encode_CHAT_LINE(buf, sizeof(buf), &chat));
             TEWI_set_string(NULL);
         }
     }
@@ -17,14 +17,8 @@
 #define LOBBY_HEADER_X          ((common_effective_display_width - LOBBY_HEADER_W) / 2.0f)
 #define LOBBY_HEADER_Y          4
 
-#define LOBBY_TIME_BETWEEN_REFRESHES    (TICKS_PER_SEC * 10)
-
-/* format of a name in the lobby refresh message:
- *  name    null  wins    losses     ties     avatar index   null padding
- * 0.....30  31  32...35 36.....39  40....43    44           45.......47
- */
-
-#define LOBBY_NAME_DATA_SIZE     48
+/*! \brief Big enough for the biggest lobby page there is; see PROTO_LOBBY_PAGE and PROTO_LOBBY_RECORD. */
+#define LOBBY_MSG_BUFF_SIZE     (LOBBY_PAGE_HEADER_SIZE + (LOBBY_LIST_RECORD_SIZE * LOBBY_PAGE_MAX_SIZE))
 
 typedef struct
 {
@@ -33,6 +27,7 @@ typedef struct
     int losses;
     int ties;
     uint8_t av_id;
+    BOOL in_game;
 } LOBBY_DISPLAYABLE_NAME_PRIV;
 
 /*! \defgroup lobby_asset_paths The file and path names of the textures this module needs to draw itself.
@@ -74,7 +69,15 @@ static TEXTURE_HANDLE   lobby_header_gfx;
 static TEXTURE_HANDLE   lobby_next_gfx;
 static TEXTURE_HANDLE   lobby_invite_gfx;
 static TEXTURE_HANDLE   lobby_chatwidget_gfx;
-static uint8_t          lobby_curr_page = 0;
+static uint32_t         lobby_curr_page = 0;
+/*! \brief How many players the server says there are, on every page. */
+static uint32_t         lobby_total_players = 0;
+/*! \brief The server's version of the page we've got, so it only has to tell us what's changed; 0 if we haven't
+ * got it.
+ */
+static uint32_t         lobby_version = 0;
+/*! \brief Which order we're seeing the lobby in; clicking the header goes through them in turn. */
+static uint8_t          lobby_sort_key = LOBBY_SORT_BY_NAME;
 /*! \brief The avatar textures. */
 static TEXTURE_HANDLE   lobby_avatars[NUM_AVATARS];
 /*! \brief A place to hold the incoming text for displaying. */
@@ -86,7 +89,7 @@ static uint8_t          lobby_incoming_chat_avatar;
 /*! \brief Plays whenever we get an incoming chat message. */
 static SAMPLE *         lobby_chat_noise;
 /*! \brief A place to hold incoming data - large enough to handle the names and stats of the max # of clients. */
-static char             lobby_msg_buff[LOBBY_NAME_DATA_SIZE * MAX_ACTIVE_PLAYERS];
+static char             lobby_msg_buff[LOBBY_MSG_BUFF_SIZE];
 /*! \brief Tracks whether the chat widget should be rendered and can receive keystrokes */
 static BOOL             lobby_chatbox_active = FALSE;
 /*! \brief Tracks the slide-in/slide-out animation for the chat widget */
@@ -94,10 +97,13 @@ static int              lobby_chatbox_slide = -LOBBY_CHATWIDGET_H;
 /*! \brief Helper function to prevent LOBBY_tick() from becoming too much of a big ball of mud... */
 static void             LOBBY_chat_helper(void);
 static void             LOBBY_name_list_helper(void);
-/*! \brief The names we're going to show in the name list. \todo Should we allocate this dynamically? */
-static LOBBY_DISPLAYABLE_NAME_PRIV lobby_name_list[MAX_ACTIVE_PLAYERS];
-/*! \brief Counter to make sure we re-fetch the lobby every so often. */
-static int              lobby_refresh_timer;
+static void             LOBBY_request(void);
+static void             LOBBY_send_chat(const char *typed);
+static void             LOBBY_read_name(LOBBY_DISPLAYABLE_NAME_PRIV *name, const char *record);
+/*! \brief The names on the page we're showing. */
+static LOBBY_DISPLAYABLE_NAME_PRIV lobby_name_list[LOBBY_NAMES_PER_PAGE];
+/*! \brief What the sort keys look like on screen. */
+static const char *     lobby_sort_names[LOBBY_SORT_KEYS] = { "name", "wins", "win ratio", "who's free" };
 /*! \brief Player we're planning to invite. */
 static int              lobby_highlighted_player;
 /*! \brief Plays when you invite someone. */
@@ -187,22 +193,19 @@ void LOBBY_unload(void)
 /****************************************************************************************************************/
 /*! \brief Set all variables to safe values, start the transition in, etc.
  * \note We also make the initial request for the lobby list here, but the response from the
- * server isn't handled until the first time LOBBY_tick() runs.
+ * server isn't handled until the first time LOBBY_tick() runs.  That's the only time we ask; for as long as
+ * we're in the lobby, the server tells us whenever anything changes.  We come back to whichever page we were
+ * on, with whatever was on it, so if we've been away for a game, we only need telling what's changed since.
  */
 void LOBBY_init(void)
 {
     SCRNWIPE_start(TRUE);
 
-    char out_buffer[MAX_MESSAGE_SIZE];
-    out_buffer[0] = MSGTYPE_REQUEST_LOBBY;
-
-    COMMON_send(out_buffer, 1);
-    lobby_refresh_timer = LOBBY_TIME_BETWEEN_REFRESHES;
+    LOBBY_request();
 
     lobby_chatbox_active = FALSE;
     lobby_chatbox_slide = -LOBBY_CHATWIDGET_H;
 
-    lobby_curr_page = 0;
     lobby_incoming_chat_timer = 0;
 
     lobby_highlighted_player = -1;
@@ -220,7 +223,7 @@ void LOBBY_init(void)
 
 
 /****************************************************************************************************************/
-/*! \brief Gather user input, and handle things like chat, refreshing, and game invites.
+/*! \brief Gather user input, and handle things like chat, lobby changes, and game invites.
  */
 void LOBBY_tick(void)
 {
@@ -238,13 +241,19 @@ void LOBBY_tick(void)
         switch (lobby_msg_buff[0])
         {
             case MSGTYPE_CHAT:
-                strncpy(lobby_incoming_chat,  &lobby_msg_buff[1], OUTGOING_CHAT_MESSAGE_LENGTH);
+            {
+                PROTO_CHAT_LINE chat;
+
+                PROTO_decode_CHAT_LINE(&chat, lobby_msg_buff, COMMON_last_recv_length());
+                strcpy(lobby_incoming_chat, chat.text);
                 play_sample(lobby_chat_noise, 255, 128, 1000, 0);
                 lobby_incoming_chat_timer = INCOMING_CHAT_TIMEOUT;
-                lobby_incoming_chat_avatar = lobby_msg_buff[64];
+                lobby_incoming_chat_avatar = chat.avatar;
+            }
             break;
 
             case MSGTYPE_REQUEST_LOBBY:
+            case MSGTYPE_LOBBY_CHANGES:
                 LOBBY_name_list_helper();
             break;
 
@@ -263,6 +272,7 @@ void LOBBY_tick(void)
             }
             break;
 
+            case MSGTYPE_DENIED_DUPLICATE_NAME:                 // someone's already logged in with our name
             case MSGTYPE_FAILURE:
             {
                 COMMON_disconnect();
@@ -279,15 +289,6 @@ void LOBBY_tick(void)
         lobby_incoming_chat_timer--;
     }
 
-    // is it time for a refresh yet?
-    lobby_refresh_timer--;
-    if (lobby_refresh_timer <= 0)
-    {
-        lobby_refresh_timer = LOBBY_TIME_BETWEEN_REFRESHES;
-        char cmd = MSGTYPE_REQUEST_LOBBY;
-        COMMON_send(&cmd, 1);
-    }
-
     // handle mouse input
     if (lobby_chatbox_active == FALSE)
     {
@@ -311,7 +312,26 @@ void LOBBY_tick(void)
                     }
 
                     lobby_curr_page++;
-                    lobby_curr_page = lobby_curr_page % (MAX_ACTIVE_PLAYERS / LOBBY_NAMES_PER_PAGE);
+
+                    if ((lobby_curr_page * LOBBY_NAMES_PER_PAGE) >= lobby_total_players)
+                        lobby_curr_page = 0;
+
+                    lobby_highlighted_player = -1;
+                    lobby_version = 0;
+                    LOBBY_request();
+                }
+
+                //-------------------------------------------------------
+
+                // the header; changes the order
+                if ((mouse_x >= LOBBY_HEADER_X) && (mouse_x <= (LOBBY_HEADER_X + LOBBY_HEADER_W)) &&
+                    (mouse_y >= LOBBY_HEADER_Y) && (mouse_y <= (LOBBY_HEADER_Y + LOBBY_HEADER_H)))
+                {
+                    lobby_sort_key = (lobby_sort_key + 1) % LOBBY_SORT_KEYS;
+                    lobby_curr_page = 0;
+                    lobby_highlighted_player = -1;
+                    lobby_version = 0;
+                    LOBBY_request();
                 }
 
                 //-------------------------------------------------------
@@ -332,12 +352,14 @@ void LOBBY_tick(void)
                                 PARTICLE_HEART, 255,  rand() % NUM_PARTICLE_COLOURS);
                         }
 
-                        char communications_buffer[MAX_MESSAGE_SIZE];
-                        communications_buffer[0] = MSGTYPE_INVITE;
-                        snprintf(&communications_buffer[1], MAX_NAME_LENGTH + 1, "%s",
+                        PROTO_INVITE    invite;
+                        char            communications_buffer[PROTO_SIZE(INVITE)];
+
+                        snprintf(invite.name, sizeof(invite.name), "%s",
                             lobby_name_list[lobby_highlighted_player].display_name);
 
-                        COMMON_send(communications_buffer, MAX_MESSAGE_SIZE);
+                        COMMON_send(communications_buffer,
+                            PROTO_encode_INVITE(communications_buffer, sizeof(communications_buffer), &invite));
 
                         play_sample(lobby_invite_noise, 255, 128, 1000, 0);
 
@@ -358,13 +380,14 @@ void LOBBY_tick(void)
 
                     if ((highlighted_index >= 0) && (highlighted_index < LOBBY_NAMES_PER_PAGE))
                     {
-                        lobby_highlighted_player = highlighted_index + (LOBBY_NAMES_PER_PAGE * lobby_curr_page);
+                        lobby_highlighted_player = highlighted_index;
                     }
                     else
                         lobby_highlighted_player = -1;
 
                     // don;t allow to select empty players
-                    if (lobby_name_list[lobby_highlighted_player].display_name[0] == 0)
+                    if ((lobby_highlighted_player != -1) &&
+                        (lobby_name_list[lobby_highlighted_player].display_name[0] == 0))
                         lobby_highlighted_player = -1;
                 }
             }
@@ -384,33 +407,206 @@ void LOBBY_tick(void)
 
 
 /****************************************************************************************************************/
-/*! \brief Handling of incoming lobby refresh here; LOBBY_tick() calls this.
+/*! \brief Forgets everything we knew about the lobby; call it whenever we connect, since whatever we knew was
+ * about some other server (or another run of this one).
+ */
+void LOBBY_forget(void)
+{
+    lobby_curr_page         = 0;
+    lobby_total_players     = 0;
+    lobby_version           = 0;
+    bzero(lobby_name_list, sizeof(lobby_name_list));
+}
+
+/****************************************************************************************************************/
+/*! \brief Asks the server for the page we're on, and to keep us posted whenever it changes.
+ */
+static void LOBBY_request(void)
+{
+    PROTO_LOBBY_QUERY   query;
+    char                out_buffer[LOBBY_QUERY_SIZE];
+
+    query.sort_key  = lobby_sort_key;
+    query.first     = lobby_curr_page * LOBBY_NAMES_PER_PAGE;
+    query.count     = LOBBY_NAMES_PER_PAGE;
+    query.version   = lobby_version;
+
+    COMMON_send(out_buffer, PROTO_encode_LOBBY_QUERY(out_buffer, sizeof(out_buffer), &query));
+}
+
+/****************************************************************************************************************/
+/*! \brief Sends whatever was typed into the chat box.  Most of the time it's just chat, which goes to whichever
+ * channel we joined last (the lobby-wide one, to start with), but a few things are commands:
+ *
+ * /join name       joins a channel (or switches back to one we're already in)
+ * /leave name      leaves one
+ * /w player text   whispers to just one player
+ */
+static void LOBBY_send_chat(const char *typed)
+{
+    PROTO_CHANNEL   channel;
+    PROTO_CHAT_LINE chat;
+    char            buf[OUTGOING_CHAT_MESSAGE_LENGTH];
+    int             name_length;
+
+    bzero(buf, OUTGOING_CHAT_MESSAGE_LENGTH);
+
+    if ((strncmp(typed, "/join ", 6) == 0) || (strncmp(typed, "/leave ", 7) == 0))
+    {
+        channel.type = (typed[1] == 'j') ? MSGTYPE_JOIN_CHANNEL : MSGTYPE_LEAVE_CHANNEL;
+        snprintf(channel.channel, sizeof(channel.channel), "%s", strchr(typed, ' ') + 1);
+
+        COMMON_send(buf, PROTO_encode_CHANNEL(buf, sizeof(buf), &channel));
+        return;
+    }
+
+    if (strncmp(typed, "/w ", 3) == 0)
+    {
+        // [cmd] [name] [NULL] [text]
+        typed += 3;
+        name_length = strcspn(typed, " ");
+
+        if ((name_length == 0) || (name_length >= MAX_NAME_LENGTH) || (typed[name_length] == 0))
+            return;
+
+        buf[0] = MSGTYPE_WHISPER;
+        memcpy(&buf[1], typed, name_length);
+        snprintf(&buf[1 + name_length + 1], OUTGOING_CHAT_MESSAGE_LENGTH - (1 + name_length + 1), "%s",
+            &typed[name_length + 1]);
+
+        COMMON_send(buf, 1 + name_length + 1 + strlen(&buf[1 + name_length + 1]));
+        return;
+    }
+
+    snprintf(chat.text, sizeof(chat.text), "%s", typed);
+    chat.avatar = 0;
+
+    COMMON_send(buf, PROTO_encode_CHAT_LINE(buf, sizeof(buf), &chat));
+}
+
+/****************************************************************************************************************/
+/*! \brief Handling of an incoming lobby page, or what's changed on one, here; LOBBY_tick() calls this.
  */
 void LOBBY_name_list_helper(void)
 {
-    int buffer_index = 1; // we need to skip the command byte
-    int player_index = 0;
-    int list_index   = 0;
+    PROTO_LOBBY_PAGE    page;
+    PROTO_LOBBY_CHANGES changes;
+    PROTO_LOBBY_ROW     row;
+    BOOL                is_changes   = (lobby_msg_buff[0] == MSGTYPE_LOBBY_CHANGES);
+    int                 buffer_index;
+    int                 list_index;
+    int                 length       = COMMON_last_recv_length();
+    char                highlighted_name[sizeof(lobby_name_list[0].display_name)];
+
+    if (is_changes)
+    {
+        if (!PROTO_decode_LOBBY_CHANGES(&changes, lobby_msg_buff, length))
+            return;
+
+        page.sort_key   = changes.sort_key;
+        page.first      = changes.first;
+        page.total      = changes.total;
+        page.version    = changes.to;
+    }
+    else if (!PROTO_decode_LOBBY_PAGE(&page, lobby_msg_buff, length))
+        return;
+
+    // a page we've asked for since is on its way; don't flash this one up in the meantime
+    if ((page.sort_key != lobby_sort_key) || (page.first != (lobby_curr_page * LOBBY_NAMES_PER_PAGE)))
+        return;
 
-    for(player_index = 0; player_index < MAX_ACTIVE_PLAYERS; player_index++)
+    if (is_changes)
     {
-        if (&lobby_msg_buff[buffer_index] != 0)
+        // had these already?
+        if (changes.to == lobby_version)
+            return;
+
+        // not changes to what we've got, so we've missed some; ask for the page over again
+        if (changes.from != lobby_version)
         {
-            strncpy(lobby_name_list[list_index].display_name, &lobby_msg_buff[buffer_index],MAX_NAME_LENGTH + 1);
-            lobby_name_list[list_index].wins    = htonl(*(int *)(&lobby_msg_buff[buffer_index + 32]));
-            lobby_name_list[list_index].losses  = htonl(*(int *)(&lobby_msg_buff[buffer_index + 36]));
-            lobby_name_list[list_index].ties    = htonl(*(int *)(&lobby_msg_buff[buffer_index + 40]));
-            lobby_name_list[list_index].av_id   = lobby_msg_buff[buffer_index + 44];
+            lobby_version = 0;
+            LOBBY_request();
+            return;
+        }
+    }
 
-            list_index++;
+    lobby_total_players = page.total;
+    lobby_version       = page.version;
+
+    // people left, and there's nobody on this page any more?
+    if ((lobby_curr_page > 0) && ((lobby_curr_page * LOBBY_NAMES_PER_PAGE) >= lobby_total_players))
+    {
+        lobby_curr_page = 0;
+        lobby_version   = 0;
+        LOBBY_request();
+        return;
+    }
+
+    // whoever we had highlighted may have moved, or may not be here any more
+    highlighted_name[0] = 0;
+
+    if (lobby_highlighted_player != -1)
+        strcpy(highlighted_name, lobby_name_list[lobby_highlighted_player].display_name);
+
+    lobby_highlighted_player = -1;
+
+    if (is_changes)
+    {
+        // just the rows that are different
+        for (buffer_index = LOBBY_CHANGES_HEADER_SIZE; (buffer_index + LOBBY_ROW_SIZE) <= length;
+            buffer_index += LOBBY_ROW_SIZE)
+        {
+            PROTO_decode_LOBBY_ROW(&row, &lobby_msg_buff[buffer_index], LOBBY_ROW_SIZE);
+
+            if (row.row < LOBBY_NAMES_PER_PAGE)
+                LOBBY_read_name(&lobby_name_list[row.row], (const char *)row.record);
         }
+    }
+    else
+    {
+        bzero(lobby_name_list, sizeof(lobby_name_list));
+        buffer_index = LOBBY_PAGE_HEADER_SIZE;  // the records come after the page header
+
+        for (list_index = 0; ((buffer_index + LOBBY_LIST_RECORD_SIZE) <= length) &&
+            (list_index < LOBBY_NAMES_PER_PAGE); list_index++)
+        {
+            LOBBY_read_name(&lobby_name_list[list_index], &lobby_msg_buff[buffer_index]);
+            buffer_index += LOBBY_LIST_RECORD_SIZE;
+        }
+    }
 
-        buffer_index += LOBBY_NAME_DATA_SIZE;
+    for (list_index = 0; list_index < LOBBY_NAMES_PER_PAGE; list_index++)
+    {
+        // anyone past the end of the page isn't on it any more
+        if ((page.first + list_index) >= page.total)
+            bzero(&lobby_name_list[list_index], sizeof(lobby_name_list[list_index]));
+        else if ((highlighted_name[0] != 0) &&
+            (strcmp(highlighted_name, lobby_name_list[list_index].display_name) == 0))
+        {
+            lobby_highlighted_player = list_index;
+        }
     }
 
     lobby_msg_buff[0] = 0;
 }
 
+/****************************************************************************************************************/
+/*! \brief Unpacks one player's record from a lobby message.
+ */
+static void LOBBY_read_name(LOBBY_DISPLAYABLE_NAME_PRIV *name, const char *record)
+{
+    PROTO_LOBBY_RECORD in;
+
+    PROTO_decode_LOBBY_RECORD(&in, record, LOBBY_LIST_RECORD_SIZE);
+
+    snprintf(name->display_name, sizeof(name->display_name), "%s", in.name);
+    name->wins    = in.wins;
+    name->losses  = in.losses;
+    name->ties    = in.ties;
+    name->av_id   = in.avatar % NUM_AVATARS;
+    name->in_game = (in.in_game != 0);
+}
+
 
 /****************************************************************************************************************/
 /*! \brief Handling of chat happens here; LOBBY_tick() calls this.
@@ -451,11 +647,8 @@ void LOBBY_chat_helper(void)
         // is there actually data there?
         if (TEWI_get_string()[0] != 0)
         {
-            // send it to the server as a chat message
-            char buf[OUTGOING_CHAT_MESSAGE_LENGTH];
-
-            snprintf(buf, OUTGOING_CHAT_MESSAGE_LENGTH, "%c%s", MSGTYPE_CHAT, TEWI_get_string());
-            COMMON_send(buf, OUTGOING_CHAT_MESSAGE_LENGTH);
+            // send it to the server as a chat message (or a channel command)
+            LOBBY_send_chat(TEWI_get_string());
             TEWI_set_string(NULL);
         }
     }
@@ -489,8 +682,9 @@ void LOBBY_draw(void)
     COMMON_draw_sprite(lobby_header_gfx, LOBBY_HEADER_X, LOBBY_HEADER_Y, 0, LOBBY_HEADER_W, LOBBY_HEADER_H);
 
     // page indicator
-    COMMON_glprint(common_gamefont, 10, 6, 0, 18,-1, "Page %d/%d",
-        lobby_curr_page + 1, (MAX_ACTIVE_PLAYERS / LOBBY_NAMES_PER_PAGE));
+    COMMON_glprint(common_gamefont, 10, 6, 0, 18,-1, "Page %d/%d, by %s",
+        lobby_curr_page + 1, (lobby_total_players == 0) ? 1 :
+        ((lobby_total_players + LOBBY_NAMES_PER_PAGE - 1) / LOBBY_NAMES_PER_PAGE), lobby_sort_names[lobby_sort_key]);
 
     // the chat widget
     if (lobby_chatbox_slide > -LOBBY_CHATWIDGET_H)
@@ -502,13 +696,11 @@ void LOBBY_draw(void)
     // painting of avatars and the lobby name list
     int plyr_index;
 
-    for (   plyr_index = (LOBBY_NAMES_PER_PAGE * lobby_curr_page);
-            plyr_index < (LOBBY_NAMES_PER_PAGE * (lobby_curr_page + 1));
-            plyr_index++)
+    for (plyr_index = 0; plyr_index < LOBBY_NAMES_PER_PAGE; plyr_index++)
     {
         if (lobby_name_list[plyr_index].display_name[0] != 0)
         {
-            float y_pos = LOBBY_HEADER_Y + LOBBY_HEADER_H + ((plyr_index - (LOBBY_NAMES_PER_PAGE * lobby_curr_page)) * LOBBY_AVATAR_SIZE);
+            float y_pos = LOBBY_HEADER_Y + LOBBY_HEADER_H + (plyr_index * LOBBY_AVATAR_SIZE);
 
             // this player is selected?
             if (plyr_index == lobby_highlighted_player)
@@ -525,8 +717,9 @@ void LOBBY_draw(void)
                 LOBBY_AVATAR_SIZE, LOBBY_AVATAR_SIZE);
 
             COMMON_glprint(common_gamefont, LOBBY_LIST_X + LOBBY_AVATAR_SIZE, y_pos, 0, LOBBY_NAME_TEXT_SIZE,
-                LOBBY_NAME_TEXT_KERN,  "%s %dW/%dL/%dT",lobby_name_list[plyr_index].display_name,
-                lobby_name_list[plyr_index].wins, lobby_name_list[plyr_index].losses, lobby_name_list[plyr_index].ties);
+                LOBBY_NAME_TEXT_KERN,  "%s %dW/%dL/%dT%s",lobby_name_list[plyr_index].display_name,
+                lobby_name_list[plyr_index].wins, lobby_name_list[plyr_index].losses, lobby_name_list[plyr_index].ties,
+                lobby_name_list[plyr_index].in_game ? " (playing)" : "");
         }
     }
 
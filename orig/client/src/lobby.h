@@ -10,6 +10,7 @@
     void LOBBY_draw(void);
     void LOBBY_load(void);
     void LOBBY_unload(void);
+    void LOBBY_forget(void);
     /*! \} */
 
 #endif
@@ -1,4 +1,5 @@
 #include "name_and_server_entry.h"
+#include "lobby.h"
 
 #define LOGIN_PHASE_NAME_SLIDING_IN         1
 #define LOGIN_PHASE_NAME_WAITING            2
@@ -226,11 +227,17 @@ void LOGIN_tick(void)
                     common_curr_state_done = TRUE;
                     if (success)
                     {
-                        char communication_buffer[MAX_MESSAGE_SIZE];
-                        communication_buffer[0] = MSGTYPE_LOGIN;
-                        snprintf(&communication_buffer[1], MAX_NAME_LENGTH + 1, "%s", login_str_name);
-                        communication_buffer[AVATAR_ID_POSITION] = login_avatar_id;
-                        COMMON_send(communication_buffer, MAX_MESSAGE_SIZE);
+                        // whatever we knew about the lobby was about some other server
+                        LOBBY_forget();
+
+                        PROTO_LOGIN login;
+                        char        communication_buffer[PROTO_SIZE(LOGIN)];
+
+                        snprintf(login.name, sizeof(login.name), "%s", login_str_name);
+                        login.avatar = login_avatar_id;
+
+                        COMMON_send(communication_buffer,
+                            PROTO_encode_LOGIN(communication_buffer, sizeof(communication_buffer), &login));
 
                         common_next_state = GAMESTATE_LOBBY;
                     }
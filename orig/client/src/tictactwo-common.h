@@ -46,7 +46,12 @@
     #define     MSGTYPE_LOGIN                   (unsigned char)'>'
     #define     MSGTYPE_LOGIN_SUCCESSFUL        (unsigned char)'<'
     #define     MSGTYPE_DENIED_DUPLICATE_NAME   (unsigned char)'-'
+    /*! \brief Asks for (and subscribes to) a page of the lobby, and is what the page comes back as; see the
+     * server's lobby.h.
+     */
     #define     MSGTYPE_REQUEST_LOBBY           (unsigned char)'R'
+    /*! \brief What's changed on a lobby page since a version of it the client's seen; see the server's lobby.h. */
+    #define     MSGTYPE_LOBBY_CHANGES           (unsigned char)'U'
     #define     MSGTYPE_INVITE                  (unsigned char)'i'
     #define     MSGTYPE_YOUVE_BEEN_INVITED      (unsigned char)'I'
     #define     MSGTYPE_RESPOND_ACCEPT          (unsigned char)'A'
@@ -54,9 +59,37 @@
     #define     MSGTYPE_GOT_ACCEPTED            (unsigned char)'a'
     #define     MSGTYPE_GOT_DECLINED            (unsigned char)'d'
     #define     MSGTYPE_CHAT                    (unsigned char)'|'
+    /*! \brief Joins a chat channel, and makes it the one MSGTYPE_CHAT goes to: [cmd] [channel name]. */
+    #define     MSGTYPE_JOIN_CHANNEL            (unsigned char)'j'
+    /*! \brief Leaves a chat channel: [cmd] [channel name]. */
+    #define     MSGTYPE_LEAVE_CHANNEL           (unsigned char)'l'
+    /*! \brief Says something to just one player: [cmd] [their name] [NULL] [what to say].  It comes out the
+     * other end as an ordinary MSGTYPE_CHAT.
+     */
+    #define     MSGTYPE_WHISPER                 (unsigned char)'w'
+    /*! \brief Asks what's been said lately in every channel the player's in: [cmd] [how far back to go, in ms, 4
+     * bytes, Motorola byte order].  Anything further back than CHAT_HISTORY_MAX_AGE_MS is out of reach.
+     */
+    #define     MSGTYPE_GET_CHAT_HISTORY        (unsigned char)'h'
+    /*! \brief The answer to MSGTYPE_GET_CHAT_HISTORY, one per channel that's had anything said in it: [cmd] then
+     * the lines, oldest first, each laid out like a MSGTYPE_CHAT without its cmd.
+     */
+    #define     MSGTYPE_CHAT_HISTORY            (unsigned char)'H'
+    /*! \brief Sent by a client once it's heard which side it's on (MSGTYPE_YOU_ARE_X or MSGTYPE_YOU_ARE_O); until
+     * then, the server keeps telling it.
+     */
     #define     MSGTYPE_START_GAME              (unsigned char)'!'
     #define     MSGTYPE_MOVE                    (unsigned char)'m'
-    #define     MSGTYPE_ITS_YOUR_TURN           (unsigned char)'T'
+    /*! \brief One move, sent to both players as soon as it's made (so the mover hears it went through, too):
+     * [cmd] [4-byte seq] [cell] [mark].  Moves are numbered from 1 in each game; whoever didn't make it is up next.
+     */
+    #define     MSGTYPE_GAME_UPDATE             (unsigned char)'u'
+    /*! \brief The whole game as of a given move: [cmd] [4-byte seq] [mark to move] [cells, a row at a time].  Sent
+     * in place of every few updates, to whoever's just acknowledged their side, and to anyone asking for it.
+     */
+    #define     MSGTYPE_GAME_CHECKPOINT         (unsigned char)'k'
+    /*! \brief Asks for a MSGTYPE_GAME_CHECKPOINT, for a client that's noticed it missed an update: [cmd]. */
+    #define     MSGTYPE_RESYNC                  (unsigned char)'y'
     #define     MSGTYPE_WAIT_FOR_OPPONENT       (unsigned char)'t'
     #define     MSGTYPE_YOU_WIN                 (unsigned char)'W'
     #define     MSGTYPE_YOU_LOSE                (unsigned char)'L'
@@ -104,28 +137,41 @@
     #define GAMESTATE_NOT_CONNECTED             99
     /*! \} */
 
-    #define     AVATAR_ID_POSITION              32
-
-    #define     LOBBY_LIST_RECORD_SIZE          48
+    /*! \defgroup lobby_sort_keys
+     * \brief The orders a client can ask to see the lobby in.
+     * \{
+     */
+    #define     LOBBY_SORT_BY_NAME              0
+    #define     LOBBY_SORT_BY_WINS              1   // most first
+    #define     LOBBY_SORT_BY_WIN_RATIO         2   // best first
+    #define     LOBBY_SORT_BY_AVAILABILITY      3   // whoever isn't in a game first
+    #define     LOBBY_SORT_KEYS                 4
+    /*! \} */
 
     #define     MAX_NAME_LENGTH                 30
     #define     MAX_CHAT_LENGTH                 30
+    #define     MAX_CHANNEL_NAME_LENGTH         12  // including the NULL
+    #define     MAX_CHANNELS_JOINED             4   // game rooms' own channels included
+    #define     CHAT_HISTORY_MAX_AGE_MS         300000  // five minutes
 
     #define     MAX_MESSAGE_SIZE                64  // please see doc/feature-list for details. this ONLY applies
                                                     // to messages coming in from the client.
 
-    #define     OUTGOING_CHAT_MESSAGE_LENGTH    (1 + MAX_NAME_LENGTH + 2 + MAX_CHAT_LENGTH + 1 + 1)
-                                            //  cmd  plyr name       ": "  what they said  NULL  avatar id
+    #define     FRAME_HEADER_SIZE               2   // every message, both ways, goes out behind a 16-bit length
+                                                    // (in Motorola byte order) so the other end can split them up.
 
     #define     BOARD_WIDTH                     3
     #define     BOARD_HEIGHT                    3
 
-    #define     MAX_ACTIVE_PLAYERS              64                         // this is already gonna mean some HUGE messages for lobby refresh...
-    #define     MAX_ACTIVE_ROOMS                (MAX_ACTIVE_PLAYERS / 2)
+    #define     LOBBY_PAGE_MAX_SIZE             32                         // the most players a lobby page carries; how many can
+                                                                           // actually be logged in is up to the server's config.
 
     #define     TICTACTWO_GAMEPLAY_PORT         5555
     #define     TICTACTWO_WEBPAGE_PORT          8080
 
     #define     NUM_AVATARS                     10
 
+    // every message's layout; see there for what used to be here
+    #include    "tictactwo-protocol.h"
+
 #endif          // TICTACTWO_COMMON_H
@@ -0,0 +1,264 @@
+/*! \file tictactwo-protocol.h
+ * \brief How every fixed-size message is laid out, byte by byte, written down once.
+ *
+ * Each message is a list of fields, in the order they go on the wire.  The list gets run through the
+ * PROTO_DEFINE() machinery below, which turns it into:
+ *
+ * - PROTO_name, a plain struct with a member for each field, to fill out or read from;
+ * - PROTO_name_WIRE, a struct of char arrays that's the message exactly as it's sent, so PROTO_SIZE() and
+ *   PROTO_OFFSET() are just sizeof() and offsetof() on it;
+ * - PROTO_encode_name(), which writes a PROTO_name out in wire order;
+ * - PROTO_decode_name(), which reads one back in.
+ *
+ * Both are straight-line code: every field's offset is a constant, so there's no parsing as such, just copying.
+ * The encoder checks there's room for the whole message up front, and the decoder treats whatever's missing off
+ * the end of a short message as zeros (and says so), so neither can run off the end of a buffer.
+ *
+ * The field kinds are:
+ *
+ * - TYPE   the command byte; a constant, so it's written but never stored
+ * - U8     one byte
+ * - U32    four bytes, in Motorola byte order
+ * - TEXT   a NULL-padded string, width bytes wide; always comes out NULL-terminated, so it holds width - 1
+ * - BYTES  width bytes, copied as they are
+ * - PAD    width bytes of zeros, neither stored nor read
+ *
+ * Messages that are just a command byte, or that carry something variable-length (like MSGTYPE_WHISPER), aren't
+ * in here.
+ *
+ * \note This file is the same on the client and the server; change both or neither.
+ */
+#ifndef         TICTACTWO_PROTOCOL_H
+    #define     TICTACTWO_PROTOCOL_H
+
+    #include    <stddef.h>  // offsetof()
+
+    /*! \defgroup protocol_schema
+     * \brief The messages.  Each field's X(message, kind, name, width or value).
+     * \{
+     */
+    /*! \brief A client's first message: who they are and what they look like. */
+    #define     PROTO_LOGIN_FIELDS(X, M)                                    \
+                    X(M, TYPE,  type,       MSGTYPE_LOGIN)                  \
+                    X(M, TEXT,  name,       MAX_NAME_LENGTH + 1)            \
+                    X(M, U8,    avatar,     0)
+
+    /*! \brief Which page of the lobby a client wants, and the version of it they've got (0 if none). */
+    #define     PROTO_LOBBY_QUERY_FIELDS(X, M)                              \
+                    X(M, TYPE,  type,       MSGTYPE_REQUEST_LOBBY)          \
+                    X(M, U8,    sort_key,   0)                              \
+                    X(M, U32,   first,      0)                              \
+                    X(M, U8,    count,      0)                              \
+                    X(M, U32,   version,    0)
+
+    /*! \brief What goes at the top of a lobby page, before its PROTO_LOBBY_RECORDs. */
+    #define     PROTO_LOBBY_PAGE_FIELDS(X, M)                               \
+                    X(M, TYPE,  type,       MSGTYPE_REQUEST_LOBBY)          \
+                    X(M, U8,    sort_key,   0)                              \
+                    X(M, U32,   first,      0)                              \
+                    X(M, U32,   total,      0)                              \
+                    X(M, U32,   version,    0)
+
+    /*! \brief What goes at the top of the changes to a lobby page, before a PROTO_LOBBY_ROW for each row that's
+     * different.
+     */
+    #define     PROTO_LOBBY_CHANGES_FIELDS(X, M)                            \
+                    X(M, TYPE,  type,       MSGTYPE_LOBBY_CHANGES)          \
+                    X(M, U8,    sort_key,   0)                              \
+                    X(M, U32,   first,      0)                              \
+                    X(M, U32,   total,      0)                              \
+                    X(M, U32,   from,       0)                              \
+                    X(M, U32,   to,         0)
+
+    /*! \brief One row of a lobby page that's changed: where it is on the page, and who's there now. */
+    #define     PROTO_LOBBY_ROW_FIELDS(X, M)                                \
+                    X(M, U8,    row,        0)                              \
+                    X(M, BYTES, record,     LOBBY_LIST_RECORD_SIZE)
+
+    /*! \brief One player on a lobby page. */
+    #define     PROTO_LOBBY_RECORD_FIELDS(X, M)                             \
+                    X(M, TEXT,  name,       MAX_NAME_LENGTH + 2)            \
+                    X(M, U32,   wins,       0)                              \
+                    X(M, U32,   losses,     0)                              \
+                    X(M, U32,   ties,       0)                              \
+                    X(M, U8,    avatar,     0)                              \
+                    X(M, U8,    in_game,    0)                              \
+                    X(M, PAD,   padding,    2)
+
+    /*! \brief An invitation: who it's for on the way in, who it's from on the way out. */
+    #define     PROTO_INVITE_FIELDS(X, M)                                   \
+                    X(M, TYPE,  type,       MSGTYPE_INVITE)                 \
+                    X(M, TEXT,  name,       MAX_NAME_LENGTH + 1)
+
+    /*! \brief Chat, both ways: what the player typed on the way in, a line ready to show on the way out. */
+    #define     PROTO_CHAT_LINE_FIELDS(X, M)                                \
+                    X(M, TYPE,  type,       MSGTYPE_CHAT)                   \
+                    X(M, TEXT,  text,       MAX_NAME_LENGTH + 2 + MAX_CHAT_LENGTH + 1) \
+                    X(M, U8,    avatar,     0)
+
+    /*! \brief MSGTYPE_JOIN_CHANNEL or MSGTYPE_LEAVE_CHANNEL, which are laid out the same. */
+    #define     PROTO_CHANNEL_FIELDS(X, M)                                  \
+                    X(M, U8,    type,       0)                              \
+                    X(M, TEXT,  channel,    MAX_CHANNEL_NAME_LENGTH)
+
+    #define     PROTO_GET_CHAT_HISTORY_FIELDS(X, M)                         \
+                    X(M, TYPE,  type,       MSGTYPE_GET_CHAT_HISTORY)       \
+                    X(M, U32,   age_ms,     0)
+
+    #define     PROTO_MOVE_FIELDS(X, M)                                     \
+                    X(M, TYPE,  type,       MSGTYPE_MOVE)                   \
+                    X(M, U8,    column,     0)                              \
+                    X(M, U8,    row,        0)
+
+    #define     PROTO_GAME_UPDATE_FIELDS(X, M)                              \
+                    X(M, TYPE,  type,       MSGTYPE_GAME_UPDATE)            \
+                    X(M, U32,   seq,        0)                              \
+                    X(M, U8,    cell,       0)                              \
+                    X(M, U8,    mark,       0)
+
+    #define     PROTO_GAME_CHECKPOINT_FIELDS(X, M)                          \
+                    X(M, TYPE,  type,       MSGTYPE_GAME_CHECKPOINT)        \
+                    X(M, U32,   seq,        0)                              \
+                    X(M, U8,    to_move,    0)                              \
+                    X(M, BYTES, cells,      BOARD_WIDTH * BOARD_HEIGHT)
+    /*! \} */
+
+    /*! \brief How many bytes a message takes up on the wire. */
+    #define     PROTO_SIZE(message)             sizeof(PROTO_##message##_WIRE)
+    /*! \brief Where a field starts in a message on the wire. */
+    #define     PROTO_OFFSET(message, field)    offsetof(PROTO_##message##_WIRE, field)
+
+    /*! \defgroup protocol_sizes
+     * \brief The sizes and offsets the rest of the code's always known by name.
+     * \{
+     */
+    #define     AVATAR_ID_POSITION              PROTO_OFFSET(LOGIN, avatar)
+    #define     LOBBY_QUERY_SIZE                PROTO_SIZE(LOBBY_QUERY)
+    #define     LOBBY_PAGE_HEADER_SIZE          PROTO_SIZE(LOBBY_PAGE)
+    #define     LOBBY_LIST_RECORD_SIZE          PROTO_SIZE(LOBBY_RECORD)
+    #define     LOBBY_CHANGES_HEADER_SIZE       PROTO_SIZE(LOBBY_CHANGES)
+    #define     LOBBY_ROW_SIZE                  PROTO_SIZE(LOBBY_ROW)
+    #define     OUTGOING_CHAT_MESSAGE_LENGTH    PROTO_SIZE(CHAT_LINE)
+    /*! \} */
+
+    /*! \defgroup protocol_machinery
+     * \brief What turns a field list into a struct, a wire layout, an encoder and a decoder.  There's one of each
+     * of these per field kind, picked by pasting the kind onto the end.
+     * \{
+     */
+    #define     PROTO_MEMBER(M, kind, name, arg)        PROTO_MEMBER_##kind(name, arg)
+    #define     PROTO_MEMBER_TYPE(name, arg)
+    #define     PROTO_MEMBER_U8(name, arg)              uint8_t     name;
+    #define     PROTO_MEMBER_U32(name, arg)             uint32_t    name;
+    #define     PROTO_MEMBER_TEXT(name, arg)            char        name[arg];
+    #define     PROTO_MEMBER_BYTES(name, arg)           uint8_t     name[arg];
+    #define     PROTO_MEMBER_PAD(name, arg)
+
+    #define     PROTO_WIRE(M, kind, name, arg)          PROTO_WIRE_##kind(name, arg)
+    #define     PROTO_WIRE_TYPE(name, arg)              char        name[1];
+    #define     PROTO_WIRE_U8(name, arg)                char        name[1];
+    #define     PROTO_WIRE_U32(name, arg)               char        name[4];
+    #define     PROTO_WIRE_TEXT(name, arg)              char        name[arg];
+    #define     PROTO_WIRE_BYTES(name, arg)             char        name[arg];
+    #define     PROTO_WIRE_PAD(name, arg)               char        name[arg];
+
+    #define     PROTO_PUT(M, kind, name, arg)           PROTO_PUT_##kind(&out[PROTO_OFFSET(M, name)], msg->name, arg)
+    #define     PROTO_PUT_TYPE(at, field, arg)          *(at) = (char)(arg);
+    #define     PROTO_PUT_U8(at, field, arg)            *(at) = (char)(field);
+    #define     PROTO_PUT_U32(at, field, arg)           PROTO_put_u32(at, field);
+    #define     PROTO_PUT_TEXT(at, field, arg)          PROTO_put_text(at, field, arg);
+    #define     PROTO_PUT_BYTES(at, field, arg)         memcpy(at, field, arg);
+    #define     PROTO_PUT_PAD(at, field, arg)           memset(at, 0, arg);
+
+    // (PAD and TYPE fields have no member, so they can't so much as mention it)
+    #define     PROTO_GET(M, kind, name, arg)           PROTO_GET_##kind(&in[PROTO_OFFSET(M, name)], msg->name, arg)
+    #define     PROTO_GET_TYPE(at, field, arg)
+    #define     PROTO_GET_U8(at, field, arg)            (field) = (uint8_t)*(at);
+    #define     PROTO_GET_U32(at, field, arg)           (field) = PROTO_get_u32(at);
+    #define     PROTO_GET_TEXT(at, field, arg)          memcpy(field, at, arg); (field)[(arg) - 1] = 0;
+    #define     PROTO_GET_BYTES(at, field, arg)         memcpy(field, at, arg);
+    #define     PROTO_GET_PAD(at, field, arg)
+
+    /*! \brief Makes the struct, wire layout, encoder and decoder for the message with the field list
+     * PROTO_message_FIELDS.  PROTO_encode_message() returns how many bytes it wrote (PROTO_SIZE()), or 0 if there
+     * wasn't room for them all; PROTO_decode_message() returns TRUE if the whole message was there, or FALSE if
+     * it was short and the rest was taken as zeros.
+     */
+    #define     PROTO_DEFINE(message)                                                                           \
+        typedef struct { PROTO_##message##_FIELDS(PROTO_MEMBER, message) } PROTO_##message;                     \
+        typedef struct { PROTO_##message##_FIELDS(PROTO_WIRE, message) } PROTO_##message##_WIRE;                \
+                                                                                                                \
+        static inline uint16_t PROTO_encode_##message(char *out, size_t room, const PROTO_##message *msg)       \
+        {                                                                                                       \
+            if (room < PROTO_SIZE(message))                                                                     \
+                return 0;                                                                                       \
+                                                                                                                \
+            PROTO_##message##_FIELDS(PROTO_PUT, message)                                                        \
+            return PROTO_SIZE(message);                                                                         \
+        }                                                                                                       \
+                                                                                                                \
+        static inline BOOL PROTO_decode_##message(PROTO_##message *msg, const char *in, size_t length)          \
+        {                                                                                                       \
+            char padded[PROTO_SIZE(message)];                                                                   \
+                                                                                                                \
+            if (length < PROTO_SIZE(message))                                                                   \
+            {                                                                                                   \
+                memset(padded, 0, PROTO_SIZE(message));                                                         \
+                memcpy(padded, in, length);                                                                     \
+                in = padded;                                                                                    \
+            }                                                                                                   \
+                                                                                                                \
+            PROTO_##message##_FIELDS(PROTO_GET, message)                                                        \
+            return (length >= PROTO_SIZE(message)) ? TRUE : FALSE;                                              \
+        }
+    /*! \} */
+
+    /****************************************************************************************************************/
+    /*! \brief Writes a 32-bit number in Motorola byte order. */
+    static inline void PROTO_put_u32(char *at, uint32_t value)
+    {
+        at[0] = (value >> 24) & 0xff;
+        at[1] = (value >> 16) & 0xff;
+        at[2] = (value >>  8) & 0xff;
+        at[3] = (value      ) & 0xff;
+    }
+
+    /****************************************************************************************************************/
+    /*! \brief Reads a 32-bit number in Motorola byte order. */
+    static inline uint32_t PROTO_get_u32(const char *at)
+    {
+        return ((uint32_t)(unsigned char)at[0] << 24) | ((uint32_t)(unsigned char)at[1] << 16) |
+               ((uint32_t)(unsigned char)at[2] <<  8) |  (uint32_t)(unsigned char)at[3];
+    }
+
+    /****************************************************************************************************************/
+    /*! \brief Writes a string into a field width bytes wide, cutting it short if it has to and padding the rest
+     * with NULLs; there's always at least one.
+     */
+    static inline void PROTO_put_text(char *at, const char *text, size_t width)
+    {
+        size_t length = strnlen(text, width - 1);
+
+        memcpy(at, text, length);
+        memset(&at[length], 0, width - length);
+    }
+
+    PROTO_DEFINE(LOGIN)
+    PROTO_DEFINE(LOBBY_QUERY)
+    PROTO_DEFINE(LOBBY_PAGE)
+    PROTO_DEFINE(LOBBY_RECORD)
+    PROTO_DEFINE(LOBBY_CHANGES)
+    PROTO_DEFINE(LOBBY_ROW)
+    PROTO_DEFINE(INVITE)
+    PROTO_DEFINE(CHAT_LINE)
+    PROTO_DEFINE(CHANNEL)
+    PROTO_DEFINE(GET_CHAT_HISTORY)
+    PROTO_DEFINE(MOVE)
+    PROTO_DEFINE(GAME_UPDATE)
+    PROTO_DEFINE(GAME_CHECKPOINT)
+
+    _Static_assert(PROTO_SIZE(LOBBY_RECORD) == 48, "lobby records have always been 48 bytes");
+    _Static_assert(PROTO_SIZE(CHAT_LINE) == 65, "chat lines have always been 65 bytes");
+    _Static_assert(PROTO_OFFSET(LOGIN, avatar) == 32, "the avatar's always been at 32 in a login");
+
+#endif          // TICTACTWO_PROTOCOL_H
@@ -76,6 +76,12 @@ void OPPWAIT_tick(void)
                 }
                 break;
 
+                // the lobby may still have been telling us what's going on when we left it; we'll catch up
+                // when we get back
+                case MSGTYPE_CHAT:
+                case MSGTYPE_REQUEST_LOBBY:
+                    return;
+
                 default:
                 {
                     COMMON_disconnect();
@@ -0,0 +1,306 @@
+/*! \file bench-client.c
+ * \brief Connections to a running server, for the benchmarks; see bench-client.h.
+ */
+#include    "bench-client.h"
+#include    <errno.h>
+#include    <fcntl.h>
+#include    <netdb.h>
+#include    <poll.h>
+#include    <time.h>
+#include    <unistd.h>
+#include    <netinet/tcp.h>
+#include    <sys/resource.h>
+
+BENCH_SERVER bench_server = { "127.0.0.1", TICTACTWO_GAMEPLAY_PORT };
+
+static int BENCH_compare_samples(const void *a, const void *b);
+
+/****************************************************************************************************************/
+/*! \brief Takes care of the -h host and -p port options every benchmark has.
+ * \return TRUE if it was one of those.
+ */
+BOOL BENCH_parse_server_arg(int opt, const char *arg)
+{
+    switch (opt)
+    {
+        case 'h':
+            bench_server.host = arg;
+            return TRUE;
+
+        case 'p':
+            bench_server.port = atoi(arg);
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Opens a non-blocking connection to the server.
+ * \param wait Whether to wait for it to finish connecting; if not, it may still be in progress, and it's
+ * writable once it's done.
+ * \return FALSE if it couldn't be started (or, if we waited, didn't work).
+ */
+BOOL BENCH_connect(BENCH_CONN *conn, BOOL wait)
+{
+    struct sockaddr_in  addr;
+    struct pollfd       pfd;
+    int                 error   = 0;
+    socklen_t           length  = sizeof(error);
+    int                 one     = 1;
+
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(bench_server.port);
+
+    if (inet_pton(AF_INET, bench_server.host, &addr.sin_addr) != 1)
+    {
+        OH_SMEG("'%s' isn't an IPv4 address.", bench_server.host);
+        return FALSE;
+    }
+
+    conn->fd            = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    conn->rx_length     = 0;
+    conn->rx_start      = 0;
+
+    if (conn->fd < 0)
+    {
+        OH_SMEG("socket(): %s", strerror(errno));
+        return FALSE;
+    }
+
+    // the messages are tiny, and we're timing them; don't let them sit around waiting for company
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if ((connect(conn->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) && (errno != EINPROGRESS))
+    {
+        BENCH_close(conn);
+        return FALSE;
+    }
+
+    if (!wait)
+        return TRUE;
+
+    pfd.fd      = conn->fd;
+    pfd.events  = POLLOUT;
+
+    if ((poll(&pfd, 1, 5000) != 1) || (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) ||
+        (error != 0))
+    {
+        BENCH_close(conn);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Sends a login, and asks for the first row of the lobby straight after it.  The server doesn't answer a
+ * login as such; the lobby page (MSGTYPE_REQUEST_LOBBY) coming back is how we know we're in.
+ */
+BOOL BENCH_login(BENCH_CONN *conn, const char *name, uint8_t avatar)
+{
+    PROTO_LOGIN         login;
+    PROTO_LOBBY_QUERY   query;
+    char                out[MAX_MESSAGE_SIZE];
+
+    bzero(&login, sizeof(login));
+    snprintf(login.name, sizeof(login.name), "%s", name);
+    login.avatar = avatar;
+
+    bzero(&query, sizeof(query));
+    query.count = 1;
+
+    return BENCH_send(conn, out, PROTO_encode_LOGIN(out, sizeof(out), &login)) &&
+        BENCH_send(conn, out, PROTO_encode_LOBBY_QUERY(out, sizeof(out), &query));
+}
+
+/****************************************************************************************************************/
+/*! \brief Sends one message, behind its length.  Everything the benchmarks send is small enough that it goes in
+ * one go or not at all.
+ * \return FALSE if it didn't.
+ */
+BOOL BENCH_send(BENCH_CONN *conn, const void *msg, uint16_t length)
+{
+    char out[FRAME_HEADER_SIZE + MAX_MESSAGE_SIZE];
+
+    if (length > MAX_MESSAGE_SIZE)
+        return FALSE;
+
+    out[0] = (char)(length >> 8);
+    out[1] = (char)(length & 0xFF);
+    memcpy(&out[FRAME_HEADER_SIZE], msg, length);
+
+    return send(conn->fd, out, FRAME_HEADER_SIZE + length, MSG_NOSIGNAL) == (FRAME_HEADER_SIZE + length);
+}
+
+/****************************************************************************************************************/
+/*! \brief Reads whatever's come in on a connection, without waiting.
+ * \return How many bytes, 0 if there wasn't anything, or -1 if the connection's closed (or broken).
+ */
+int BENCH_fill(BENCH_CONN *conn)
+{
+    int got;
+
+    // make room, if what's left is up against the end
+    if (conn->rx_start > 0)
+    {
+        memmove(conn->rx, &conn->rx[conn->rx_start], conn->rx_length - conn->rx_start);
+        conn->rx_length -= conn->rx_start;
+        conn->rx_start   = 0;
+    }
+
+    got = recv(conn->fd, &conn->rx[conn->rx_length], BENCH_RX_BUFFER_SIZE - conn->rx_length, 0);
+
+    if (got == 0)
+        return -1;
+
+    if (got < 0)
+        return ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ? 0 : -1;
+
+    conn->rx_length += got;
+    return got;
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes the next whole message off what's been read.
+ * \param msg Set to where it starts; it stays there until the next BENCH_fill().
+ * \return How long it is, or -1 if there isn't a whole one yet.
+ */
+int BENCH_next(BENCH_CONN *conn, char **msg)
+{
+    int available = conn->rx_length - conn->rx_start;
+    int length;
+
+    if (available < FRAME_HEADER_SIZE)
+        return -1;
+
+    length = ((unsigned char)conn->rx[conn->rx_start] << 8) | (unsigned char)conn->rx[conn->rx_start + 1];
+
+    if (available < (FRAME_HEADER_SIZE + length))
+        return -1;
+
+    *msg            = &conn->rx[conn->rx_start + FRAME_HEADER_SIZE];
+    conn->rx_start += FRAME_HEADER_SIZE + length;
+
+    return length;
+}
+
+/****************************************************************************************************************/
+/*! \brief Waits for a message of a particular type, throwing away anything else that comes first.
+ * \return Its type if it turned up; 0 if it didn't in time, or the connection closed; or the type of a
+ * MSGTYPE_FAILURE or MSGTYPE_DENIED_DUPLICATE_NAME, if one of those came instead.
+ */
+int BENCH_wait_for(BENCH_CONN *conn, uint8_t type, uint32_t timeout_ms)
+{
+    uint64_t        deadline = BENCH_now_ns() + ((uint64_t)timeout_ms * 1000000ULL);
+    struct pollfd   pfd;
+    char            *msg;
+    int             length;
+    uint64_t        now;
+
+    pfd.fd      = conn->fd;
+    pfd.events  = POLLIN;
+
+    while (TRUE)
+    {
+        while ((length = BENCH_next(conn, &msg)) >= 0)
+        {
+            if (length == 0)
+                continue;
+
+            if (((uint8_t)msg[0] == type) || ((uint8_t)msg[0] == MSGTYPE_FAILURE) ||
+                ((uint8_t)msg[0] == MSGTYPE_DENIED_DUPLICATE_NAME))
+            {
+                return (uint8_t)msg[0];
+            }
+        }
+
+        now = BENCH_now_ns();
+
+        if ((now >= deadline) || (poll(&pfd, 1, (int)((deadline - now) / 1000000ULL) + 1) < 0))
+            return 0;
+
+        if (BENCH_fill(conn) < 0)
+            return 0;
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Hangs up.
+ */
+void BENCH_close(BENCH_CONN *conn)
+{
+    if (conn->fd >= 0)
+        close(conn->fd);
+
+    conn->fd = -1;
+}
+
+/****************************************************************************************************************/
+/*! \brief A monotonic clock, in nanoseconds.
+ */
+uint64_t BENCH_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000000ULL) + now.tv_nsec;
+}
+
+/****************************************************************************************************************/
+/*! \brief Asks for enough file descriptors for however many connections we're about to open (plus a few); if
+ * the hard limit's lower than that, we get what there is and say so.
+ */
+void BENCH_raise_fd_limit(uint32_t wanted)
+{
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0)
+        return;
+
+    wanted += 64;
+
+    if (limit.rlim_cur >= wanted)
+        return;
+
+    limit.rlim_cur = (limit.rlim_max < wanted) ? limit.rlim_max : wanted;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    if (limit.rlim_cur < wanted)
+        DUH_WHERE_AM_I("Only %llu file descriptors to be had; some connections will fail.",
+            (unsigned long long)limit.rlim_cur);
+}
+
+/****************************************************************************************************************/
+/*! \brief Prints the middle and the tail of a set of timings.  Sorts them while it's at it.
+ */
+void BENCH_report_latency(const char *what, uint64_t *samples_ns, uint32_t count)
+{
+    if (count == 0)
+    {
+        printf("%-24s no samples\n", what);
+        return;
+    }
+
+    qsort(samples_ns, count, sizeof(uint64_t), BENCH_compare_samples);
+
+    printf("%-24s p50 %8.1f us   p99 %8.1f us   p99.9 %8.1f us   max %8.1f us   (%u samples)\n", what,
+        samples_ns[count / 2] / 1000.0,
+        samples_ns[(uint32_t)(count * 0.99)] / 1000.0,
+        samples_ns[(uint32_t)(count * 0.999)] / 1000.0,
+        samples_ns[count - 1] / 1000.0,
+        count);
+}
+
+/****************************************************************************************************************/
+/*! \brief qsort() order for BENCH_report_latency(): shortest first.
+ */
+static int BENCH_compare_samples(const void *a, const void *b)
+{
+    uint64_t first  = *(const uint64_t *)a;
+    uint64_t second = *(const uint64_t *)b;
+
+    return (first > second) - (first < second);
+}
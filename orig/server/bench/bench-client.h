@@ -0,0 +1,51 @@
+/*! \file bench-client.h
+ * \brief What the benchmarks that talk to a running server have in common: connecting, framing messages, and
+ * reading them back, for lots of connections at once off one epoll set.
+ *
+ * None of this is part of the server; it's built by 'make bench', along with the benchmarks themselves.
+ */
+#ifndef         BENCH_CLIENT_H
+    #define     BENCH_CLIENT_H
+
+    #include    "tictactwo-common.h"
+
+    /*! \brief How much of what's come in on a connection is held on to, waiting to be split up into messages. */
+    #define     BENCH_RX_BUFFER_SIZE    4096
+
+    /*! \brief One connection to the server. */
+    typedef struct
+    {
+        int         fd;
+        /*! \brief What's come in that hasn't been taken off with BENCH_next() yet. */
+        char        rx[BENCH_RX_BUFFER_SIZE];
+        int         rx_length;
+        /*! \brief How far into rx the next message starts. */
+        int         rx_start;
+        /*! \brief Whatever the benchmark wants to keep about it. */
+        uint64_t    started_ns;
+        uint32_t    index;
+        int         state;
+    } BENCH_CONN;
+
+    /*! \brief Where the server is; set from -h and -p by BENCH_parse_server_arg(). */
+    typedef struct
+    {
+        const char  *host;
+        int         port;
+    } BENCH_SERVER;
+
+    extern BENCH_SERVER bench_server;
+
+    BOOL        BENCH_parse_server_arg(int opt, const char *arg);
+    BOOL        BENCH_connect(BENCH_CONN *conn, BOOL wait);
+    BOOL        BENCH_login(BENCH_CONN *conn, const char *name, uint8_t avatar);
+    BOOL        BENCH_send(BENCH_CONN *conn, const void *msg, uint16_t length);
+    int         BENCH_fill(BENCH_CONN *conn);
+    int         BENCH_next(BENCH_CONN *conn, char **msg);
+    int         BENCH_wait_for(BENCH_CONN *conn, uint8_t type, uint32_t timeout_ms);
+    void        BENCH_close(BENCH_CONN *conn);
+    uint64_t    BENCH_now_ns(void);
+    void        BENCH_raise_fd_limit(uint32_t wanted);
+    void        BENCH_report_latency(const char *what, uint64_t *samples_ns, uint32_t count);
+
+#endif
@@ -0,0 +1,42 @@
+#!/bin/sh
+# How many syscalls each message costs, and how long a round trip takes, with each of the server's I/O backends
+# (its -i option).  Runs a fresh one-shard server for each, in a scratch directory, points round-trip at it,
+# and works the syscalls out from the running totals the server logs every second while it's going: from the
+# last line that's still only got the logins in it (two messages in for each client) to the last line of all.
+#
+#       bench/compare-backends.sh [clients (default 100)] [seconds (default 10)]
+#
+# Run it from the server's directory, after 'make' and 'make bench'.
+CLIENTS=${1:-100}
+SECONDS_TO_RUN=${2:-10}
+SERVER=$(pwd)/TicTac2Server.elf
+ROUND_TRIP=$(pwd)/bench/round-trip.elf
+SCRATCH=$(mktemp -d)
+
+for BACKEND in epoll uring
+do
+    (cd "$SCRATCH" && rm -f .tictac2* && exec "$SERVER" -t 1 -i $BACKEND -s 1000 -m $((CLIENTS + 64))) \
+        2>"$SCRATCH/server.log" &
+    PID=$!
+    sleep 1
+
+    echo "--- $BACKEND"
+    "$ROUND_TRIP" -n "$CLIENTS" -d "$SECONDS_TO_RUN" -q 1500
+
+    kill $PID
+    wait $PID 2>/dev/null
+
+    # "shard 0 syscalls: A loop, B read, C send for D messages in and E out"
+    grep -o 'syscalls: .*' "$SCRATCH/server.log" | tr -d ',' | awk -v logins=$((CLIENTS * 2)) '
+        { loop = $2; rx = $4; tx = $6; in_ = $9; out = $13 }
+        in_ == logins { base_loop = loop; base_rx = rx; base_tx = tx; base_in = in_; base_out = out; based = 1 }
+        END {
+            if (!based || in_ == base_in) { print "no running totals from the timed part"; exit 1 }
+            in_ -= base_in; out -= base_out
+            printf "%d messages in, %d out: %.3f syscalls a message in (%.3f loop, %.3f read, %.3f send)\n",
+                in_, out, (loop - base_loop + rx - base_rx + tx - base_tx) / in_,
+                (loop - base_loop) / in_, (rx - base_rx) / in_, (tx - base_tx) / in_
+        }'
+done
+
+rm -rf "$SCRATCH"
@@ -0,0 +1,242 @@
+/*! \file connect-storm.c
+ * \brief How many logins a second the server can take: opens connections as fast as it can, keeping a set
+ * number in flight at once, and has each one log in (as a different player) and hang up as soon as it's in,
+ * which is when the lobby page BENCH_login() asks for comes back.
+ *
+ *      connect-storm [-h host] [-p port] [-n logins (default 10000)] [-c in flight at once (default 256)]
+ *                    [-x name prefix (default: made up from our pid)]
+ *
+ * Every name it logs in with gets added to the server's player list, so each run uses a fresh prefix unless
+ * it's given one (use the same one again to time logins by players the server already knows).
+ */
+#include    "bench-client.h"
+#include    <errno.h>
+#include    <unistd.h>
+#include    <sys/epoll.h>
+
+#define     STORM_DEFAULT_LOGINS        10000
+#define     STORM_DEFAULT_IN_FLIGHT     256
+/*! \brief How long a connection gets to be logged in before we give up on it. */
+#define     STORM_TIMEOUT_MS            10000
+
+/*! \defgroup storm_states Where each connection in flight is up to.
+ * \{
+ */
+#define     STORM_CONNECTING            0
+#define     STORM_LOGGING_IN            1
+/*! \} */
+
+static BENCH_CONN   *storm_conns;
+static uint64_t     *storm_samples;
+static uint32_t     storm_sample_count  = 0;
+static uint32_t     storm_started       = 0;
+static uint32_t     storm_succeeded     = 0;
+static uint32_t     storm_failed        = 0;
+static uint32_t     storm_total         = STORM_DEFAULT_LOGINS;
+static char         storm_prefix[16];
+static int          storm_epoll_fd;
+
+static void STORM_start(BENCH_CONN *conn);
+static void STORM_finish(BENCH_CONN *conn, BOOL succeeded);
+static void STORM_on_event(BENCH_CONN *conn, uint32_t events);
+
+int main(int argc, char **argv)
+{
+    struct epoll_event  events[256];
+    uint32_t            in_flight   = STORM_DEFAULT_IN_FLIGHT;
+    uint64_t            started;
+    double              seconds;
+    int                 opt;
+    int                 count;
+    int                 index;
+
+    snprintf(storm_prefix, sizeof(storm_prefix), "s%x_", (unsigned)getpid());
+
+    while ((opt = getopt(argc, argv, "h:p:n:c:x:")) != -1)
+    {
+        if (BENCH_parse_server_arg(opt, optarg))
+            continue;
+
+        switch (opt)
+        {
+            case 'n':
+                storm_total = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'c':
+                in_flight = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'x':
+                snprintf(storm_prefix, sizeof(storm_prefix), "%s", optarg);
+            break;
+
+            default:
+                fprintf(stderr, "usage: %s [-h host] [-p port] [-n logins (default %d)] "
+                    "[-c in flight at once (default %d)] [-x name prefix]\n", argv[0], STORM_DEFAULT_LOGINS,
+                    STORM_DEFAULT_IN_FLIGHT);
+                return 1;
+        }
+    }
+
+    if ((storm_total == 0) || (in_flight == 0))
+        return 1;
+
+    if (in_flight > storm_total)
+        in_flight = storm_total;
+
+    BENCH_raise_fd_limit(in_flight);
+
+    storm_conns     = (BENCH_CONN *)calloc(in_flight, sizeof(BENCH_CONN));
+    storm_samples   = (uint64_t *)calloc(storm_total, sizeof(uint64_t));
+    storm_epoll_fd  = epoll_create1(EPOLL_CLOEXEC);
+
+    if ((storm_conns == NULL) || (storm_samples == NULL) || (storm_epoll_fd < 0))
+    {
+        OH_SMEG("Couldn't get set up.");
+        return 1;
+    }
+
+    started = BENCH_now_ns();
+
+    for (index = 0; index < (int)in_flight; index++)
+        STORM_start(&storm_conns[index]);
+
+    while ((storm_succeeded + storm_failed) < storm_total)
+    {
+        count = epoll_wait(storm_epoll_fd, events, 256, 1000);
+
+        for (index = 0; index < count; index++)
+            STORM_on_event((BENCH_CONN *)events[index].data.ptr, events[index].events);
+
+        // anyone who's been stuck too long (a dropped SYN that hasn't been retried yet, say)
+        if (count == 0)
+        {
+            for (index = 0; index < (int)in_flight; index++)
+            {
+                if ((storm_conns[index].fd >= 0) &&
+                    ((BENCH_now_ns() - storm_conns[index].started_ns) > (STORM_TIMEOUT_MS * 1000000ULL)))
+                {
+                    STORM_finish(&storm_conns[index], FALSE);
+                }
+            }
+        }
+    }
+
+    seconds = (BENCH_now_ns() - started) / 1e9;
+
+    printf("%u logins (%u failed) in %.3f s: %.0f logins/s, %u in flight at once\n", storm_succeeded,
+        storm_failed, seconds, storm_succeeded / seconds, in_flight);
+    BENCH_report_latency("connect to logged in", storm_samples, storm_sample_count);
+
+    return (storm_failed == 0) ? 0 : 1;
+}
+
+/****************************************************************************************************************/
+/*! \brief Starts the next login off on a free connection, if there are any still to do.
+ */
+static void STORM_start(BENCH_CONN *conn)
+{
+    struct epoll_event event;
+
+    conn->fd = -1;
+
+    while (storm_started < storm_total)
+    {
+        conn->index         = storm_started++;
+        conn->state         = STORM_CONNECTING;
+        conn->started_ns    = BENCH_now_ns();
+
+        if (!BENCH_connect(conn, FALSE))
+        {
+            storm_failed++;
+            continue;
+        }
+
+        event.events    = EPOLLIN | EPOLLOUT;
+        event.data.ptr  = conn;
+        epoll_ctl(storm_epoll_fd, EPOLL_CTL_ADD, conn->fd, &event);
+        return;
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Done with a connection one way or the other; hangs up and starts the next one on it.
+ */
+static void STORM_finish(BENCH_CONN *conn, BOOL succeeded)
+{
+    if (succeeded)
+    {
+        storm_succeeded++;
+        storm_samples[storm_sample_count++] = BENCH_now_ns() - conn->started_ns;
+    }
+    else
+        storm_failed++;
+
+    BENCH_close(conn);
+    STORM_start(conn);
+}
+
+/****************************************************************************************************************/
+/*! \brief Something's happened on a connection in flight.
+ */
+static void STORM_on_event(BENCH_CONN *conn, uint32_t events)
+{
+    struct epoll_event  event;
+    char                name[MAX_NAME_LENGTH];
+    char                *msg;
+    int                 length;
+
+    if (conn->fd < 0)
+        return;
+
+    if (events & (EPOLLERR | EPOLLHUP))
+    {
+        STORM_finish(conn, FALSE);
+        return;
+    }
+
+    if (conn->state == STORM_CONNECTING)
+    {
+        if ((events & EPOLLOUT) == 0)
+            return;
+
+        snprintf(name, sizeof(name), "%s%u", storm_prefix, conn->index);
+
+        if (!BENCH_login(conn, name, conn->index % NUM_AVATARS))
+        {
+            STORM_finish(conn, FALSE);
+            return;
+        }
+
+        conn->state     = STORM_LOGGING_IN;
+        event.events    = EPOLLIN;
+        event.data.ptr  = conn;
+        epoll_ctl(storm_epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+        return;
+    }
+
+    if (BENCH_fill(conn) < 0)
+    {
+        STORM_finish(conn, FALSE);
+        return;
+    }
+
+    while ((length = BENCH_next(conn, &msg)) >= 0)
+    {
+        if (length == 0)
+            continue;
+
+        if ((uint8_t)msg[0] == MSGTYPE_REQUEST_LOBBY)
+        {
+            STORM_finish(conn, TRUE);
+            return;
+        }
+
+        if (((uint8_t)msg[0] == MSGTYPE_FAILURE) || ((uint8_t)msg[0] == MSGTYPE_DENIED_DUPLICATE_NAME))
+        {
+            STORM_finish(conn, FALSE);
+            return;
+        }
+    }
+}
@@ -0,0 +1,290 @@
+/*! \file fan-out.c
+ * \brief How long a line of lobby chat takes to get to everyone: logs a crowd of players in, then has one of
+ * them say something, waits until every one of them (the speaker too) has heard it, and does it again.
+ *
+ *      fan-out [-h host] [-p port] [-n players (default 1000)] [-b lines to say (default 100)]
+ *              [-P the server's pid, to say how much CPU it used] [-x name prefix (default: made up from our pid)]
+ *
+ * The server needs to have been started with room for everyone (-m), and without a limit on chat (-c 0), or
+ * most of the lines would be dropped as flooding.  Nobody asks for the lobby page, so nothing else gets pushed
+ * to anyone while they're logging in; each one knows it's in when the server answers a whisper to nobody.
+ */
+#include    "bench-client.h"
+#include    <errno.h>
+#include    <unistd.h>
+#include    <sys/epoll.h>
+
+#define     FAN_DEFAULT_PLAYERS         1000
+#define     FAN_DEFAULT_LINES           100
+/*! \brief How many logins can be waiting on the server at once; it turns away anything past MAX_PENDING_LOGINS. */
+#define     FAN_LOGINS_IN_FLIGHT        256
+/*! \brief How long to wait for anything before giving up. */
+#define     FAN_TIMEOUT_MS              30000
+/*! \brief Who the whisper that tells us we're in goes to; nobody can be called that, so the server says so. */
+#define     FAN_NOBODY                  "-"
+
+static BENCH_CONN   *fan_conns;
+static uint32_t     fan_players         = FAN_DEFAULT_PLAYERS;
+/*! \brief How many players have heard what they're waiting for: the server's answer while they're logging in, or
+ * the latest line after that.
+ */
+static uint32_t     fan_heard           = 0;
+static int          fan_epoll_fd;
+
+static BOOL     FAN_wait_for_everyone(uint32_t heard);
+static void     FAN_on_event(BENCH_CONN *conn);
+static BOOL     FAN_login(BENCH_CONN *conn, const char *name);
+static BOOL     FAN_say(BENCH_CONN *conn, uint32_t line);
+static uint64_t FAN_cpu_ticks(int pid);
+
+int main(int argc, char **argv)
+{
+    struct epoll_event  event;
+    char                prefix[16];
+    char                name[MAX_NAME_LENGTH];
+    uint64_t            *samples;
+    uint32_t            lines       = FAN_DEFAULT_LINES;
+    uint32_t            line;
+    uint32_t            index;
+    int                 server_pid  = 0;
+    uint64_t            ticks;
+    uint64_t            started;
+    double              seconds;
+    int                 opt;
+
+    snprintf(prefix, sizeof(prefix), "f%x_", (unsigned)getpid());
+
+    while ((opt = getopt(argc, argv, "h:p:n:b:P:x:")) != -1)
+    {
+        if (BENCH_parse_server_arg(opt, optarg))
+            continue;
+
+        switch (opt)
+        {
+            case 'n':
+                fan_players = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'b':
+                lines = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'P':
+                server_pid = atoi(optarg);
+            break;
+
+            case 'x':
+                snprintf(prefix, sizeof(prefix), "%s", optarg);
+            break;
+
+            default:
+                fprintf(stderr, "usage: %s [-h host] [-p port] [-n players (default %d)] "
+                    "[-b lines (default %d)] [-P server pid] [-x name prefix]\n", argv[0], FAN_DEFAULT_PLAYERS,
+                    FAN_DEFAULT_LINES);
+                return 1;
+        }
+    }
+
+    if ((fan_players == 0) || (lines == 0))
+        return 1;
+
+    BENCH_raise_fd_limit(fan_players);
+
+    fan_conns       = (BENCH_CONN *)calloc(fan_players, sizeof(BENCH_CONN));
+    samples         = (uint64_t *)calloc(lines, sizeof(uint64_t));
+    fan_epoll_fd    = epoll_create1(EPOLL_CLOEXEC);
+
+    if ((fan_conns == NULL) || (samples == NULL) || (fan_epoll_fd < 0))
+    {
+        OH_SMEG("Couldn't get set up.");
+        return 1;
+    }
+
+    // everyone logs in, a few hundred at a time so as not to run into the server's limit on pending logins
+    for (index = 0; index < fan_players; index++)
+    {
+        snprintf(name, sizeof(name), "%s%u", prefix, index);
+
+        fan_conns[index].index = index;
+        fan_conns[index].state = 0;
+
+        if (!BENCH_connect(&fan_conns[index], TRUE) || !FAN_login(&fan_conns[index], name))
+        {
+            OH_SMEG("Player %u couldn't log in.", index);
+            return 1;
+        }
+
+        event.events    = EPOLLIN;
+        event.data.ptr  = &fan_conns[index];
+        epoll_ctl(fan_epoll_fd, EPOLL_CTL_ADD, fan_conns[index].fd, &event);
+
+        if (((index + 1) >= FAN_LOGINS_IN_FLIGHT) && !FAN_wait_for_everyone(index + 1 - FAN_LOGINS_IN_FLIGHT))
+            return 1;
+    }
+
+    if (!FAN_wait_for_everyone(fan_players))
+        return 1;
+
+    printf("%u players logged in\n", fan_players);
+
+    ticks   = FAN_cpu_ticks(server_pid);
+    started = BENCH_now_ns();
+
+    for (line = 1; line <= lines; line++)
+    {
+        fan_heard           = 0;
+        samples[line - 1] = BENCH_now_ns();
+
+        if (!FAN_say(&fan_conns[0], line) || !FAN_wait_for_everyone(fan_players))
+            return 1;
+
+        samples[line - 1] = BENCH_now_ns() - samples[line - 1];
+    }
+
+    seconds = (BENCH_now_ns() - started) / 1e9;
+    ticks   = FAN_cpu_ticks(server_pid) - ticks;
+
+    printf("%u lines to %u players in %.3f s: %.0f deliveries a second\n", lines, fan_players, seconds,
+        ((double)lines * fan_players) / seconds);
+    BENCH_report_latency("said to heard by all", samples, lines);
+
+    if (server_pid > 0)
+    {
+        printf("server CPU: %.1f us a line, %.1f ns a player it went to\n",
+            (ticks * 1e6 / sysconf(_SC_CLK_TCK)) / lines,
+            (ticks * 1e9 / sysconf(_SC_CLK_TCK)) / ((double)lines * fan_players));
+    }
+
+    return 0;
+}
+
+/****************************************************************************************************************/
+/*! \brief Handles what comes in until at least heard players have heard what they're waiting for.
+ * \return FALSE if that didn't happen in time, or somebody got cut off.
+ */
+static BOOL FAN_wait_for_everyone(uint32_t heard)
+{
+    struct epoll_event  events[256];
+    uint64_t            deadline    = BENCH_now_ns() + (FAN_TIMEOUT_MS * 1000000ULL);
+    int                 count;
+    int                 index;
+
+    while (fan_heard < heard)
+    {
+        if (BENCH_now_ns() >= deadline)
+        {
+            OH_SMEG("Only %u of %u players heard back in time.", fan_heard, heard);
+            return FALSE;
+        }
+
+        count = epoll_wait(fan_epoll_fd, events, 256, 100);
+
+        for (index = 0; index < count; index++)
+        {
+            FAN_on_event((BENCH_CONN *)events[index].data.ptr);
+
+            if (((BENCH_CONN *)events[index].data.ptr)->fd < 0)
+            {
+                OH_SMEG("Player %u got cut off.", ((BENCH_CONN *)events[index].data.ptr)->index);
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Something's come in for a player.  Every chat line they get is one more heard, whether it's the answer
+ * to their login whisper or a line someone said; conn->state counts them.
+ */
+static void FAN_on_event(BENCH_CONN *conn)
+{
+    char    *msg;
+    int     length;
+
+    if (BENCH_fill(conn) < 0)
+    {
+        BENCH_close(conn);
+        return;
+    }
+
+    while ((length = BENCH_next(conn, &msg)) >= 0)
+    {
+        if ((length > 0) && ((uint8_t)msg[0] == MSGTYPE_CHAT))
+        {
+            conn->state++;
+            fan_heard++;
+        }
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Logs in, and whispers to nobody, so the server's answer says when we're in.
+ */
+static BOOL FAN_login(BENCH_CONN *conn, const char *name)
+{
+    PROTO_LOGIN login;
+    char        out[MAX_MESSAGE_SIZE];
+    int         length;
+
+    bzero(&login, sizeof(login));
+    snprintf(login.name, sizeof(login.name), "%s", name);
+    login.avatar = conn->index % NUM_AVATARS;
+
+    if (!BENCH_send(conn, out, PROTO_encode_LOGIN(out, sizeof(out), &login)))
+        return FALSE;
+
+    // [cmd] [their name] [NULL] [what to say]
+    length = snprintf(out, sizeof(out), "%c%s%c?", MSGTYPE_WHISPER, FAN_NOBODY, 0);
+
+    return BENCH_send(conn, out, length);
+}
+
+/****************************************************************************************************************/
+/*! \brief Says something in the lobby.  (PROTO_CHAT_LINE's the way out, with room for the speaker's name; on
+ * the way in it's just [cmd] [what they said] [NULL].)
+ */
+static BOOL FAN_say(BENCH_CONN *conn, uint32_t line)
+{
+    char out[MAX_MESSAGE_SIZE];
+
+    return BENCH_send(conn, out, snprintf(out, sizeof(out), "%cfan-out line %u", MSGTYPE_CHAT, line) + 1);
+}
+
+/****************************************************************************************************************/
+/*! \brief How much CPU a process has used so far, user and system together, in clock ticks; 0 if there's no
+ * process to ask about.
+ */
+static uint64_t FAN_cpu_ticks(int pid)
+{
+    char                path[64];
+    char                stat[1024];
+    char                *fields;
+    unsigned long long  user;
+    unsigned long long  system;
+    FILE                *file;
+    size_t              got;
+
+    if (pid <= 0)
+        return 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+    if ((file = fopen(path, "r")) == NULL)
+        return 0;
+
+    got         = fread(stat, 1, sizeof(stat) - 1, file);
+    stat[got]   = 0;
+    fclose(file);
+
+    // the process' name's in brackets, and can have anything in it, so start counting fields after it: utime and
+    // stime are the 14th and 15th, counting its pid as the 1st
+    if (((fields = strrchr(stat, ')')) == NULL) ||
+        (sscanf(fields + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &user, &system) != 2))
+    {
+        return 0;
+    }
+
+    return user + system;
+}
@@ -0,0 +1,318 @@
+/*! \file name-index.c
+ * \brief What looking a player up by name costs once there are a lot of them: adds a million (or however many)
+ * players to a fresh player store with PLYRDB_create_new_player(), then times PLYRDB_find_by_name() on names that
+ * are there and names that aren't.  For comparison, it also times a few lookups done the way they were before
+ * the name index, by walking every player there is and comparing names.
+ *
+ *      name-index [-n players (default 1000000)] [-l lookups of each kind (default 1000000)]
+ *                 [-w walks for the old way (default 100)] [-d journal|mmap (default journal)] [-S seed]
+ *                 [-k directory to keep the store in]
+ *
+ * It's linked against the server itself (everything but main.c), and keeps the player store in a scratch
+ * directory it makes under /tmp and gets rid of afterwards - unless it's told to keep it somewhere (-k), in
+ * which case it's left there, saved the way the server saves it on the way out.  Then it can time how long the
+ * server takes to start up on it, and how much memory that takes:
+ *
+ *      name-index -L directory [-d journal|mmap] [-r]
+ *
+ * loads the store that's there, the same way the server does before any shards start, and says how long it
+ * took and what our RSS was afterwards.  -r throws away a mapped store's name index first, to time rebuilding
+ * it (as happens after a crash).  Use the same -d the store was made with; starting a mapped store on a
+ * directory with only a player list in it imports the list instead.  The files are in the page cache by then,
+ * so it's a warm start that's being timed.
+ */
+#include    "tictactwo-common.h"
+#include    "player_db.h"
+#include    "server-common.h"
+#include    <dirent.h>
+#include    <errno.h>
+#include    <sys/stat.h>
+#include    <time.h>
+#include    <unistd.h>
+
+#define     NI_DEFAULT_PLAYERS          1000000
+#define     NI_DEFAULT_LOOKUPS          1000000
+#define     NI_DEFAULT_WALKS            100
+
+static uint64_t ni_random_state = 1;
+static char     ni_scratch[]    = "/tmp/name-index-XXXXXX";
+
+static int      NI_time_startup(const char *directory, BOOL rebuild_index);
+static void     NI_name(char *name, const char *kind, uint32_t number);
+static void     NI_clean_up(void);
+static uint32_t NI_memory_kb(const char *field);
+static uint32_t NI_random(uint32_t below);
+static uint64_t NI_now_ns(void);
+
+int main(int argc, char **argv)
+{
+    char            name[MAX_NAME_LENGTH];
+    uint32_t        players     = NI_DEFAULT_PLAYERS;
+    uint32_t        lookups     = NI_DEFAULT_LOOKUPS;
+    uint32_t        walks       = NI_DEFAULT_WALKS;
+    uint32_t        found       = 0;
+    uint32_t        index;
+    uint32_t        id;
+    uint64_t        started;
+    PLAYER_STRUCT   *ps;
+    const char      *keep_in    = NULL;
+    const char      *load_from  = NULL;
+    BOOL            rebuild     = FALSE;
+    int             opt;
+
+    while ((opt = getopt(argc, argv, "n:l:w:d:S:k:L:r")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                players = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'l':
+                lookups = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'w':
+                walks = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'd':
+                server_config.player_store = (strcmp(optarg, "mmap") == 0) ? PLYRDB_STORE_MAPPED :
+                    PLYRDB_STORE_JOURNAL;
+            break;
+
+            case 'S':
+                // xorshift never gets anywhere from 0
+                ni_random_state = strtoull(optarg, NULL, 10) | 1;
+            break;
+
+            case 'k':
+                keep_in = optarg;
+            break;
+
+            case 'L':
+                load_from = optarg;
+            break;
+
+            case 'r':
+                rebuild = TRUE;
+            break;
+
+            default:
+                fprintf(stderr, "usage: %s [-n players (default %d)] [-l lookups (default %d)] "
+                    "[-w walks (default %d)] [-d journal|mmap] [-S seed] [-k keep the store in directory]\n"
+                    "       %s -L directory [-d journal|mmap] [-r rebuild the index]\n", argv[0],
+                    NI_DEFAULT_PLAYERS, NI_DEFAULT_LOOKUPS, NI_DEFAULT_WALKS, argv[0]);
+                return 1;
+        }
+    }
+
+    if (load_from != NULL)
+        return NI_time_startup(load_from, rebuild);
+
+    if ((players == 0) || (lookups == 0))
+        return 1;
+
+    if (keep_in != NULL)
+    {
+        if (((mkdir(keep_in, 0755) < 0) && (errno != EEXIST)) || (chdir(keep_in) < 0))
+        {
+            OH_SMEG("Couldn't keep the player store in %s: %s", keep_in, strerror(errno));
+            return 1;
+        }
+    }
+    else
+    {
+        if ((mkdtemp(ni_scratch) == NULL) || (chdir(ni_scratch) < 0))
+        {
+            OH_SMEG("Couldn't make somewhere to keep the player store.");
+            return 1;
+        }
+
+        atexit(NI_clean_up);
+    }
+
+    // (the store saves itself as we exit, as it does when the server shuts down; with -k, that's what's kept)
+    PLYRDB_load_from_disk();
+
+    started = NI_now_ns();
+
+    for (index = 0; index < players; index++)
+    {
+        NI_name(name, "p", index);
+
+        if (PLYRDB_create_new_player(name) == NULL)
+        {
+            OH_SMEG("Couldn't add player %u.", index);
+            return 1;
+        }
+    }
+
+    printf("%u players added: %8.1f ns each\n", players, (double)(NI_now_ns() - started) / players);
+
+    // names that are there...
+    started = NI_now_ns();
+
+    for (index = 0; index < lookups; index++)
+    {
+        NI_name(name, "p", NI_random(players));
+        found += (PLYRDB_find_by_name(name) != NULL);
+    }
+
+    printf("%u lookups that hit:   %8.1f ns each\n", lookups, (double)(NI_now_ns() - started) / lookups);
+
+    // ...and names that aren't
+    started = NI_now_ns();
+
+    for (index = 0; index < lookups; index++)
+    {
+        NI_name(name, "q", NI_random(players));
+        found += (PLYRDB_find_by_name(name) != NULL);
+    }
+
+    printf("%u lookups that miss:  %8.1f ns each\n", lookups, (double)(NI_now_ns() - started) / lookups);
+
+    if (found != lookups)
+    {
+        OH_SMEG("%u lookups found someone; there should have been %u.", found, lookups);
+        return 1;
+    }
+
+    if (walks == 0)
+        return 0;
+
+    // the old way: from the first player on, until the name matches
+    started = NI_now_ns();
+
+    for (index = 0; index < walks; index++)
+    {
+        NI_name(name, "p", NI_random(players));
+
+        for (id = 0; ((ps = PLYRDB_get(id)) != NULL) && (strcmp(ps->name, name) != 0); id++)
+            ;
+    }
+
+    printf("%u walks of the list:  %8.1f ns each (as lookups were before the index)\n", walks,
+        (double)(NI_now_ns() - started) / walks);
+
+    return 0;
+}
+
+/****************************************************************************************************************/
+/*! \brief Times starting up on a player store that's in a directory already.
+ * \param rebuild_index Whether to throw away a mapped store's name index first, so it has to be rebuilt.
+ * \return What main() should.
+ */
+static int NI_time_startup(const char *directory, BOOL rebuild_index)
+{
+    uint32_t    before;
+    uint64_t    started;
+    double      taken;
+
+    if (chdir(directory) < 0)
+    {
+        OH_SMEG("Couldn't get into %s: %s", directory, strerror(errno));
+        return 1;
+    }
+
+    // (it's private to player_db.c, but that's where the index lives; see PLAYERDB_INDEX_PATH)
+    if (rebuild_index)
+        unlink(".tictac2_players.idx");
+
+    before  = NI_memory_kb("VmRSS:");
+    started = NI_now_ns();
+
+    PLYRDB_load_from_disk();
+
+    taken = (NI_now_ns() - started) / 1e6;
+
+    printf("%s store started up in %.1f ms: RSS %u kB (%u kB before), peak %u kB\n",
+        (server_config.player_store == PLYRDB_STORE_MAPPED) ? "mapped" : "journaled", taken,
+        NI_memory_kb("VmRSS:"), before, NI_memory_kb("VmHWM:"));
+
+    return 0;
+}
+
+/****************************************************************************************************************/
+/*! \brief Makes up the number'th name of a kind; the same number and kind always make the same name, and the
+ * numbers are hashed in so that the names don't all start the same way.
+ */
+static void NI_name(char *name, const char *kind, uint32_t number)
+{
+    snprintf(name, MAX_NAME_LENGTH, "%s%08x_%u", kind, number * 2654435761U, number);
+}
+
+/****************************************************************************************************************/
+/*! \brief Gets rid of the scratch directory, and whatever the player store left in it.
+ */
+static void NI_clean_up(void)
+{
+    char            path[sizeof(ni_scratch) + 256 + 2];
+    struct dirent   *entry;
+    DIR             *dir;
+
+    if ((dir = opendir(ni_scratch)) == NULL)
+        return;
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if ((strcmp(entry->d_name, ".") == 0) || (strcmp(entry->d_name, "..") == 0))
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", ni_scratch, entry->d_name);
+        unlink(path);
+    }
+
+    closedir(dir);
+    rmdir(ni_scratch);
+}
+
+/****************************************************************************************************************/
+/*! \brief Reads one of the memory figures (VmRSS:, VmHWM:, ...) out of /proc/self/status.
+ * \return It, in kB, or 0 if it isn't there.
+ */
+static uint32_t NI_memory_kb(const char *field)
+{
+    char        line[256];
+    uint32_t    kb      = 0;
+    FILE        *status = fopen("/proc/self/status", "r");
+
+    if (status == NULL)
+        return 0;
+
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (strncmp(line, field, strlen(field)) == 0)
+        {
+            kb = strtoul(&line[strlen(field)], NULL, 10);
+            break;
+        }
+    }
+
+    fclose(status);
+    return kb;
+}
+
+/****************************************************************************************************************/
+/*! \brief A random number below below; xorshift64*, so runs with the same seed look up the same names.
+ */
+static uint32_t NI_random(uint32_t below)
+{
+    ni_random_state ^= ni_random_state >> 12;
+    ni_random_state ^= ni_random_state << 25;
+    ni_random_state ^= ni_random_state >> 27;
+
+    return (uint32_t)(((ni_random_state * 2685821657736338717ULL) >> 32) % below);
+}
+
+/****************************************************************************************************************/
+/*! \brief A monotonic clock, in nanoseconds.
+ */
+static uint64_t NI_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000000ULL) + now.tv_nsec;
+}
@@ -0,0 +1,319 @@
+/*! \file pool-bench.c
+ * \brief What it costs to put an object back in a pool and take another out, once the pool's nearly full: the
+ * pool's filled, enough random objects are freed to bring it down to the occupancy being measured, and then it's
+ * timed freeing a random object and allocating a new one, over and over.
+ *
+ *      pool-bench [-n slots (default 16384)] [-o object size in bytes (default 64)] [-r pairs (default 1000000)]
+ *                 [-S random seed (default 1)]
+ *
+ * Each occupancy's run against the real pool (src/pool.c), and against the way slots used to be found before it
+ * kept a free list - a rover scanning forward for one whose in-use flag is clear - so there's something to
+ * compare it with.  Then it times walking the pool with POOL_next(), which the bitmap's meant to have kept cheap.
+ */
+#include    "pool.h"
+#include    <time.h>
+#include    <unistd.h>
+
+#define     PB_DEFAULT_SLOTS            16384
+#define     PB_DEFAULT_OBJECT_SIZE      64
+#define     PB_DEFAULT_PAIRS            1000000
+/*! \brief The same as the pools in the server use; it doesn't matter much here, since they're all allocated up
+ * front by the fill.
+ */
+#define     PB_SLAB_OBJECTS             1024
+
+/*! \brief The old way of doing it: an in-use flag at the top of each slot, and a rover that goes looking for a
+ * slot with it clear, starting from wherever the last one was found.
+ */
+typedef struct
+{
+    char        *slots;
+    uint32_t    stride;
+    uint32_t    count;
+    uint32_t    rover;
+} PB_SCAN_POOL;
+
+static const uint32_t   pb_occupancies[] = { 90, 95, 99 };
+static uint64_t         pb_random_state;
+
+static double   PB_time_pool(uint32_t slots, uint32_t object_size, uint32_t occupancy, uint32_t pairs);
+static double   PB_time_scan(uint32_t slots, uint32_t object_size, uint32_t occupancy, uint32_t pairs);
+static double   PB_time_walk(uint32_t slots, uint32_t object_size, uint32_t occupancy);
+static void     PB_fill_pool(POOL_STRUCT *pool, POOL_HANDLE *handles, uint32_t slots, uint32_t occupancy);
+static uint32_t PB_scan_alloc(PB_SCAN_POOL *pool);
+static uint32_t PB_random(uint32_t below);
+static uint64_t PB_now_ns(void);
+
+int main(int argc, char **argv)
+{
+    uint32_t    slots       = PB_DEFAULT_SLOTS;
+    uint32_t    object_size = PB_DEFAULT_OBJECT_SIZE;
+    uint32_t    pairs       = PB_DEFAULT_PAIRS;
+    uint64_t    seed        = 1;
+    uint32_t    index;
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "n:o:r:S:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                slots = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'o':
+                object_size = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'r':
+                pairs = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'S':
+                // xorshift never gets anywhere from 0
+                seed = strtoull(optarg, NULL, 10) | 1;
+            break;
+
+            default:
+                fprintf(stderr, "usage: %s [-n slots (default %d)] [-o object size (default %d)] "
+                    "[-r pairs (default %d)] [-S seed]\n", argv[0], PB_DEFAULT_SLOTS, PB_DEFAULT_OBJECT_SIZE,
+                    PB_DEFAULT_PAIRS);
+                return 1;
+        }
+    }
+
+    if ((slots < 100) || (slots > POOL_MAX_CAPACITY) || (object_size < 1) || (pairs == 0))
+    {
+        OH_SMEG("Between 100 and %u slots, please, of at least a byte each.", POOL_MAX_CAPACITY);
+        return 1;
+    }
+
+    printf("%u slots of %u bytes, %u free+alloc pairs each:\n", slots, object_size, pairs);
+
+    for (index = 0; index < sizeof(pb_occupancies) / sizeof(pb_occupancies[0]); index++)
+    {
+        pb_random_state = seed;
+        printf("  %u%% full:  pool %8.1f ns a pair", pb_occupancies[index],
+            PB_time_pool(slots, object_size, pb_occupancies[index], pairs));
+
+        pb_random_state = seed;
+        printf("   rover scan %8.1f ns a pair", PB_time_scan(slots, object_size, pb_occupancies[index], pairs));
+
+        pb_random_state = seed;
+        printf("   walk %6.2f ns a slot\n", PB_time_walk(slots, object_size, pb_occupancies[index]));
+    }
+
+    return 0;
+}
+
+/****************************************************************************************************************/
+/*! \brief Times free+alloc pairs on the real pool.
+ * \return How long a pair took, on average, in ns.
+ */
+static double PB_time_pool(uint32_t slots, uint32_t object_size, uint32_t occupancy, uint32_t pairs)
+{
+    POOL_STRUCT pool;
+    POOL_HANDLE *handles;
+    uint32_t    live        = (uint32_t)(((uint64_t)slots * occupancy) / 100);
+    uint32_t    pair;
+    uint32_t    victim;
+    uint64_t    started;
+    double      taken;
+    char        *object;
+
+    handles = (POOL_HANDLE *)malloc(slots * sizeof(POOL_HANDLE));
+
+    if ((handles == NULL) || !POOL_init(&pool, object_size, PB_SLAB_OBJECTS, slots))
+        exit(1);
+
+    PB_fill_pool(&pool, handles, slots, occupancy);
+
+    started = PB_now_ns();
+
+    for (pair = 0; pair < pairs; pair++)
+    {
+        victim = PB_random(live);
+        POOL_free(&pool, handles[victim]);
+
+        // touch it, as anything that allocated it would
+        object  = (char *)POOL_alloc(&pool, &handles[victim]);
+        *object = (char)pair;
+    }
+
+    taken = (double)(PB_now_ns() - started) / pairs;
+
+    free(handles);
+    return taken;
+}
+
+/****************************************************************************************************************/
+/*! \brief Times free+alloc pairs the old way, on the same sort of fill.
+ * \return How long a pair took, on average, in ns.
+ */
+static double PB_time_scan(uint32_t slots, uint32_t object_size, uint32_t occupancy, uint32_t pairs)
+{
+    PB_SCAN_POOL    pool;
+    uint32_t        *indexes;
+    uint32_t        live        = (uint32_t)(((uint64_t)slots * occupancy) / 100);
+    uint32_t        index;
+    uint32_t        pair;
+    uint32_t        victim;
+    uint32_t        swap;
+    uint64_t        started;
+    double          taken;
+
+    pool.stride = (object_size + 1 + 15) & ~15U;
+    pool.count  = slots;
+    pool.rover  = 0;
+    pool.slots  = (char *)calloc(slots, pool.stride);
+    indexes     = (uint32_t *)malloc(slots * sizeof(uint32_t));
+
+    if ((pool.slots == NULL) || (indexes == NULL))
+        exit(1);
+
+    // fill it, then free random ones until it's down to the occupancy we want, as PB_fill_pool() does
+    for (index = 0; index < slots; index++)
+        indexes[index] = PB_scan_alloc(&pool);
+
+    for (index = slots; index > live; index--)
+    {
+        victim = PB_random(index);
+        pool.slots[(size_t)indexes[victim] * pool.stride] = 0;
+
+        swap                = indexes[index - 1];
+        indexes[index - 1]  = indexes[victim];
+        indexes[victim]     = swap;
+    }
+
+    started = PB_now_ns();
+
+    for (pair = 0; pair < pairs; pair++)
+    {
+        victim = PB_random(live);
+        pool.slots[(size_t)indexes[victim] * pool.stride] = 0;
+
+        indexes[victim] = PB_scan_alloc(&pool);
+        pool.slots[((size_t)indexes[victim] * pool.stride) + 1] = (char)pair;
+    }
+
+    taken = (double)(PB_now_ns() - started) / pairs;
+
+    free(pool.slots);
+    free(indexes);
+    return taken;
+}
+
+/****************************************************************************************************************/
+/*! \brief Times walking everything in use in the real pool with POOL_next().
+ * \return How long it took, per slot the pool has, in ns.
+ */
+static double PB_time_walk(uint32_t slots, uint32_t object_size, uint32_t occupancy)
+{
+    POOL_STRUCT pool;
+    POOL_HANDLE *handles;
+    uint32_t    walks       = (100000000 / slots) + 1;
+    uint32_t    walk;
+    uint32_t    cursor;
+    uint64_t    started;
+    uint64_t    sum         = 0;
+    char        *object;
+    double      taken;
+
+    handles = (POOL_HANDLE *)malloc(slots * sizeof(POOL_HANDLE));
+
+    if ((handles == NULL) || !POOL_init(&pool, object_size, PB_SLAB_OBJECTS, slots))
+        exit(1);
+
+    PB_fill_pool(&pool, handles, slots, occupancy);
+
+    started = PB_now_ns();
+
+    for (walk = 0; walk < walks; walk++)
+    {
+        cursor = 0;
+
+        while ((object = (char *)POOL_next(&pool, &cursor)) != NULL)
+            sum += (uint8_t)*object;
+    }
+
+    taken = (double)(PB_now_ns() - started) / ((double)walks * slots);
+
+    // so the walk can't be optimised away
+    if (sum == 1)
+        printf(" ");
+
+    free(handles);
+    return taken;
+}
+
+/****************************************************************************************************************/
+/*! \brief Fills a pool right up, then frees random objects until it's down to occupancy percent full.  The
+ * handles of what's left are the first of handles.
+ */
+static void PB_fill_pool(POOL_STRUCT *pool, POOL_HANDLE *handles, uint32_t slots, uint32_t occupancy)
+{
+    uint32_t    live        = (uint32_t)(((uint64_t)slots * occupancy) / 100);
+    uint32_t    index;
+    uint32_t    victim;
+    POOL_HANDLE swap;
+    char        *object;
+
+    for (index = 0; index < slots; index++)
+    {
+        object  = (char *)POOL_alloc(pool, &handles[index]);
+        *object = (char)index;
+    }
+
+    for (index = slots; index > live; index--)
+    {
+        victim              = PB_random(index);
+        POOL_free(pool, handles[victim]);
+        swap                = handles[index - 1];
+        handles[index - 1]  = handles[victim];
+        handles[victim]     = swap;
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes a slot the old way: look for one that's free from the rover on, and leave the rover there.
+ */
+static uint32_t PB_scan_alloc(PB_SCAN_POOL *pool)
+{
+    uint32_t strides;
+
+    for (strides = 0; strides < pool->count; strides++)
+    {
+        if (!pool->slots[(size_t)pool->rover * pool->stride])
+            break;
+
+        pool->rover = (pool->rover + 1) % pool->count;
+    }
+
+    pool->slots[(size_t)pool->rover * pool->stride] = 1;
+
+    return pool->rover;
+}
+
+/****************************************************************************************************************/
+/*! \brief A random number below below; xorshift64*, so runs with the same seed free the same objects.
+ */
+static uint32_t PB_random(uint32_t below)
+{
+    pb_random_state ^= pb_random_state >> 12;
+    pb_random_state ^= pb_random_state << 25;
+    pb_random_state ^= pb_random_state >> 27;
+
+    return (uint32_t)(((pb_random_state * 2685821657736338717ULL) >> 32) % below);
+}
+
+/****************************************************************************************************************/
+/*! \brief A monotonic clock, in nanoseconds.
+ */
+static uint64_t PB_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000000ULL) + now.tv_nsec;
+}
@@ -0,0 +1,280 @@
+/*! \file round-trip.c
+ * \brief How long a message takes to get to the server and an answer back, with a set number of clients all
+ * going at once: each logs in, and then keeps asking for the top of the lobby (passing the version it's already
+ * got, so what comes back is usually an empty MSGTYPE_LOBBY_CHANGES), one question at a time, timing each answer.
+ *
+ *      round-trip [-h host] [-p port] [-n clients (default 100)] [-d seconds to run for (default 10)]
+ *                 [-q ms to sit quiet before and after (default 0)] [-x name prefix (default: made up from our pid)]
+ *
+ * The quiet spells are there so that the server's running totals (see its -s option) have a line from before
+ * the timed part and one from after it, with nothing from the logins in between; compare-backends.sh uses them
+ * to work out how many syscalls each message cost.
+ */
+#include    "bench-client.h"
+#include    <errno.h>
+#include    <unistd.h>
+#include    <sys/epoll.h>
+
+#define     RT_DEFAULT_CLIENTS          100
+#define     RT_DEFAULT_SECONDS          10
+/*! \brief How long everyone gets to log in before we give up. */
+#define     RT_LOGIN_TIMEOUT_MS         30000
+/*! \brief Where we start keeping timings; there'll be more if they're needed. */
+#define     RT_INITIAL_SAMPLES          (1 << 20)
+
+/*! \defgroup rt_states Where each client is up to.
+ * \{
+ */
+#define     RT_LOGGING_IN               0
+#define     RT_IDLE                     1
+#define     RT_WAITING                  2
+/*! \} */
+
+static BENCH_CONN   *rt_conns;
+/*! \brief The version of the lobby page each client's got. */
+static uint32_t     *rt_versions;
+static uint64_t     *rt_samples;
+static uint32_t     rt_sample_count     = 0;
+static uint32_t     rt_sample_room      = 0;
+static uint32_t     rt_clients          = RT_DEFAULT_CLIENTS;
+static uint32_t     rt_waiting          = 0;
+static uint32_t     rt_failed           = 0;
+/*! \brief Whether the timed part's still going, so answers should be followed by another question. */
+static BOOL         rt_running          = FALSE;
+static int          rt_epoll_fd;
+
+static BOOL RT_run_until(uint64_t deadline_ns);
+static void RT_ask(BENCH_CONN *conn);
+static void RT_on_event(BENCH_CONN *conn);
+
+int main(int argc, char **argv)
+{
+    struct epoll_event  event;
+    char                prefix[16];
+    char                name[MAX_NAME_LENGTH];
+    uint32_t            seconds     = RT_DEFAULT_SECONDS;
+    uint32_t            quiet_ms    = 0;
+    uint64_t            started;
+    double              elapsed;
+    uint32_t            index;
+    int                 opt;
+
+    snprintf(prefix, sizeof(prefix), "r%x_", (unsigned)getpid());
+
+    while ((opt = getopt(argc, argv, "h:p:n:d:q:x:")) != -1)
+    {
+        if (BENCH_parse_server_arg(opt, optarg))
+            continue;
+
+        switch (opt)
+        {
+            case 'n':
+                rt_clients = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'd':
+                seconds = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'q':
+                quiet_ms = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'x':
+                snprintf(prefix, sizeof(prefix), "%s", optarg);
+            break;
+
+            default:
+                fprintf(stderr, "usage: %s [-h host] [-p port] [-n clients (default %d)] "
+                    "[-d seconds (default %d)] [-q quiet ms before and after] [-x name prefix]\n", argv[0],
+                    RT_DEFAULT_CLIENTS, RT_DEFAULT_SECONDS);
+                return 1;
+        }
+    }
+
+    if ((rt_clients == 0) || (seconds == 0))
+        return 1;
+
+    BENCH_raise_fd_limit(rt_clients);
+
+    rt_conns        = (BENCH_CONN *)calloc(rt_clients, sizeof(BENCH_CONN));
+    rt_versions     = (uint32_t *)calloc(rt_clients, sizeof(uint32_t));
+    rt_sample_room  = RT_INITIAL_SAMPLES;
+    rt_samples      = (uint64_t *)malloc(rt_sample_room * sizeof(uint64_t));
+    rt_epoll_fd     = epoll_create1(EPOLL_CLOEXEC);
+
+    if ((rt_conns == NULL) || (rt_versions == NULL) || (rt_samples == NULL) || (rt_epoll_fd < 0))
+    {
+        OH_SMEG("Couldn't get set up.");
+        return 1;
+    }
+
+    // everyone logs in; a login's a LOGIN and a LOBBY_QUERY, so that's two messages in for each of them
+    for (index = 0; index < rt_clients; index++)
+    {
+        snprintf(name, sizeof(name), "%s%u", prefix, index);
+
+        rt_conns[index].index = index;
+        rt_conns[index].state = RT_LOGGING_IN;
+
+        if (!BENCH_connect(&rt_conns[index], TRUE) || !BENCH_login(&rt_conns[index], name, index % NUM_AVATARS))
+        {
+            OH_SMEG("Client %u couldn't log in.", index);
+            return 1;
+        }
+
+        event.events    = EPOLLIN;
+        event.data.ptr  = &rt_conns[index];
+        epoll_ctl(rt_epoll_fd, EPOLL_CTL_ADD, rt_conns[index].fd, &event);
+        rt_waiting++;
+    }
+
+    if (!RT_run_until(BENCH_now_ns() + (RT_LOGIN_TIMEOUT_MS * 1000000ULL)))
+    {
+        OH_SMEG("Only %u of %u clients got logged in.", rt_clients - rt_waiting, rt_clients);
+        return 1;
+    }
+
+    usleep(quiet_ms * 1000);
+
+    rt_running  = TRUE;
+    started     = BENCH_now_ns();
+
+    for (index = 0; index < rt_clients; index++)
+        RT_ask(&rt_conns[index]);
+
+    RT_run_until(started + (seconds * 1000000000ULL));
+
+    // stop asking, and let the last answers come in
+    rt_running = FALSE;
+    RT_run_until(BENCH_now_ns() + (RT_LOGIN_TIMEOUT_MS * 1000000ULL));
+
+    elapsed = (BENCH_now_ns() - started) / 1e9;
+
+    usleep(quiet_ms * 1000);
+
+    printf("%u round trips (%u failed) in %.3f s: %.0f a second, %u clients\n", rt_sample_count, rt_failed,
+        elapsed, rt_sample_count / elapsed, rt_clients);
+    BENCH_report_latency("query to answer", rt_samples, rt_sample_count);
+
+    return (rt_failed == 0) ? 0 : 1;
+}
+
+/****************************************************************************************************************/
+/*! \brief Handles what comes in until nobody's waiting for an answer (and the timed part's over), or it's the
+ * deadline.
+ * \return FALSE if we ran out of time.
+ */
+static BOOL RT_run_until(uint64_t deadline_ns)
+{
+    struct epoll_event  events[256];
+    uint64_t            now;
+    int                 count;
+    int                 index;
+
+    while ((rt_waiting > 0) || rt_running)
+    {
+        now = BENCH_now_ns();
+
+        if (now >= deadline_ns)
+            return FALSE;
+
+        count = epoll_wait(rt_epoll_fd, events, 256, (int)((deadline_ns - now) / 1000000ULL) + 1);
+
+        for (index = 0; index < count; index++)
+            RT_on_event((BENCH_CONN *)events[index].data.ptr);
+    }
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Sends a client's next question, saying which version of the page it's got.
+ */
+static void RT_ask(BENCH_CONN *conn)
+{
+    PROTO_LOBBY_QUERY   query;
+    char                out[MAX_MESSAGE_SIZE];
+
+    if (conn->fd < 0)
+        return;
+
+    bzero(&query, sizeof(query));
+    query.count     = 1;
+    query.version   = rt_versions[conn->index];
+
+    conn->state         = RT_WAITING;
+    conn->started_ns    = BENCH_now_ns();
+    rt_waiting++;
+
+    if (!BENCH_send(conn, out, PROTO_encode_LOBBY_QUERY(out, sizeof(out), &query)))
+    {
+        rt_failed++;
+        rt_waiting--;
+        BENCH_close(conn);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Something's come in for a client: if it's the answer it's waiting for, time it and ask again.
+ */
+static void RT_on_event(BENCH_CONN *conn)
+{
+    PROTO_LOBBY_PAGE    page;
+    PROTO_LOBBY_CHANGES changes;
+    char                *msg;
+    int                 length;
+
+    if (conn->fd < 0)
+        return;
+
+    if (BENCH_fill(conn) < 0)
+    {
+        if (conn->state != RT_IDLE)
+            rt_waiting--;
+
+        rt_failed++;
+        BENCH_close(conn);
+        return;
+    }
+
+    while ((length = BENCH_next(conn, &msg)) >= 0)
+    {
+        if (length == 0)
+            continue;
+
+        if ((uint8_t)msg[0] == MSGTYPE_REQUEST_LOBBY)
+        {
+            PROTO_decode_LOBBY_PAGE(&page, msg, length);
+            rt_versions[conn->index] = page.version;
+        }
+        else if ((uint8_t)msg[0] == MSGTYPE_LOBBY_CHANGES)
+        {
+            PROTO_decode_LOBBY_CHANGES(&changes, msg, length);
+            rt_versions[conn->index] = changes.to;
+        }
+        else
+            continue;
+
+        // the page changing while others log in gets pushed to everyone who's already watching it
+        if (conn->state == RT_IDLE)
+            continue;
+
+        if (conn->state == RT_WAITING)
+        {
+            if (rt_sample_count == rt_sample_room)
+            {
+                rt_sample_room *= 2;
+                rt_samples      = (uint64_t *)realloc(rt_samples, rt_sample_room * sizeof(uint64_t));
+            }
+
+            rt_samples[rt_sample_count++] = BENCH_now_ns() - conn->started_ns;
+        }
+
+        conn->state = RT_IDLE;
+        rt_waiting--;
+
+        if (rt_running)
+            RT_ask(conn);
+    }
+}
@@ -1,16 +1,117 @@
 #include "active-player-manager.h"
+#include "gameroom.h"
+#include "connection.h"
+#include "shard.h"
+#include "pool.h"
+#include "lobby.h"
+#include "chat.h"
 #include <fcntl.h>
+#include <errno.h>
+
+/*! \brief Turns a shard and a player's handle in its session pool into an id that's unique across every shard. */
+#define     PLYRMNGR_PLAYER_ID(shard, slot)     (((shard) << POOL_HANDLE_BITS) | (slot))
+#define     PLYRMNGR_SHARD_OF(player_id)        ((player_id) >> POOL_HANDLE_BITS)
+#define     PLYRMNGR_SLOT_OF(player_id)         ((player_id) & POOL_HANDLE_MASK)
+
+_Static_assert((((int64_t)MAX_SHARDS - 1) << POOL_HANDLE_BITS) + POOL_HANDLE_MASK <= INT32_MAX,
+    "player ids have to fit in an int");
+
+/*! \brief How many players' worth of room the session pool makes at a time. */
+#define     PLYRMNGR_POOL_SLAB_SIZE             1024
+/*! \brief How long an invitation's good for before it's taken as a no. */
+#define     PLYRMNGR_INVITE_TIMEOUT_MS          30000
+
+/*! \brief The kinds of message a player's only allowed to send so many of; each gets a PLYRMNGR_BUCKET. */
+enum
+{
+    PLYRMNGR_BUCKET_CHAT,
+    PLYRMNGR_BUCKET_INVITE,
+    PLYRMNGR_BUCKET_COUNT
+};
+
+/*! \brief A token bucket: it fills back up at a steady rate, to no more than a burst's worth, and every message
+ * takes a token out.  Anything sent while it's empty gets thrown away.
+ */
+typedef struct
+{
+    /*! \brief What's left in it, in thousandths of a token, so a rate in tokens a second is also how many of
+     * these come back every millisecond.
+     */
+    uint32_t        tokens;
+    /*! \brief When it was last topped up, by SERVER_now_ms(). */
+    uint64_t        topped_up_ms;
+} PLYRMNGR_BUCKET;
+
+/*! \brief What a shard keeps for each of its logged-in players; everything else about them lives in their
+ * PLAYER_STRUCT, which outlives the session.
+ */
+typedef struct
+{
+    PLAYER_STRUCT   *player;
+    /*! \brief Runs while they've sent or received an invitation that hasn't been answered yet. */
+    RCTR_TIMER      invite_timer;
+    /*! \brief How much more chatting and inviting they can do right now. */
+    PLYRMNGR_BUCKET buckets[PLYRMNGR_BUCKET_COUNT];
+} PLYRMNGR_SESSION;
+
+/*! \brief Posted to another shard to invite one of its players, and back again if the invitation falls through.
+ */
+typedef struct
+{
+    PLAYER_STRUCT   *invitee;
+    /*! \brief The inviter's PLYRMNGR_PLAYER_ID(). */
+    int             inviter_id;
+    char            inviter_name[MAX_NAME_LENGTH];
+} PLYRMNGR_INVITATION;
+
+/*! \brief Posted to an inviter's shard when a player on another shard accepts.  Both players need to be on the
+ * same shard to share a game room, so the one who accepted moves over, connection and all.
+ */
+typedef struct
+{
+    PLAYER_STRUCT   *player;
+    int             inviter_id;
+    CONN_HANDOFF    conn;
+    /*! \brief The chat channels they were in, to put them back in over there; see CHAT_park(). */
+    char            chat_channels[MAX_CHANNELS_JOINED][MAX_CHANNEL_NAME_LENGTH];
+    /*! \brief Their flood control, so moving doesn't fill their buckets back up. */
+    PLYRMNGR_BUCKET buckets[PLYRMNGR_BUCKET_COUNT];
+} PLYRMNGR_MIGRATION;
 
 /*! \defgroup player_manager_private
- * \brief Data and functions private to the active-player-manager module.
+ * \brief Data and functions private to the active-player-manager module.  Every shard has its own players, so
+ * all of it is per-thread.
  * \{
  */
-static PLAYER_STRUCT *active_players[MAX_ACTIVE_PLAYERS];
-static void PLYRMNGR_check_for_new_connections(void);
-static BOOL plyrmngr_was_module_inited = FALSE;
+/*! \brief This shard's logged-in players. */
+static __thread POOL_STRUCT plyrmngr_sessions;
+/*! \brief The reactor watch for the gameplay listening socket. */
+static __thread RCTR_WATCH plyrmngr_listen_watch;
+/*! \brief With io_uring, the multishot accept on the gameplay listening socket, which takes the watch's place. */
+static __thread RCTR_OP plyrmngr_accept_op;
+static void PLYRMNGR_check_for_new_connections(void *unused);
+static void PLYRMNGR_on_accept(void *context, int result, uint32_t flags);
+static void PLYRMNGR_take_connection(int fd);
+static void PLYRMNGR_on_readable(void *context);
+static BOOL PLYRMNGR_within_limits(PLAYER_STRUCT *ps, const char *msg);
+static BOOL PLYRMNGR_take_token(PLYRMNGR_BUCKET *bucket, uint32_t rate, uint32_t burst, uint64_t now);
+static void PLYRMNGR_handle_login(CONN_STRUCT *conn, const char *msg, int length);
+static void PLYRMNGR_handle_message(PLAYER_STRUCT *ps, const char *msg, int length);
+static void PLYRMNGR_accept(PLAYER_STRUCT *ps, PLAYER_STRUCT *inviter);
+static void PLYRMNGR_decline(PLAYER_STRUCT *ps);
+static void PLYRMNGR_start_invite_timer(PLAYER_STRUCT *ps);
+static void PLYRMNGR_on_invite_timeout(void *context);
+static void PLYRMNGR_end_session(PLAYER_STRUCT *ps);
+static void PLYRMNGR_migrate(PLAYER_STRUCT *ps, int inviter_id);
+static void PLYRMNGR_send_migration(void *context);
+static POOL_HANDLE PLYRMNGR_claim_slot(PLAYER_STRUCT *ps);
+static PLAYER_STRUCT *PLYRMNGR_local_player(int player_id);
+static void PLYRMNGR_take_invitation(int from_shard, void *payload, uint32_t length);
+static void PLYRMNGR_tell_invited(PLAYER_STRUCT *invitee, const char *from);
+static void PLYRMNGR_take_decline(int from_shard, void *payload, uint32_t length);
+static void PLYRMNGR_take_migration(int from_shard, void *payload, uint32_t length);
+static __thread BOOL plyrmngr_was_module_inited = FALSE;
 static void PLYRMNGR_cleanup(void);
-static void PLYRMNGR_build_lobbylist(void);
-static char plyrmngr_name_list_buffer[1 + (LOBBY_LIST_RECORD_SIZE * MAX_ACTIVE_PLAYERS)];
 /*! \} */
 
 /****************************************************************************************************************/
@@ -20,11 +121,29 @@ void PLYRMNGR_init(void)
 {
     if (plyrmngr_was_module_inited) return;
 
-    int index;
+    if (!POOL_init(&plyrmngr_sessions, sizeof(PLYRMNGR_SESSION), PLYRMNGR_POOL_SLAB_SIZE, server_config.max_players))
+    {
+        OH_SMEG("Couldn't set up the active player pool.");
+        exit(1);
+    }
+
+    LOBBY_init();
+    CHAT_init();
 
-    for (index = 0; index < MAX_ACTIVE_PLAYERS; index++)
+    // new connections get picked up as soon as they arrive, rather than once a tick; with io_uring, the kernel
+    // accepts them for us and just hands over the sockets
+    if (RCTR_backend() == RCTR_BACKEND_URING)
     {
-        active_players[index] = NULL;
+        plyrmngr_accept_op.on_complete  = PLYRMNGR_on_accept;
+        plyrmngr_accept_op.context      = NULL;
+
+        RCTR_accept(&plyrmngr_accept_op, server_listenfd_game);
+    }
+    else if (!RCTR_watch(&plyrmngr_listen_watch, server_listenfd_game, PLYRMNGR_check_for_new_connections, NULL,
+                NULL))
+    {
+        OH_SMEG("Can't watch the gameplay port for new connections; nobody would be able to log in.");
+        exit(1);
     }
 
     plyrmngr_was_module_inited = TRUE;
@@ -33,37 +152,18 @@ void PLYRMNGR_init(void)
 /****************************************************************************************************************/
 /*! \brief Handle a newly-connected player by retrieving a PLAYER_STRUCT with their details; if they don't
  * exist in the DB yet, a new PLAYER_STRUCT will be created for them.
+ * \param duplicate Set to TRUE if they're already logged in (here or on another shard), FALSE otherwise.
  *
- * \note If the server already has too many players, NULL is returned and nothing is added to the DB.
+ * \note If the server already has too many players, or they're already logged in, NULL is returned.
  */
-PLAYER_STRUCT *PLYRMNGR_handle_new_connect(const char *name, uint8_t avatar)
+PLAYER_STRUCT *PLYRMNGR_handle_new_connect(const char *name, uint8_t avatar, BOOL *duplicate)
 {
-    static int last_pool_index;
-    int strides;
-
-    BOOL success = FALSE;
+    int unclaimed = -1;
 
-    // find an empty slot in the pool first
-    while (strides < MAX_ACTIVE_PLAYERS)
-    {
-        if (active_players[last_pool_index] == NULL)
-        {
-            success = TRUE;
-            strides = MAX_ACTIVE_PLAYERS;
-        }
-        else
-        {
-            strides++;
-            last_pool_index++;
-            if (last_pool_index >= MAX_ACTIVE_PLAYERS)
-            {
-                last_pool_index = 0;
-            }
-        }
-    }
+    *duplicate = FALSE;
 
     // is the server full?
-    if (success == FALSE)
+    if (POOL_count(&plyrmngr_sessions) >= server_config.max_players)
     {
         // eeyup
         return NULL;
@@ -77,319 +177,907 @@ PLAYER_STRUCT *PLYRMNGR_handle_new_connect(const char *name, uint8_t avatar)
         tmp = PLYRDB_create_new_player(name);
     }
 
-    active_players[last_pool_index] = tmp;
-    tmp->avatar = avatar;
-    PLYRMNGR_build_lobbylist();
+    if (tmp == NULL)
+        return NULL;
+
+    // they're ours only if nobody has them already; until we know that, nothing of theirs can be touched, since
+    // whichever shard does have them is still using it
+    if (!__atomic_compare_exchange_n(&tmp->shard_id, &unclaimed, SHARD_self(), FALSE, __ATOMIC_ACQ_REL,
+            __ATOMIC_ACQUIRE))
+    {
+        *duplicate = TRUE;
+        return NULL;
+    }
+
+    POOL_HANDLE slot = PLYRMNGR_claim_slot(tmp);
+
+    // (only if we're out of memory, since we checked there was room)
+    if (slot == POOL_NO_HANDLE)
+    {
+        __atomic_store_n(&tmp->shard_id, -1, __ATOMIC_RELEASE);
+        return NULL;
+    }
+
+    tmp->avatar         = avatar;
+    tmp->active_slot    = slot;
+    tmp->gameroom_id    = -1;
+    LOBBY_join(tmp);
 
     return tmp;
 }
 
 /****************************************************************************************************************/
-/*! \brief A helper function that rebuilds the lobby list and caches it, so PLYRMNGR_tick() doesn't have to.
+/*! \brief Starts a session for a player in this shard's pool.
+ * \return The session's handle, or POOL_NO_HANDLE if the pool's full.
+ */
+static POOL_HANDLE PLYRMNGR_claim_slot(PLAYER_STRUCT *ps)
+{
+    PLYRMNGR_SESSION    *session;
+    POOL_HANDLE         handle;
+    uint64_t            now = SERVER_now_ms();
+
+    session = (PLYRMNGR_SESSION *)POOL_alloc(&plyrmngr_sessions, &handle);
+
+    if (session == NULL)
+        return POOL_NO_HANDLE;
+
+    session->player = ps;
+
+    // everyone starts out with a full burst's worth
+    session->buckets[PLYRMNGR_BUCKET_CHAT].tokens           = server_config.chat_burst * 1000;
+    session->buckets[PLYRMNGR_BUCKET_CHAT].topped_up_ms     = now;
+    session->buckets[PLYRMNGR_BUCKET_INVITE].tokens         = server_config.invite_burst * 1000;
+    session->buckets[PLYRMNGR_BUCKET_INVITE].topped_up_ms   = now;
+
+    return handle;
+}
+
+/****************************************************************************************************************/
+/*! \brief Looks up one of this shard's players by their PLYRMNGR_PLAYER_ID().
+ * \return The player, or NULL if they've logged off (or moved on) since, or the id belongs to another shard.
  */
-static void PLYRMNGR_build_lobbylist(void)
+static PLAYER_STRUCT *PLYRMNGR_local_player(int player_id)
 {
-    // structure of individual lobby list item:
-    //  name    null  wins    losses     ties     avatar index   null padding
-    // 0.....30  31  32...35 36.....39  40....43    44           45.......47
+    PLYRMNGR_SESSION *session;
 
-    bzero(plyrmngr_name_list_buffer, (LOBBY_LIST_RECORD_SIZE * MAX_ACTIVE_PLAYERS));
+    if ((player_id < 0) || (PLYRMNGR_SHARD_OF(player_id) != SHARD_self()))
+        return NULL;
 
-    plyrmngr_name_list_buffer[0] = MSGTYPE_REQUEST_LOBBY;
+    session = (PLYRMNGR_SESSION *)POOL_get(&plyrmngr_sessions, PLYRMNGR_SLOT_OF(player_id));
 
-    int client_index;
+    return (session != NULL) ? session->player : NULL;
+}
 
-    for (client_index = 0; client_index < MAX_ACTIVE_PLAYERS; client_index++)
+/****************************************************************************************************************/
+/*! \brief Called by the reactor when the gameplay port has one or more pending connections.
+ * \note The listening socket is edge-triggered, so we take everything off the accept queue in one go; we won't
+ *  get told about any that are left behind until someone else connects.
+ */
+static void PLYRMNGR_check_for_new_connections(void *unused)
+{
+    struct  sockaddr_in tmp;
+    socklen_t tmp_len;
+    int     success;
+
+    while (TRUE)
     {
-        if (active_players[client_index] !=  NULL)
+        tmp_len = sizeof(tmp);
+        success = accept4(server_listenfd_game, (struct sockaddr *) &tmp, &tmp_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+        // was there anything (else) waiting for us?
+        if (success == -1)
         {
-            // name
-            memcpy(&plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE))],
-                active_players[client_index]->name, 31);
-
-            // force the trailing null
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE)) + 31] = 0;
-
-            // wins
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE )) + 32] = (active_players[client_index]->games_won >> 24) & 0xff;
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE )) + 33] = (active_players[client_index]->games_won >> 16) & 0xff;
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE )) + 34] = (active_players[client_index]->games_won >>  8) & 0xff;
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE )) + 35] = (active_players[client_index]->games_won      ) & 0xff;
-
-            // losses
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE )) + 36] = (active_players[client_index]->games_lost >> 24) & 0xff;
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE )) + 37] = (active_players[client_index]->games_lost >> 16) & 0xff;
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE )) + 38] = (active_players[client_index]->games_lost >>  8) & 0xff;
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE )) + 39] = (active_players[client_index]->games_lost      ) & 0xff;
-
-            // ties
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE )) + 40] = (active_players[client_index]->games_tied >> 24) & 0xff;
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE )) + 41] = (active_players[client_index]->games_tied >> 16) & 0xff;
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE )) + 42] = (active_players[client_index]->games_tied >>  8) & 0xff;
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE )) + 43] = (active_players[client_index]->games_tied      ) & 0xff;
-
-            // avatar
-            plyrmngr_name_list_buffer[1 + (client_index * (LOBBY_LIST_RECORD_SIZE)) + 44] = active_players[client_index]->avatar;
+            switch (errno)
+            {
+                case EINTR:
+                case ECONNABORTED:
+                    // that one didn't work out, but there may be more behind it
+                    continue;
+
+                case EAGAIN:
+#if EAGAIN != EWOULDBLOCK
+                case EWOULDBLOCK:
+#endif
+                    // nope, queue's empty
+                    return;
+
+                default:
+                    // most likely out of descriptors; whoever's still queued will have to wait
+                    OH_SMEG("accept4() failed: %s", strerror(errno));
+                    server_stats.connections_refused++;
+                    return;
+            }
         }
+
+        PLYRMNGR_take_connection(success);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor (io_uring only) every time the kernel's accepted a connection on the gameplay
+ * port for us, or failed to.
+ * \param result The new socket, or -errno.
+ */
+static void PLYRMNGR_on_accept(void *context, int result, uint32_t flags)
+{
+    if (result >= 0)
+    {
+        PLYRMNGR_take_connection(result);
     }
+    else if ((result != -ECONNABORTED) && (result != -EINTR) && (result != -EAGAIN) && (result != -ECANCELED))
+    {
+        // most likely out of descriptors; whoever's still queued will have to wait
+        OH_SMEG("accept failed: %s", strerror(-result));
+        server_stats.connections_refused++;
+    }
+
+    // the kernel gives up on a multishot accept if it runs into trouble; start it over
+    if (!(flags & RCTR_MORE_TO_COME))
+        RCTR_accept(&plyrmngr_accept_op, server_listenfd_game);
 }
 
 /****************************************************************************************************************/
-/*! \brief A helper function that checks whether there's a brand-new incoming connection yet.  If
- *  there isn't, it returns without doing anything; otherwise, it tries to add the player to2 the game server if there
- * is room. */
-static void PLYRMNGR_check_for_new_connections(void)
+/*! \brief Takes a freshly-accepted socket, which gets a connection of its own and has until its login deadline to
+ *  tell us who they are.
+ */
+static void PLYRMNGR_take_connection(int fd)
 {
-    char    communication_buffer[MAX_MESSAGE_SIZE];
-    struct  sockaddr_in tmp;
-    int     tmp_len = sizeof(tmp);
-    int     success = accept(server_listenfd_game, (struct sockaddr *) &tmp, &tmp_len);
+    server_stats.connections_accepted++;
 
-    // was there anything waiting for us?
-    if (success != -1)
+    if (CONN_open(fd, PLYRMNGR_on_readable) == NULL)
     {
-        // yep
-        DUH_WHERE_AM_I(" --- got new connection, getting player's name.");
-        bzero(communication_buffer, MAX_MESSAGE_SIZE);
-
-        // block here and wait for a player name.
-        // admittedly, blocking here is kind of lame, and this should be some kind of
-        // timeout, but alas.  Maybe version 2.0.
-        int fd_opts;
-
-        fd_opts = fcntl(success, F_GETFL);
-        fd_opts ^= O_NONBLOCK;
-        fcntl(success, F_SETFL, fd_opts);
-        recv(success, communication_buffer, 64, 0); // wait here - the client is supposed to do this immediately.
-
-        // what did the client actually send us?
-        if (communication_buffer[0] != MSGTYPE_LOGIN)
+        // too many people knocking at once - they're welcome to try again later
+        char packet = MSGTYPE_FAILURE;
+        FRAME_write(fd, &packet, 1);
+        close(fd);
+        server_stats.connections_refused++;
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Handles the first message from a connection, which had better be MSGTYPE_LOGIN (see PROTO_LOGIN).
+ */
+static void PLYRMNGR_handle_login(CONN_STRUCT *conn, const char *msg, int length)
+{
+    PROTO_LOGIN login;
+    char        name[MAX_NAME_LENGTH];
+    char        packet;
+    BOOL        duplicate;
+
+    // what did the client actually send us?
+    if ((msg[0] != MSGTYPE_LOGIN) || !PROTO_decode_LOGIN(&login, msg, length))
+    {
+        // garbage, that's what.
+        packet = MSGTYPE_FAILURE;
+        CONN_send(conn, &packet, 1);
+        CONN_close(conn);
+        return;
+    }
+
+    // it's terminated already, but it may be a character too long to keep
+    snprintf(name, MAX_NAME_LENGTH, "%s", login.name);
+
+    // does the server have room for them?
+    PLAYER_STRUCT *tmp_plyr = PLYRMNGR_handle_new_connect(name, login.avatar, &duplicate);
+    if (tmp_plyr == NULL)
+    {
+        // server was full, or they're logged in already
+        packet = MSGTYPE_FAILURE; // there's no client state for server full (yet) - future enhancement?
+
+        if (duplicate)
+            packet = MSGTYPE_DENIED_DUPLICATE_NAME;
+
+        CONN_send(conn, &packet, 1);
+        CONN_close(conn);
+        return;
+    }
+
+    // we had room for them, at this point, they should be in the player pool
+    // remember which connection to talk to them on later...
+    tmp_plyr->connection_id     = conn->id;
+
+    // they haven't been challenged yet, so they're invitable
+    tmp_plyr->challenger_id     = -1;
+    tmp_plyr->lobby_subscription = -1;
+    tmp_plyr->state             = GAMESTATE_LOBBY;
+
+    // the lobby chat's where everyone starts out
+    CHAT_reset(tmp_plyr);
+    CHAT_join(tmp_plyr, CHAT_GLOBAL_CHANNEL);
+
+    CONN_logged_in(conn, tmp_plyr);
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor when a client's socket has something for us.  Reads everything that's waiting
+ * and hands every complete message off to whichever module is responsible for the state the client's in.
+ * \param context The client's CONN_STRUCT.
+ */
+static void PLYRMNGR_on_readable(void *context)
+{
+    CONN_STRUCT *conn = (CONN_STRUCT *)context;
+    const char  *msg;
+    int         length;
+    ssize_t     received;
+    char        packet;
+
+    // edge-triggered, so keep reading until the socket's empty or the client's gone (or moved to another shard)
+    while (CONN_is_active(conn))
+    {
+        received = CONN_fill(conn);
+
+        if ((received == 0) || ((received == -1) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)))
         {
-            // garbage, that's what.
-            communication_buffer[0] = MSGTYPE_FAILURE;
-            send(success, communication_buffer, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
-            close(success);
+            // they hung up on us (or the connection's hosed)
+            if (conn->state == CONN_STATE_LOGGED_IN)
+                PLYRMNGR_handle_disconnect(conn->player);
+            else
+                CONN_close(conn);
+
             return;
         }
 
-        // does the server have room for them?
-        PLAYER_STRUCT *tmp_plyr = PLYRMNGR_handle_new_connect(&communication_buffer[1], communication_buffer[AVATAR_ID_POSITION]);
-        if (tmp_plyr == NULL)
+        // act on every complete message that's arrived; TCP is free to bunch them up or split them
+        while (CONN_is_active(conn) && ((length = FRAME_peek(&conn->rx, &msg)) > 0))
         {
-            // server was full
-            communication_buffer[0] = MSGTYPE_FAILURE; // there's no client state for server full (yet) - future enhancement?
-            send(success, communication_buffer, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
-            close(success);
+            // msg stays put until the next CONN_fill(); taking it out first means that if handling it moves the
+            // connection to another shard, only what's left goes along
+            FRAME_pop(&conn->rx);
+            server_stats.messages_received++;
+
+            if (conn->state == CONN_STATE_AWAITING_LOGIN)
+                PLYRMNGR_handle_login(conn, msg, length);
+            // one player spamming chat makes work for everyone listening, so that's checked before anything else
+            else if (!PLYRMNGR_within_limits(conn->player, msg))
+                continue;
+            // players in a game get handled by the game room they're in
+            else if (conn->player->state == GAMESTATE_GAMEPLAY)
+                GMRM_handle_message(conn->player, msg, length);
+            else
+                PLYRMNGR_handle_message(conn->player, msg, length);
+        }
+
+        if (CONN_is_active(conn) && (length < 0))
+        {
+            // client has sent a garbled frame - there's no resynchronizing after that, just toss 'em
+            DUH_WHERE_AM_I("connection %d sent a malformed message", conn->id);
+            packet = MSGTYPE_FAILURE;
+            CONN_send(conn, &packet, 1);
+
+            if (conn->state == CONN_STATE_LOGGED_IN)
+                PLYRMNGR_handle_disconnect(conn->player);
+            else
+                CONN_close(conn);
+
             return;
         }
 
-        // we had room for them, at this point, they should be in the player pool
-        // save their socket descriptor for talking to them later...
-        tmp_plyr->connection_fd  = success;
+        // caught up?
+        if (received == -1)
+            return;
+    }
+}
 
-        // they haven't been challenged yet, so they're invitable
-        tmp_plyr->challenger_id     = -1;
-        tmp_plyr->state             = GAMESTATE_LOBBY;
+/****************************************************************************************************************/
+/*! \brief Checks a message from a logged-in player against their flood control, and takes a token for it if it's
+ * one of the kinds that's limited.  Invitations that don't make the cut get declined, so the client isn't left
+ * waiting for an answer that's never coming; chat just goes nowhere.
+ * \return TRUE if it should be handled, FALSE if it's been dealt with (thrown away) already.
+ */
+static BOOL PLYRMNGR_within_limits(PLAYER_STRUCT *ps, const char *msg)
+{
+    PLYRMNGR_SESSION    *session;
+    char                packet;
+
+    switch (msg[0])
+    {
+        case MSGTYPE_CHAT:
+        case MSGTYPE_WHISPER:
+        case MSGTYPE_JOIN_CHANNEL:
+        case MSGTYPE_LEAVE_CHANNEL:
+        case MSGTYPE_GET_CHAT_HISTORY:
+            if (server_config.chat_rate == 0)
+                return TRUE;
+
+            session = (PLYRMNGR_SESSION *)POOL_get(&plyrmngr_sessions, ps->active_slot);
+
+            if (PLYRMNGR_take_token(&session->buckets[PLYRMNGR_BUCKET_CHAT], server_config.chat_rate,
+                server_config.chat_burst, SERVER_now_ms()))
+            {
+                return TRUE;
+            }
+
+            server_stats.chat_dropped++;
+            return FALSE;
+
+        case MSGTYPE_INVITE:
+            if (server_config.invite_rate == 0)
+                return TRUE;
+
+            session = (PLYRMNGR_SESSION *)POOL_get(&plyrmngr_sessions, ps->active_slot);
+
+            if (PLYRMNGR_take_token(&session->buckets[PLYRMNGR_BUCKET_INVITE], server_config.invite_rate,
+                server_config.invite_burst, SERVER_now_ms()))
+            {
+                return TRUE;
+            }
+
+            server_stats.invites_dropped++;
+
+            // the lobby's the only place an invitation would've gotten an answer
+            if (ps->state == GAMESTATE_LOBBY)
+            {
+                packet = MSGTYPE_GOT_DECLINED;
+                PLYRMNGR_send(ps, &packet, 1);
+            }
+            return FALSE;
+
+        default:
+            return TRUE;
     }
 }
 
 /****************************************************************************************************************/
-/*! \brief Walk thorough all the players that are currently connected and update them as needed.
- * \todo This could stand to be broken up a bit more for modularity/readability...
+/*! \brief Tops a token bucket up for however long it's been since the last time, then takes a token out of it if
+ * there's one there.
+ * \param rate How many tokens it gets back a second.
+ * \param burst The most it can hold.
+ * \return TRUE if there was a token to take, FALSE if it's empty.
  */
-void PLYRMNGR_tick(void)
+static BOOL PLYRMNGR_take_token(PLYRMNGR_BUCKET *bucket, uint32_t rate, uint32_t burst, uint64_t now)
 {
-    PLYRMNGR_check_for_new_connections();
+    uint64_t tokens = bucket->tokens + ((now - bucket->topped_up_ms) * rate);
+
+    bucket->tokens          = (tokens > (uint64_t)burst * 1000) ? burst * 1000 : (uint32_t)tokens;
+    bucket->topped_up_ms    = now;
+
+    if (bucket->tokens < 1000)
+        return FALSE;
+
+    bucket->tokens -= 1000;
+    return TRUE;
+}
 
-    int     index;
-    char    communication_buffer[OUTGOING_CHAT_MESSAGE_LENGTH];     // used for receiving messages from client
-    ssize_t received;
+/****************************************************************************************************************/
+/*! \brief Sends a message to a logged-in player.
+ * \return TRUE if it went out, FALSE otherwise.
+ */
+BOOL PLYRMNGR_send(PLAYER_STRUCT *ps, const void *msg, uint16_t length)
+{
+    if ((ps == NULL) || (ps->state == GAMESTATE_NOT_CONNECTED))
+        return FALSE;
+
+    return CONN_send(CONN_get(ps->connection_id), msg, length);
+}
+
+/****************************************************************************************************************/
+/*! \brief Sends a message made with FRAME_share() to a logged-in player, without copying it.
+ * \return TRUE if it went out, FALSE otherwise.
+ */
+BOOL PLYRMNGR_send_shared(PLAYER_STRUCT *ps, FRAME_SHARED *frame)
+{
+    if ((ps == NULL) || (ps->state == GAMESTATE_NOT_CONNECTED))
+        return FALSE;
+
+    return CONN_send_shared(CONN_get(ps->connection_id), frame);
+}
+
+/****************************************************************************************************************/
+/*! \brief Close a player's connection and remove them from the active player table.  If they were in the middle
+ * of a game, their opponent wins by forfeit.
+ * \param ps The player who's leaving; does nothing if they're not logged in.
+ */
+void PLYRMNGR_handle_disconnect(PLAYER_STRUCT *ps)
+{
+    if ((ps == NULL) || (ps->state == GAMESTATE_NOT_CONNECTED)) return;
 
-    for (index = 0; index < MAX_ACTIVE_PLAYERS; index++)
+    if (ps->state == GAMESTATE_GAMEPLAY)
+        GMRM_handle_quit(ps);
+
+    CONN_close(CONN_get(ps->connection_id));
+
+    PLYRMNGR_end_session(ps);
+    ps->state           = GAMESTATE_NOT_CONNECTED;
+    ps->connection_id   = -1;
+
+    LOBBY_unsubscribe(ps);
+    LOBBY_leave(ps);
+    CHAT_leave_all(ps);
+
+    // (last, since whoever logs in as them next could be on another shard, and everything above has to be done)
+    __atomic_store_n(&ps->shard_id, -1, __ATOMIC_RELEASE);
+}
+
+/****************************************************************************************************************/
+/*! \brief Act on a single message from a player who's in the lobby (or somewhere else that isn't a game room).
+ * \param ps The player who sent it.
+ * \param msg The message, starting with its command byte; it isn't necessarily NULL-terminated.
+ * \param length How many bytes of msg are valid.
+ * \todo This could stand to be broken up a bit more for modularity/readability...
+ */
+static void PLYRMNGR_handle_message(PLAYER_STRUCT *ps, const char *msg, int length)
+{
+    char    packet;
+    int     index = PLYRMNGR_PLAYER_ID(SHARD_self(), ps->active_slot);
+
+    switch (msg[0])
     {
-        if (active_players[index] !=  NULL)
+        case MSGTYPE_DONE_WITH_STAT_SCREEN:
+            ps->state = GAMESTATE_LOBBY;
+            ps->challenger_id = -1;
+        break;
+
+        //--------------------------
+
+        case MSGTYPE_CHAT :
         {
+            PROTO_CHAT_LINE chat;
 
-            // did this player send something?
-            bzero(communication_buffer, MAX_MESSAGE_SIZE);
+            // it goes to whichever channel they're talking in, wherever its members are
+            PROTO_decode_CHAT_LINE(&chat, msg, length);
+            CHAT_say(ps, chat.text, strlen(chat.text));
+        }
+        break;
 
-            if (active_players[index]->state != GAMESTATE_GAMEPLAY)
-            {
-                received = recv(active_players[index]->connection_fd, communication_buffer,
-                    OUTGOING_CHAT_MESSAGE_LENGTH, MSG_DONTWAIT | MSG_NOSIGNAL);
-            }
+        // ---------------------
+
+        case MSGTYPE_JOIN_CHANNEL:
+        case MSGTYPE_LEAVE_CHANNEL:
+        {
+            PROTO_CHANNEL channel;
+
+            PROTO_decode_CHANNEL(&channel, msg, length);
+
+            if (channel.type == MSGTYPE_JOIN_CHANNEL)
+                CHAT_join(ps, channel.channel);
+            else
+                CHAT_leave(ps, channel.channel);
+        }
+        break;
+
+        // ---------------------
+
+        case MSGTYPE_GET_CHAT_HISTORY:
+        {
+            PROTO_GET_CHAT_HISTORY request;
+
+            if (PROTO_decode_GET_CHAT_HISTORY(&request, msg, length))
+                CHAT_history(ps, request.age_ms);
+        }
+        break;
+
+        // ---------------------
+
+        case MSGTYPE_WHISPER:
+        {
+            char    to[MAX_NAME_LENGTH];
+            int     name_length = strnlen(&msg[1], (length > MAX_NAME_LENGTH) ? MAX_NAME_LENGTH - 1 : length - 1);
+            int     text_start  = 1 + name_length + 1;
+
+            memcpy(to, &msg[1], name_length);
+            to[name_length] = 0;
+
+            // (the name's followed by a NULL, then whatever they want to say)
+            if (text_start < length)
+                CHAT_whisper(ps, to, &msg[text_start], length - text_start);
+        }
+        break;
+
+        // ---------------------
+
+        case MSGTYPE_CLIENT_QUITTING:
+            PLYRMNGR_handle_disconnect(ps);
+        break;
+
+        // ---------------------
+
+        case MSGTYPE_REQUEST_LOBBY:
+        {
+            PROTO_LOBBY_QUERY query;
+
+            // which page they want, if they've said; if they haven't, it's all zeros, which is the first page
+            // sorted by name
+            PROTO_decode_LOBBY_QUERY(&query, msg, length);
+
+            // from now on, we'll tell them whenever it changes
+            LOBBY_subscribe(ps, query.sort_key, query.first, query.count, query.version);
+        }
+        break;
+
+        // ------------
 
-            if (received > 0)
+        case MSGTYPE_INVITE:
+            if (ps->state == GAMESTATE_LOBBY)
             {
-                switch (communication_buffer[0])
+                PROTO_INVITE    invite;
+                char            invitee_name[MAX_NAME_LENGTH];
+
+                PROTO_decode_INVITE(&invite, msg, length);
+                snprintf(invitee_name, MAX_NAME_LENGTH, "%s", invite.name);
+
+                ps->state = GAMESTATE_WAITING_FOR_HANDSHAKE;
+                PLYRMNGR_start_invite_timer(ps);
+
+                PLAYER_STRUCT *invitee = PLYRDB_find_by_name(invitee_name);
+
+                // did we try to invite ourselves?
+                if (invitee == ps)
                 {
-                    case MSGTYPE_DONE_WITH_STAT_SCREEN:
-                        active_players[index]->state = GAMESTATE_LOBBY;
-                        active_players[index]->challenger_id = -1;
-                        PLYRMNGR_build_lobbylist();
-                    break;
+                    // not allowed, for obvious reasons - autodecline
+                    packet = MSGTYPE_GOT_DECLINED;
+                    PLYRMNGR_send(ps, &packet, 1);
+                    ps->state = GAMESTATE_LOBBY;
+                }
 
-                    //--------------------------
+                // do they belong to another shard?  it's up to that one to decide whether they're invitable
+                if ((invitee != NULL) && (invitee != ps) &&
+                    (__atomic_load_n(&invitee->shard_id, __ATOMIC_ACQUIRE) != SHARD_self()))
+                {
+                    PLYRMNGR_INVITATION invitation;
+
+                    bzero(&invitation, sizeof(invitation));
+                    invitation.invitee      = invitee;
+                    invitation.inviter_id   = index;
+                    snprintf(invitation.inviter_name, MAX_NAME_LENGTH, "%s", ps->name);
 
-                    case MSGTYPE_CHAT :
+                    if (!SHARD_post(__atomic_load_n(&invitee->shard_id, __ATOMIC_ACQUIRE), PLYRMNGR_take_invitation,
+                        &invitation, sizeof(invitation)))
                     {
-                        char    out_buffer[OUTGOING_CHAT_MESSAGE_LENGTH];
-                        int     client_index;
-
-                        // format the chat message into the way it should display on the client
-                        bzero(out_buffer, OUTGOING_CHAT_MESSAGE_LENGTH);
-                        snprintf(out_buffer, OUTGOING_CHAT_MESSAGE_LENGTH, "%c%s: %s", MSGTYPE_CHAT,
-                            active_players[index]->name, &communication_buffer[1]);
-
-                        out_buffer[64] = active_players[index]->avatar;
-
-                        // put it out to the console to ease debugging
-                        DUH_WHERE_AM_I("%s", &out_buffer[1]);
-
-                        // ...and propagate it.
-                        for (client_index = 0; client_index < MAX_ACTIVE_PLAYERS; client_index++)
-                        {
-                            if (active_players[client_index] != NULL)
-                            {
-                                send(active_players[client_index]->connection_fd, out_buffer,
-                                    OUTGOING_CHAT_MESSAGE_LENGTH, MSG_DONTWAIT | MSG_NOSIGNAL);
-                            }
-                        }
+                        // they're not logged in anywhere - autodecline
+                        packet = MSGTYPE_GOT_DECLINED;
+                        PLYRMNGR_send(ps, &packet, 1);
+                        ps->state = GAMESTATE_LOBBY;
                     }
                     break;
+                }
 
-                    // ---------------------
+                // does player even exist and are they in an invitable state?
+                if ((invitee == NULL) || (invitee->state != GAMESTATE_LOBBY))
+                {
+                    // player cannot be invited - autodecline
+                    packet = MSGTYPE_GOT_DECLINED;
+                    PLYRMNGR_send(ps, &packet, 1);
+                    ps->state = GAMESTATE_LOBBY;
+                }
+                else
+                {
+                    // they're inviteable - only allow one active invite at a time...
+                    invitee->state          = GAMESTATE_RECEIVED_INVITATION;
+                    invitee->challenger_id  = index;
+                    PLYRMNGR_start_invite_timer(invitee);
 
-                    case MSGTYPE_CLIENT_QUITTING:
-                    {
-                        close(active_players[index]->connection_fd);
-                        active_players[index]->state = GAMESTATE_NOT_CONNECTED;
-                        active_players[index] = NULL;
-                        PLYRMNGR_build_lobbylist();
-                    }
-                    break;
+                    // tell them they've been invited (insert your own pinkie pie reference here)
+                    PLYRMNGR_tell_invited(invitee, (const char *)ps->name);
+                }
+            }
+        break;
 
-                    // ---------------------
+        // ------------
 
-                    case MSGTYPE_REQUEST_LOBBY:
-                    {
-                        int i = 0;
+        case MSGTYPE_RESPOND_ACCEPT:
+        {
+            int acceptee_id = ps->challenger_id;
+
+            // the game has to happen on the inviter's shard, so if that isn't this one, we're moving
+            if ((acceptee_id >= 0) && (PLYRMNGR_SHARD_OF(acceptee_id) != SHARD_self()))
+            {
+                PLYRMNGR_migrate(ps, acceptee_id);
+                break;
+            }
 
-                        /*! \todo This stupidly sends the entire lobby, meaning ~6kbytes, every time - even if only
-                         * one player is logged in. */
+            PLYRMNGR_accept(ps, PLYRMNGR_local_player(acceptee_id));
+        }
+        break;
 
-                        send(active_players[index]->connection_fd, plyrmngr_name_list_buffer, 1 + (LOBBY_LIST_RECORD_SIZE * MAX_ACTIVE_PLAYERS), MSG_DONTWAIT | MSG_NOSIGNAL);
-                    }
-                    break;
+        // ------------
 
-                    // ------------
-
-                    case MSGTYPE_INVITE:
-                        if (active_players[index]->state == GAMESTATE_LOBBY)
-                        {
-                            active_players[index]->state = GAMESTATE_WAITING_FOR_HANDSHAKE;
-
-                            PLAYER_STRUCT *invitee = PLYRDB_find_by_name(&communication_buffer[1]);
-
-                            // did we try to invite ourselves?
-                            if (invitee == active_players[index])
-                            {
-                                // not allowed, for obvious reasons - autodecline
-                                communication_buffer[0] = MSGTYPE_GOT_DECLINED;
-                                send(active_players[index]->connection_fd, communication_buffer, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
-                                active_players[index]->state = GAMESTATE_LOBBY;
-                            }
-
-                            // does player even exist and are they in an invitable state?
-                            if ((invitee == NULL) || (invitee->state != GAMESTATE_LOBBY))
-                            {
-                                // player cannot be invited - autodecline
-                                communication_buffer[0] = MSGTYPE_GOT_DECLINED;
-                                send(active_players[index]->connection_fd, communication_buffer, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
-                                active_players[index]->state = GAMESTATE_LOBBY;
-                            }
-                            else
-                            {
-                                // they're inviteable - only allow one active invite at a time...
-                                invitee->state          = GAMESTATE_RECEIVED_INVITATION;
-                                invitee->challenger_id  = index;
-
-                                communication_buffer[0] = MSGTYPE_INVITE;
-
-                                snprintf(&communication_buffer[1], MAX_NAME_LENGTH + 1, "%s",
-                                    active_players[index]->name);
-
-                                // tell them they've been invited (insert your own pinkie pie reference here)
-                                send(invitee->connection_fd, communication_buffer, 1 + MAX_NAME_LENGTH + 1,
-                                    MSG_DONTWAIT | MSG_NOSIGNAL);
-                            }
-                        }
-                    break;
+        case MSGTYPE_RESPOND_DECLINE:
+            PLYRMNGR_decline(ps);
+        break;
 
-                    // ------------
+        // ------------
 
-                    case MSGTYPE_RESPOND_ACCEPT:
-                    {
-                        int acceptee_id = active_players[index]->challenger_id;
+        case MSGTYPE_MOVE:
+            // handled elsewhere.
+        break;
 
-                        // inform the inviter that they've been matched
-                        communication_buffer[0] = MSGTYPE_GOT_ACCEPTED;
-                        send(active_players[acceptee_id]->connection_fd, communication_buffer, 1,
-                            MSG_DONTWAIT | MSG_NOSIGNAL);
+        default:
+        {
+            DUH_WHERE_AM_I("player %s sent invalid stuff", ps->name);
+            // client has sent a garbled response - don't attempt to handle it, just toss 'em
+            packet = MSGTYPE_FAILURE;
+            PLYRMNGR_send(ps, &packet, 1);
+            PLYRMNGR_handle_disconnect(ps);
+        }
+    }
+}
 
-                        // remember they're in-game
-                        active_players[index]->state            = GAMESTATE_GAMEPLAY;
-                        active_players[acceptee_id]->state      = GAMESTATE_GAMEPLAY;
+/****************************************************************************************************************/
+/*! \brief Starts a game between a player who's accepted an invitation and whoever sent it, both of whom have to
+ * be on this shard.
+ * \param inviter NULL if they've given up and gone, in which case the player who accepted gets turned down; the
+ *  same goes if they're not waiting to hear back any more.
+ */
+static void PLYRMNGR_accept(PLAYER_STRUCT *ps, PLAYER_STRUCT *inviter)
+{
+    char packet;
 
-                        // retsuprae
-                        GMRM_create_new(active_players[index], active_players[acceptee_id]);
-                        DUH_WHERE_AM_I("starting game with %s and %s",active_players[index]->name, active_players[acceptee_id]->name);
+    // did the inviter give up on us (or get stood up) in the meantime?
+    if ((inviter == NULL) || (inviter->state != GAMESTATE_WAITING_FOR_HANDSHAKE))
+    {
+        packet = MSGTYPE_GOT_DECLINED;
+        PLYRMNGR_send(ps, &packet, 1);
+        ps->state            = GAMESTATE_LOBBY;
+        ps->challenger_id    = -1;
+        return;
+    }
 
-                        /*! \todo MORE STUFF GOES HERE. */
-                    }
-                    break;
+    // inform the inviter that they've been matched
+    packet = MSGTYPE_GOT_ACCEPTED;
+    PLYRMNGR_send(inviter, &packet, 1);
 
-                    // ------------
+    // remember they're in-game
+    ps->state           = GAMESTATE_GAMEPLAY;
+    inviter->state      = GAMESTATE_GAMEPLAY;
 
-                    case MSGTYPE_RESPOND_DECLINE:
-                    {
-                        if ((active_players[index]->state == GAMESTATE_RECEIVED_INVITATION) ||
-                            (active_players[index]->state == GAMESTATE_WAITING_FOR_HANDSHAKE))
-                        {
-                            int declinee_id = active_players[index]->challenger_id;
-
-                            // inform the inviter that they've been turned down
-                            communication_buffer[0] = MSGTYPE_GOT_DECLINED;
-                            if(active_players[declinee_id] != NULL)
-                                active_players[declinee_id]->state = GAMESTATE_LOBBY;
-                            send(active_players[declinee_id]->connection_fd, communication_buffer, 1,
-                                MSG_DONTWAIT | MSG_NOSIGNAL);
-
-                            // remember that the invitee turned them down
-                            active_players[index]->state            = GAMESTATE_LOBBY;
-                            active_players[index]->challenger_id    = -1;
-                        }
-                    }
-                    break;
+    // ...and so does everyone else
+    LOBBY_update(ps);
+    LOBBY_update(inviter);
 
-                    // ------------
+    // retsuprae
+    GMRM_create_new(ps, inviter);
+    DUH_WHERE_AM_I("starting game with %s and %s", ps->name, inviter->name);
 
-                    case MSGTYPE_MOVE:
-                        // handled elsewhere.
-                    break;
+    /*! \todo MORE STUFF GOES HERE. */
+}
 
-                    default:
-                    {                                                                                                                                                                             DUH_WHERE_AM_I("player %s sent invalid stuff",active_players[index]->name);
-                        // client has sent a garbled response - don't attempt to handle it, just toss 'em
-                        communication_buffer[0] = MSGTYPE_FAILURE;
-                        send(active_players[index]->connection_fd, communication_buffer, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
-                        close(active_players[index]->connection_fd);
-                        PLYRMNGR_build_lobbylist();
-                    }
-                }
-                received = 0;
-            } // end the case where a message was received
-        }
-    } // end for
+/****************************************************************************************************************/
+/*! \brief Turns down whatever invitation a player's got (or withdraws the one they've sent), and lets the other
+ * side know.
+ */
+static void PLYRMNGR_decline(PLAYER_STRUCT *ps)
+{
+    PLAYER_STRUCT   *declinee;
+    int             declinee_id = ps->challenger_id;
+    char            packet;
+
+    if ((ps->state != GAMESTATE_RECEIVED_INVITATION) && (ps->state != GAMESTATE_WAITING_FOR_HANDSHAKE))
+        return;
+
+    // inform the inviter that they've been turned down
+    if ((declinee_id >= 0) && (PLYRMNGR_SHARD_OF(declinee_id) != SHARD_self()))
+    {
+        PLYRMNGR_INVITATION invitation;
+
+        bzero(&invitation, sizeof(invitation));
+        invitation.invitee      = ps;
+        invitation.inviter_id   = declinee_id;
+
+        SHARD_post(PLYRMNGR_SHARD_OF(declinee_id), PLYRMNGR_take_decline, &invitation, sizeof(invitation));
+    }
+    else if (((declinee = PLYRMNGR_local_player(declinee_id)) != NULL) &&
+        (declinee->state == GAMESTATE_WAITING_FOR_HANDSHAKE))
+    {
+        packet = MSGTYPE_GOT_DECLINED;
+        declinee->state = GAMESTATE_LOBBY;
+        PLYRMNGR_send(declinee, &packet, 1);
+    }
+
+    // remember that the invitee turned them down
+    ps->state            = GAMESTATE_LOBBY;
+    ps->challenger_id    = -1;
 }
 
+/****************************************************************************************************************/
+/*! \brief (Re)starts the clock on a player's invitation, whichever end of it they're on.
+ */
+static void PLYRMNGR_start_invite_timer(PLAYER_STRUCT *ps)
+{
+    PLYRMNGR_SESSION *session = (PLYRMNGR_SESSION *)POOL_get(&plyrmngr_sessions, ps->active_slot);
+
+    if (session != NULL)
+        RCTR_start_timer(&session->invite_timer, PLYRMNGR_INVITE_TIMEOUT_MS, PLYRMNGR_on_invite_timeout, session);
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor when an invitation's gone unanswered for too long.  If they're the one who was
+ * invited, it's as good as a no; if they're the one who did the inviting, they've been stood up, and go back to
+ * the lobby.  Either way, if it got answered in the meantime, there's nothing to do.
+ * \param context The player's PLYRMNGR_SESSION.
+ */
+static void PLYRMNGR_on_invite_timeout(void *context)
+{
+    PLAYER_STRUCT   *ps = ((PLYRMNGR_SESSION *)context)->player;
+    char            packet;
+
+    if (ps->state == GAMESTATE_RECEIVED_INVITATION)
+    {
+        DUH_WHERE_AM_I("%s never answered their invitation", ps->name);
+        PLYRMNGR_decline(ps);
+    }
+    else if (ps->state == GAMESTATE_WAITING_FOR_HANDSHAKE)
+    {
+        DUH_WHERE_AM_I("%s never heard back about their invitation", ps->name);
+        packet = MSGTYPE_GOT_DECLINED;
+        PLYRMNGR_send(ps, &packet, 1);
+        ps->state = GAMESTATE_LOBBY;
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes a player off this shard's books, along with anything that was waiting on them.
+ */
+static void PLYRMNGR_end_session(PLAYER_STRUCT *ps)
+{
+    PLYRMNGR_SESSION *session = (PLYRMNGR_SESSION *)POOL_get(&plyrmngr_sessions, ps->active_slot);
+
+    if (session != NULL)
+        RCTR_stop_timer(&session->invite_timer);
+
+    POOL_free(&plyrmngr_sessions, ps->active_slot);
+}
+
+/****************************************************************************************************************/
+/*! \brief Hands a player who's accepted an invitation from another shard over to that shard, connection and all,
+ * so the two of them can share a game room.
+ */
+static void PLYRMNGR_migrate(PLAYER_STRUCT *ps, int inviter_id)
+{
+    PLYRMNGR_MIGRATION  *move = (PLYRMNGR_MIGRATION *)malloc(sizeof(PLYRMNGR_MIGRATION));
+    CONN_STRUCT         *conn;
+    char                packet;
+
+    if (move == NULL)
+    {
+        OH_SMEG("Out of memory moving %s to shard %d.", ps->name, PLYRMNGR_SHARD_OF(inviter_id));
+        packet = MSGTYPE_FAILURE;
+        PLYRMNGR_send(ps, &packet, 1);
+        PLYRMNGR_handle_disconnect(ps);
+        return;
+    }
+
+    DUH_WHERE_AM_I("moving %s from shard %d to shard %d", ps->name, SHARD_self(), PLYRMNGR_SHARD_OF(inviter_id));
+
+    move->player        = ps;
+    move->inviter_id    = inviter_id;
+    memcpy(move->buckets, ((PLYRMNGR_SESSION *)POOL_get(&plyrmngr_sessions, ps->active_slot))->buckets,
+        sizeof(move->buckets));
+
+    conn = CONN_get(ps->connection_id);
+
+    // they're off the books here from now on, even if the connection takes a moment to pack up (and once it has,
+    // ps belongs to the other shard)
+    PLYRMNGR_end_session(ps);
+    ps->connection_id = -1;
+    LOBBY_unsubscribe(ps);
+    LOBBY_leave(ps);
+    CHAT_park(ps, move->chat_channels);
+
+    CONN_detach(conn, &move->conn, PLYRMNGR_send_migration, move);
+}
+
+/****************************************************************************************************************/
+/*! \brief Called once a migrating player's connection is packed up, to send them on their way.
+ * \param context The PLYRMNGR_MIGRATION; freed here.
+ */
+static void PLYRMNGR_send_migration(void *context)
+{
+    PLYRMNGR_MIGRATION *move = (PLYRMNGR_MIGRATION *)context;
+
+    if (!SHARD_post(PLYRMNGR_SHARD_OF(move->inviter_id), PLYRMNGR_take_migration, move, sizeof(PLYRMNGR_MIGRATION)))
+    {
+        // there's nowhere left to put them
+        close(move->conn.fd);
+        move->player->state = GAMESTATE_NOT_CONNECTED;
+        __atomic_store_n(&move->player->shard_id, -1, __ATOMIC_RELEASE);
+    }
+
+    free(move);
+}
+
+/****************************************************************************************************************/
+/*! \brief Posted by another shard when one of its players invites one of ours.
+ */
+static void PLYRMNGR_take_invitation(int from_shard, void *payload, uint32_t length)
+{
+    PLYRMNGR_INVITATION *invitation = (PLYRMNGR_INVITATION *)payload;
+    PLAYER_STRUCT       *invitee    = invitation->invitee;
+
+    // have they moved on, or are they busy?
+    if ((__atomic_load_n(&invitee->shard_id, __ATOMIC_ACQUIRE) != SHARD_self()) ||
+        (invitee->state != GAMESTATE_LOBBY))
+    {
+        SHARD_post(from_shard, PLYRMNGR_take_decline, invitation, sizeof(PLYRMNGR_INVITATION));
+        return;
+    }
+
+    // they're inviteable - only allow one active invite at a time...
+    invitee->state          = GAMESTATE_RECEIVED_INVITATION;
+    invitee->challenger_id  = invitation->inviter_id;
+    PLYRMNGR_start_invite_timer(invitee);
+
+    PLYRMNGR_tell_invited(invitee, invitation->inviter_name);
+}
+
+/****************************************************************************************************************/
+/*! \brief Tells a player someone's invited them.
+ * \param from Who it's from.
+ */
+static void PLYRMNGR_tell_invited(PLAYER_STRUCT *invitee, const char *from)
+{
+    PROTO_INVITE    invite;
+    char            out_buffer[PROTO_SIZE(INVITE)];
+
+    snprintf(invite.name, sizeof(invite.name), "%s", from);
+
+    PLYRMNGR_send(invitee, out_buffer, PROTO_encode_INVITE(out_buffer, sizeof(out_buffer), &invite));
+}
+
+/****************************************************************************************************************/
+/*! \brief Posted back by another shard when one of our players' invitations falls through.
+ */
+static void PLYRMNGR_take_decline(int from_shard, void *payload, uint32_t length)
+{
+    PLYRMNGR_INVITATION *invitation = (PLYRMNGR_INVITATION *)payload;
+    PLAYER_STRUCT       *inviter    = PLYRMNGR_local_player(invitation->inviter_id);
+    char                packet      = MSGTYPE_GOT_DECLINED;
+
+    // still waiting to hear back?
+    if ((inviter == NULL) || (inviter->state != GAMESTATE_WAITING_FOR_HANDSHAKE))
+        return;
+
+    inviter->state = GAMESTATE_LOBBY;
+    PLYRMNGR_send(inviter, &packet, 1);
+}
+
+/****************************************************************************************************************/
+/*! \brief Posted by another shard when one of its players accepts one of our players' invitations; they're ours
+ * now.
+ */
+static void PLYRMNGR_take_migration(int from_shard, void *payload, uint32_t length)
+{
+    PLYRMNGR_MIGRATION  *move   = (PLYRMNGR_MIGRATION *)payload;
+    PLAYER_STRUCT       *ps     = move->player;
+    CONN_STRUCT         *conn   = NULL;
+    POOL_HANDLE         slot    = PLYRMNGR_claim_slot(ps);
+
+    if (slot != POOL_NO_HANDLE)
+    {
+        conn = CONN_adopt(&move->conn, PLYRMNGR_on_readable);
+
+        if (conn == NULL)
+            POOL_free(&plyrmngr_sessions, slot);
+    }
+
+    if (conn == NULL)
+    {
+
+        // no room at the inn; there's nothing for it but to hang up on them
+        PLYRMNGR_INVITATION invitation;
+
+        DUH_WHERE_AM_I("no room to take %s from shard %d, dropping them.", ps->name, from_shard);
+        close(move->conn.fd);
+        ps->state = GAMESTATE_NOT_CONNECTED;
+        __atomic_store_n(&ps->shard_id, -1, __ATOMIC_RELEASE);
+
+        invitation.inviter_id = move->inviter_id;
+        PLYRMNGR_take_decline(from_shard, &invitation, sizeof(invitation));
+        return;
+    }
+
+    memcpy(((PLYRMNGR_SESSION *)POOL_get(&plyrmngr_sessions, slot))->buckets, move->buckets, sizeof(move->buckets));
+
+    ps->active_slot         = slot;
+    ps->connection_id       = conn->id;
+    ps->lobby_subscription  = -1;
+    __atomic_store_n(&ps->shard_id, SHARD_self(), __ATOMIC_RELEASE);
+
+    CONN_logged_in(conn, ps);
+
+    LOBBY_join(ps);
+    CHAT_unpark(ps, move->chat_channels);
+    PLYRMNGR_accept(ps, PLYRMNGR_local_player(move->inviter_id));
+
+    // the reactor won't tell us about anything they sent before the move, so go look
+    PLYRMNGR_on_readable(conn);
+}
@@ -9,14 +9,16 @@
     #include    "tictactwo-common.h"
     #include    "server-common.h"
     #include    "player_db.h"
+    #include    "framing.h"
 
     void                PLYRMNGR_init(void);
-    void                PLYRMNGR_tick(void);
     void                PLYRMNGR_handle_lobby_refresh(PLAYER_STRUCT *ps);
     void                PLYRMNGR_handle_chat_msg(PLAYER_STRUCT *ps, const char *msg_text);
-    PLAYER_STRUCT *     PLYRMNGR_handle_new_connect(const char *name, uint8_t avatar);
+    PLAYER_STRUCT *     PLYRMNGR_handle_new_connect(const char *name, uint8_t avatar, BOOL *duplicate);
     void                PLYRMNGR_send_invite(PLAYER_STRUCT *inviter, const char *invitee_name);
     void                PLYRMNGR_resp_invite(PLAYER_STRUCT *invitee, const char *inviter_name);
     void                PLYRMNGR_handle_disconnect(PLAYER_STRUCT *ps);
+    BOOL                PLYRMNGR_send(PLAYER_STRUCT *ps, const void *msg, uint16_t length);
+    BOOL                PLYRMNGR_send_shared(PLAYER_STRUCT *ps, FRAME_SHARED *frame);
 
 #endif
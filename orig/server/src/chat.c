@@ -0,0 +1,947 @@
+/*! \file chat.c
+ * \brief Chat channels; see chat.h.
+ */
+#include    "chat.h"
+#include    "active-player-manager.h"
+#include    "connection.h"
+#include    "framing.h"
+#include    "shard.h"
+#include    "pool.h"
+#include    <stdarg.h>
+
+/*! \brief How many channels' worth of room the pool makes at a time. */
+#define     CHAT_POOL_SLAB_SIZE         256
+/*! \brief How many chains the channel lookup table has.  Has to be a power of two. */
+#define     CHAT_BUCKETS                1024
+/*! \brief How many members a channel has room for to start with; it doubles whenever it runs out. */
+#define     CHAT_MIN_MEMBERS            8
+/*! \brief How many lines each channel remembers.  Has to be a power of two. */
+#define     CHAT_HISTORY_LENGTH         64
+/*! \brief A remembered line is a PROTO_CHAT_LINE without the command byte. */
+#define     CHAT_HISTORY_LINE_LENGTH    (OUTGOING_CHAT_MESSAGE_LENGTH - PROTO_OFFSET(CHAT_LINE, text))
+
+_Static_assert(MAX_CHANNELS_JOINED * (FRAME_HEADER_SIZE + 1 + (CHAT_HISTORY_LENGTH * CHAT_HISTORY_LINE_LENGTH))
+    <= CONN_TX_QUEUE_SIZE, "everything a player's channels remember has to fit in their output queue");
+
+#define     CHAT_ROOM_CHANNEL_FORMAT    "room:%d"
+
+/*! \defgroup chat_kinds
+ * \brief What sort of channel a channel is, which is down to its name.
+ * \{
+ */
+#define     CHAT_KIND_GLOBAL            0
+#define     CHAT_KIND_NAMED             1
+/*! \brief A game room's; stays on its shard, and nobody gets told who's come and gone. */
+#define     CHAT_KIND_ROOM              2
+/*! \} */
+
+/*! \brief What's been said in a channel lately: a ring of the last CHAT_HISTORY_LENGTH lines. */
+typedef struct
+{
+    /*! \brief When each line was heard here, by SERVER_now_ms().  They only ever go up, oldest to newest, which is
+     * what lets CHAT_recall() search them.
+     */
+    uint64_t        stamps[CHAT_HISTORY_LENGTH];
+    char            lines[CHAT_HISTORY_LENGTH][CHAT_HISTORY_LINE_LENGTH];
+    /*! \brief How many lines have ever gone in; the next one goes at added % CHAT_HISTORY_LENGTH. */
+    uint32_t        added;
+} CHAT_HISTORY;
+
+/*! \brief One channel, as far as one shard's concerned. */
+typedef struct
+{
+    char            name[MAX_CHANNEL_NAME_LENGTH];
+    uint8_t         kind;
+    /*! \brief Its handle in the channel pool. */
+    POOL_HANDLE     id;
+    /*! \brief The next channel in the same chain of the lookup table, or POOL_NO_HANDLE. */
+    POOL_HANDLE     next;
+    /*! \brief This shard's players who are in it, in no particular order; each of them knows where they are in
+     * here (see PLAYER_STRUCT's chat_positions), so they can be taken out without looking.
+     */
+    PLAYER_STRUCT   **members;
+    uint32_t        member_count;
+    uint32_t        member_capacity;
+    /*! \brief Which other shards have anyone in it, one bit per shard. */
+    uint64_t        shards;
+    /*! \brief What's been said in it since this shard opened it, or NULL if nothing has. */
+    CHAT_HISTORY    *history;
+} CHAT_CHANNEL;
+
+/*! \brief Something said in a channel, posted to the other shards with anyone in it. */
+typedef struct
+{
+    char            channel[MAX_CHANNEL_NAME_LENGTH];
+    char            line[OUTGOING_CHAT_MESSAGE_LENGTH];
+} CHAT_POST;
+
+/*! \brief Posted to every other shard when a shard gets its first member of a channel, or loses its last. */
+typedef struct
+{
+    char            channel[MAX_CHANNEL_NAME_LENGTH];
+    BOOL            present;
+} CHAT_PRESENCE;
+
+/*! \brief A whisper to a player on another shard. */
+typedef struct
+{
+    PLAYER_STRUCT   *to;
+    char            line[OUTGOING_CHAT_MESSAGE_LENGTH];
+} CHAT_WHISPER;
+
+/*! \defgroup chat_private
+ * \brief Data and functions private to the chat module.  Every shard has its own channels, so all of it is
+ * per-thread.
+ * \{
+ */
+static __thread POOL_STRUCT chat_channels;
+/*! \brief Finds a channel by name: chains of handles into chat_channels, POOL_NO_HANDLE where they end. */
+static __thread POOL_HANDLE chat_buckets[CHAT_BUCKETS];
+static __thread BOOL        chat_was_module_inited  = FALSE;
+
+static CHAT_CHANNEL *CHAT_find(const char *name);
+static CHAT_CHANNEL *CHAT_open(const char *name);
+static void CHAT_close_if_empty(CHAT_CHANNEL *channel);
+static BOOL CHAT_add_member(PLAYER_STRUCT *ps, int slot, const char *name, BOOL announce);
+static void CHAT_remove_member(PLAYER_STRUCT *ps, int slot, BOOL announce);
+static int CHAT_slot_of(const PLAYER_STRUCT *ps, const CHAT_CHANNEL *channel);
+static int CHAT_free_slot(const PLAYER_STRUCT *ps);
+static void CHAT_broadcast(CHAT_CHANNEL *channel, const char *line);
+static void CHAT_deliver(CHAT_CHANNEL *channel, const char *line);
+static void CHAT_remember(CHAT_CHANNEL *channel, const char *line);
+static void CHAT_recall(PLAYER_STRUCT *ps, const CHAT_HISTORY *history, uint64_t since);
+static void CHAT_announce(CHAT_CHANNEL *channel, const PLAYER_STRUCT *ps, const char *what);
+static void CHAT_post_presence(const CHAT_CHANNEL *channel, BOOL present);
+static void CHAT_tell(PLAYER_STRUCT *ps, const char *format, ...);
+static void CHAT_format(char *line, uint8_t avatar, const char *format, ...);
+static void CHAT_vformat(char *line, uint8_t avatar, const char *format, va_list args);
+static void CHAT_take_post(int from_shard, void *payload, uint32_t length);
+static void CHAT_take_presence(int from_shard, void *payload, uint32_t length);
+static void CHAT_take_whisper(int from_shard, void *payload, uint32_t length);
+static BOOL CHAT_clean_name(char *clean, const char *name);
+static uint8_t CHAT_kind_of(const char *name);
+static uint32_t CHAT_hash(const char *name);
+/*! \} */
+
+/****************************************************************************************************************/
+/*! \brief Readies the module for use.
+ */
+void CHAT_init(void)
+{
+    uint64_t        capacity = (uint64_t)server_config.max_players * MAX_CHANNELS_JOINED * SHARD_count();
+    uint32_t        index;
+    CHAT_CHANNEL    *global;
+
+    if (chat_was_module_inited) return;
+
+    // the most there could be is every channel everyone everywhere's in
+    if (capacity > POOL_MAX_CAPACITY)
+        capacity = POOL_MAX_CAPACITY;
+
+    if (!POOL_init(&chat_channels, sizeof(CHAT_CHANNEL), CHAT_POOL_SLAB_SIZE, (uint32_t)capacity))
+    {
+        OH_SMEG("Couldn't set up the chat channels.");
+        exit(1);
+    }
+
+    for (index = 0; index < CHAT_BUCKETS; index++)
+        chat_buckets[index] = POOL_NO_HANDLE;
+
+    // every shard's in the global channel from the start, whether it's got any players yet or not, so every
+    // shard's heard (and remembers) everything said in it
+    if ((global = CHAT_open(CHAT_GLOBAL_CHANNEL)) == NULL)
+        exit(1);
+
+    global->shards = ((SHARD_count() == 64) ? ~0ULL : ((1ULL << SHARD_count()) - 1)) & ~(1ULL << SHARD_self());
+
+    chat_was_module_inited = TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Forgets whatever channels a player was in; for when they log in or move shards, since the handles
+ * they had belonged to wherever they were before.
+ */
+void CHAT_reset(PLAYER_STRUCT *ps)
+{
+    int slot;
+
+    for (slot = 0; slot < MAX_CHANNELS_JOINED; slot++)
+        ps->chat_channels[slot] = POOL_NO_HANDLE;
+
+    ps->chat_talking = -1;
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts a player in a channel they've asked to join, and makes it the one they talk in from the lobby.
+ * They're told if they can't (because of the name, or because they're in too many already).
+ * \return TRUE if they're in it.
+ */
+BOOL CHAT_join(PLAYER_STRUCT *ps, const char *channel)
+{
+    char    name[MAX_CHANNEL_NAME_LENGTH];
+    int     slot;
+    int     joined = 0;
+
+    if ((!CHAT_clean_name(name, channel)) || (CHAT_kind_of(name) == CHAT_KIND_ROOM))
+    {
+        CHAT_tell(ps, "server: can't join [%.*s].", MAX_CHANNEL_NAME_LENGTH - 1, channel);
+        return FALSE;
+    }
+
+    // already in it?  then they just want to talk there
+    for (slot = 0; slot < MAX_CHANNELS_JOINED; slot++)
+    {
+        CHAT_CHANNEL *in = (CHAT_CHANNEL *)POOL_get(&chat_channels, ps->chat_channels[slot]);
+
+        if (in == NULL)
+            continue;
+
+        if (strcmp(in->name, name) == 0)
+        {
+            ps->chat_talking = slot;
+            return TRUE;
+        }
+
+        if (in->kind != CHAT_KIND_ROOM)
+            joined++;
+    }
+
+    // (there's always got to be a slot spare for the game room they might go into)
+    if (joined >= MAX_CHANNELS_JOINED - 1)
+    {
+        CHAT_tell(ps, "server: too many channels to join [%s].", name);
+        return FALSE;
+    }
+
+    if (!CHAT_add_member(ps, CHAT_free_slot(ps), name, TRUE))
+    {
+        CHAT_tell(ps, "server: can't join [%s] right now.", name);
+        return FALSE;
+    }
+
+    ps->chat_talking = CHAT_slot_of(ps, CHAT_find(name));
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes a player out of a channel they've asked to leave; does nothing if they're not in it.
+ */
+void CHAT_leave(PLAYER_STRUCT *ps, const char *channel)
+{
+    char    name[MAX_CHANNEL_NAME_LENGTH];
+    int     slot;
+
+    if ((!CHAT_clean_name(name, channel)) || (CHAT_kind_of(name) == CHAT_KIND_ROOM))
+        return;
+
+    slot = CHAT_slot_of(ps, CHAT_find(name));
+
+    if (slot >= 0)
+        CHAT_remove_member(ps, slot, TRUE);
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes a player out of every channel they're in, because they've logged off.
+ */
+void CHAT_leave_all(PLAYER_STRUCT *ps)
+{
+    int slot;
+
+    for (slot = 0; slot < MAX_CHANNELS_JOINED; slot++)
+    {
+        if (ps->chat_channels[slot] != POOL_NO_HANDLE)
+            CHAT_remove_member(ps, slot, TRUE);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Quietly takes a player out of every channel they're in because they're moving to another shard, and
+ * writes down which ones (by slot; an empty name for a spare one) for CHAT_unpark() to put them back in there.
+ */
+void CHAT_park(PLAYER_STRUCT *ps, char channels[MAX_CHANNELS_JOINED][MAX_CHANNEL_NAME_LENGTH])
+{
+    CHAT_CHANNEL    *channel;
+    int             slot;
+
+    for (slot = 0; slot < MAX_CHANNELS_JOINED; slot++)
+    {
+        channel = (CHAT_CHANNEL *)POOL_get(&chat_channels, ps->chat_channels[slot]);
+
+        bzero(channels[slot], MAX_CHANNEL_NAME_LENGTH);
+
+        if (channel == NULL)
+            continue;
+
+        // (a game room's channel stays with the game room)
+        if (channel->kind != CHAT_KIND_ROOM)
+            memcpy(channels[slot], channel->name, MAX_CHANNEL_NAME_LENGTH);
+
+        CHAT_remove_member(ps, slot, FALSE);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Quietly puts a player who's just arrived from another shard back in the channels CHAT_park() wrote
+ * down for them there, in the same slots, so they're still talking wherever they were.
+ */
+void CHAT_unpark(PLAYER_STRUCT *ps, char channels[MAX_CHANNELS_JOINED][MAX_CHANNEL_NAME_LENGTH])
+{
+    int talking = ps->chat_talking;
+    int slot;
+
+    CHAT_reset(ps);
+
+    for (slot = 0; slot < MAX_CHANNELS_JOINED; slot++)
+    {
+        channels[slot][MAX_CHANNEL_NAME_LENGTH - 1] = 0;
+
+        if (channels[slot][0] != 0)
+            CHAT_add_member(ps, slot, channels[slot], FALSE);
+    }
+
+    if ((talking >= 0) && (ps->chat_channels[talking] != POOL_NO_HANDLE))
+        ps->chat_talking = talking;
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts both of a game room's players in its channel.
+ * \param room_id The room's handle in its shard's room pool.
+ */
+void CHAT_join_room(PLAYER_STRUCT *ps, int room_id)
+{
+    char name[MAX_CHANNEL_NAME_LENGTH];
+
+    snprintf(name, MAX_CHANNEL_NAME_LENGTH, CHAT_ROOM_CHANNEL_FORMAT, room_id);
+
+    CHAT_add_member(ps, CHAT_free_slot(ps), name, FALSE);
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes a player out of a game room's channel, once the game's over.
+ */
+void CHAT_leave_room(PLAYER_STRUCT *ps, int room_id)
+{
+    char    name[MAX_CHANNEL_NAME_LENGTH];
+    int     slot;
+
+    snprintf(name, MAX_CHANNEL_NAME_LENGTH, CHAT_ROOM_CHANNEL_FORMAT, room_id);
+
+    if ((slot = CHAT_slot_of(ps, CHAT_find(name))) >= 0)
+        CHAT_remove_member(ps, slot, FALSE);
+}
+
+/****************************************************************************************************************/
+/*! \brief Says something in the channel a player's talking in from the lobby.
+ * \param text What they said; it isn't necessarily NULL-terminated.
+ * \param length How much of text there is; anything past MAX_CHAT_LENGTH is cut off.
+ */
+void CHAT_say(PLAYER_STRUCT *ps, const char *text, int length)
+{
+    CHAT_CHANNEL    *channel    = NULL;
+    char            line[OUTGOING_CHAT_MESSAGE_LENGTH];
+
+    if (ps->chat_talking >= 0)
+        channel = (CHAT_CHANNEL *)POOL_get(&chat_channels, ps->chat_channels[ps->chat_talking]);
+
+    if (channel == NULL)
+    {
+        CHAT_tell(ps, "server: join a channel to chat.");
+        return;
+    }
+
+    if (length > MAX_CHAT_LENGTH) length = MAX_CHAT_LENGTH;
+
+    // the global channel's just the lobby chat there's always been; anywhere else says where it's from
+    if (channel->kind == CHAT_KIND_NAMED)
+        CHAT_format(line, ps->avatar, "[%s] %s: %.*s", channel->name, ps->name, length, text);
+    else
+        CHAT_format(line, ps->avatar, "%s: %.*s", ps->name, length, text);
+
+    // put it out to the console to ease debugging
+    DUH_WHERE_AM_I("%s", &line[1]);
+
+    CHAT_broadcast(channel, line);
+}
+
+/****************************************************************************************************************/
+/*! \brief Says something in a game room's channel, which only the two players in it hear.
+ */
+void CHAT_say_in_room(PLAYER_STRUCT *ps, int room_id, const char *text, int length)
+{
+    CHAT_CHANNEL    *channel;
+    char            name[MAX_CHANNEL_NAME_LENGTH];
+    char            line[OUTGOING_CHAT_MESSAGE_LENGTH];
+
+    snprintf(name, MAX_CHANNEL_NAME_LENGTH, CHAT_ROOM_CHANNEL_FORMAT, room_id);
+
+    if ((channel = CHAT_find(name)) == NULL)
+        return;
+
+    if (length > MAX_CHAT_LENGTH) length = MAX_CHAT_LENGTH;
+
+    CHAT_format(line, ps->avatar, "%s: %.*s", ps->name, length, text);
+    CHAT_deliver(channel, line);
+}
+
+/****************************************************************************************************************/
+/*! \brief Says something to just one player, wherever they are.  The player whispering hears it back, so they
+ * know it went; if whoever they're whispering to isn't logged in here, they hear that instead.
+ * \note If they're on another shard, it's up to that shard whether they're still there by the time it arrives.
+ */
+void CHAT_whisper(PLAYER_STRUCT *ps, const char *to, const char *text, int length)
+{
+    PLAYER_STRUCT   *target = PLYRDB_find_by_name(to);
+    CHAT_WHISPER    whisper;
+    int             shard = -1;
+
+    if (target != NULL)
+        shard = __atomic_load_n(&target->shard_id, __ATOMIC_ACQUIRE);
+
+    if ((target == NULL) || (shard < 0) || ((shard == SHARD_self()) && (target->state == GAMESTATE_NOT_CONNECTED)))
+    {
+        CHAT_tell(ps, "server: %.*s isn't around.", MAX_NAME_LENGTH - 1, to);
+        return;
+    }
+
+    if (length > MAX_CHAT_LENGTH) length = MAX_CHAT_LENGTH;
+
+    bzero(&whisper, sizeof(whisper));
+    whisper.to = target;
+    CHAT_format(whisper.line, ps->avatar, "%s whispers: %.*s", ps->name, length, text);
+
+    if (shard == SHARD_self())
+        PLYRMNGR_send(target, whisper.line, OUTGOING_CHAT_MESSAGE_LENGTH);
+    else if (!SHARD_post(shard, CHAT_take_whisper, &whisper, sizeof(whisper)))
+    {
+        // they've never been logged in anywhere
+        CHAT_tell(ps, "server: %s isn't around.", target->name);
+        return;
+    }
+
+    CHAT_tell(ps, "to %s: %.*s", target->name, length, text);
+}
+
+/****************************************************************************************************************/
+/*! \brief Catches a player up on what's been said in every channel they're in: one MSGTYPE_CHAT_HISTORY for
+ * each that's had anything said in it lately.
+ * \param age_ms How far back to go; anything over CHAT_HISTORY_MAX_AGE_MS is cut down to it.
+ * \note A named channel only remembers what's been said since its shard opened it, which may not be very long;
+ *  the global channel's open everywhere from the start.
+ */
+void CHAT_history(PLAYER_STRUCT *ps, uint32_t age_ms)
+{
+    CHAT_CHANNEL    *channel;
+    uint64_t        now = SERVER_now_ms();
+    int             slot;
+
+    if (age_ms > CHAT_HISTORY_MAX_AGE_MS) age_ms = CHAT_HISTORY_MAX_AGE_MS;
+
+    for (slot = 0; slot < MAX_CHANNELS_JOINED; slot++)
+    {
+        channel = (CHAT_CHANNEL *)POOL_get(&chat_channels, ps->chat_channels[slot]);
+
+        if ((channel != NULL) && (channel->history != NULL))
+            CHAT_recall(ps, channel->history, (now > age_ms) ? now - age_ms : 0);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Finds a channel this shard knows about by name.
+ * \return The channel, or NULL if there's nobody in it here or anywhere else.
+ */
+static CHAT_CHANNEL *CHAT_find(const char *name)
+{
+    POOL_HANDLE     handle = chat_buckets[CHAT_hash(name) & (CHAT_BUCKETS - 1)];
+    CHAT_CHANNEL    *channel;
+
+    while ((channel = (CHAT_CHANNEL *)POOL_get(&chat_channels, handle)) != NULL)
+    {
+        if (strcmp(channel->name, name) == 0)
+            return channel;
+
+        handle = channel->next;
+    }
+
+    return NULL;
+}
+
+/****************************************************************************************************************/
+/*! \brief Finds a channel by name, making it if this shard didn't know about it yet.
+ * \return The channel, or NULL if we're out of room.
+ */
+static CHAT_CHANNEL *CHAT_open(const char *name)
+{
+    CHAT_CHANNEL    *channel = CHAT_find(name);
+    POOL_HANDLE     handle;
+    uint32_t        bucket;
+
+    if (channel != NULL)
+        return channel;
+
+    if ((channel = (CHAT_CHANNEL *)POOL_alloc(&chat_channels, &handle)) == NULL)
+    {
+        OH_SMEG("Out of room for chat channels.");
+        return NULL;
+    }
+
+    bucket = CHAT_hash(name) & (CHAT_BUCKETS - 1);
+
+    snprintf(channel->name, MAX_CHANNEL_NAME_LENGTH, "%s", name);
+    channel->kind               = CHAT_kind_of(name);
+    channel->id                 = handle;
+    channel->next               = chat_buckets[bucket];
+    channel->members            = NULL;
+    channel->member_count       = 0;
+    channel->member_capacity    = 0;
+    channel->shards             = 0;
+    channel->history            = NULL;
+
+    chat_buckets[bucket] = handle;
+
+    return channel;
+}
+
+/****************************************************************************************************************/
+/*! \brief Gets rid of a channel once there's nobody in it, here or on any other shard.  The global channel
+ * stays put regardless.
+ */
+static void CHAT_close_if_empty(CHAT_CHANNEL *channel)
+{
+    POOL_HANDLE *link;
+
+    if ((channel->member_count > 0) || (channel->shards != 0) || (channel->kind == CHAT_KIND_GLOBAL))
+        return;
+
+    // unhook it from its chain
+    link = &chat_buckets[CHAT_hash(channel->name) & (CHAT_BUCKETS - 1)];
+
+    while (*link != channel->id)
+        link = &((CHAT_CHANNEL *)POOL_get(&chat_channels, *link))->next;
+
+    *link = channel->next;
+
+    free(channel->members);
+    free(channel->history);
+    POOL_free(&chat_channels, channel->id);
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts one of this shard's players in a channel.
+ * \param slot Which of their slots it goes in; it has to be spare (or -1, if they've none spare, which fails).
+ * \param announce Whether to tell the channel (if it's the sort that gets told).
+ * \return FALSE if they've no slots left or we're out of memory.
+ */
+static BOOL CHAT_add_member(PLAYER_STRUCT *ps, int slot, const char *name, BOOL announce)
+{
+    CHAT_CHANNEL    *channel;
+    PLAYER_STRUCT   **members;
+
+    if ((slot < 0) || ((channel = CHAT_open(name)) == NULL))
+        return FALSE;
+
+    if (channel->member_count == channel->member_capacity)
+    {
+        uint32_t capacity = (channel->member_capacity == 0) ? CHAT_MIN_MEMBERS : channel->member_capacity * 2;
+
+        members = (PLAYER_STRUCT **)realloc(channel->members, capacity * sizeof(PLAYER_STRUCT *));
+
+        if (members == NULL)
+        {
+            OH_SMEG("Out of memory growing [%s] past %u members.", channel->name, channel->member_count);
+            CHAT_close_if_empty(channel);
+            return FALSE;
+        }
+
+        channel->members            = members;
+        channel->member_capacity    = capacity;
+    }
+
+    ps->chat_channels[slot]     = channel->id;
+    ps->chat_positions[slot]    = channel->member_count;
+
+    channel->members[channel->member_count++] = ps;
+
+    // the first one here?  then the other shards ought to start sending it our way
+    if (channel->member_count == 1)
+        CHAT_post_presence(channel, TRUE);
+
+    if (announce)
+        CHAT_announce(channel, ps, "joined");
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes one of this shard's players out of the channel in one of their slots.
+ * \param announce Whether to tell the channel (if it's the sort that gets told).
+ */
+static void CHAT_remove_member(PLAYER_STRUCT *ps, int slot, BOOL announce)
+{
+    CHAT_CHANNEL    *channel    = (CHAT_CHANNEL *)POOL_get(&chat_channels, ps->chat_channels[slot]);
+    uint32_t        position    = ps->chat_positions[slot];
+    PLAYER_STRUCT   *last;
+
+    ps->chat_channels[slot] = POOL_NO_HANDLE;
+
+    if (ps->chat_talking == slot)
+        ps->chat_talking = -1;
+
+    if (channel == NULL)
+        return;
+
+    // whoever's on the end takes their place
+    last = channel->members[--channel->member_count];
+
+    if (last != ps)
+    {
+        channel->members[position] = last;
+        last->chat_positions[CHAT_slot_of(last, channel)] = position;
+    }
+
+    if (announce)
+        CHAT_announce(channel, ps, "left");
+
+    // the last one here?  then there's no more need to send it our way
+    if (channel->member_count == 0)
+        CHAT_post_presence(channel, FALSE);
+
+    CHAT_close_if_empty(channel);
+}
+
+/****************************************************************************************************************/
+/*! \brief Which of a player's slots a channel's in.
+ * \return The slot, or -1 if they're not in it (or there's no such channel).
+ */
+static int CHAT_slot_of(const PLAYER_STRUCT *ps, const CHAT_CHANNEL *channel)
+{
+    int slot;
+
+    if (channel == NULL)
+        return -1;
+
+    for (slot = 0; slot < MAX_CHANNELS_JOINED; slot++)
+    {
+        if (ps->chat_channels[slot] == channel->id)
+            return slot;
+    }
+
+    return -1;
+}
+
+/****************************************************************************************************************/
+/*! \brief The first of a player's slots that isn't being used, or -1 if they're all taken.
+ */
+static int CHAT_free_slot(const PLAYER_STRUCT *ps)
+{
+    int slot;
+
+    for (slot = 0; slot < MAX_CHANNELS_JOINED; slot++)
+    {
+        if (ps->chat_channels[slot] == POOL_NO_HANDLE)
+            return slot;
+    }
+
+    return -1;
+}
+
+/****************************************************************************************************************/
+/*! \brief Sends a line to everyone in a channel: the members here, and (by way of a post) any other shards
+ * with members of their own.
+ */
+static void CHAT_broadcast(CHAT_CHANNEL *channel, const char *line)
+{
+    CHAT_POST   post;
+    uint64_t    shards = channel->shards;
+    int         shard;
+
+    CHAT_deliver(channel, line);
+
+    if (shards == 0)
+        return;
+
+    memcpy(post.channel, channel->name, MAX_CHANNEL_NAME_LENGTH);
+    memcpy(post.line, line, OUTGOING_CHAT_MESSAGE_LENGTH);
+
+    while (shards != 0)
+    {
+        shard   = __builtin_ctzll(shards);
+        shards  &= shards - 1;
+
+        SHARD_post(shard, CHAT_take_post, &post, sizeof(post));
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Sends a line to a channel's members on this shard.
+ */
+static void CHAT_deliver(CHAT_CHANNEL *channel, const char *line)
+{
+    FRAME_SHARED    *frame;
+    uint32_t        index;
+
+    CHAT_remember(channel, line);
+
+    if (channel->member_count == 0)
+        return;
+
+    // framed the once, and every connection just takes a reference to it
+    if ((frame = FRAME_share(line, OUTGOING_CHAT_MESSAGE_LENGTH)) == NULL)
+        return;
+
+    for (index = 0; index < channel->member_count; index++)
+        PLYRMNGR_send_shared(channel->members[index], frame);
+
+    FRAME_release(frame);
+}
+
+/****************************************************************************************************************/
+/*! \brief Adds a line to a channel's history, pushing the oldest out if it's full.
+ */
+static void CHAT_remember(CHAT_CHANNEL *channel, const char *line)
+{
+    CHAT_HISTORY    *history = channel->history;
+    uint32_t        at;
+
+    // most channels (game rooms, mostly) never hear a word, so they don't get one till they need it
+    if (history == NULL)
+    {
+        if ((history = (CHAT_HISTORY *)malloc(sizeof(CHAT_HISTORY))) == NULL)
+        {
+            OH_SMEG("Out of memory for [%s]'s history.", channel->name);
+            return;
+        }
+
+        history->added      = 0;
+        channel->history    = history;
+    }
+
+    at = history->added & (CHAT_HISTORY_LENGTH - 1);
+
+    history->stamps[at] = SERVER_now_ms();
+    memcpy(history->lines[at], &line[PROTO_OFFSET(CHAT_LINE, text)], CHAT_HISTORY_LINE_LENGTH);
+    history->added++;
+}
+
+/****************************************************************************************************************/
+/*! \brief Sends a player everything in a channel's history from a given time on, as one MSGTYPE_CHAT_HISTORY.
+ * \param since A time by SERVER_now_ms(); lines heard before it are left out.
+ */
+static void CHAT_recall(PLAYER_STRUCT *ps, const CHAT_HISTORY *history, uint64_t since)
+{
+    char        reply[1 + (CHAT_HISTORY_LENGTH * CHAT_HISTORY_LINE_LENGTH)];
+    uint32_t    first   = (history->added > CHAT_HISTORY_LENGTH) ? history->added - CHAT_HISTORY_LENGTH : 0;
+    uint32_t    last    = history->added;
+    uint32_t    middle;
+    uint32_t    count;
+    uint32_t    start;
+    uint32_t    before_wrap;
+
+    // binary search for the oldest line that's new enough; first and last count every line that's ever gone in,
+    // so they don't wrap round where the ring does
+    while (first < last)
+    {
+        middle = first + ((last - first) / 2);
+
+        if (history->stamps[middle & (CHAT_HISTORY_LENGTH - 1)] < since)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+
+    if ((count = history->added - first) == 0)
+        return;
+
+    // everything from there to the newest is in one piece, unless it runs off the end of the ring
+    start       = first & (CHAT_HISTORY_LENGTH - 1);
+    before_wrap = (count < CHAT_HISTORY_LENGTH - start) ? count : CHAT_HISTORY_LENGTH - start;
+
+    reply[0] = MSGTYPE_CHAT_HISTORY;
+    memcpy(&reply[1], history->lines[start], before_wrap * CHAT_HISTORY_LINE_LENGTH);
+    memcpy(&reply[1 + (before_wrap * CHAT_HISTORY_LINE_LENGTH)], history->lines[0],
+        (count - before_wrap) * CHAT_HISTORY_LINE_LENGTH);
+
+    PLYRMNGR_send(ps, reply, 1 + (count * CHAT_HISTORY_LINE_LENGTH));
+}
+
+/****************************************************************************************************************/
+/*! \brief Tells everyone in a named channel someone's come or gone.
+ */
+static void CHAT_announce(CHAT_CHANNEL *channel, const PLAYER_STRUCT *ps, const char *what)
+{
+    char line[OUTGOING_CHAT_MESSAGE_LENGTH];
+
+    if (channel->kind != CHAT_KIND_NAMED)
+        return;
+
+    CHAT_format(line, ps->avatar, "*** %s %s [%s]", ps->name, what, channel->name);
+    CHAT_broadcast(channel, line);
+}
+
+/****************************************************************************************************************/
+/*! \brief Lets every other shard know this one's got its first member of a channel, or lost its last.  Game
+ * rooms' channels are nobody else's business, and every shard's always in the global channel.
+ */
+static void CHAT_post_presence(const CHAT_CHANNEL *channel, BOOL present)
+{
+    CHAT_PRESENCE presence;
+
+    if (channel->kind != CHAT_KIND_NAMED)
+        return;
+
+    bzero(&presence, sizeof(presence));
+    memcpy(presence.channel, channel->name, MAX_CHANNEL_NAME_LENGTH);
+    presence.present = present;
+
+    SHARD_post_to_others(CHAT_take_presence, &presence, sizeof(presence));
+}
+
+/****************************************************************************************************************/
+/*! \brief Sends one player a line of their own (from the server, or confirming a whisper went).
+ */
+static void CHAT_tell(PLAYER_STRUCT *ps, const char *format, ...)
+{
+    char    line[OUTGOING_CHAT_MESSAGE_LENGTH];
+    va_list args;
+
+    va_start(args, format);
+    CHAT_vformat(line, ps->avatar, format, args);
+    va_end(args);
+
+    PLYRMNGR_send(ps, line, OUTGOING_CHAT_MESSAGE_LENGTH);
+}
+
+/****************************************************************************************************************/
+/*! \brief Formats a line the way the client shows it; see CHAT_vformat().
+ */
+static void CHAT_format(char *line, uint8_t avatar, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    CHAT_vformat(line, avatar, format, args);
+    va_end(args);
+}
+
+/****************************************************************************************************************/
+/*! \brief Formats a line the way the client shows it: the command byte, the text (cut short if need be), and
+ * the avatar to show next to it in the last byte.
+ * \param line OUTGOING_CHAT_MESSAGE_LENGTH bytes.
+ */
+static void CHAT_vformat(char *line, uint8_t avatar, const char *format, va_list args)
+{
+    PROTO_CHAT_LINE chat;
+
+    vsnprintf(chat.text, sizeof(chat.text), format, args);
+    chat.avatar = avatar;
+
+    PROTO_encode_CHAT_LINE(line, OUTGOING_CHAT_MESSAGE_LENGTH, &chat);
+}
+
+/****************************************************************************************************************/
+/*! \brief Posted by another shard when someone there says something in a channel we've got members of.
+ */
+static void CHAT_take_post(int from_shard, void *payload, uint32_t length)
+{
+    CHAT_POST       *post       = (CHAT_POST *)payload;
+    CHAT_CHANNEL    *channel    = CHAT_find(post->channel);
+
+    // (everyone here may have left since they heard otherwise)
+    if (channel != NULL)
+        CHAT_deliver(channel, post->line);
+}
+
+/****************************************************************************************************************/
+/*! \brief Posted by another shard when it gets its first member of a channel, or loses its last.
+ */
+static void CHAT_take_presence(int from_shard, void *payload, uint32_t length)
+{
+    CHAT_PRESENCE   *presence   = (CHAT_PRESENCE *)payload;
+    CHAT_CHANNEL    *channel;
+
+    if (presence->present)
+    {
+        if ((channel = CHAT_open(presence->channel)) != NULL)
+            channel->shards |= (1ULL << from_shard);
+
+        return;
+    }
+
+    if ((channel = CHAT_find(presence->channel)) != NULL)
+    {
+        channel->shards &= ~(1ULL << from_shard);
+        CHAT_close_if_empty(channel);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Posted by another shard when someone there whispers to one of our players.
+ */
+static void CHAT_take_whisper(int from_shard, void *payload, uint32_t length)
+{
+    CHAT_WHISPER *whisper = (CHAT_WHISPER *)payload;
+
+    // have they moved on, or logged off?
+    if ((__atomic_load_n(&whisper->to->shard_id, __ATOMIC_ACQUIRE) != SHARD_self()) ||
+        (whisper->to->state == GAMESTATE_NOT_CONNECTED))
+        return;
+
+    PLYRMNGR_send(whisper->to, whisper->line, OUTGOING_CHAT_MESSAGE_LENGTH);
+}
+
+/****************************************************************************************************************/
+/*! \brief Tidies up a channel name a client's sent: it's cut off at MAX_CHANNEL_NAME_LENGTH, lowercased, and
+ * has to be letters, numbers, '-' and '_' only (so nobody can name their way into a game room's).
+ * \param clean Where the tidied-up name goes; MAX_CHANNEL_NAME_LENGTH bytes.
+ * \return FALSE if there's nothing left of it, or something in it that can't be in a name.
+ */
+static BOOL CHAT_clean_name(char *clean, const char *name)
+{
+    int index;
+
+    bzero(clean, MAX_CHANNEL_NAME_LENGTH);
+
+    for (index = 0; (index < MAX_CHANNEL_NAME_LENGTH - 1) && (name[index] != 0); index++)
+    {
+        char c = name[index];
+
+        if ((c >= 'A') && (c <= 'Z'))
+            c += 'a' - 'A';
+
+        if (!(((c >= 'a') && (c <= 'z')) || ((c >= '0') && (c <= '9')) || (c == '-') || (c == '_')))
+            return FALSE;
+
+        clean[index] = c;
+    }
+
+    return (index > 0);
+}
+
+/****************************************************************************************************************/
+/*! \brief What sort of channel a name makes.
+ */
+static uint8_t CHAT_kind_of(const char *name)
+{
+    if (strcmp(name, CHAT_GLOBAL_CHANNEL) == 0)
+        return CHAT_KIND_GLOBAL;
+
+    if (strchr(name, ':') != NULL)
+        return CHAT_KIND_ROOM;
+
+    return CHAT_KIND_NAMED;
+}
+
+/****************************************************************************************************************/
+/*! \brief Which chain of the lookup table a channel name goes in (FNV-1a).
+ */
+static uint32_t CHAT_hash(const char *name)
+{
+    uint32_t hash = 2166136261U;
+
+    while (*name != 0)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
@@ -0,0 +1,47 @@
+/*! \file chat.h
+ * \brief Chat channels: who's listening to what, so whatever's said only goes to whoever's listening.
+ *
+ * A channel's just a name.  Everyone's put in CHAT_GLOBAL_CHANNEL when they log in, which is where the lobby's
+ * chat has always gone; they can leave it if it's too much.  Any other name without a ':' in it (a region like
+ * "eu" or "na", or whatever people come up with) gets made the first time someone joins it, and goes away when
+ * the last of them leaves.  Game rooms have a channel each (CHAT_join_room() and friends), which players can't
+ * join by hand.  Whispers go to one player by name, and don't need a channel at all.
+ *
+ * Every shard keeps the channels its own players are in, each with a plain array of its members, so saying
+ * something costs one send per listener and nothing at all for anyone else.  Shards tell each other when they
+ * get the first member of a channel and when they lose the last, so a channel also knows which other shards
+ * have anyone in it, and only posts to those.  Room channels never leave their shard, since both players are
+ * always on it.  The global channel's on every shard from the start, players or no, so it's never any news.
+ *
+ * Members of named channels hear when someone joins or leaves.  Nobody needs to hear about every login in the
+ * global channel, or about the two players in a game room.
+ *
+ * Every channel remembers the last few dozen lines said in it, each stamped with when it was heard, so a client
+ * that's been away can catch up with one MSGTYPE_GET_CHAT_HISTORY (see CHAT_history()).
+ *
+ * Everything that reaches a client goes out as an ordinary MSGTYPE_CHAT, ready to show, or for history, as a run
+ * of them in one MSGTYPE_CHAT_HISTORY.
+ */
+#ifndef         CHAT_H
+    #define     CHAT_H
+
+    #include    "tictactwo-common.h"
+    #include    "player_db.h"
+
+    #define     CHAT_GLOBAL_CHANNEL         "global"
+
+    void        CHAT_init(void);
+    void        CHAT_reset(PLAYER_STRUCT *ps);
+    BOOL        CHAT_join(PLAYER_STRUCT *ps, const char *channel);
+    void        CHAT_leave(PLAYER_STRUCT *ps, const char *channel);
+    void        CHAT_leave_all(PLAYER_STRUCT *ps);
+    void        CHAT_park(PLAYER_STRUCT *ps, char channels[MAX_CHANNELS_JOINED][MAX_CHANNEL_NAME_LENGTH]);
+    void        CHAT_unpark(PLAYER_STRUCT *ps, char channels[MAX_CHANNELS_JOINED][MAX_CHANNEL_NAME_LENGTH]);
+    void        CHAT_join_room(PLAYER_STRUCT *ps, int room_id);
+    void        CHAT_leave_room(PLAYER_STRUCT *ps, int room_id);
+    void        CHAT_say(PLAYER_STRUCT *ps, const char *text, int length);
+    void        CHAT_say_in_room(PLAYER_STRUCT *ps, int room_id, const char *text, int length);
+    void        CHAT_whisper(PLAYER_STRUCT *ps, const char *to, const char *text, int length);
+    void        CHAT_history(PLAYER_STRUCT *ps, uint32_t age_ms);
+
+#endif
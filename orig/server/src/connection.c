@@ -0,0 +1,977 @@
+/*! \file connection.c
+ * \brief The connection table and the bookkeeping for the login handshake deadline; see connection.h.
+ */
+#include "connection.h"
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+
+/*! \brief How many connections' worth of room the pool makes at a time; each one's got its queues built in, so
+ * that's a couple of megabytes.
+ */
+#define     CONN_POOL_SLAB_SIZE             64
+
+#define     CONN_TX_MASK                    (CONN_TX_QUEUE_SIZE - 1)
+#define     CONN_TX_SHARED_MASK             (CONN_TX_SHARED_SLOTS - 1)
+
+/*! \defgroup connection_private
+ * \brief Data and functions private to the connection module.  Every shard has its own connections, so all of it
+ * is per-thread.
+ * \{
+ */
+static __thread POOL_STRUCT conn_pool;
+static __thread BOOL        conn_was_module_inited  = FALSE;
+
+/*! \brief Connections that have had something queued since the last flush.  Each one's on here at most once
+ * (that's what tx_dirty is for, and it sticks with the slot even if the connection closes and the slot's reused),
+ * so it can never need more than the pool's capacity.
+ */
+static __thread CONN_STRUCT **conn_dirty            = NULL;
+static __thread int         conn_dirty_count        = 0;
+
+static CONN_STRUCT *CONN_claim(int fd, RCTR_CALLBACK on_readable);
+static void CONN_on_login_deadline(void *context);
+static void CONN_finish_detach(CONN_STRUCT *conn);
+static void CONN_release(CONN_STRUCT *conn);
+static void CONN_flush(CONN_STRUCT *conn);
+static void CONN_flush_now(CONN_STRUCT *conn);
+static void CONN_submit_send(CONN_STRUCT *conn, BOOL hold_next);
+static void CONN_mark_dirty(CONN_STRUCT *conn);
+static void CONN_arm_recv(CONN_STRUCT *conn);
+static void CONN_on_recv(void *context, int result, uint32_t flags);
+static void CONN_on_sent(void *context, int result, uint32_t flags);
+static void CONN_on_closed(void *context, int result, uint32_t flags);
+static void CONN_flush_dirty(void *unused);
+static void CONN_on_writable(void *context);
+static void CONN_fail(CONN_STRUCT *conn);
+static int CONN_gather(CONN_STRUCT *conn, struct iovec *iov, int max, uint32_t *total);
+static void CONN_consume(CONN_STRUCT *conn, uint32_t bytes);
+static void CONN_discard(CONN_STRUCT *conn);
+static void CONN_drop_shared(CONN_STRUCT *conn);
+static void CONN_cleanup(void);
+/*! \} */
+
+/****************************************************************************************************************/
+/*! \brief Readies the module for use.  The reactor has to be up already.
+ */
+void CONN_init(void)
+{
+    if (conn_was_module_inited) return;
+
+    uint32_t capacity = server_config.max_players + MAX_PENDING_LOGINS;
+
+    // the pool only grows as far as the load takes it, but the dirty list has to be ready for the worst
+    conn_dirty = (CONN_STRUCT **)malloc(capacity * sizeof(CONN_STRUCT *));
+
+    if ((conn_dirty == NULL) || (!POOL_init(&conn_pool, sizeof(CONN_STRUCT), CONN_POOL_SLAB_SIZE, capacity)))
+    {
+        OH_SMEG("Couldn't allocate the connection pool.");
+        exit(1);
+    }
+
+    // everything anyone's sent during a trip around the loop goes out in one go at the end of it
+    RCTR_add_batch_hook(CONN_flush_dirty, NULL);
+
+    atexit(CONN_cleanup);
+    conn_was_module_inited = TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes ownership of a freshly-accepted socket, starts its login deadline and starts watching it.
+ * \param fd The socket; must already be non-blocking.
+ * \param on_readable What the reactor should call when the socket has data; gets the CONN_STRUCT as its context.
+ * \return The new connection, or NULL if the table was full or the reactor wouldn't take it (in which case the
+ *  caller still owns fd).
+ */
+CONN_STRUCT *CONN_open(int fd, RCTR_CALLBACK on_readable)
+{
+    CONN_STRUCT *conn;
+    int         no_delay = 1;
+
+    // we do our own coalescing, so Nagle would only ever hold back the last message of a flush
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+    conn = CONN_claim(fd, on_readable);
+
+    if (conn == NULL)
+        return NULL;
+
+    RCTR_start_timer(&conn->login_timer, server_config.login_deadline_ms, CONN_on_login_deadline, conn);
+    conn->state = CONN_STATE_AWAITING_LOGIN;
+
+    return conn;
+}
+
+/****************************************************************************************************************/
+/*! \brief Packs up a logged-in connection so another shard can take it over with CONN_adopt(), and frees up its
+ * slot here.  The socket stays open; it belongs to the handoff now.
+ * \param on_detached Called (with context) once handoff's ready to go.  With epoll, that's before this returns;
+ *  with io_uring, it's once the kernel's given back any receive or send it had going, and until then the
+ *  connection sits in CONN_STATE_DETACHING.
+ */
+void CONN_detach(CONN_STRUCT *conn, CONN_HANDOFF *handoff, RCTR_CALLBACK on_detached, void *context)
+{
+    conn->handoff           = handoff;
+    conn->on_detached       = on_detached;
+    conn->detach_context    = context;
+
+    if (RCTR_backend() == RCTR_BACKEND_URING)
+    {
+        // whatever's queued goes along with it rather than out from here
+        conn->state = CONN_STATE_DETACHING;
+
+        if (conn->rx_armed)
+            RCTR_cancel(&conn->recv_op);
+
+        if (conn->ops_in_flight == 0)
+            CONN_finish_detach(conn);
+
+        return;
+    }
+
+    if (!conn->tx_blocked)
+        CONN_flush(conn);
+
+    RCTR_unwatch(&conn->watch);
+    CONN_finish_detach(conn);
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes over a connection another shard packed up with CONN_detach().  Anything it had queued goes out at
+ * the end of this batch, ahead of whatever gets sent to it from here on.
+ * \note Unlike CONN_open(), there's no login deadline; the caller is expected to mark it CONN_logged_in() right
+ *  away.  Anything the client had already sent is still in the rx ring, and since the reactor won't say so, it's
+ *  up to the caller to go through it.
+ * \return The connection, or NULL if there wasn't room for it (in which case the caller still owns the socket).
+ */
+CONN_STRUCT *CONN_adopt(const CONN_HANDOFF *handoff, RCTR_CALLBACK on_readable)
+{
+    CONN_STRUCT *conn = CONN_claim(handoff->fd, on_readable);
+
+    if (conn == NULL)
+        return NULL;
+
+    conn->rx = handoff->rx;
+
+    if (handoff->tx_length > 0)
+    {
+        memcpy(conn->tx, handoff->tx, handoff->tx_length);
+        conn->tx_tail                   = handoff->tx_length;
+        server_stats.tx_bytes_queued    += handoff->tx_length;
+
+        CONN_mark_dirty(conn);
+    }
+
+    return conn;
+}
+
+/****************************************************************************************************************/
+/*! \brief Marks a connection as belonging to a logged-in player, which stops its login deadline.
+ */
+void CONN_logged_in(CONN_STRUCT *conn, PLAYER_STRUCT *ps)
+{
+    RCTR_stop_timer(&conn->login_timer);
+
+    conn->state     = CONN_STATE_LOGGED_IN;
+    conn->player    = ps;
+}
+
+/****************************************************************************************************************/
+/*! \brief Stops watching a connection, closes its socket, and frees up its slot (or, with io_uring, leaves it for
+ * CONN_on_closed() to free up once the kernel's done with it).  Does nothing to any player
+ * it belongs to; that's the active player manager's business.
+ * \note Anything still queued gets one last chance to go out first, so a parting MSGTYPE_FAILURE and the like
+ *  still reach the client - but only if the socket will take it without blocking.
+ */
+void CONN_close(CONN_STRUCT *conn)
+{
+    if (conn->state == CONN_STATE_FREE) return;
+
+    RCTR_stop_timer(&conn->login_timer);
+
+    if (RCTR_backend() == RCTR_BACKEND_URING)
+    {
+        if (conn->rx_armed)
+            RCTR_cancel(&conn->recv_op);
+
+        // the last of the queue goes out ahead of the close, unless there's a send still going (in which case
+        // the socket's most likely full anyway)
+        if ((!conn->tx_failed) && (conn->tx_inflight == 0) && (CONN_queued(conn) > 0))
+            CONN_submit_send(conn, TRUE);
+
+        RCTR_close(&conn->close_op, conn->fd);
+        conn->ops_in_flight++;
+    }
+    else
+    {
+        if (!conn->tx_blocked)
+            CONN_flush(conn);
+
+        RCTR_unwatch(&conn->watch);
+        close(conn->fd);
+    }
+
+    CONN_discard(conn);
+
+    conn->fd        = -1;
+    conn->player    = NULL;
+    conn->state     = CONN_STATE_FREE;
+
+    CONN_release(conn);
+}
+
+/****************************************************************************************************************/
+/*! \brief Queues a message for whoever's on the other end of a connection.  It actually goes out when the
+ * reactor gets to the end of the current batch of events, along with anything else queued for them by then.
+ * \return TRUE if it was queued, FALSE if it couldn't be (in which case it's lost).  A client that's stopped
+ *  reading long enough for CONN_TX_QUEUE_SIZE bytes to pile up behind a full socket buffer gets disconnected,
+ *  since there's no dropping part of the stream without garbling the framing.
+ */
+BOOL CONN_send(CONN_STRUCT *conn, const void *msg, uint16_t length)
+{
+    uint32_t    needed = FRAME_HEADER_SIZE + length;
+    uint32_t    start;
+    uint32_t    first;
+    char        header[FRAME_HEADER_SIZE];
+
+    if ((conn->state == CONN_STATE_FREE) || (conn->tx_failed))
+        return FALSE;
+
+    // a burst can fill the queue before the end of the batch comes around; see if the socket will take some now
+    if (((CONN_TX_QUEUE_SIZE - CONN_queued(conn)) < needed) && (!conn->tx_blocked))
+        CONN_flush_now(conn);
+
+    // (which may have found out the client's gone)
+    if (conn->tx_failed)
+        return FALSE;
+
+    if ((CONN_TX_QUEUE_SIZE - CONN_queued(conn)) < needed)
+    {
+        DUH_WHERE_AM_I("connection %d isn't keeping up with its output, dropping it.", conn->id);
+        server_stats.tx_overflows++;
+        CONN_fail(conn);
+        return FALSE;
+    }
+
+    header[0] = (length >> 8) & 0xff;
+    header[1] = (length     ) & 0xff;
+
+    // header first, then the message; either may wrap around the end of the queue
+    start = conn->tx_tail & CONN_TX_MASK;
+    first = CONN_TX_QUEUE_SIZE - start;
+
+    if (first >= needed)
+    {
+        memcpy(&conn->tx[start], header, FRAME_HEADER_SIZE);
+        memcpy(&conn->tx[start + FRAME_HEADER_SIZE], msg, length);
+    }
+    else
+    {
+        uint32_t index;
+
+        for (index = 0; index < FRAME_HEADER_SIZE; index++)
+            conn->tx[(conn->tx_tail + index) & CONN_TX_MASK] = header[index];
+
+        start = (conn->tx_tail + FRAME_HEADER_SIZE) & CONN_TX_MASK;
+        first = CONN_TX_QUEUE_SIZE - start;
+
+        if (first > length) first = length;
+
+        memcpy(&conn->tx[start], msg, first);
+        memcpy(&conn->tx[0], (const char *)msg + first, length - first);
+    }
+
+    conn->tx_tail += needed;
+
+    server_stats.messages_queued++;
+    server_stats.tx_bytes_queued += needed;
+
+    if (CONN_queued(conn) > server_stats.tx_queue_high_water)
+        server_stats.tx_queue_high_water = CONN_queued(conn);
+
+    // if the socket's full, the reactor will tell us when to try again; no point trying before then
+    if (!conn->tx_blocked)
+        CONN_mark_dirty(conn);
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Queues a message that's going to lots of connections at once, made with FRAME_share().  Rather than
+ * being copied, the connection takes a reference to it and sends it straight from there, in its place among
+ * anything else that's queued.  Otherwise, it's just like CONN_send(), and counts the same against the queue.
+ * \return TRUE if it was queued, FALSE if it couldn't be (in which case it's lost).
+ */
+BOOL CONN_send_shared(CONN_STRUCT *conn, FRAME_SHARED *frame)
+{
+    CONN_TX_SHARED *entry;
+
+    if ((conn->state == CONN_STATE_FREE) || (conn->tx_failed))
+        return FALSE;
+
+    // (a client that's this far behind is probably about to overflow anyway)
+    if ((conn->tx_shared_tail - conn->tx_shared_head) == CONN_TX_SHARED_SLOTS)
+        return CONN_send(conn, &frame->data[FRAME_HEADER_SIZE], frame->length - FRAME_HEADER_SIZE);
+
+    if (((CONN_TX_QUEUE_SIZE - CONN_queued(conn)) < frame->length) && (!conn->tx_blocked))
+        CONN_flush_now(conn);
+
+    if (conn->tx_failed)
+        return FALSE;
+
+    if ((CONN_TX_QUEUE_SIZE - CONN_queued(conn)) < frame->length)
+    {
+        DUH_WHERE_AM_I("connection %d isn't keeping up with its output, dropping it.", conn->id);
+        server_stats.tx_overflows++;
+        CONN_fail(conn);
+        return FALSE;
+    }
+
+    FRAME_hold(frame);
+
+    entry           = &conn->tx_shared[conn->tx_shared_tail & CONN_TX_SHARED_MASK];
+    entry->frame    = frame;
+    entry->at       = conn->tx_tail;
+
+    conn->tx_shared_tail++;
+    conn->tx_shared_bytes += frame->length;
+
+    server_stats.messages_queued++;
+    server_stats.tx_bytes_queued += frame->length;
+    server_stats.tx_bytes_shared += frame->length;
+
+    if (CONN_queued(conn) > server_stats.tx_queue_high_water)
+        server_stats.tx_queue_high_water = CONN_queued(conn);
+
+    if (!conn->tx_blocked)
+        CONN_mark_dirty(conn);
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Brings in whatever the client's sent since last time, into conn->rx.  Call it until it says there's
+ * nothing more, the way you would read() on a non-blocking socket.
+ * \return How many bytes came in, 0 if the client's hung up, or -1 with errno set (EAGAIN if it's just that
+ *  there's nothing more for now).
+ */
+ssize_t CONN_fill(CONN_STRUCT *conn)
+{
+    ssize_t received;
+
+    if (RCTR_backend() == RCTR_BACKEND_EPOLL)
+    {
+        server_stats.rx_syscalls++;
+        return FRAME_fill(&conn->rx, conn->fd);
+    }
+
+    // with io_uring, it's already in the ring by the time anyone asks; just pass on how it went
+    received        = conn->rx_result;
+    errno           = conn->rx_errno;
+    conn->rx_result = -1;
+    conn->rx_errno  = EAGAIN;
+
+    return received;
+}
+
+/****************************************************************************************************************/
+/*! \brief Whether a connection is still open and still ours, so it's worth acting on what it sends.
+ */
+BOOL CONN_is_active(const CONN_STRUCT *conn)
+{
+    return (conn->state != CONN_STATE_FREE) && (conn->state != CONN_STATE_DETACHING);
+}
+
+/****************************************************************************************************************/
+/*! \brief How many bytes a connection has waiting to go out.
+ */
+uint32_t CONN_queued(const CONN_STRUCT *conn)
+{
+    return (conn->tx_tail - conn->tx_head) + conn->tx_shared_bytes;
+}
+
+/****************************************************************************************************************/
+/*! \brief Looks up a connection by its id.
+ * \return The connection, or NULL if there's no such connection (any more).
+ */
+CONN_STRUCT *CONN_get(POOL_HANDLE id)
+{
+    return (CONN_STRUCT *)POOL_get(&conn_pool, id);
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes a connection out of the pool for a socket, readies it and starts watching the socket.
+ * \return The connection, in CONN_STATE_ACCEPTED, or NULL if the pool's at capacity or the reactor wouldn't take it.
+ */
+static CONN_STRUCT *CONN_claim(int fd, RCTR_CALLBACK on_readable)
+{
+    CONN_STRUCT *conn;
+    POOL_HANDLE handle;
+
+    conn = (CONN_STRUCT *)POOL_alloc(&conn_pool, &handle);
+
+    // every slot's taken
+    if (conn == NULL)
+        return NULL;
+
+    // (tx_dirty is the one thing that carries over from the slot's last user; see conn_dirty)
+    conn->id                    = handle;
+    conn->watch.fd              = -1;
+    conn->recv_op.on_complete   = CONN_on_recv;
+    conn->recv_op.context       = conn;
+    conn->send_op.on_complete   = CONN_on_sent;
+    conn->send_op.context       = conn;
+    conn->close_op.on_complete  = CONN_on_closed;
+    conn->close_op.context      = conn;
+
+    conn->fd                = fd;
+    conn->state             = CONN_STATE_ACCEPTED;
+    conn->player            = NULL;
+    FRAME_reset(&conn->rx);
+    conn->tx_head           = 0;
+    conn->tx_tail           = 0;
+    conn->tx_shared_head    = 0;
+    conn->tx_shared_tail    = 0;
+    conn->tx_shared_sent    = 0;
+    conn->tx_shared_bytes   = 0;
+    conn->tx_blocked        = FALSE;
+    conn->tx_failed         = FALSE;
+    conn->tx_inflight       = 0;
+    conn->rx_result         = -1;
+    conn->rx_errno          = EAGAIN;
+
+    if (RCTR_backend() == RCTR_BACKEND_URING)
+    {
+        conn->on_readable = on_readable;
+        CONN_arm_recv(conn);
+
+        return conn;
+    }
+
+    if (!RCTR_watch(&conn->watch, fd, on_readable, CONN_on_writable, conn))
+    {
+        conn->fd    = -1;
+        conn->state = CONN_STATE_FREE;
+        CONN_release(conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor when a connection's had as long as it gets to log in, and hasn't.
+ */
+static void CONN_on_login_deadline(void *context)
+{
+    CONN_STRUCT *conn = (CONN_STRUCT *)context;
+
+    DUH_WHERE_AM_I(" --- connection %d never logged in, dropping it.", conn->id);
+    CONN_close(conn);
+}
+
+/****************************************************************************************************************/
+/*! \brief Packs a detaching connection up into its handoff, frees its slot, and lets whoever asked know.
+ */
+static void CONN_finish_detach(CONN_STRUCT *conn)
+{
+    CONN_HANDOFF    *handoff = (CONN_HANDOFF *)conn->handoff;
+    struct iovec    iov[CONN_TX_IOV_MAX];
+    uint32_t        total;
+    int             pieces;
+    int             index;
+
+    handoff->fd         = conn->fd;
+    handoff->rx         = conn->rx;
+    handoff->tx_length  = 0;
+
+    // the same as sending it, only into the handoff; shared frames can't go with it, so they get copied now
+    while (CONN_queued(conn) > 0)
+    {
+        pieces = CONN_gather(conn, iov, CONN_TX_IOV_MAX, &total);
+
+        for (index = 0; index < pieces; index++)
+        {
+            memcpy(&handoff->tx[handoff->tx_length], iov[index].iov_base, iov[index].iov_len);
+            handoff->tx_length += iov[index].iov_len;
+        }
+
+        CONN_consume(conn, total);
+    }
+
+    conn->fd        = -1;
+    conn->player    = NULL;
+    conn->state     = CONN_STATE_FREE;
+
+    CONN_release(conn);
+
+    conn->on_detached(conn->detach_context);
+}
+
+/****************************************************************************************************************/
+/*! \brief Gives a closed connection's slot back to the pool, once the kernel's finished with everything it was
+ * doing for it.  Safe to call more than once.
+ * \note The slab it's in stays put, so the connection's still there to look at afterwards; it just won't be
+ *  found by CONN_get() any more, and the next CONN_claim() may well hand it out again.
+ */
+static void CONN_release(CONN_STRUCT *conn)
+{
+    if ((conn->state == CONN_STATE_FREE) && (conn->ops_in_flight == 0))
+        POOL_free(&conn_pool, conn->id);
+}
+
+/****************************************************************************************************************/
+/*! \brief Writes as much of a connection's queue as the socket will take, in as few calls as possible.
+ * \note With io_uring, that means handing the kernel a send for all of it, unless there's one going already;
+ *  whatever's queued behind that goes out once it's done.
+ */
+static void CONN_flush(CONN_STRUCT *conn)
+{
+    struct iovec    iov[CONN_TX_IOV_MAX];
+    struct msghdr   out;
+    uint32_t        total;
+    ssize_t         sent;
+
+    if (RCTR_backend() == RCTR_BACKEND_URING)
+    {
+        if ((conn->state != CONN_STATE_DETACHING) && (conn->tx_inflight == 0) && (CONN_queued(conn) > 0))
+            CONN_submit_send(conn, FALSE);
+
+        return;
+    }
+
+    bzero(&out, sizeof(out));
+    out.msg_iov = iov;
+
+    while (CONN_queued(conn) > 0)
+    {
+        // the ring may wrap around the end, and there may be shared frames in amongst it; it all goes at once
+        out.msg_iovlen = CONN_gather(conn, iov, CONN_TX_IOV_MAX, &total);
+
+        sent = sendmsg(conn->fd, &out, MSG_DONTWAIT | MSG_NOSIGNAL);
+        server_stats.tx_syscalls++;
+
+        if (sent == -1)
+        {
+            if (errno == EINTR) continue;
+
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            {
+                conn->tx_blocked = TRUE;
+                server_stats.tx_stalls++;
+            }
+            else
+            {
+                // they're gone; reading will find that out and clean up
+                CONN_fail(conn);
+            }
+
+            return;
+        }
+
+        CONN_consume(conn, sent);
+
+        // a short write means the socket buffer's full, and trying again now would just get EAGAIN
+        if ((uint32_t)sent < total)
+        {
+            conn->tx_blocked = TRUE;
+            server_stats.tx_stalls++;
+            return;
+        }
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Tries to make room in a connection's queue right now, rather than at the end of the batch.
+ */
+static void CONN_flush_now(CONN_STRUCT *conn)
+{
+    if ((RCTR_backend() == RCTR_BACKEND_EPOLL) || (conn->state == CONN_STATE_DETACHING))
+    {
+        CONN_flush(conn);
+        return;
+    }
+
+    // the send for the front of the queue may already be done without us having heard yet
+    if (conn->tx_inflight > 0)
+        RCTR_reap(&conn->send_op);
+
+    if ((!conn->tx_failed) && (conn->tx_inflight == 0) && (CONN_queued(conn) > 0))
+    {
+        CONN_submit_send(conn, FALSE);
+        RCTR_reap(&conn->send_op);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief With io_uring, hands the kernel a send for everything in a connection's queue.
+ * \param hold_next Whether whatever's queued after it (a close, say) should wait for it.
+ */
+static void CONN_submit_send(CONN_STRUCT *conn, BOOL hold_next)
+{
+    uint32_t total;
+
+    // same as CONN_flush(), except it all has to stay put until the kernel's done with it (which the shared
+    // frames will, since nothing lets go of them until CONN_on_sent())
+    bzero(&conn->tx_msg, sizeof(conn->tx_msg));
+    conn->tx_msg.msg_iov    = conn->tx_iov;
+    conn->tx_msg.msg_iovlen = CONN_gather(conn, conn->tx_iov, CONN_TX_IOV_MAX, &total);
+
+    RCTR_sendmsg(&conn->send_op, conn->fd, &conn->tx_msg, hold_next);
+
+    conn->tx_inflight = total;
+    conn->ops_in_flight++;
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts a connection on the list of ones to flush at the end of the batch, if it isn't already.
+ */
+static void CONN_mark_dirty(CONN_STRUCT *conn)
+{
+    if (conn->tx_dirty) return;
+
+    conn->tx_dirty = TRUE;
+    conn_dirty[conn_dirty_count++] = conn;
+}
+
+/****************************************************************************************************************/
+/*! \brief With io_uring, starts the receive that keeps a connection's rx ring topped up.
+ */
+static void CONN_arm_recv(CONN_STRUCT *conn)
+{
+    RCTR_recv(&conn->recv_op, conn->fd);
+
+    conn->rx_armed = TRUE;
+    conn->ops_in_flight++;
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor when something's come in on a connection (io_uring only).  It goes straight into
+ * the rx ring, and the connection's owner gets told about it just as if epoll had said it was readable.
+ */
+static void CONN_on_recv(void *context, int result, uint32_t flags)
+{
+    CONN_STRUCT *conn       = (CONN_STRUCT *)context;
+    BOOL        overflowed  = FALSE;
+
+    if (!(flags & RCTR_MORE_TO_COME))
+    {
+        conn->rx_armed = FALSE;
+        conn->ops_in_flight--;
+    }
+
+    if ((result > 0) && (conn->state != CONN_STATE_FREE))
+    {
+        // only a client that's flooding us can get this far ahead of us
+        if (!FRAME_append(&conn->rx, RCTR_received(flags), result))
+            overflowed = TRUE;
+        else if (conn->rx_result > 0)
+            conn->rx_result += result;
+        else
+            conn->rx_result = result;
+    }
+
+    RCTR_release(flags);
+
+    // closed?  whatever came in, came in too late
+    if (conn->state == CONN_STATE_FREE)
+    {
+        CONN_release(conn);
+        return;
+    }
+
+    // on its way elsewhere?  whatever came in goes along with it
+    if (conn->state == CONN_STATE_DETACHING)
+    {
+        if (conn->ops_in_flight == 0)
+            CONN_finish_detach(conn);
+
+        return;
+    }
+
+    if (overflowed)
+    {
+        conn->rx_result = -1;
+        conn->rx_errno  = ENOBUFS;
+    }
+    else if (result == 0)
+    {
+        conn->rx_result = 0;
+    }
+    else if ((result < 0) && (result != -ENOBUFS) && (result != -ECANCELED))
+    {
+        // (-ENOBUFS here just means the reactor ran short of buffers, and nothing's been lost)
+        conn->rx_result = -1;
+        conn->rx_errno  = -result;
+    }
+
+    if ((conn->rx_result != -1) || (conn->rx_errno != EAGAIN))
+        conn->on_readable(conn);
+
+    // the kernel can stop a multishot receive whenever it likes; pick it back up if we're still interested
+    if (CONN_is_active(conn) && (!conn->rx_armed) && (result != 0))
+        CONN_arm_recv(conn);
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor when a send on a connection has finished (io_uring only).
+ */
+static void CONN_on_sent(void *context, int result, uint32_t flags)
+{
+    CONN_STRUCT *conn       = (CONN_STRUCT *)context;
+    uint32_t    expected    = conn->tx_inflight;
+
+    conn->tx_inflight = 0;
+    conn->ops_in_flight--;
+
+    // closed (or given up on) while it was going out?  then the queue's been thrown away already, bar the shared
+    // frames the kernel was still reading from
+    if ((conn->state == CONN_STATE_FREE) || (conn->tx_failed))
+    {
+        CONN_drop_shared(conn);
+        CONN_release(conn);
+        return;
+    }
+
+    if (result < 0)
+    {
+        // they're gone; reading will find that out and clean up
+        CONN_fail(conn);
+    }
+    else
+    {
+        CONN_consume(conn, result);
+
+        if ((uint32_t)result < expected)
+            server_stats.tx_stalls++;
+    }
+
+    if (conn->state == CONN_STATE_DETACHING)
+    {
+        if (conn->ops_in_flight == 0)
+            CONN_finish_detach(conn);
+
+        return;
+    }
+
+    // more got queued while it was going out (or it only went part way); it can go at the end of the batch
+    if ((!conn->tx_failed) && (CONN_queued(conn) > 0))
+        CONN_mark_dirty(conn);
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor when a connection's socket has been closed (io_uring only).
+ */
+static void CONN_on_closed(void *context, int result, uint32_t flags)
+{
+    CONN_STRUCT *conn = (CONN_STRUCT *)context;
+
+    conn->ops_in_flight--;
+    CONN_release(conn);
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor at the end of every batch of events to send out everything queued during it.
+ */
+static void CONN_flush_dirty(void *unused)
+{
+    int index;
+
+    for (index = 0; index < conn_dirty_count; index++)
+    {
+        CONN_STRUCT *conn = conn_dirty[index];
+
+        conn->tx_dirty = FALSE;
+
+        // closed since it was queued to?  (or reopened, in which case it's fine to flush anyway)
+        if ((conn->state == CONN_STATE_FREE) || (conn->tx_blocked))
+            continue;
+
+        CONN_flush(conn);
+    }
+
+    conn_dirty_count = 0;
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor when a connection whose socket had filled up can take more.
+ */
+static void CONN_on_writable(void *context)
+{
+    CONN_STRUCT *conn = (CONN_STRUCT *)context;
+
+    if (!conn->tx_blocked) return;
+
+    conn->tx_blocked = FALSE;
+    CONN_flush(conn);
+}
+
+/****************************************************************************************************************/
+/*! \brief Gives up on sending anything more to a connection.  Rather than pulling the rug out from under whoever's
+ * in the middle of talking to it, this shuts the socket down, so the reactor reports it as hung up and it gets
+ * cleaned up the usual way.
+ */
+static void CONN_fail(CONN_STRUCT *conn)
+{
+    CONN_discard(conn);
+
+    conn->tx_failed = TRUE;
+
+    shutdown(conn->fd, SHUT_RDWR);
+}
+
+/****************************************************************************************************************/
+/*! \brief Works out what to hand the kernel to send the front of a connection's queue: runs of the tx ring, with
+ * any shared frames in between, in order.
+ * \param total Set to how many bytes that comes to.
+ * \return How many of iov it filled in (at most max).
+ */
+static int CONN_gather(CONN_STRUCT *conn, struct iovec *iov, int max, uint32_t *total)
+{
+    uint32_t    position    = conn->tx_head;
+    uint32_t    slot        = conn->tx_shared_head;
+    uint32_t    skip        = conn->tx_shared_sent;
+    FRAME_SHARED *frame;
+    uint32_t    limit;
+    uint32_t    length;
+    int         pieces      = 0;
+
+    *total = 0;
+
+    while (pieces < max)
+    {
+        limit = (slot != conn->tx_shared_tail) ? conn->tx_shared[slot & CONN_TX_SHARED_MASK].at : conn->tx_tail;
+
+        // the ring up to the next shared frame, or the end (in two goes, if it wraps)
+        if (position != limit)
+        {
+            length = CONN_TX_QUEUE_SIZE - (position & CONN_TX_MASK);
+
+            if (length > limit - position) length = limit - position;
+
+            iov[pieces].iov_base    = &conn->tx[position & CONN_TX_MASK];
+            iov[pieces].iov_len     = length;
+            pieces++;
+
+            position    += length;
+            *total      += length;
+            continue;
+        }
+
+        if (slot == conn->tx_shared_tail)
+            break;
+
+        frame = conn->tx_shared[slot & CONN_TX_SHARED_MASK].frame;
+
+        iov[pieces].iov_base    = &frame->data[skip];
+        iov[pieces].iov_len     = frame->length - skip;
+        pieces++;
+
+        *total  += frame->length - skip;
+        skip    = 0;
+        slot++;
+    }
+
+    return pieces;
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes what's been sent off the front of a connection's queue, letting go of any shared frames that have
+ * gone out in full.
+ */
+static void CONN_consume(CONN_STRUCT *conn, uint32_t bytes)
+{
+    CONN_TX_SHARED  *entry;
+    uint32_t        length;
+
+    server_stats.tx_bytes_queued -= bytes;
+
+    while (bytes > 0)
+    {
+        if (conn->tx_shared_head == conn->tx_shared_tail)
+        {
+            conn->tx_head += bytes;
+            return;
+        }
+
+        entry = &conn->tx_shared[conn->tx_shared_head & CONN_TX_SHARED_MASK];
+
+        // what's in the ring ahead of it goes first
+        if (conn->tx_head != entry->at)
+        {
+            length = entry->at - conn->tx_head;
+
+            if (length > bytes) length = bytes;
+
+            conn->tx_head   += length;
+            bytes           -= length;
+            continue;
+        }
+
+        length = entry->frame->length - conn->tx_shared_sent;
+
+        if (length > bytes) length = bytes;
+
+        conn->tx_shared_sent    += length;
+        conn->tx_shared_bytes   -= length;
+        bytes                   -= length;
+
+        if (conn->tx_shared_sent == entry->frame->length)
+        {
+            FRAME_release(entry->frame);
+
+            conn->tx_shared_head++;
+            conn->tx_shared_sent = 0;
+        }
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Throws away everything queued for a connection.  Shared frames are let go of too, unless there's a send
+ * in flight that might still be reading from them; CONN_on_sent() lets go of them once it's done.
+ */
+static void CONN_discard(CONN_STRUCT *conn)
+{
+    server_stats.tx_bytes_queued -= CONN_queued(conn);
+
+    conn->tx_head           = conn->tx_tail;
+    conn->tx_shared_bytes   = 0;
+
+    if (conn->tx_inflight == 0)
+        CONN_drop_shared(conn);
+}
+
+/****************************************************************************************************************/
+/*! \brief Lets go of every shared frame a connection has queued.  Only for once the queue's been thrown away.
+ */
+static void CONN_drop_shared(CONN_STRUCT *conn)
+{
+    while (conn->tx_shared_head != conn->tx_shared_tail)
+    {
+        FRAME_release(conn->tx_shared[conn->tx_shared_head & CONN_TX_SHARED_MASK].frame);
+        conn->tx_shared_head++;
+    }
+
+    conn->tx_shared_sent = 0;
+}
+
+/****************************************************************************************************************/
+/*! \brief Closes anything that's still open.  Designed to be called automagically on exit.
+ */
+static void CONN_cleanup(void)
+{
+    CONN_STRUCT *conn;
+    uint32_t    cursor = 0;
+
+    if (!conn_was_module_inited) return;
+
+    while ((conn = (CONN_STRUCT *)POOL_next(&conn_pool, &cursor)) != NULL)
+    {
+        if (conn->state != CONN_STATE_FREE)
+            close(conn->fd);
+
+        // every shard registers this, but they all run on the thread that's exiting
+        conn->state = CONN_STATE_FREE;
+    }
+}
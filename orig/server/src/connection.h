@@ -0,0 +1,154 @@
+/*! \file connection.h
+ * \brief Keeps track of every socket a client has connected on, from the moment it's accepted until it's closed,
+ * including ones that haven't finished logging in yet.
+ */
+#ifndef         CONNECTION_H
+    #define     CONNECTION_H
+
+    #include    "tictactwo-common.h"
+    #include    "server-common.h"
+    #include    "player_db.h"
+    #include    "reactor.h"
+    #include    "framing.h"
+    #include    "pool.h"
+    #include    <sys/uio.h>
+
+    /*! \brief How many connections can be sitting in the login handshake at once, on top of the ones that
+     * belong to logged-in players (of which there can be server_config.max_players).
+     */
+    #define     MAX_PENDING_LOGINS          1024
+
+    /*! \brief How much outgoing data a connection can have queued up before we decide the client's not keeping up
+     * and hang up on it.  Has to be a power of two.
+     */
+    #define     CONN_TX_QUEUE_SIZE          32768
+
+    /*! \brief How many shared frames (see CONN_send_shared()) a connection can have queued at once; past that,
+     * they get copied in like anything else.  Has to be a power of two.
+     */
+    #define     CONN_TX_SHARED_SLOTS        64
+
+    /*! \brief The most pieces one send gets put together from (every shared frame's one, and so's every run of the
+     * tx ring between them); whatever's past that waits for the next send.
+     */
+    #define     CONN_TX_IOV_MAX             64
+
+    /*! \defgroup connection_states
+     * \brief Where a connection is in its lifecycle.
+     * \{
+     */
+    #define     CONN_STATE_FREE             0
+    /*! \brief Just accepted; not being watched yet. */
+    #define     CONN_STATE_ACCEPTED         1
+    /*! \brief Watched, but hasn't sent a complete MSGTYPE_LOGIN yet; gets dropped if its login_timer goes off. */
+    #define     CONN_STATE_AWAITING_LOGIN   2
+    /*! \brief Belongs to an active player. */
+    #define     CONN_STATE_LOGGED_IN        3
+    /*! \brief On its way to another shard; waiting on the kernel to finish with it before it can go.  Nothing it
+     * sends gets acted on here.
+     */
+    #define     CONN_STATE_DETACHING        4
+    /*! \} */
+
+    /*! \brief A shared frame in a connection's output, and where it goes in among everything else.
+     */
+    typedef struct
+    {
+        FRAME_SHARED    *frame;
+        /*! \brief The value tx_tail had when it was queued; it goes out after the tx ring's got that far. */
+        uint32_t        at;
+    } CONN_TX_SHARED;
+
+    /*! \brief Represents one client socket.
+     */
+    typedef struct
+    {
+        int             fd;
+        uint8_t         state;
+        /*! \brief This connection's handle in its shard's connection pool; once it's closed, CONN_get() won't find
+         * it any more, even after its slot's been reused.
+         */
+        POOL_HANDLE     id;
+        /*! \brief Runs while the connection's awaiting login; if it goes off, the connection gets dropped. */
+        RCTR_TIMER      login_timer;
+        /*! \brief Whatever's come in off the socket that hasn't been acted on yet. */
+        FRAME_RING      rx;
+        /*! \brief Framed messages waiting to go out; gets flushed once per trip around the reactor loop.
+         * \note Like the rx ring, tx_head and tx_tail run freely, so (tx_tail - tx_head) is how much is queued.
+         */
+        char            tx[CONN_TX_QUEUE_SIZE];
+        uint32_t        tx_head;
+        uint32_t        tx_tail;
+        /*! \brief Shared frames queued in amongst what's in the tx ring, oldest first; these run freely too.  Each
+         * one holds a reference to its frame until it's all gone out.
+         */
+        CONN_TX_SHARED  tx_shared[CONN_TX_SHARED_SLOTS];
+        uint32_t        tx_shared_head;
+        uint32_t        tx_shared_tail;
+        /*! \brief How much of the oldest shared frame has gone out already. */
+        uint32_t        tx_shared_sent;
+        /*! \brief How many bytes of shared frames are left to go out. */
+        uint32_t        tx_shared_bytes;
+        /*! \brief Set while the connection is on the list of ones with output to flush. */
+        BOOL            tx_dirty;
+        /*! \brief Set when the socket buffer filled up; we're waiting on the reactor to say it's writable again. */
+        BOOL            tx_blocked;
+        /*! \brief Set once the queue's overflowed or the socket's errored; anything else sent is thrown away. */
+        BOOL            tx_failed;
+        /*! \brief The player this connection belongs to, once they've logged in. */
+        PLAYER_STRUCT   *player;
+        RCTR_WATCH      watch;
+
+        // with io_uring, the reactor does the reading and writing, and these keep track of it
+        /*! \brief What to call when something's come in (with epoll, the watch takes care of it). */
+        RCTR_CALLBACK   on_readable;
+        RCTR_OP         recv_op;
+        RCTR_OP         send_op;
+        RCTR_OP         close_op;
+        /*! \brief Operations the kernel hasn't finished with; the slot doesn't go back to the pool until it has. */
+        int             ops_in_flight;
+        /*! \brief Set while the multishot receive is running. */
+        BOOL            rx_armed;
+        /*! \brief What the receives since CONN_fill() was last called add up to: bytes, 0 for hung up, or -1 with
+         * rx_errno set.
+         */
+        ssize_t         rx_result;
+        int             rx_errno;
+        /*! \brief How much of the queue the send in flight covers; 0 if there isn't one. */
+        uint32_t        tx_inflight;
+        struct iovec    tx_iov[CONN_TX_IOV_MAX];
+        struct msghdr   tx_msg;
+        /*! \brief Where a detaching connection gets packed up to, and who to tell once it has; see CONN_detach(). */
+        void            *handoff;
+        RCTR_CALLBACK   on_detached;
+        void            *detach_context;
+    } CONN_STRUCT;
+
+    /*! \brief Everything needed to carry a logged-in connection from one shard to another; see CONN_detach().
+     */
+    typedef struct
+    {
+        int             fd;
+        /*! \brief Whatever the client's sent that hasn't been acted on yet. */
+        FRAME_RING      rx;
+        /*! \brief Whatever was queued for the client that the socket hadn't taken yet, straightened out (shared
+         * frames and all).
+         */
+        uint32_t        tx_length;
+        char            tx[CONN_TX_QUEUE_SIZE];
+    } CONN_HANDOFF;
+
+    void            CONN_init(void);
+    CONN_STRUCT     *CONN_open(int fd, RCTR_CALLBACK on_readable);
+    void            CONN_detach(CONN_STRUCT *conn, CONN_HANDOFF *handoff, RCTR_CALLBACK on_detached, void *context);
+    CONN_STRUCT     *CONN_adopt(const CONN_HANDOFF *handoff, RCTR_CALLBACK on_readable);
+    void            CONN_logged_in(CONN_STRUCT *conn, PLAYER_STRUCT *ps);
+    void            CONN_close(CONN_STRUCT *conn);
+    ssize_t         CONN_fill(CONN_STRUCT *conn);
+    BOOL            CONN_is_active(const CONN_STRUCT *conn);
+    BOOL            CONN_send(CONN_STRUCT *conn, const void *msg, uint16_t length);
+    BOOL            CONN_send_shared(CONN_STRUCT *conn, FRAME_SHARED *frame);
+    CONN_STRUCT     *CONN_get(POOL_HANDLE id);
+    uint32_t        CONN_queued(const CONN_STRUCT *conn);
+
+#endif
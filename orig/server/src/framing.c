@@ -0,0 +1,211 @@
+/*! \file framing.c
+ * \brief Message framing for the gameplay protocol; see framing.h.
+ */
+#include    "framing.h"
+#include    <sys/uio.h>
+#include    <errno.h>
+
+#define     FRAME_RING_MASK     (FRAME_RX_RING_SIZE - 1)
+
+/*! \defgroup framing_private
+ * \brief Functions private to the framing module.
+ * \{
+ */
+static uint16_t FRAME_read_header(const FRAME_RING *ring);
+/*! \} */
+
+/****************************************************************************************************************/
+/*! \brief Empties a ring out, ready for a new connection.
+ */
+void FRAME_reset(FRAME_RING *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+/****************************************************************************************************************/
+/*! \brief Reads as much as will fit from a socket into a ring.
+ * \return How many bytes were read, 0 if the other end hung up, or -1 (with errno set) if nothing could be
+ *  read - EAGAIN just means we've caught up.
+ */
+ssize_t FRAME_fill(FRAME_RING *ring, int fd)
+{
+    struct iovec    iov[2];
+    uint32_t        space   = FRAME_RX_RING_SIZE - (ring->tail - ring->head);
+    uint32_t        start   = ring->tail & FRAME_RING_MASK;
+    uint32_t        first   = FRAME_RX_RING_SIZE - start;
+    ssize_t         received;
+
+    if (space == 0)
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    if (first > space) first = space;
+
+    // the free space may wrap around the end, so read into both halves at once
+    iov[0].iov_base = &ring->data[start];
+    iov[0].iov_len  = first;
+    iov[1].iov_base = &ring->data[0];
+    iov[1].iov_len  = space - first;
+
+    received = readv(fd, iov, (iov[1].iov_len > 0) ? 2 : 1);
+
+    if (received > 0)
+        ring->tail += received;
+
+    return received;
+}
+
+/****************************************************************************************************************/
+/*! \brief Adds data that's already been received some other way (with io_uring, say) to the ring.
+ * \return TRUE if it all fit, FALSE (having added none of it) if it didn't.
+ */
+BOOL FRAME_append(FRAME_RING *ring, const char *data, uint32_t length)
+{
+    uint32_t    space   = FRAME_RX_RING_SIZE - (ring->tail - ring->head);
+    uint32_t    start   = ring->tail & FRAME_RING_MASK;
+    uint32_t    first   = FRAME_RX_RING_SIZE - start;
+
+    if (length > space)
+        return FALSE;
+
+    if (first > length) first = length;
+
+    memcpy(&ring->data[start], data, first);
+    memcpy(&ring->data[0], data + first, length - first);
+
+    ring->tail += length;
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Looks at the next complete message in a ring without taking it out.
+ * \param msg Gets pointed at the message; it stays valid until the next FRAME_pop() or FRAME_fill().
+ * \return The length of the message, 0 if there isn't a complete one buffered yet, or -1 if the client's
+ *  sending us garbage.
+ */
+int FRAME_peek(FRAME_RING *ring, const char **msg)
+{
+    uint32_t    buffered = ring->tail - ring->head;
+    uint16_t    length;
+    uint32_t    start;
+
+    if (buffered < FRAME_HEADER_SIZE)
+        return 0;
+
+    length = FRAME_read_header(ring);
+
+    if ((length == 0) || (length > FRAME_MAX_INBOUND_SIZE))
+        return -1;
+
+    if (buffered < (uint32_t)(FRAME_HEADER_SIZE + length))
+        return 0;
+
+    start = (ring->head + FRAME_HEADER_SIZE) & FRAME_RING_MASK;
+
+    if ((start + length) <= FRAME_RX_RING_SIZE)
+    {
+        // the usual case - it's all in one piece
+        *msg = &ring->data[start];
+    }
+    else
+    {
+        // it runs off the end and back around to the start
+        uint32_t first = FRAME_RX_RING_SIZE - start;
+
+        memcpy(ring->bounce, &ring->data[start], first);
+        memcpy(&ring->bounce[first], &ring->data[0], length - first);
+        *msg = ring->bounce;
+    }
+
+    return length;
+}
+
+/****************************************************************************************************************/
+/*! \brief Throws away the message FRAME_peek() last returned.
+ */
+void FRAME_pop(FRAME_RING *ring)
+{
+    if ((ring->tail - ring->head) < FRAME_HEADER_SIZE)
+        return;
+
+    ring->head += FRAME_HEADER_SIZE + FRAME_read_header(ring);
+}
+
+/****************************************************************************************************************/
+/*! \brief Frames a message and sends it.
+ * \return TRUE if the whole thing went out, FALSE otherwise.
+ */
+BOOL FRAME_write(int fd, const void *msg, uint16_t length)
+{
+    unsigned char   header[FRAME_HEADER_SIZE];
+    struct iovec    iov[2];
+    struct msghdr   out;
+
+    header[0] = (length >> 8) & 0xff;
+    header[1] = (length     ) & 0xff;
+
+    iov[0].iov_base = header;
+    iov[0].iov_len  = FRAME_HEADER_SIZE;
+    iov[1].iov_base = (void *)msg;
+    iov[1].iov_len  = length;
+
+    bzero(&out, sizeof(out));
+    out.msg_iov     = iov;
+    out.msg_iovlen  = 2;
+
+    return (sendmsg(fd, &out, MSG_DONTWAIT | MSG_NOSIGNAL) == (FRAME_HEADER_SIZE + length));
+}
+
+/****************************************************************************************************************/
+/*! \brief Frames a message once, for sending to everyone who needs it with CONN_send_shared().
+ * \return The frame, which the caller holds the one reference to (let go of it with FRAME_release() once it's
+ *  been queued everywhere), or NULL if we're out of memory.
+ */
+FRAME_SHARED *FRAME_share(const void *msg, uint16_t length)
+{
+    FRAME_SHARED *frame = (FRAME_SHARED *)malloc(sizeof(FRAME_SHARED) + FRAME_HEADER_SIZE + length);
+
+    if (frame == NULL)
+    {
+        OH_SMEG("Out of memory framing a %u byte message.", length);
+        return NULL;
+    }
+
+    frame->refs     = 1;
+    frame->length   = FRAME_HEADER_SIZE + length;
+    frame->data[0]  = (length >> 8) & 0xff;
+    frame->data[1]  = (length     ) & 0xff;
+    memcpy(&frame->data[FRAME_HEADER_SIZE], msg, length);
+
+    return frame;
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes another reference to a shared frame.
+ */
+void FRAME_hold(FRAME_SHARED *frame)
+{
+    frame->refs++;
+}
+
+/****************************************************************************************************************/
+/*! \brief Lets go of a reference to a shared frame, which goes away with the last one.
+ */
+void FRAME_release(FRAME_SHARED *frame)
+{
+    if (--frame->refs == 0)
+        free(frame);
+}
+
+/****************************************************************************************************************/
+/*! \brief Decodes the length header at the front of a ring.  The caller makes sure it's all there.
+ */
+static uint16_t FRAME_read_header(const FRAME_RING *ring)
+{
+    return ((unsigned char)ring->data[ring->head & FRAME_RING_MASK] << 8) |
+            (unsigned char)ring->data[(ring->head + 1) & FRAME_RING_MASK];
+}
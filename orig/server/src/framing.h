@@ -0,0 +1,58 @@
+/*! \file framing.h
+ * \brief Splits the byte stream coming in on a connection back up into the messages the client sent.
+ *
+ * Every message on the wire, in either direction, is preceded by a FRAME_HEADER_SIZE-byte header holding the
+ * length of the message in Motorola byte order.  Incoming bytes land in a per-connection ring buffer, and
+ * complete messages are handed out as pointers straight into it, so nothing gets copied unless a message happens
+ * to wrap around the end of the ring.
+ */
+#ifndef         FRAMING_H
+    #define     FRAMING_H
+
+    #include    "tictactwo-common.h"
+
+    /*! \brief How much unprocessed incoming data a connection can have buffered.  Has to be a power of two. */
+    #define     FRAME_RX_RING_SIZE          4096
+
+    /*! \brief The biggest message we'll accept from a client; anything claiming to be longer is garbage. */
+    #define     FRAME_MAX_INBOUND_SIZE      256
+
+    /*! \brief A connection's receive buffer.
+     * \note head and tail run freely and are only masked when they're used as indices, so (tail - head) is always
+     *  how much is buffered.
+     */
+    typedef struct
+    {
+        char        data[FRAME_RX_RING_SIZE];
+        /*! \brief Where the next unprocessed byte is. */
+        uint32_t    head;
+        /*! \brief Where the next byte off the socket will go. */
+        uint32_t    tail;
+        /*! \brief Where a message that wraps around the end of data gets straightened out. */
+        char        bounce[FRAME_MAX_INBOUND_SIZE];
+    } FRAME_RING;
+
+    /*! \brief An outgoing message that's been framed once, to go out to any number of connections as it is (see
+     * CONN_send_shared()) rather than being copied into every one of their queues.  Nothing may change it once
+     * it's made; it goes away when whoever made it, and every connection that's queued it, have let go of it.
+     * \note The count isn't atomic, so a shared frame mustn't leave the shard that made it.
+     */
+    typedef struct
+    {
+        uint32_t    refs;
+        /*! \brief How long it is, header included. */
+        uint32_t    length;
+        char        data[];
+    } FRAME_SHARED;
+
+    void        FRAME_reset(FRAME_RING *ring);
+    ssize_t     FRAME_fill(FRAME_RING *ring, int fd);
+    BOOL        FRAME_append(FRAME_RING *ring, const char *data, uint32_t length);
+    int         FRAME_peek(FRAME_RING *ring, const char **msg);
+    void        FRAME_pop(FRAME_RING *ring);
+    BOOL        FRAME_write(int fd, const void *msg, uint16_t length);
+    FRAME_SHARED *FRAME_share(const void *msg, uint16_t length);
+    void        FRAME_hold(FRAME_SHARED *frame);
+    void        FRAME_release(FRAME_SHARED *frame);
+
+#endif
@@ -1,25 +1,55 @@
 #include "gameroom.h"
-
-#define GAMEROOM_MAX_IDLE_TICKS     10000
+#include "active-player-manager.h"
+#include "reactor.h"
+#include "lobby.h"
+#include "chat.h"
+
+/*! \brief How long a room can go without anyone saying or doing anything before it gets reaped. */
+#define GAMEROOM_MAX_IDLE_MS        (2500 * 1000)
+/*! \brief How many rooms' worth of room the pool makes at a time. */
+#define GAMEROOM_POOL_SLAB_SIZE     1024
+/*! \brief How long to wait for a player to acknowledge which side they're on before telling them again. */
+#define GAMEROOM_SIDE_RETRY_MS      500
+/*! \brief How many times to tell them before giving up on the game. */
+#define GAMEROOM_SIDE_MAX_TRIES     10
+/*! \brief Every this many moves, both players get the whole board instead of just the move. */
+#define GAMEROOM_CHECKPOINT_EVERY   4
+
+#define GAMEROOM_PLAYER_ONE_ACKED   1
+#define GAMEROOM_PLAYER_TWO_ACKED   2
+#define GAMEROOM_BOTH_ACKED         (GAMEROOM_PLAYER_ONE_ACKED | GAMEROOM_PLAYER_TWO_ACKED)
 
 /*! \defgroup gameroom_module_private
- * \brief Functions and data private to the gameroom module.
+ * \brief Functions and data private to the gameroom module.  Every shard has its own rooms, so all of it is
+ * per-thread.
  * \{
  */
 
-/*! \brief A table of game rooms. */
-static GAMEROOM_STRUCT gamerooms[MAX_ACTIVE_ROOMS];
+/*! \brief Every game that's going on. */
+static __thread POOL_STRUCT gamerooms;
 
 /*! \brief Tracks whether this module was inited already; tries to prevent it from
  * getting inited more than once.
  */
-static BOOL gmrm_was_module_inited = FALSE;
+static __thread BOOL gmrm_was_module_inited = FALSE;
+
+static void GMRM_on_idle_timer(void *context);
+static void GMRM_on_handshake_timer(void *context);
+static void GMRM_send_sides(GAMEROOM_STRUCT *room);
+static void GMRM_handle_side_ack(GAMEROOM_STRUCT *room, PLAYER_STRUCT *ps, int my_turn);
+static BOOL GMRM_has_acked(const GAMEROOM_STRUCT *room, const PLAYER_STRUCT *ps);
+static void GMRM_send_update(GAMEROOM_STRUCT *room, uint8_t cell, uint8_t mark);
+static void GMRM_send_checkpoint(GAMEROOM_STRUCT *room, PLAYER_STRUCT *ps);
+static void GMRM_time_out(GAMEROOM_STRUCT *room);
+static void GMRM_handle_move(GAMEROOM_STRUCT *room, PLAYER_STRUCT *mover, PLAYER_STRUCT *opponent,
+    uint8_t mark, unsigned char x_tmp, unsigned char y_tmp);
+static void GMRM_release(GAMEROOM_STRUCT *room, uint8_t next_state);
 
 /*! \} */
 
 /****************************************************************************************************************/
-/*! \brief Marks all the gamerooms as idle and prepares them for use. Needs to be called once, when the server
- * is started.
+/*! \brief Sets up the pool the gamerooms come out of and prepares them for use. Needs to be called once, when the
+ * server is started.
  */
 void GMRM_init(void)
 {
@@ -29,14 +59,13 @@ void GMRM_init(void)
         return;
     }
 
-    int index;
-
-    for (index = 0; index < MAX_ACTIVE_ROOMS; index++)
+    if (!POOL_init(&gamerooms, sizeof(GAMEROOM_STRUCT), GAMEROOM_POOL_SLAB_SIZE, server_config.max_rooms))
     {
-        gamerooms[index].occupied   = FALSE;
-        gamerooms[index].plyr_1     = NULL;
-        gamerooms[index].plyr_2     = NULL;
+        OH_SMEG("Couldn't set up the game room pool.");
+        exit(1);
     }
+
+    gmrm_was_module_inited = TRUE;
 }
 
 /****************************************************************************************************************/
@@ -101,412 +130,435 @@ uint8_t GMRM_check_if_won(const GAMEROOM_STRUCT *gs)
 /****************************************************************************************************************/
 /*! \brief Attempt to start a new game with the specified players.
  * \return FALSE if there were no free gamerooms, or TRUE if it succeeded.
- * \note Notifies both interested clients of success or failure.
+ * \note Notifies both interested clients of success or failure.  Doesn't wait around for them to acknowledge
+ *  which side they're on; see GMRM_handle_side_ack().
  */
 BOOL GMRM_create_new(PLAYER_STRUCT *player_1, PLAYER_STRUCT *player_2)
 {
-    char packet;
-    static int pool_index;
-    int walk;
+    char            packet;
+    POOL_HANDLE     handle;
+    GAMEROOM_STRUCT *room = (GAMEROOM_STRUCT *)POOL_alloc(&gamerooms, &handle);
+
+    if (room == NULL)
+    {
+        // packet = MSGTYPE_NO_FREE_ROOMS; // not implemented yet
+        packet = MSGTYPE_FAILURE;
+
+        PLYRMNGR_send(player_1, &packet, 1);
+        PLYRMNGR_send(player_2, &packet, 1);
+
+        return FALSE;
+    }
+
+    // ♥ don't disturb this rooooom... ♫
+    room->id = handle;
+
+    // set up players.
+    // we decide randomly who gets to be p1 and p2 so that
+    // the same person doesn't always go first.
+    if (rand() & 1)
+    {
+        room->plyr_1 = player_1;
+        room->plyr_2 = player_2;
+    }
+    else
+    {
+        room->plyr_1 = player_2;
+        room->plyr_2 = player_1;
+    }
+
+    // clear the board and set us up to start with player 1
+    bzero(room->board, BOARD_HEIGHT * BOARD_WIDTH);
+    room->whose_turn        = 1;
+    room->seq               = 0;
+    room->last_activity_ms  = SERVER_now_ms();
+
+    RCTR_start_timer(&room->idle_timer, GAMEROOM_MAX_IDLE_MS, GMRM_on_idle_timer, room);
+
+    // so their moves (and what they say) find their way here
+    player_1->gameroom_id = handle;
+    player_2->gameroom_id = handle;
+    CHAT_join_room(player_1, handle);
+    CHAT_join_room(player_2, handle);
+
+    // tell them which side they're on; each of them acknowledges it, and whoever hasn't by the time the
+    // handshake timer goes off gets told again
+    room->acked_sides   = 0;
+    room->side_tries    = 0;
+    GMRM_send_sides(room);
+
+    return TRUE;
+}
 
-    while (walk < MAX_ACTIVE_ROOMS)
+/****************************************************************************************************************/
+/*! \brief Handles one message from a player who's in a game room.
+ * \param ps The player who sent it.
+ * \param msg The message, starting with its command byte; it isn't necessarily NULL-terminated.
+ * \param length How many bytes of msg are valid.
+ * \bug It's possible to eat up a room by going into gameplay, then sending a chat message once every five
+ *  minutes, if done by enough players, it forms a denial-of-service attack. I am not going to fix this right
+ *  now, though.
+ */
+void GMRM_handle_message(PLAYER_STRUCT *ps, const char *msg, int length)
+{
+    GAMEROOM_STRUCT *room;
+    PLAYER_STRUCT   *opponent;
+    int             my_turn;
+    uint8_t         my_mark;
+
+    room = (GAMEROOM_STRUCT *)POOL_get(&gamerooms, ps->gameroom_id);
+
+    if ((length < 1) || (room == NULL))
+        return;
+
+    // at least one player did something - room isn't idling anymore
+    room->last_activity_ms = SERVER_now_ms();
+
+    // player 1 is always x and player 2 is always o
+    if (ps == room->plyr_1)
     {
-        if (gamerooms[pool_index].occupied)
+        opponent    = room->plyr_2;
+        my_turn     = 1;
+        my_mark     = 'x';
+    }
+    else
+    {
+        opponent    = room->plyr_1;
+        my_turn     = 2;
+        my_mark     = 'o';
+    }
+
+    switch (msg[0])
+    {
+        // chat messages - these are private to the players in the game room, which has its own channel
+        case MSGTYPE_CHAT:
+        {
+            PROTO_CHAT_LINE chat;
+
+            PROTO_decode_CHAT_LINE(&chat, msg, length);
+            CHAT_say_in_room(ps, room->id, chat.text, strlen(chat.text));
+        }
+        break;
+
+        // gameplay messages
+        case MSGTYPE_START_GAME:
+            GMRM_handle_side_ack(room, ps, my_turn);
+        break;
+
+        case MSGTYPE_MOVE:
         {
-            pool_index++;
-            pool_index = pool_index % MAX_ACTIVE_ROOMS;
-            walk++;
+            PROTO_MOVE move;
+
+            // moves out of turn are quietly ignored
+            if (PROTO_decode_MOVE(&move, msg, length) && (room->whose_turn == my_turn))
+                GMRM_handle_move(room, ps, opponent, my_mark, move.column, move.row);
+        }
+        break;
+
+        // their client's noticed it missed a move somewhere - catch it up
+        case MSGTYPE_RESYNC:
+            GMRM_send_checkpoint(room, ps);
+        break;
+
+        // handle quit/disconnect message.
+        case MSGTYPE_CLIENT_QUITTING:
+            PLYRMNGR_handle_disconnect(ps);
+        break;
+
+        // if we get any other kinds of message here, the client's royally hosed,
+        // but we certainly don't care about that, now do we?  (⍛‿⍛)
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Applies a move from whoever's turn it is, then either ends the game or passes the turn along.
+ * \param mark The mover's symbol on the board ('x' or 'o').
+ */
+static void GMRM_handle_move(GAMEROOM_STRUCT *room, PLAYER_STRUCT *mover, PLAYER_STRUCT *opponent,
+    uint8_t mark, unsigned char x_tmp, unsigned char y_tmp)
+{
+    PROTO_CHAT_LINE chat;
+    char            out_buffer[OUTGOING_CHAT_MESSAGE_LENGTH];
+
+    if ((x_tmp >= BOARD_WIDTH) || (y_tmp >= BOARD_HEIGHT) || (room->board[x_tmp + (y_tmp * BOARD_WIDTH)] != 0))
+    {
+        // clicked in an occupied square - let them know we're on to them.
+        snprintf(chat.text, sizeof(chat.text), "server: %s tried to cheat.", mover->name);
+        chat.avatar = mover->avatar;
+        PROTO_encode_CHAT_LINE(out_buffer, sizeof(out_buffer), &chat);
+
+        PLYRMNGR_send(room->plyr_1, out_buffer, OUTGOING_CHAT_MESSAGE_LENGTH);
+
+        PLYRMNGR_send(room->plyr_2, out_buffer, OUTGOING_CHAT_MESSAGE_LENGTH);
+
+        // no need to change gamestates, since it's still their turn...
+        return;
+    }
+
+    // ONLY do the move if this square is empty.
+    // we shouldn't get illegal moves, but...
+    room->board[x_tmp + (y_tmp * BOARD_WIDTH)] = mark;
+
+    // they've moved, it's the other player's turn now
+    room->whose_turn = (room->whose_turn == 1) ? 2 : 1;
+
+    // let everyone know, including the mover, before anyone hears how it all turned out
+    room->seq++;
+    GMRM_send_update(room, x_tmp + (y_tmp * BOARD_WIDTH), mark);
+
+    // before we do anything, make sure the game didn't just end...
+    int result = GMRM_check_if_won(room);
+    if (result != GAMEROOM_STILL_PLAYING)
+    {
+        // game just ended
+        if (result == mark)
+        {
+            // track this in the stats...
+            PLYRDB_count_game(mover, 1, 0, 0);
+            PLYRDB_count_game(opponent, 0, 1, 0);
+
+            // ...and notify the clients...
+            out_buffer[0] = MSGTYPE_YOU_WIN;
+            PLYRMNGR_send(mover, out_buffer, 1);
+
+            out_buffer[0] = MSGTYPE_YOU_LOSE;
+            PLYRMNGR_send(opponent, out_buffer, 1);
         }
         else
         {
-            // ♥ don't disturb this rooooom... ♫
-            gamerooms[pool_index].occupied = TRUE;
-
-            // set up players.
-            // we decide randomly who gets to be p1 and p2 so that
-            // the same person doesn't always go first.
-            if (rand() & 1)
-            {
-                gamerooms[pool_index].plyr_1 = player_1;
-                gamerooms[pool_index].plyr_2 = player_2;
-            }
-            else
-            {
-                gamerooms[pool_index].plyr_1 = player_2;
-                gamerooms[pool_index].plyr_2 = player_1;
-            }
-
-            // clear the board and set us up to start with player 1
-            bzero(gamerooms[pool_index].board, BOARD_HEIGHT * BOARD_WIDTH);
-            gamerooms[pool_index].whose_turn = 1;
-
-            // notify the clients that the game is ready to start
-            packet = MSGTYPE_YOU_ARE_X;
-            send(gamerooms[pool_index].plyr_1->connection_fd, &packet, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
-            usleep(150000);
-            send(gamerooms[pool_index].plyr_1->connection_fd, &packet, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-            packet = MSGTYPE_YOU_ARE_O;
-            // I have no idea why the client never sees this, let's force the issue by sending it twice...
-            send(gamerooms[pool_index].plyr_2->connection_fd, &packet, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
-            usleep(150000);
-            send(gamerooms[pool_index].plyr_2->connection_fd, &packet, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
-            // maybe the client is in the wrong state when it arrives? ~shrug~
-
-            // don't start searching on this room next time, since we just started using it
-            pool_index++;
-            pool_index = pool_index % MAX_ACTIVE_ROOMS;
-
-            return TRUE;
+            // tie - repeat win steps above, but with different values
+            PLYRDB_count_game(mover, 0, 0, 1);
+            PLYRDB_count_game(opponent, 0, 0, 1);
+
+            out_buffer[0] = MSGTYPE_YOU_TIE;
+            PLYRMNGR_send(mover, out_buffer, 1);
+            PLYRMNGR_send(opponent, out_buffer, 1);
         }
+
+        // ...and free up the room.
+        GMRM_release(room, GAMESTATE_STAT_SCREEN);
+        return;
     }
+}
+
+/****************************************************************************************************************/
+/*! \brief Whether a player's acknowledged which side they're on; until they have, their client would just drop
+ * anything about the game, so there's no point sending it.
+ */
+static BOOL GMRM_has_acked(const GAMEROOM_STRUCT *room, const PLAYER_STRUCT *ps)
+{
+    return (room->acked_sides & ((ps == room->plyr_1) ? GAMEROOM_PLAYER_ONE_ACKED : GAMEROOM_PLAYER_TWO_ACKED)) != 0;
+}
+
+/****************************************************************************************************************/
+/*! \brief Tells both players about the move that's just been made, as move number room->seq.  It's the same few
+ * bytes however big the board is, except every GAMEROOM_CHECKPOINT_EVERY moves, when they get the whole board
+ * instead, so a client that's gone wrong somehow doesn't stay that way for long.
+ */
+static void GMRM_send_update(GAMEROOM_STRUCT *room, uint8_t cell, uint8_t mark)
+{
+    PROTO_GAME_UPDATE   update;
+    char                out_buffer[PROTO_SIZE(GAME_UPDATE)];
+    uint16_t            length;
 
-    // packet = MSGTYPE_NO_FREE_ROOMS; // not implemented yet
-    packet = MSGTYPE_FAILURE;
+    if ((room->seq % GAMEROOM_CHECKPOINT_EVERY) == 0)
+    {
+        if (GMRM_has_acked(room, room->plyr_1))
+            GMRM_send_checkpoint(room, room->plyr_1);
 
-    send(player_1->connection_fd, &packet, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
-    send(player_2->connection_fd, &packet, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (GMRM_has_acked(room, room->plyr_2))
+            GMRM_send_checkpoint(room, room->plyr_2);
 
-    return FALSE;
+        return;
+    }
+
+    update.seq  = room->seq;
+    update.cell = cell;
+    update.mark = mark;
+    length      = PROTO_encode_GAME_UPDATE(out_buffer, sizeof(out_buffer), &update);
+
+    if (GMRM_has_acked(room, room->plyr_1))
+        PLYRMNGR_send(room->plyr_1, out_buffer, length);
+
+    if (GMRM_has_acked(room, room->plyr_2))
+        PLYRMNGR_send(room->plyr_2, out_buffer, length);
 }
 
 /****************************************************************************************************************/
-/*! \brief Advances all active rooms, handling incoming messages and trying to reap old/unused games.
- *  \bug It's possible to eat up a room by going into gameplay, then sending a chat message once every five
- *  minutes, if done by enough players, it forms a denial-of-service attack. I am not going to fix this right
- *  now, though.
+/*! \brief Tells a player everything about the game: the whole board, whose turn it is, and which move it's as of,
+ * so they can carry on from there with the updates that follow.
  */
-void GMRM_tick_all(void)
+static void GMRM_send_checkpoint(GAMEROOM_STRUCT *room, PLAYER_STRUCT *ps)
 {
-    char    communication_buffer_1[MAX_MESSAGE_SIZE];
-    char    communication_buffer_2[MAX_MESSAGE_SIZE];
-    char    out_buffer[OUTGOING_CHAT_MESSAGE_LENGTH];
-    int     got_from_1;
-    int     got_from_2;
-    int     index;
-
-    for (index = 0; index < MAX_ACTIVE_ROOMS; index++)
+    PROTO_GAME_CHECKPOINT   checkpoint;
+    char                    out_buffer[PROTO_SIZE(GAME_CHECKPOINT)];
+
+    checkpoint.seq      = room->seq;
+    checkpoint.to_move  = (room->whose_turn == 1) ? MSGTYPE_YOU_ARE_X : MSGTYPE_YOU_ARE_O;
+    memcpy(checkpoint.cells, room->board, sizeof(checkpoint.cells));
+
+    PLYRMNGR_send(ps, out_buffer, PROTO_encode_GAME_CHECKPOINT(out_buffer, sizeof(out_buffer), &checkpoint));
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes a player out of the game they're in because they quit or dropped; nothing happens to their stats
+ * and the other person gets an automatic win for now (there isn't a field for disconnects (yet)).
+ *
+ * \todo make sure this isn't exploitable with both clients quitting to collude and give each other wins...
+ */
+void GMRM_handle_quit(PLAYER_STRUCT *quitter)
+{
+    char            packet;
+    GAMEROOM_STRUCT *room;
+    PLAYER_STRUCT   *winner;
+
+    room = (GAMEROOM_STRUCT *)POOL_get(&gamerooms, quitter->gameroom_id);
+
+    // check this to handle a race between someone quitting simultaneously with the round ending...
+    if (room == NULL)
+        return;
+
+    winner = (quitter == room->plyr_1) ? room->plyr_2 : room->plyr_1;
+
+    PLYRDB_count_game(winner, 1, 0, 0);
+
+    packet = MSGTYPE_YOU_WIN;
+    PLYRMNGR_send(winner, &packet, 1);
+
+    // room not needed anymore
+    GMRM_release(room, GAMESTATE_STAT_SCREEN);
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor when a room might have gone long enough without anyone doing anything in it to be
+ * timed out.
+ */
+static void GMRM_on_idle_timer(void *context)
+{
+    GAMEROOM_STRUCT *room = (GAMEROOM_STRUCT *)context;
+    uint64_t        idle = SERVER_now_ms() - room->last_activity_ms;
+
+    // someone's done something since it was started; check back once they've been quiet for long enough
+    if (idle < GAMEROOM_MAX_IDLE_MS)
     {
-        if (gamerooms[index].occupied)
-        {
-            gamerooms[index].ticks_since_last_move++;
-
-            bzero(communication_buffer_1, MAX_MESSAGE_SIZE);
-            bzero(communication_buffer_2, MAX_MESSAGE_SIZE);
-            bzero(out_buffer, OUTGOING_CHAT_MESSAGE_LENGTH);
-
-            // check to see if either player has communicated with us
-            got_from_1 = recv(gamerooms[index].plyr_1->connection_fd, communication_buffer_1,
-                MAX_MESSAGE_SIZE, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-            got_from_2 = recv(gamerooms[index].plyr_2->connection_fd, communication_buffer_2,
-                MAX_MESSAGE_SIZE, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-            // got anhything?
-            if ((got_from_1 > 0) || (got_from_2 > 0))
-            {
-                // at least one player did something - room isn't idling anymore
-                gamerooms[index].ticks_since_last_move = 0;
-
-                // handle chat messages - these are private to the players in the game room
-
-                if (communication_buffer_1[0] == MSGTYPE_CHAT)
-                {
-                    char tmp[OUTGOING_CHAT_MESSAGE_LENGTH];
-                    tmp[0] = MSGTYPE_CHAT;
-
-                    snprintf(&tmp[1], OUTGOING_CHAT_MESSAGE_LENGTH-1, "%s: %s", gamerooms[index].plyr_1->name, &communication_buffer_1[1]);
-                    send(gamerooms[index].plyr_1->connection_fd, tmp,
-                        OUTGOING_CHAT_MESSAGE_LENGTH, MSG_DONTWAIT | MSG_NOSIGNAL);
-                    send(gamerooms[index].plyr_2->connection_fd, tmp,
-                        OUTGOING_CHAT_MESSAGE_LENGTH, MSG_DONTWAIT | MSG_NOSIGNAL);
-                }
-
-                if (communication_buffer_2[0] == MSGTYPE_CHAT)
-                {
-                    char tmp[OUTGOING_CHAT_MESSAGE_LENGTH];
-                    tmp[0] = MSGTYPE_CHAT;
-
-                    snprintf(&tmp[1], OUTGOING_CHAT_MESSAGE_LENGTH-1, "%s: %s", gamerooms[index].plyr_2->name, &communication_buffer_2[1]);
-                    send(gamerooms[index].plyr_1->connection_fd, tmp,
-                        OUTGOING_CHAT_MESSAGE_LENGTH, MSG_DONTWAIT | MSG_NOSIGNAL);
-                    send(gamerooms[index].plyr_2->connection_fd, tmp,
-                        OUTGOING_CHAT_MESSAGE_LENGTH, MSG_DONTWAIT | MSG_NOSIGNAL);
-                }
-
-                // handle gameplay messages
-                // these are laid out like so:
-                //
-                // [0]   [1  2   .......30]  [31]
-                // cmd   col row NULL bytes  NULL byte
-                switch (gamerooms[index].whose_turn)
-                {
-                    case 1:
-                    {       DUH_WHERE_AM_I("here 1.");
-                        if (communication_buffer_1[0] == MSGTYPE_MOVE)
-                        {
-                            unsigned char x_tmp = communication_buffer_1[1];
-                            unsigned char y_tmp = communication_buffer_1[2];
-
-                            if (gamerooms[index].board[x_tmp + (y_tmp * 3)] == 0)
-                            {
-                                // ONLY do the move if this square is empty.
-                                // we shouldn't get illegal moves, but...
-                                gamerooms[index].board[x_tmp + (y_tmp * 3)] = 'x';
-
-                                // player 1 has moved, player 2's turn now
-                                gamerooms[index].whose_turn = 2;
-
-                                // before we do anything, make sure the game didn't just end...
-                                int result = GMRM_check_if_won(&gamerooms[index]);
-                                if (result != GAMEROOM_STILL_PLAYING)
-                                {
-                                    // game just ended
-
-                                    if (result == 'x')
-                                    {
-                                        // track this in the stats...
-                                        gamerooms[index].plyr_1->games_won++;
-                                        gamerooms[index].plyr_2->games_lost++;
-
-                                        // ...and notify the clients...
-                                        communication_buffer_1[0] = MSGTYPE_YOU_WIN;
-                                        communication_buffer_2[0] = MSGTYPE_YOU_LOSE;
-
-                                        send(gamerooms[index].plyr_1->connection_fd, communication_buffer_1,
-                                            1, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-                                        send(gamerooms[index].plyr_2->connection_fd, communication_buffer_2,
-                                            1, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-                                        // ...and free up the room.
-                                        gamerooms[index].occupied = FALSE;
-                                    }
-                                    else
-                                    {
-                                        // tie - repeat win steps above, but with different values
-                                        gamerooms[index].plyr_1->games_tied++;
-                                        gamerooms[index].plyr_2->games_tied++;
-
-                                        communication_buffer_1[0] = MSGTYPE_YOU_TIE;
-
-                                        send(gamerooms[index].plyr_1->connection_fd, communication_buffer_1,
-                                            1, MSG_DONTWAIT | MSG_NOSIGNAL);
-                                        send(gamerooms[index].plyr_2->connection_fd, communication_buffer_1,
-                                            1, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-                                        gamerooms[index].occupied = FALSE;
-                                    }
-
-                                    gamerooms[index].plyr_1->state = GAMESTATE_STAT_SCREEN;
-                                    gamerooms[index].plyr_2->state = GAMESTATE_STAT_SCREEN;
-                                }
-                                else
-                                {
-                                    gamerooms[index].whose_turn = 2;
-                                    // we're still underway - notify players what state they should be in
-//                                    communication_buffer_1[0] = MSGTYPE_WAIT_FOR_OPPONENT;
-                                    communication_buffer_2[0] = MSGTYPE_ITS_YOUR_TURN;
-
-                                    communication_buffer_2[1] = gamerooms[index].board[0];
-                                    communication_buffer_2[2] = gamerooms[index].board[1];
-                                    communication_buffer_2[3] = gamerooms[index].board[2];
-
-                                    communication_buffer_2[4] = gamerooms[index].board[3];
-                                    communication_buffer_2[5] = gamerooms[index].board[4];
-                                    communication_buffer_2[6] = gamerooms[index].board[5];
-
-                                    communication_buffer_2[7] = gamerooms[index].board[6];
-                                    communication_buffer_2[8] = gamerooms[index].board[7];
-                                    communication_buffer_2[9] = gamerooms[index].board[8];
-
-
-//                                    send(gamerooms[index].plyr_1->connection_fd, communication_buffer_1,
-//                                        1, MSG_DONTWAIT | MSG_NOSIGNAL);
-                                    send(gamerooms[index].plyr_2->connection_fd, communication_buffer_2,
-                                        10,  MSG_NOSIGNAL);
-                                }
-                            }
-                            else
-                            {
-                                // player 1 clicked in an occupied square - let them know we're on to them.
-                                snprintf(out_buffer, OUTGOING_CHAT_MESSAGE_LENGTH, "server: %s tried to cheat.",
-                                    gamerooms[index].plyr_1->name);
-
-                                send(gamerooms[index].plyr_1->connection_fd, out_buffer,
-                                    OUTGOING_CHAT_MESSAGE_LENGTH, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-                                send(gamerooms[index].plyr_2->connection_fd, out_buffer,
-                                    OUTGOING_CHAT_MESSAGE_LENGTH, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-                                // no need to change gamestates, since it's still p1's turn...
-                            }
-                        }
-                    } // -------- end the case where it's player one's turn.
-                    break;
-
-                    /********************************************************************************************/
-
-                    case 2:
-                    {
-                        // logic is pretty much identical to player one's
-                        if (communication_buffer_2[0] == MSGTYPE_MOVE)
-                        {
-                            unsigned char x_tmp = communication_buffer_2[1];
-                            unsigned char y_tmp = communication_buffer_2[2];
-
-                            if (gamerooms[index].board[x_tmp + (y_tmp * 3)] == 0)
-                            {
-                                gamerooms[index].board[x_tmp + (y_tmp * 3)] = 'o';
-
-                                // player 2 has moved, player 1's turn now
-                                gamerooms[index].whose_turn = 1;
-
-                                int result = GMRM_check_if_won(&gamerooms[index]);
-                                if (result != GAMEROOM_STILL_PLAYING)
-                                {
-                                    // game just ended
-                                    if (result == 'o')
-                                    {
-                                        // win
-                                        gamerooms[index].plyr_2->games_won++;
-                                        gamerooms[index].plyr_1->games_lost++;
-
-                                        communication_buffer_1[0] = MSGTYPE_YOU_LOSE;
-                                        communication_buffer_2[0] = MSGTYPE_YOU_WIN;
-
-                                        send(gamerooms[index].plyr_1->connection_fd, communication_buffer_1,
-                                            1, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-                                        send(gamerooms[index].plyr_2->connection_fd, communication_buffer_2,
-                                            1, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-                                        gamerooms[index].occupied = FALSE;
-
-
-                                    }
-                                    else
-                                    {
-                                        // tie
-                                        gamerooms[index].plyr_1->games_tied++;
-                                        gamerooms[index].plyr_2->games_tied++;
-
-                                        communication_buffer_1[0] = MSGTYPE_YOU_TIE;
-
-                                        send(gamerooms[index].plyr_1->connection_fd, communication_buffer_1,
-                                            1, MSG_DONTWAIT | MSG_NOSIGNAL);
-                                        send(gamerooms[index].plyr_2->connection_fd, communication_buffer_1,
-                                            1, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-                                        gamerooms[index].occupied = FALSE;
-                                    }
-
-                                    gamerooms[index].plyr_1->state = GAMESTATE_STAT_SCREEN;
-                                    gamerooms[index].plyr_2->state = GAMESTATE_STAT_SCREEN;
-                                }
-                                else
-                                {
-                                    gamerooms[index].whose_turn = 1;
-                                    // we're still underway - notify players what state they should be in
-                                    communication_buffer_1[0] = MSGTYPE_ITS_YOUR_TURN;
-//                                    communication_buffer_2[0] = MSGTYPE_WAIT_FOR_OPPONENT;
-
-                                    communication_buffer_1[1] = gamerooms[index].board[0];
-                                    communication_buffer_1[2] = gamerooms[index].board[1];
-                                    communication_buffer_1[3] = gamerooms[index].board[2];
-
-                                    communication_buffer_1[4] = gamerooms[index].board[3];
-                                    communication_buffer_1[5] = gamerooms[index].board[4];
-                                    communication_buffer_1[6] = gamerooms[index].board[5];
-
-                                    communication_buffer_1[7] = gamerooms[index].board[6];
-                                    communication_buffer_1[8] = gamerooms[index].board[7];
-                                    communication_buffer_1[9] = gamerooms[index].board[8];
-
-
-                                    send(gamerooms[index].plyr_1->connection_fd, communication_buffer_1,
-                                        10,  MSG_NOSIGNAL);
-//                                    send(gamerooms[index].plyr_2->connection_fd, communication_buffer_2,
-//                                        1, MSG_DONTWAIT | MSG_NOSIGNAL);
-                                }
-                            }
-                            else
-                            {
-                                // player 2 clicked in an occupied square - let them know we're on to them.
-                                snprintf(out_buffer, OUTGOING_CHAT_MESSAGE_LENGTH, "server: %s tried to cheat.",
-                                    gamerooms[index].plyr_2->name);
-
-                                send(gamerooms[index].plyr_1->connection_fd, out_buffer,
-                                    OUTGOING_CHAT_MESSAGE_LENGTH, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-                                send(gamerooms[index].plyr_2->connection_fd, out_buffer,
-                                    OUTGOING_CHAT_MESSAGE_LENGTH, MSG_DONTWAIT | MSG_NOSIGNAL);
-                            }
-                        }
-                    } // -------- end the case where it's player two's turn.
-                    break;
-
-                    default:
-                        DUH_WHERE_AM_I("SHOULD NOT GET HERE.");
-                }
-
-                // handle quit/disconnect message.
-                // if either player quits during the game, nothing happens to their stats and the other person
-                // gets an automatic win for now (there isn't a field for disconnects (yet))
-                //
-                // todo: make sure this isn't exploitable with both clients quitting to collude and
-                // give each other wins...
-                if (gamerooms[index].occupied) // check this to handle a race between someone quitting
-                {                               // simultaneously with the round ending...
-
-                    if ((communication_buffer_1[0] == MSGTYPE_CLIENT_QUITTING) && (communication_buffer_2[0] != MSGTYPE_CLIENT_QUITTING))
-                    {
-                        gamerooms[index].plyr_2->games_won++;
-
-                        communication_buffer_2[0] = MSGTYPE_YOU_WIN;
-                        send(gamerooms[index].plyr_2->connection_fd, communication_buffer_2,
-                            1, MSG_DONTWAIT | MSG_NOSIGNAL);
-                    }
-
-                    if ((communication_buffer_2[0] == MSGTYPE_CLIENT_QUITTING) && (communication_buffer_1[0] != MSGTYPE_CLIENT_QUITTING))
-                    {
-                        gamerooms[index].plyr_1->games_won++;
-
-                        communication_buffer_1[0] = MSGTYPE_YOU_WIN;
-                        send(gamerooms[index].plyr_1->connection_fd, communication_buffer_1,
-                            1, MSG_DONTWAIT | MSG_NOSIGNAL);
-                    }
-
-                    if ((communication_buffer_1[0] == MSGTYPE_CLIENT_QUITTING) || (communication_buffer_2[0] == MSGTYPE_CLIENT_QUITTING))
-                    {
-                        // room not needed anymore
-                        gamerooms[index].occupied = FALSE;
-                    }
-                }
-
-                // if we get any other kinds of message here, the client's royally hosed,
-                // but we certainly don't care about that, now do we?  (⍛‿⍛)
-            }
-            else
-            {
-                // yep, no one said anything
-                // how long have we been idle?
-                if (gamerooms[index].ticks_since_last_move > GAMEROOM_MAX_IDLE_TICKS)
-                {
-                    // <applejack mood="annoyed">both o' y'all waited too long, get out of mah orchard</applejack>
-                    communication_buffer_1[0] = MSGTYPE_GAMEPLAY_TIMED_OUT;
-
-                    send(gamerooms[index].plyr_1->connection_fd, communication_buffer_1,
-                        MAX_MESSAGE_SIZE, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-                    send(gamerooms[index].plyr_2->connection_fd, communication_buffer_1,
-                        MAX_MESSAGE_SIZE, MSG_DONTWAIT | MSG_NOSIGNAL);
-
-                    // reap the room
-                    gamerooms[index].occupied = FALSE;
-                }
-            }
-
-        } // end the case where this game room was occupied
-    } // end for
+        RCTR_start_timer(&room->idle_timer, GAMEROOM_MAX_IDLE_MS - idle, GMRM_on_idle_timer, room);
+        return;
+    }
+
+    GMRM_time_out(room);
+}
+
+/****************************************************************************************************************/
+/*! \brief Tells both players their game's been called off, and sends them back to the lobby.
+ */
+static void GMRM_time_out(GAMEROOM_STRUCT *room)
+{
+    char packet[MAX_MESSAGE_SIZE];
+
+    bzero(packet, MAX_MESSAGE_SIZE);
+
+    // <applejack mood="annoyed">both o' y'all waited too long, get out of mah orchard</applejack>
+    packet[0] = MSGTYPE_GAMEPLAY_TIMED_OUT;
+
+    PLYRMNGR_send(room->plyr_1, packet, MAX_MESSAGE_SIZE);
+
+    PLYRMNGR_send(room->plyr_2, packet, MAX_MESSAGE_SIZE);
+
+    // reap the room and put them back where the lobby will listen to them
+    room->plyr_1->challenger_id = -1;
+    room->plyr_2->challenger_id = -1;
+    GMRM_release(room, GAMESTATE_LOBBY);
+}
+
+/****************************************************************************************************************/
+/*! \brief Tells whichever players haven't acknowledged their sides yet which side they're on, and gives them
+ * GAMEROOM_SIDE_RETRY_MS to say they've heard.
+ */
+static void GMRM_send_sides(GAMEROOM_STRUCT *room)
+{
+    char packet;
+
+    if (!(room->acked_sides & GAMEROOM_PLAYER_ONE_ACKED))
+    {
+        packet = MSGTYPE_YOU_ARE_X;
+        PLYRMNGR_send(room->plyr_1, &packet, 1);
+    }
+
+    if (!(room->acked_sides & GAMEROOM_PLAYER_TWO_ACKED))
+    {
+        packet = MSGTYPE_YOU_ARE_O;
+        PLYRMNGR_send(room->plyr_2, &packet, 1);
+    }
+
+    room->side_tries++;
+    RCTR_start_timer(&room->handshake_timer, GAMEROOM_SIDE_RETRY_MS, GMRM_on_handshake_timer, room);
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor when someone's been told which side they're on but hasn't said so yet.  Their
+ * client may well have been busy with something else when it arrived, so they get told again; if they still
+ * haven't answered after GAMEROOM_SIDE_MAX_TRIES, they're not coming, and the game's off.
+ */
+static void GMRM_on_handshake_timer(void *context)
+{
+    GAMEROOM_STRUCT *room = (GAMEROOM_STRUCT *)context;
+
+    if (room->side_tries >= GAMEROOM_SIDE_MAX_TRIES)
+    {
+        DUH_WHERE_AM_I("%s and %s never both got going; calling their game off", room->plyr_1->name,
+            room->plyr_2->name);
+        GMRM_time_out(room);
+        return;
+    }
+
+    GMRM_send_sides(room);
+}
+
+/****************************************************************************************************************/
+/*! \brief Handles a player acknowledging which side they're on.  They get a checkpoint straight away, since any
+ * moves made in the meantime weren't sent to them.
+ */
+static void GMRM_handle_side_ack(GAMEROOM_STRUCT *room, PLAYER_STRUCT *ps, int my_turn)
+{
+    uint8_t bit = (my_turn == 1) ? GAMEROOM_PLAYER_ONE_ACKED : GAMEROOM_PLAYER_TWO_ACKED;
+
+    // (they'll answer every time they're told, and they may have been told more than once)
+    if (room->acked_sides & bit)
+        return;
+
+    room->acked_sides |= bit;
+
+    if (room->acked_sides == GAMEROOM_BOTH_ACKED)
+        RCTR_stop_timer(&room->handshake_timer);
+
+    GMRM_send_checkpoint(room, ps);
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts a room back in the pool and moves both of its players on to the specified state.
+ */
+static void GMRM_release(GAMEROOM_STRUCT *room, uint8_t next_state)
+{
+    RCTR_stop_timer(&room->idle_timer);
+    RCTR_stop_timer(&room->handshake_timer);
+    POOL_free(&gamerooms, room->id);
+
+    room->plyr_1->gameroom_id   = -1;
+    room->plyr_2->gameroom_id   = -1;
+    CHAT_leave_room(room->plyr_1, room->id);
+    CHAT_leave_room(room->plyr_2, room->id);
+
+    // don't resurrect anyone who's already logged off; everyone else is free again (and their stats have likely
+    // changed), which the lobby ought to know
+    if (room->plyr_1->state != GAMESTATE_NOT_CONNECTED)
+    {
+        room->plyr_1->state = next_state;
+        LOBBY_update(room->plyr_1);
+    }
+
+    if (room->plyr_2->state != GAMESTATE_NOT_CONNECTED)
+    {
+        room->plyr_2->state = next_state;
+        LOBBY_update(room->plyr_2);
+    }
 }
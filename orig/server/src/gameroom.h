@@ -3,6 +3,8 @@
 
     #include    "tictactwo-common.h"
     #include    "player_db.h"
+    #include    "pool.h"
+    #include    "reactor.h"
 
     /*! \defgroup gameroom_resolutions
      * \brief Various states a game can be in - returned by GMRM_check_if_won()
@@ -19,21 +21,35 @@
     typedef struct
     {
         uint8_t         board[BOARD_WIDTH * BOARD_HEIGHT];
-        BOOL            occupied;
+        /*! \brief This room's handle in its shard's room pool, which is what its players' gameroom_id is set to. */
+        POOL_HANDLE     id;
         PLAYER_STRUCT   *plyr_1;
         PLAYER_STRUCT   *plyr_2;
         int             whose_turn;
+        /*! \brief How many moves have been made so far, which is also the number the last one went out with. */
+        uint32_t        seq;
         int             who_went_first;
         /*! \brief Used to time out and reap rooms where one or
          * more players are disconnected or otherwise not playing
          */
-        uint32_t        ticks_since_last_move;
+        uint64_t        last_activity_ms;
+        /*! \brief Goes off when the room might have been idle too long.  It doesn't get pushed back every time
+         * someone does something (that'd be a lot of restarting); it just checks last_activity_ms when it goes
+         * off, and if the room's been busy since, goes back to sleep for however long's left.
+         */
+        RCTR_TIMER      idle_timer;
+        /*! \brief Which players have acknowledged which side they're on: bit 0 for plyr_1, bit 1 for plyr_2. */
+        uint8_t         acked_sides;
+        /*! \brief How many times we've told them so far. */
+        uint8_t         side_tries;
+        /*! \brief Runs until both players have acknowledged their sides, telling whoever hasn't again. */
+        RCTR_TIMER      handshake_timer;
     } GAMEROOM_STRUCT;
 
     void    GMRM_init(void);
     BOOL    GMRM_create_new(PLAYER_STRUCT *player_1, PLAYER_STRUCT *player_2);
-    void    GMRM_handle_incoming_move(int row, int col, int plyr);
+    void    GMRM_handle_message(PLAYER_STRUCT *ps, const char *msg, int length);
+    void    GMRM_handle_quit(PLAYER_STRUCT *quitter);
     uint8_t GMRM_check_if_won(const GAMEROOM_STRUCT *gs);
-    void    GMRM_tick_all(void);
 
 #endif
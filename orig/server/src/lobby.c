@@ -0,0 +1,1086 @@
+/*! \file lobby.c
+ * \brief The sorted, paged lobby; see lobby.h.
+ */
+#include    "lobby.h"
+#include    "active-player-manager.h"
+#include    "framing.h"
+#include    "shard.h"
+#include    "pool.h"
+#include    "rank.h"
+#include    "reactor.h"
+
+/*! \brief How many players' worth of room the lobby's pool makes at a time. */
+#define     LOBBY_POOL_SLAB_SIZE    1024
+/*! \brief How big the player lookup table starts out; it doubles whenever it gets half full. */
+#define     LOBBY_INDEX_MIN_SIZE    1024
+/*! \brief How many subscribers' worth of room the subscriber pool makes at a time. */
+#define     LOBBY_SUBSCRIBER_SLAB_SIZE  1024
+/*! \brief How many pages' worth of room the view pool makes at a time. */
+#define     LOBBY_VIEW_SLAB_SIZE    64
+/*! \brief How big the view lookup table starts out; it doubles whenever it gets half full. */
+#define     LOBBY_VIEW_INDEX_MIN_SIZE   64
+/*! \brief How many pages nobody's looking at any more are hung on to, so that whoever comes back to one (from a
+ * game, say) can be caught up on it instead of being sent the lot.
+ */
+#define     LOBBY_IDLE_VIEWS        64
+/*! \brief How many of a page's changes it remembers; anyone further behind than that gets the whole page. */
+#define     LOBBY_VIEW_LOG_SIZE     32
+
+/*! \defgroup lobby_versions
+ * \brief Every change to every page on a shard takes the next number from the one counter, with the shard in the
+ * top bits, so a version only ever means something on the page it came from, and a client that's moved pages or
+ * shards just gets sent the page.  0 never gets used; it's what a client sends when it hasn't got the page.
+ * \{
+ */
+#define     LOBBY_COUNTER_BITS      26
+#define     LOBBY_COUNTER_MASK      ((1U << LOBBY_COUNTER_BITS) - 1)
+#define     LOBBY_VERSION(shard, counter)   (((uint32_t)(shard) << LOBBY_COUNTER_BITS) | ((counter) & LOBBY_COUNTER_MASK))
+/*! \} */
+
+_Static_assert(MAX_SHARDS <= (1 << (32 - LOBBY_COUNTER_BITS)), "every shard needs its own lobby versions");
+_Static_assert(LOBBY_PAGE_MAX_SIZE <= 32, "which rows of a page have changed has to fit in 32 bits");
+
+/*! \defgroup lobby_changes
+ * \brief What can happen to a player's entry in the lobby.
+ * \{
+ */
+#define     LOBBY_CHANGE_JOINED     (unsigned char)'+'
+#define     LOBBY_CHANGE_UPDATED    (unsigned char)'~'
+#define     LOBBY_CHANGE_LEFT       (unsigned char)'-'
+/*! \} */
+
+/*! \brief Gets back from one of an entry's RANK_NODEs to the entry. */
+#define     LOBBY_ENTRY_OF(node, sort_key)  \
+    ((LOBBY_ENTRY *)((char *)(node) - offsetof(LOBBY_ENTRY, ranks) - ((sort_key) * sizeof(RANK_NODE))))
+
+/*! \brief One player's entry in a shard's copy of the lobby. */
+typedef struct
+{
+    const PLAYER_STRUCT *player;
+    /*! \brief Its handle in the lobby's pool. */
+    POOL_HANDLE         id;
+    /*! \brief The shard that's looking after them.  When someone moves shards, the shard they've moved to can
+     * tell us they've arrived before the one they left tells us they've gone; this is how we know to ignore the
+     * latter.
+     */
+    int                 owner;
+    /*! \brief Where it is in each of the sort orders, indexed by LOBBY_SORT_ key. */
+    RANK_NODE           ranks[LOBBY_SORT_KEYS];
+    /*! \brief What it's sorted by, unpacked from the record. */
+    uint32_t            won;
+    uint32_t            played;
+    BOOL                in_game;
+    char                record[LOBBY_LIST_RECORD_SIZE];
+} LOBBY_ENTRY;
+
+/*! \brief Something that's happened to one player's entry, posted between shards. */
+typedef struct
+{
+    const PLAYER_STRUCT *player;
+    /*! \brief One of the LOBBY_CHANGE_ values. */
+    uint8_t             op;
+    char                record[LOBBY_LIST_RECORD_SIZE];
+} LOBBY_CHANGE;
+
+/*! \brief Where LOBBY_add_to_page() is up to. */
+typedef struct
+{
+    char                *out;
+    uint8_t             sort_key;
+} LOBBY_PAGE_CURSOR;
+
+/*! \brief One change to a page: the version it took it from, the one it took it to, and a bit for each row that
+ * was different afterwards.
+ */
+typedef struct
+{
+    uint32_t            from;
+    uint32_t            to;
+    uint32_t            rows;
+} LOBBY_STEP;
+
+/*! \brief A page of the lobby that some of this shard's players are looking at (or were, not long ago).  It's
+ * put together once per batch, however many of them there are, and remembers what's changed on it lately so
+ * that anyone who's a version or two behind only gets sent the rows that are different.
+ */
+typedef struct
+{
+    /*! \brief Which page: the LOBBY_SORT_ key, where it starts, and how long it can be. */
+    uint8_t             sort_key;
+    uint8_t             count;
+    uint32_t            first;
+    /*! \brief Its handle in the view pool. */
+    POOL_HANDLE         id;
+    /*! \brief How many subscribers are looking at it; if none are, it's idle, and nothing keeps it up to date. */
+    uint32_t            subscribers;
+    /*! \brief How many players there are in all, and how many of them are on the page. */
+    uint32_t            total;
+    uint8_t             length;
+    uint32_t            version;
+    /*! \brief The last LOBBY_VIEW_LOG_SIZE changes; change n lives at n % LOBBY_VIEW_LOG_SIZE. */
+    LOBBY_STEP          log[LOBBY_VIEW_LOG_SIZE];
+    uint32_t            steps;
+    /*! \brief This batch's change, ready to go, for everyone who had the version before it; only set during
+     * LOBBY_push().
+     */
+    FRAME_SHARED        *frame;
+    uint32_t            frame_from;
+    /*! \brief What's on it; the rows past its length are all zeros. */
+    char                rows[LOBBY_PAGE_MAX_SIZE][LOBBY_LIST_RECORD_SIZE];
+} LOBBY_VIEW;
+
+/*! \brief One of this shard's players who's sitting in the lobby, looking at a page of it. */
+typedef struct
+{
+    PLAYER_STRUCT       *player;
+    /*! \brief The page, in the view pool. */
+    POOL_HANDLE         view;
+    /*! \brief The version of it they've been sent. */
+    uint32_t            version;
+} LOBBY_SUBSCRIBER;
+
+/*! \defgroup lobby_private
+ * \brief Data and functions private to the lobby module.  Every shard has its own copy of the lobby, so all of
+ * it is per-thread.
+ * \{
+ */
+static __thread POOL_STRUCT     lobby_entries;
+/*! \brief Finds a player's entry by their PLAYER_STRUCT: an open-addressed table of handles into lobby_entries,
+ * POOL_NO_HANDLE where it's empty.
+ */
+static __thread POOL_HANDLE     *lobby_index;
+static __thread uint32_t        lobby_index_size;
+/*! \brief Every entry, in every order there is, indexed by LOBBY_SORT_ key. */
+static __thread RANK_TREE       lobby_ranks[LOBBY_SORT_KEYS];
+/*! \brief Whether anything's changed since the last push. */
+static __thread BOOL            lobby_changed           = FALSE;
+/*! \brief This shard's players who are in the lobby, and get pushed whatever changes on the page they're on. */
+static __thread POOL_STRUCT     lobby_subscribers;
+/*! \brief The pages they're looking at, and how to find one by which page it is: an open-addressed table of
+ * handles into lobby_views, POOL_NO_HANDLE where it's empty.
+ */
+static __thread POOL_STRUCT     lobby_views;
+static __thread POOL_HANDLE     *lobby_view_index;
+static __thread uint32_t        lobby_view_index_size;
+/*! \brief How many of lobby_views nobody's looking at. */
+static __thread uint32_t        lobby_idle_views        = 0;
+/*! \brief The last version handed out, before the shard's put on it. */
+static __thread uint32_t        lobby_counter           = 0;
+/*! \brief Where LOBBY_build() puts a page together, for LOBBY_refresh() to compare with what was there. */
+static __thread char            lobby_page_rows[LOBBY_PAGE_MAX_SIZE][LOBBY_LIST_RECORD_SIZE];
+/*! \brief A page, or what's changed on one, on its way out.  Changes only go out if they're smaller than the
+ * page would be, so a page is the biggest it has to hold.
+ */
+static __thread char            lobby_out_buffer[LOBBY_PAGE_HEADER_SIZE + (LOBBY_LIST_RECORD_SIZE * LOBBY_PAGE_MAX_SIZE)];
+static __thread BOOL            lobby_was_module_inited = FALSE;
+
+static void LOBBY_notify(const PLAYER_STRUCT *ps, uint8_t op);
+static void LOBBY_push(void *unused);
+static LOBBY_SUBSCRIBER *LOBBY_subscription(const PLAYER_STRUCT *ps);
+static LOBBY_VIEW *LOBBY_attach(uint8_t sort_key, uint32_t first, uint8_t count);
+static void LOBBY_detach(LOBBY_SUBSCRIBER *subscriber);
+static BOOL LOBBY_refresh(LOBBY_VIEW *view);
+static uint8_t LOBBY_build(uint8_t sort_key, uint32_t first, uint8_t count);
+static void LOBBY_add_to_page(RANK_NODE *node, void *context);
+static int LOBBY_catch_up(const LOBBY_VIEW *view, uint32_t seen_version);
+static int LOBBY_write_page(const LOBBY_VIEW *view);
+static int LOBBY_write_changes(const LOBBY_VIEW *view, uint32_t from, uint32_t rows);
+static uint32_t LOBBY_next_version(void);
+static void LOBBY_take_change(int from_shard, void *payload, uint32_t length);
+static void LOBBY_apply(int owner, LOBBY_CHANGE *change);
+static void LOBBY_rank(LOBBY_ENTRY *entry);
+static void LOBBY_unrank(LOBBY_ENTRY *entry);
+static int LOBBY_by_name(const RANK_NODE *a, const RANK_NODE *b);
+static int LOBBY_by_wins(const RANK_NODE *a, const RANK_NODE *b);
+static int LOBBY_by_win_ratio(const RANK_NODE *a, const RANK_NODE *b);
+static int LOBBY_by_availability(const RANK_NODE *a, const RANK_NODE *b);
+static int LOBBY_compare_names(const LOBBY_ENTRY *a, const LOBBY_ENTRY *b);
+static void LOBBY_write_record(char *record, const PLAYER_STRUCT *ps);
+static uint32_t LOBBY_find(const PLAYER_STRUCT *ps);
+static BOOL LOBBY_index_add(LOBBY_ENTRY *entry);
+static void LOBBY_index_remove(uint32_t position);
+static uint32_t LOBBY_hash(const PLAYER_STRUCT *ps);
+static uint32_t LOBBY_view_find(uint8_t sort_key, uint32_t first, uint8_t count);
+static BOOL LOBBY_view_index_add(LOBBY_VIEW *view);
+static void LOBBY_view_index_remove(uint32_t position);
+static uint32_t LOBBY_view_hash(uint8_t sort_key, uint32_t first, uint8_t count);
+/*! \} */
+
+/****************************************************************************************************************/
+/*! \brief Readies the module for use.
+ */
+void LOBBY_init(void)
+{
+    uint64_t capacity = (uint64_t)server_config.max_players * SHARD_count();
+    uint32_t index;
+
+    if (lobby_was_module_inited) return;
+
+    // everyone on every shard
+    if (capacity > POOL_MAX_CAPACITY)
+        capacity = POOL_MAX_CAPACITY;
+
+    lobby_index_size        = LOBBY_INDEX_MIN_SIZE;
+    lobby_index             = (POOL_HANDLE *)malloc(lobby_index_size * sizeof(POOL_HANDLE));
+    lobby_view_index_size   = LOBBY_VIEW_INDEX_MIN_SIZE;
+    lobby_view_index        = (POOL_HANDLE *)malloc(lobby_view_index_size * sizeof(POOL_HANDLE));
+
+    // (at worst, every subscriber's on a page of their own, and there are some idle ones besides)
+    if ((lobby_index == NULL) || (lobby_view_index == NULL) ||
+        (!POOL_init(&lobby_entries, sizeof(LOBBY_ENTRY), LOBBY_POOL_SLAB_SIZE, (uint32_t)capacity)) ||
+        (!POOL_init(&lobby_subscribers, sizeof(LOBBY_SUBSCRIBER), LOBBY_SUBSCRIBER_SLAB_SIZE,
+            server_config.max_players)) ||
+        (!POOL_init(&lobby_views, sizeof(LOBBY_VIEW), LOBBY_VIEW_SLAB_SIZE,
+            server_config.max_players + LOBBY_IDLE_VIEWS)))
+    {
+        OH_SMEG("Couldn't set up the lobby.");
+        exit(1);
+    }
+
+    for (index = 0; index < lobby_index_size; index++)
+        lobby_index[index] = POOL_NO_HANDLE;
+
+    for (index = 0; index < lobby_view_index_size; index++)
+        lobby_view_index[index] = POOL_NO_HANDLE;
+
+    RANK_init(&lobby_ranks[LOBBY_SORT_BY_NAME],         LOBBY_by_name);
+    RANK_init(&lobby_ranks[LOBBY_SORT_BY_WINS],         LOBBY_by_wins);
+    RANK_init(&lobby_ranks[LOBBY_SORT_BY_WIN_RATIO],    LOBBY_by_win_ratio);
+    RANK_init(&lobby_ranks[LOBBY_SORT_BY_AVAILABILITY], LOBBY_by_availability);
+
+    // whatever's changed during a trip around the loop gets pushed out at the end of it
+    RCTR_add_batch_hook(LOBBY_push, NULL);
+
+    lobby_was_module_inited = TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts one of this shard's players in the lobby (everyone's copy of it).
+ */
+void LOBBY_join(const PLAYER_STRUCT *ps)
+{
+    LOBBY_notify(ps, LOBBY_CHANGE_JOINED);
+}
+
+/****************************************************************************************************************/
+/*! \brief Lets everyone know something's changed about one of this shard's players (their stats, say).
+ */
+void LOBBY_update(const PLAYER_STRUCT *ps)
+{
+    LOBBY_notify(ps, LOBBY_CHANGE_UPDATED);
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes one of this shard's players out of the lobby, because they've logged off or moved shards.
+ */
+void LOBBY_leave(const PLAYER_STRUCT *ps)
+{
+    LOBBY_notify(ps, LOBBY_CHANGE_LEFT);
+}
+
+/****************************************************************************************************************/
+/*! \brief Brings a player up to date on the page of the lobby they've asked for, and keeps them that way: from
+ * now on, whenever that page changes, they get sent what's different at the end of the batch it changed in,
+ * until they ask for another one or leave the lobby.
+ * \param sort_key Which order they want it in (one of the LOBBY_SORT_ keys).
+ * \param first Where the page starts, in that order.
+ * \param count How long it is; anything over LOBBY_PAGE_MAX_SIZE (or 0) gets LOBBY_PAGE_MAX_SIZE.
+ * \param seen_version The version of the page they've got already, or 0 if they haven't.
+ */
+void LOBBY_subscribe(PLAYER_STRUCT *ps, uint8_t sort_key, uint32_t first, uint8_t count, uint32_t seen_version)
+{
+    LOBBY_SUBSCRIBER    *subscriber = LOBBY_subscription(ps);
+    LOBBY_VIEW          *view;
+    POOL_HANDLE         handle;
+
+    if (sort_key >= LOBBY_SORT_KEYS)
+        sort_key = LOBBY_SORT_BY_NAME;
+
+    if ((count == 0) || (count > LOBBY_PAGE_MAX_SIZE))
+        count = LOBBY_PAGE_MAX_SIZE;
+
+    if (subscriber == NULL)
+    {
+        subscriber = (LOBBY_SUBSCRIBER *)POOL_alloc(&lobby_subscribers, &handle);
+
+        // (can't happen; there's room for every player the shard can have)
+        if (subscriber == NULL)
+            return;
+
+        subscriber->player      = ps;
+        subscriber->view        = POOL_NO_HANDLE;
+        ps->lobby_subscription  = handle;
+    }
+
+    // onto the new page before off the old one, so asking for the same page again doesn't throw it away
+    view = LOBBY_attach(sort_key, first, count);
+    LOBBY_detach(subscriber);
+
+    // (can't happen either; there's room for a page each)
+    if (view == NULL)
+    {
+        LOBBY_unsubscribe(ps);
+        return;
+    }
+
+    subscriber->view    = view->id;
+    subscriber->version = view->version;
+
+    PLYRMNGR_send(ps, lobby_out_buffer, LOBBY_catch_up(view, seen_version));
+}
+
+/****************************************************************************************************************/
+/*! \brief Stops pushing lobby changes to a player, because they've logged off or moved shards.  (Players who
+ * just wander off into a game get dropped by themselves.)
+ */
+void LOBBY_unsubscribe(PLAYER_STRUCT *ps)
+{
+    LOBBY_SUBSCRIBER *subscriber = LOBBY_subscription(ps);
+
+    if (subscriber != NULL)
+    {
+        LOBBY_detach(subscriber);
+        POOL_free(&lobby_subscribers, ps->lobby_subscription);
+    }
+
+    ps->lobby_subscription = POOL_NO_HANDLE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor at the end of every batch of events: if anything's changed in the lobby during
+ * it, each page someone's looking at gets put together again, once, and whatever's different on it goes out to
+ * everyone looking at it.  Anyone who's subscribed but has since left the lobby (for a game, say) gets dropped
+ * instead; they'll subscribe again when they come back.
+ */
+static void LOBBY_push(void *unused)
+{
+    LOBBY_SUBSCRIBER    *subscriber;
+    LOBBY_VIEW          *view;
+    uint32_t            cursor;
+    uint32_t            from;
+
+    if (!lobby_changed)
+        return;
+
+    lobby_changed = FALSE;
+
+    // whoever's gone first, so nobody's old page gets put together for nothing
+    cursor = 0;
+
+    while ((subscriber = (LOBBY_SUBSCRIBER *)POOL_next(&lobby_subscribers, &cursor)) != NULL)
+    {
+        if (subscriber->player->state != GAMESTATE_LOBBY)
+            LOBBY_unsubscribe(subscriber->player);
+    }
+
+    // then each page, the once; what's changed on it is framed the once too, and everyone who was up to date
+    // just takes a reference to it
+    cursor = 0;
+
+    while ((view = (LOBBY_VIEW *)POOL_next(&lobby_views, &cursor)) != NULL)
+    {
+        from = view->version;
+
+        if ((view->subscribers == 0) || (!LOBBY_refresh(view)))
+            continue;
+
+        view->frame         = FRAME_share(lobby_out_buffer, LOBBY_catch_up(view, from));
+        view->frame_from    = from;
+    }
+
+    cursor = 0;
+
+    while ((subscriber = (LOBBY_SUBSCRIBER *)POOL_next(&lobby_subscribers, &cursor)) != NULL)
+    {
+        view = (LOBBY_VIEW *)POOL_get(&lobby_views, subscriber->view);
+
+        if (subscriber->version == view->version)
+            continue;
+
+        if ((view->frame != NULL) && (subscriber->version == view->frame_from))
+            PLYRMNGR_send_shared(subscriber->player, view->frame);
+        else
+            PLYRMNGR_send(subscriber->player, lobby_out_buffer, LOBBY_catch_up(view, subscriber->version));
+
+        subscriber->version = view->version;
+    }
+
+    cursor = 0;
+
+    while ((view = (LOBBY_VIEW *)POOL_next(&lobby_views, &cursor)) != NULL)
+    {
+        if (view->frame != NULL)
+            FRAME_release(view->frame);
+
+        view->frame = NULL;
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Finds a player's subscription.
+ * \return It, or NULL if they're not subscribed here.
+ */
+static LOBBY_SUBSCRIBER *LOBBY_subscription(const PLAYER_STRUCT *ps)
+{
+    LOBBY_SUBSCRIBER *subscriber = (LOBBY_SUBSCRIBER *)POOL_get(&lobby_subscribers, ps->lobby_subscription);
+
+    // (the handle could be left over from another shard's pool)
+    return ((subscriber != NULL) && (subscriber->player == ps)) ? subscriber : NULL;
+}
+
+/****************************************************************************************************************/
+/*! \brief Finds the view of a page, putting it together if there isn't one, and counts one more subscriber
+ * looking at it.
+ * \return It, or NULL if we're out of room.
+ */
+static LOBBY_VIEW *LOBBY_attach(uint8_t sort_key, uint32_t first, uint8_t count)
+{
+    uint32_t    position    = LOBBY_view_find(sort_key, first, count);
+    LOBBY_VIEW  *view;
+    POOL_HANDLE handle;
+
+    if (lobby_view_index[position] != POOL_NO_HANDLE)
+    {
+        view = (LOBBY_VIEW *)POOL_get(&lobby_views, lobby_view_index[position]);
+
+        // nobody's been keeping it up to date; whatever's happened since counts as one change
+        if (view->subscribers == 0)
+        {
+            lobby_idle_views--;
+            LOBBY_refresh(view);
+        }
+
+        view->subscribers++;
+        return view;
+    }
+
+    view = (LOBBY_VIEW *)POOL_alloc(&lobby_views, &handle);
+
+    if (view == NULL)
+        return NULL;
+
+    bzero(view, sizeof(LOBBY_VIEW));
+    view->sort_key      = sort_key;
+    view->first         = first;
+    view->count         = count;
+    view->id            = handle;
+
+    if (!LOBBY_view_index_add(view))
+    {
+        POOL_free(&lobby_views, handle);
+        return NULL;
+    }
+
+    view->subscribers   = 1;
+    view->length        = LOBBY_build(sort_key, first, count);
+    view->total         = RANK_count(&lobby_ranks[sort_key]);
+    view->version       = LOBBY_next_version();
+    memcpy(view->rows, lobby_page_rows, sizeof(view->rows));
+
+    return view;
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes a subscriber off whichever page they were looking at.  If that leaves nobody looking at it, it's
+ * kept (idle) if there's room, or thrown away if there isn't.
+ */
+static void LOBBY_detach(LOBBY_SUBSCRIBER *subscriber)
+{
+    LOBBY_VIEW *view = (LOBBY_VIEW *)POOL_get(&lobby_views, subscriber->view);
+
+    subscriber->view = POOL_NO_HANDLE;
+
+    if ((view == NULL) || (--view->subscribers > 0))
+        return;
+
+    if (lobby_idle_views < LOBBY_IDLE_VIEWS)
+    {
+        lobby_idle_views++;
+        return;
+    }
+
+    LOBBY_view_index_remove(LOBBY_view_find(view->sort_key, view->first, view->count));
+    POOL_free(&lobby_views, view->id);
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts a view's page together again and, if it's any different, gives it a new version and logs which
+ * rows changed.
+ * \return TRUE if it was different.
+ */
+static BOOL LOBBY_refresh(LOBBY_VIEW *view)
+{
+    uint8_t     length  = LOBBY_build(view->sort_key, view->first, view->count);
+    uint32_t    total   = RANK_count(&lobby_ranks[view->sort_key]);
+    uint32_t    rows    = 0;
+    LOBBY_STEP  *step;
+    int         row;
+
+    for (row = 0; row < view->count; row++)
+    {
+        if (memcmp(view->rows[row], lobby_page_rows[row], LOBBY_LIST_RECORD_SIZE) != 0)
+        {
+            memcpy(view->rows[row], lobby_page_rows[row], LOBBY_LIST_RECORD_SIZE);
+            rows |= 1U << row;
+        }
+    }
+
+    if ((rows == 0) && (total == view->total))
+        return FALSE;
+
+    step            = &view->log[view->steps % LOBBY_VIEW_LOG_SIZE];
+    step->from      = view->version;
+    step->to        = LOBBY_next_version();
+    step->rows      = rows;
+
+    view->steps++;
+    view->version   = step->to;
+    view->total     = total;
+    view->length    = length;
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts a page of the lobby together in lobby_page_rows, with zeros after the last player on it.  Finding
+ * where it starts is a trip down a tree, so it costs the same whichever page it is.
+ * \return How many players are on it.
+ */
+static uint8_t LOBBY_build(uint8_t sort_key, uint32_t first, uint8_t count)
+{
+    LOBBY_PAGE_CURSOR   cursor;
+    uint8_t             length;
+
+    cursor.out      = lobby_page_rows[0];
+    cursor.sort_key = sort_key;
+    length          = (uint8_t)RANK_visit(&lobby_ranks[sort_key], first, count, LOBBY_add_to_page, &cursor);
+
+    bzero(lobby_page_rows[length], (count - length) * LOBBY_LIST_RECORD_SIZE);
+
+    return length;
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by RANK_visit() with each of the entries on a page, to copy it out.
+ * \param context The LOBBY_PAGE_CURSOR; moved along past it.
+ */
+static void LOBBY_add_to_page(RANK_NODE *node, void *context)
+{
+    LOBBY_PAGE_CURSOR   *cursor = (LOBBY_PAGE_CURSOR *)context;
+    LOBBY_ENTRY         *entry  = LOBBY_ENTRY_OF(node, cursor->sort_key);
+
+    memcpy(cursor->out, entry->record, LOBBY_LIST_RECORD_SIZE);
+    cursor->out += LOBBY_LIST_RECORD_SIZE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Works out what someone who's got a particular version of a page needs to be brought up to date, and
+ * puts it in lobby_out_buffer: just the rows that have changed since, if the log goes back that far and that's
+ * smaller than the page, or the whole page if not.
+ * \return How long it is.
+ */
+static int LOBBY_catch_up(const LOBBY_VIEW *view, uint32_t seen_version)
+{
+    uint32_t    rows    = 0;
+    BOOL        found   = (seen_version == view->version);
+    uint32_t    step;
+
+    // back through the log to the change that took it from the version they've got
+    for (step = view->steps; (!found) && (step > 0) && ((view->steps - step) < LOBBY_VIEW_LOG_SIZE); step--)
+    {
+        rows    |= view->log[(step - 1) % LOBBY_VIEW_LOG_SIZE].rows;
+        found    = (view->log[(step - 1) % LOBBY_VIEW_LOG_SIZE].from == seen_version);
+    }
+
+    // (rows past the end of the page don't go out; the client can tell how long it is from the total)
+    if (view->length < 32)
+        rows &= (1U << view->length) - 1;
+
+    if ((found) && ((LOBBY_CHANGES_HEADER_SIZE + (__builtin_popcount(rows) * LOBBY_ROW_SIZE)) <
+        (LOBBY_PAGE_HEADER_SIZE + (view->length * LOBBY_LIST_RECORD_SIZE))))
+    {
+        return LOBBY_write_changes(view, seen_version, rows);
+    }
+
+    return LOBBY_write_page(view);
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts the whole of a view's page in lobby_out_buffer.
+ * \return How long it is.
+ */
+static int LOBBY_write_page(const LOBBY_VIEW *view)
+{
+    PROTO_LOBBY_PAGE    page;
+    int                 length;
+
+    page.sort_key   = view->sort_key;
+    page.first      = view->first;
+    page.total      = view->total;
+    page.version    = view->version;
+
+    length = PROTO_encode_LOBBY_PAGE(lobby_out_buffer, sizeof(lobby_out_buffer), &page);
+    memcpy(&lobby_out_buffer[length], view->rows, view->length * LOBBY_LIST_RECORD_SIZE);
+
+    return length + (view->length * LOBBY_LIST_RECORD_SIZE);
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts some of the rows of a view's page in lobby_out_buffer, as the changes since a version of it.
+ * \param rows A bit for each row that goes in.
+ * \return How long it is.
+ */
+static int LOBBY_write_changes(const LOBBY_VIEW *view, uint32_t from, uint32_t rows)
+{
+    PROTO_LOBBY_CHANGES changes;
+    PROTO_LOBBY_ROW     out;
+    int                 length;
+    int                 row;
+
+    changes.sort_key    = view->sort_key;
+    changes.first       = view->first;
+    changes.total       = view->total;
+    changes.from        = from;
+    changes.to          = view->version;
+
+    length = PROTO_encode_LOBBY_CHANGES(lobby_out_buffer, sizeof(lobby_out_buffer), &changes);
+
+    for (row = 0; row < view->length; row++)
+    {
+        if ((rows & (1U << row)) == 0)
+            continue;
+
+        out.row = row;
+        memcpy(out.record, view->rows[row], LOBBY_LIST_RECORD_SIZE);
+        length += PROTO_encode_LOBBY_ROW(&lobby_out_buffer[length], sizeof(lobby_out_buffer) - length, &out);
+    }
+
+    return length;
+}
+
+/****************************************************************************************************************/
+/*! \brief Hands out the next version.
+ */
+static uint32_t LOBBY_next_version(void)
+{
+    lobby_counter = (lobby_counter + 1) & LOBBY_COUNTER_MASK;
+
+    // (0's what "I haven't got it" looks like)
+    if (lobby_counter == 0)
+        lobby_counter = 1;
+
+    return LOBBY_VERSION(SHARD_self(), lobby_counter);
+}
+
+/*! \brief Applies a change to one of our own players here, then sends it on to every other shard.
+ */
+static void LOBBY_notify(const PLAYER_STRUCT *ps, uint8_t op)
+{
+    LOBBY_CHANGE change;
+
+    bzero(&change, sizeof(change));
+    change.player   = ps;
+    change.op       = op;
+    LOBBY_write_record(change.record, ps);
+
+    LOBBY_apply(SHARD_self(), &change);
+    SHARD_post_to_others(LOBBY_take_change, &change, sizeof(change));
+}
+
+/****************************************************************************************************************/
+/*! \brief Posted by another shard when something's happened to one of its players.
+ */
+static void LOBBY_take_change(int from_shard, void *payload, uint32_t length)
+{
+    LOBBY_apply(from_shard, (LOBBY_CHANGE *)payload);
+}
+
+/****************************************************************************************************************/
+/*! \brief Applies a change to this shard's copy of the lobby, keeping every sort order up to date as it goes.
+ * \param owner The shard the player belongs to.
+ */
+static void LOBBY_apply(int owner, LOBBY_CHANGE *change)
+{
+    uint32_t    position    = LOBBY_find(change->player);
+    LOBBY_ENTRY *entry      = NULL;
+    POOL_HANDLE handle;
+
+    if (lobby_index[position] != POOL_NO_HANDLE)
+        entry = (LOBBY_ENTRY *)POOL_get(&lobby_entries, lobby_index[position]);
+
+    if (change->op == LOBBY_CHANGE_LEFT)
+    {
+        // gone already, or just here from their old shard, and their new one's told us about them already?
+        if ((entry == NULL) || (entry->owner != owner))
+            return;
+
+        LOBBY_unrank(entry);
+        LOBBY_index_remove(position);
+        POOL_free(&lobby_entries, entry->id);
+        lobby_changed = TRUE;
+        return;
+    }
+
+    if (entry == NULL)
+    {
+        entry = (LOBBY_ENTRY *)POOL_alloc(&lobby_entries, &handle);
+
+        if (entry == NULL)
+        {
+            OH_SMEG("No room in the lobby for %s.", change->player->name);
+            return;
+        }
+
+        entry->player   = change->player;
+        entry->id       = handle;
+        entry->owner    = owner;
+
+        if (!LOBBY_index_add(entry))
+        {
+            POOL_free(&lobby_entries, handle);
+            return;
+        }
+    }
+    else
+    {
+        // (they may have just moved shards; as far as anyone in the lobby's concerned, they never went anywhere)
+        entry->owner = owner;
+
+        if (memcmp(entry->record, change->record, LOBBY_LIST_RECORD_SIZE) == 0)
+            return;
+
+        // it has to come out of the trees before what they're sorted by changes
+        LOBBY_unrank(entry);
+    }
+
+    memcpy(entry->record, change->record, LOBBY_LIST_RECORD_SIZE);
+    LOBBY_rank(entry);
+
+    lobby_changed = TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Unpacks what an entry's sorted by from its record, then puts it in every sort order.
+ */
+static void LOBBY_rank(LOBBY_ENTRY *entry)
+{
+    PROTO_LOBBY_RECORD  record;
+    int                 sort_key;
+
+    PROTO_decode_LOBBY_RECORD(&record, entry->record, LOBBY_LIST_RECORD_SIZE);
+
+    entry->won      = record.wins;
+    entry->played   = record.wins + record.losses + record.ties;
+    entry->in_game  = (record.in_game != 0);
+
+    for (sort_key = 0; sort_key < LOBBY_SORT_KEYS; sort_key++)
+        RANK_insert(&lobby_ranks[sort_key], &entry->ranks[sort_key]);
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes an entry out of every sort order.
+ */
+static void LOBBY_unrank(LOBBY_ENTRY *entry)
+{
+    int sort_key;
+
+    for (sort_key = 0; sort_key < LOBBY_SORT_KEYS; sort_key++)
+        RANK_remove(&lobby_ranks[sort_key], &entry->ranks[sort_key]);
+}
+
+/****************************************************************************************************************/
+/*! \brief LOBBY_SORT_BY_NAME: alphabetical.
+ */
+static int LOBBY_by_name(const RANK_NODE *a, const RANK_NODE *b)
+{
+    return LOBBY_compare_names(LOBBY_ENTRY_OF(a, LOBBY_SORT_BY_NAME), LOBBY_ENTRY_OF(b, LOBBY_SORT_BY_NAME));
+}
+
+/****************************************************************************************************************/
+/*! \brief LOBBY_SORT_BY_WINS: most wins first, then alphabetical.
+ */
+static int LOBBY_by_wins(const RANK_NODE *a, const RANK_NODE *b)
+{
+    const LOBBY_ENTRY *first    = LOBBY_ENTRY_OF(a, LOBBY_SORT_BY_WINS);
+    const LOBBY_ENTRY *second   = LOBBY_ENTRY_OF(b, LOBBY_SORT_BY_WINS);
+
+    if (first->won != second->won)
+        return (first->won > second->won) ? -1 : 1;
+
+    return LOBBY_compare_names(first, second);
+}
+
+/****************************************************************************************************************/
+/*! \brief LOBBY_SORT_BY_WIN_RATIO: best share of games won first (no games counting as none won), then most wins,
+ * then alphabetical.
+ */
+static int LOBBY_by_win_ratio(const RANK_NODE *a, const RANK_NODE *b)
+{
+    const LOBBY_ENTRY   *first  = LOBBY_ENTRY_OF(a, LOBBY_SORT_BY_WIN_RATIO);
+    const LOBBY_ENTRY   *second = LOBBY_ENTRY_OF(b, LOBBY_SORT_BY_WIN_RATIO);
+    // cross-multiplied, so there's no dividing (by zero, or otherwise)
+    uint64_t            left    = (uint64_t)first->won * second->played;
+    uint64_t            right   = (uint64_t)second->won * first->played;
+
+    if (left != right)
+        return (left > right) ? -1 : 1;
+
+    if (first->won != second->won)
+        return (first->won > second->won) ? -1 : 1;
+
+    return LOBBY_compare_names(first, second);
+}
+
+/****************************************************************************************************************/
+/*! \brief LOBBY_SORT_BY_AVAILABILITY: whoever's free to play first, then alphabetical.
+ */
+static int LOBBY_by_availability(const RANK_NODE *a, const RANK_NODE *b)
+{
+    const LOBBY_ENTRY *first    = LOBBY_ENTRY_OF(a, LOBBY_SORT_BY_AVAILABILITY);
+    const LOBBY_ENTRY *second   = LOBBY_ENTRY_OF(b, LOBBY_SORT_BY_AVAILABILITY);
+
+    if (first->in_game != second->in_game)
+        return first->in_game ? 1 : -1;
+
+    return LOBBY_compare_names(first, second);
+}
+
+/****************************************************************************************************************/
+/*! \brief Alphabetical, ignoring case; names are unique, so it only ever calls two entries equal if they're the
+ * same one.
+ */
+static int LOBBY_compare_names(const LOBBY_ENTRY *a, const LOBBY_ENTRY *b)
+{
+    int result = strcasecmp(a->record, b->record);
+
+    return (result != 0) ? result : strcmp(a->record, b->record);
+}
+
+/****************************************************************************************************************/
+/*! \brief Fills out a single player's entry in the lobby list.
+ */
+static void LOBBY_write_record(char *record, const PLAYER_STRUCT *ps)
+{
+    PROTO_LOBBY_RECORD out;
+
+    snprintf(out.name, sizeof(out.name), "%s", ps->name);
+    out.wins    = ps->games_won;
+    out.losses  = ps->games_lost;
+    out.ties    = ps->games_tied;
+    out.avatar  = ps->avatar;
+    out.in_game = (ps->state == GAMESTATE_GAMEPLAY) ? 1 : 0;
+
+    PROTO_encode_LOBBY_RECORD(record, LOBBY_LIST_RECORD_SIZE, &out);
+}
+
+/****************************************************************************************************************/
+/*! \brief Finds where a player is in the lookup table, or where they'd go if they're not in it.
+ */
+static uint32_t LOBBY_find(const PLAYER_STRUCT *ps)
+{
+    uint32_t    mask        = lobby_index_size - 1;
+    uint32_t    position    = LOBBY_hash(ps) & mask;
+    LOBBY_ENTRY *entry;
+
+    while (lobby_index[position] != POOL_NO_HANDLE)
+    {
+        entry = (LOBBY_ENTRY *)POOL_get(&lobby_entries, lobby_index[position]);
+
+        if (entry->player == ps)
+            break;
+
+        position = (position + 1) & mask;
+    }
+
+    return position;
+}
+
+/****************************************************************************************************************/
+/*! \brief Adds a (new) entry to the lookup table, doubling it first if it's getting full.
+ * \return FALSE if we're out of memory.
+ */
+static BOOL LOBBY_index_add(LOBBY_ENTRY *entry)
+{
+    POOL_HANDLE *old_index  = lobby_index;
+    uint32_t    old_size    = lobby_index_size;
+    uint32_t    index;
+
+    // (the entry's already been counted)
+    if ((POOL_count(&lobby_entries) * 2) > lobby_index_size)
+    {
+        lobby_index = (POOL_HANDLE *)malloc(old_size * 2 * sizeof(POOL_HANDLE));
+
+        if (lobby_index == NULL)
+        {
+            OH_SMEG("Out of memory growing the lobby past %u players.", POOL_count(&lobby_entries));
+            lobby_index = old_index;
+            return FALSE;
+        }
+
+        lobby_index_size = old_size * 2;
+
+        for (index = 0; index < lobby_index_size; index++)
+            lobby_index[index] = POOL_NO_HANDLE;
+
+        for (index = 0; index < old_size; index++)
+        {
+            if (old_index[index] != POOL_NO_HANDLE)
+                lobby_index[LOBBY_find(((LOBBY_ENTRY *)POOL_get(&lobby_entries, old_index[index]))->player)] =
+                    old_index[index];
+        }
+
+        free(old_index);
+    }
+
+    lobby_index[LOBBY_find(entry->player)] = entry->id;
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes an entry out of the lookup table, moving back anything after it that had to go further along
+ * than it wanted to because it was in the way, so nothing ends up past a gap.
+ */
+static void LOBBY_index_remove(uint32_t position)
+{
+    uint32_t    mask = lobby_index_size - 1;
+    uint32_t    next = position;
+    uint32_t    home;
+
+    lobby_index[position] = POOL_NO_HANDLE;
+
+    while (TRUE)
+    {
+        next = (next + 1) & mask;
+
+        if (lobby_index[next] == POOL_NO_HANDLE)
+            return;
+
+        home = LOBBY_hash(((LOBBY_ENTRY *)POOL_get(&lobby_entries, lobby_index[next]))->player) & mask;
+
+        // can it move back into the gap, without ending up in front of where it belongs?
+        if (((next - home) & mask) >= ((next - position) & mask))
+        {
+            lobby_index[position]   = lobby_index[next];
+            lobby_index[next]       = POOL_NO_HANDLE;
+            position                = next;
+        }
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Where in the lookup table a player would like to be.
+ */
+static uint32_t LOBBY_hash(const PLAYER_STRUCT *ps)
+{
+    // PLAYER_STRUCTs are at least 16-byte aligned, so the low bits don't tell us anything
+    return (uint32_t)((((uintptr_t)ps >> 4) * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+/****************************************************************************************************************/
+/*! \brief Finds where a page's view is in the view lookup table, or where it'd go if it's not in it.
+ */
+static uint32_t LOBBY_view_find(uint8_t sort_key, uint32_t first, uint8_t count)
+{
+    uint32_t    mask        = lobby_view_index_size - 1;
+    uint32_t    position    = LOBBY_view_hash(sort_key, first, count) & mask;
+    LOBBY_VIEW  *view;
+
+    while (lobby_view_index[position] != POOL_NO_HANDLE)
+    {
+        view = (LOBBY_VIEW *)POOL_get(&lobby_views, lobby_view_index[position]);
+
+        if ((view->sort_key == sort_key) && (view->first == first) && (view->count == count))
+            break;
+
+        position = (position + 1) & mask;
+    }
+
+    return position;
+}
+
+/****************************************************************************************************************/
+/*! \brief Adds a (new) view to the view lookup table, doubling it first if it's getting full.
+ * \return FALSE if we're out of memory.
+ */
+static BOOL LOBBY_view_index_add(LOBBY_VIEW *view)
+{
+    POOL_HANDLE *old_index  = lobby_view_index;
+    uint32_t    old_size    = lobby_view_index_size;
+    LOBBY_VIEW  *moving;
+    uint32_t    index;
+
+    // (the view's already been counted)
+    if ((POOL_count(&lobby_views) * 2) > lobby_view_index_size)
+    {
+        lobby_view_index = (POOL_HANDLE *)malloc(old_size * 2 * sizeof(POOL_HANDLE));
+
+        if (lobby_view_index == NULL)
+        {
+            OH_SMEG("Out of memory growing the lobby past %u pages.", POOL_count(&lobby_views));
+            lobby_view_index = old_index;
+            return FALSE;
+        }
+
+        lobby_view_index_size = old_size * 2;
+
+        for (index = 0; index < lobby_view_index_size; index++)
+            lobby_view_index[index] = POOL_NO_HANDLE;
+
+        for (index = 0; index < old_size; index++)
+        {
+            if (old_index[index] == POOL_NO_HANDLE)
+                continue;
+
+            moving = (LOBBY_VIEW *)POOL_get(&lobby_views, old_index[index]);
+            lobby_view_index[LOBBY_view_find(moving->sort_key, moving->first, moving->count)] = old_index[index];
+        }
+
+        free(old_index);
+    }
+
+    lobby_view_index[LOBBY_view_find(view->sort_key, view->first, view->count)] = view->id;
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes a view out of the view lookup table the same way LOBBY_index_remove() does an entry.
+ */
+static void LOBBY_view_index_remove(uint32_t position)
+{
+    uint32_t    mask = lobby_view_index_size - 1;
+    uint32_t    next = position;
+    uint32_t    home;
+    LOBBY_VIEW  *view;
+
+    lobby_view_index[position] = POOL_NO_HANDLE;
+
+    while (TRUE)
+    {
+        next = (next + 1) & mask;
+
+        if (lobby_view_index[next] == POOL_NO_HANDLE)
+            return;
+
+        view = (LOBBY_VIEW *)POOL_get(&lobby_views, lobby_view_index[next]);
+        home = LOBBY_view_hash(view->sort_key, view->first, view->count) & mask;
+
+        if (((next - home) & mask) >= ((next - position) & mask))
+        {
+            lobby_view_index[position]  = lobby_view_index[next];
+            lobby_view_index[next]      = POOL_NO_HANDLE;
+            position                    = next;
+        }
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Where in the view lookup table a page would like to be.
+ */
+static uint32_t LOBBY_view_hash(uint8_t sort_key, uint32_t first, uint8_t count)
+{
+    uint64_t key = ((uint64_t)first << 16) | ((uint64_t)sort_key << 8) | count;
+
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
@@ -0,0 +1,51 @@
+/*! \file lobby.h
+ * \brief What the lobby shows: a record for every player who's logged in, on any shard, in whichever order a
+ * client wants to see it, a page at a time.
+ *
+ * Every shard keeps its own copy of the whole lobby.  Its own players' comings and goings get applied to it
+ * directly and posted on to the other shards, which apply them to theirs; nobody ever sends the whole thing.
+ * Each copy's kept sorted every way a client can ask for it (see the LOBBY_SORT_ keys) in order-statistic trees
+ * that are updated as players come, go, start games and finish them, so a page costs a trip down one tree plus
+ * however long the page is, wherever it starts and however many players there are.
+ *
+ * A client asks for a page with MSGTYPE_REQUEST_LOBBY, laid out like so (numbers are in Motorola byte order):
+ *
+ *      [cmd] [sort key] [where the page starts, 4 bytes] [how many to a page] [the version it's got, 4 bytes]
+ *
+ * (leaving off the end of that gets the first, biggest page there is, by name, from scratch).  That also
+ * subscribes it to the page: for as long as it stays in the lobby, whenever the page changes during a trip around
+ * the reactor loop, the client's told what's different at the end of that trip, so there's no need for it to
+ * ever ask again unless it wants a different page.  A whole page goes out as:
+ *
+ *      [cmd] [sort key] [where it starts, 4 bytes] [how many players there are in all, 4 bytes]
+ *      [its version, 4 bytes] [a LOBBY_LIST_RECORD_SIZE record per player on the page...]
+ *
+ * and that's what a client gets if it hasn't got the page, or is too far behind on it for the shard to remember
+ * what's changed since.  Otherwise, it gets a MSGTYPE_LOBBY_CHANGES:
+ *
+ *      [cmd] [sort key] [where it starts, 4 bytes] [how many players there are in all, 4 bytes]
+ *      [the version it's from, 4 bytes] [the version it's to, 4 bytes]
+ *      [for each row that's different: the row, then its LOBBY_LIST_RECORD_SIZE record...]
+ *
+ * Players joining, leaving and having their stats change all come down to rows that are different.  The page
+ * is however many players there are from where it starts, up to how many to a page; anything past the end of
+ * it isn't on it any more, and doesn't get a row of its own.
+ *
+ * Every shard puts each page that its players are looking at together the once per trip around the loop,
+ * however many of them are looking at it, and everyone who was up to date gets sent the same frame.
+ */
+#ifndef         LOBBY_H
+    #define     LOBBY_H
+
+    #include    "tictactwo-common.h"
+    #include    "player_db.h"
+
+    void        LOBBY_init(void);
+    void        LOBBY_join(const PLAYER_STRUCT *ps);
+    void        LOBBY_update(const PLAYER_STRUCT *ps);
+    void        LOBBY_leave(const PLAYER_STRUCT *ps);
+    void        LOBBY_subscribe(PLAYER_STRUCT *ps, uint8_t sort_key, uint32_t first, uint8_t count,
+                    uint32_t seen_version);
+    void        LOBBY_unsubscribe(PLAYER_STRUCT *ps);
+
+#endif
@@ -2,31 +2,69 @@
 #include "active-player-manager.h"
 #include "player_db.h"
 #include "gameroom.h"
+#include "reactor.h"
+#include "connection.h"
+#include "shard.h"
 
-#define     SAVE_STATS_INTERVAL     120 // every 30 seconds
+#define     SAVE_STATS_INTERVAL_MS  30000 // every 30 seconds, see if the journal's worth folding in (or checkpoint)
 
-int main(void)
+/*! \brief The reactor timer that periodically writes the player stats out (if enough has changed); only shard 0
+ * has one.
+ */
+static __thread RCTR_TIMER main_save_stats_timer;
+
+/*! \brief The reactor timer that periodically logs the shard's running totals. */
+static __thread RCTR_TIMER main_log_stats_timer;
+
+/****************************************************************************************************************/
+/*! \brief Reactor callback to save the player stats. */
+static void MAIN_save_stats(void *unused)
 {
-    int save_stats_clock = 0;
+    PLYRDB_compact();
+}
 
-    if(!SERVER_init()) return 1;
+/****************************************************************************************************************/
+/*! \brief Reactor callback to log the shard's running totals. */
+static void MAIN_log_stats(void *unused)
+{
+    SERVER_log_stats();
+}
+
+/****************************************************************************************************************/
+/*! \brief What every shard runs: sets up its own share of the server and runs its reactor.  Never returns. */
+static void MAIN_run_shard(void)
+{
+    if(!SERVER_listen()) exit(1);
+    if(!RCTR_init(server_config.io_backend)) exit(1);
+    CONN_init();
     PLYRMNGR_init();
     GMRM_init();
+    PLYRDB_init();  // last, so its batch hook runs first, and results are on disk before anyone's told about them
+    SHARD_attach();
 
-    while(TRUE)
+    if (SHARD_self() == 0)
     {
-        save_stats_clock++;
-
-        if (save_stats_clock >= SAVE_STATS_INTERVAL)
-        {
-            save_stats_clock = 0;
-            PLYRDB_save_to_disk();
-        }
+        RCTR_add_timer(&main_save_stats_timer, SAVE_STATS_INTERVAL_MS, MAIN_save_stats, NULL);
 
-        PLYRMNGR_tick();
-        GMRM_tick_all();
-        usleep(250000);
+        // signals land on shard 0; this is where they get acted on, once it's safe to
+        SERVER_watch_for_shutdown();
     }
 
+    RCTR_add_timer(&main_log_stats_timer, server_config.stats_interval_ms, MAIN_log_stats, NULL);
+
+    // from here on, everything happens in response to network traffic, timers or other shards
+    RCTR_run();
+}
+
+int main(int argc, char **argv)
+{
+    if(!SERVER_parse_args(argc, argv)) return 1;
+    if(!SERVER_init()) return 1;
+
+    // the player DB is shared by every shard, so it has to be ready before any of them start
+    PLYRDB_load_from_disk();
+
+    if(!SHARD_start(server_config.shard_count, server_config.pin_shards, MAIN_run_shard)) return 1;
+
     return 0;
 }
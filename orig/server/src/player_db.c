@@ -7,12 +7,85 @@
 
 #include    <stdio.h>
 #include    <malloc.h>
+#include    <pthread.h>
+#include    <errno.h>
+#include    <fcntl.h>
+#include    <unistd.h>
+#include    <sys/mman.h>
+#include    <sys/stat.h>
 #include    "player_db.h"
+#include    "reactor.h"
+#include    "server-common.h"
 
 /*! \brief The path to the on-disk backing file for the player list. */
 #define     PLAYERDB_FILE_PATH "./.tictac2_playerlist.db"
 /*! \brief The path to a backup so minimal stats are lost if something goes wrong. */
 #define     PLAYERDB_BKUP_PATH "./.tictac2_playerlist.db.bak"
+/*! \brief Where a new copy of the player list is written, before it takes the old one's place. */
+#define     PLAYERDB_TEMP_PATH "./.tictac2_playerlist.db.tmp"
+/*! \brief Where the old player list is linked while it's on its way to becoming the backup. */
+#define     PLAYERDB_BKUP_TEMP_PATH "./.tictac2_playerlist.db.bak.tmp"
+/*! \brief The path to the journal of what's changed since the player list was last written out. */
+#define     PLAYERDB_JOURNAL_PATH       "./.tictac2_playerlist.journal"
+/*! \brief Where the journal goes while the player list's being written out, until it's safely on disk. */
+#define     PLAYERDB_OLD_JOURNAL_PATH   "./.tictac2_playerlist.journal.old"
+/*! \brief The path to the player file, when the store's mapped in rather than journaled (see PLYRDB_map()). */
+#define     PLAYERDB_MAP_PATH       "./.tictac2_players.map"
+/*! \brief The path to the name index that goes with it, and where a bigger one's built before taking its place. */
+#define     PLAYERDB_INDEX_PATH     "./.tictac2_players.idx"
+#define     PLAYERDB_INDEX_TEMP_PATH "./.tictac2_players.idx.tmp"
+/*! \brief What the player file and its index start with, and which version of them this server writes. */
+#define     PLAYERDB_MAP_MAGIC      "TT2PLYRS"
+#define     PLAYERDB_INDEX_MAGIC    "TT2INDEX"
+#define     PLAYERDB_MAP_VERSION    1
+/*! \brief How big one player is on disk, in the player list, the journal and the player file alike: their name,
+ * padded out with NULLs, then wins, losses and ties, all stored in Motorola byte order.
+ */
+#define     PLAYERDB_RECORD_SIZE    (MAX_NAME_LENGTH + (3 * sizeof(uint32_t)))
+/*! \brief How many journal records a shard holds on to before it has to write them out, even if it's not at the
+ * end of a batch yet.
+ */
+#define     PLAYERDB_BATCH_RECORDS  64
+/*! \brief The journal's never worth folding into the player list before it's got this big... */
+#define     PLAYERDB_COMPACT_MIN_BYTES  (64 * 1024)
+/*! \brief ...or before it's this much of the size of the player list (as a divisor). */
+#define     PLAYERDB_COMPACT_RATIO  2
+/*! \brief How many slots the name index starts out with; it doubles whenever it gets half full. */
+#define     PLAYERDB_INDEX_MIN_SIZE 1024
+/*! \brief How many players each slab of the store holds, as a power of two. */
+#define     PLAYERDB_SLAB_SHIFT     12
+#define     PLAYERDB_SLAB_SIZE      (1 << PLAYERDB_SLAB_SHIFT)
+/*! \brief How many slabs the store can have, which caps it at sixteen million-odd players. */
+#define     PLAYERDB_MAX_SLABS      4096
+/*! \brief What an empty slot in the name index holds instead of an ID. */
+#define     PLAYERDB_NO_ID          0xFFFFFFFFU
+/*! \brief How much address space the player file's given, which is enough for as many players as the store can
+ * hold, so it never has to be mapped in anywhere else.
+ */
+#define     PLAYERDB_MAP_RESERVE    (sizeof(PLYRDB_FILE_HEADER) + \
+                                     ((size_t)PLAYERDB_MAX_SLABS * PLAYERDB_SLAB_SIZE * PLAYERDB_RECORD_SIZE))
+
+/*! \brief What the player file and its index start with.  It's all chars, so it's laid out the same everywhere;
+ * the numbers are in Motorola byte order, like everything else on disk.
+ */
+typedef struct
+{
+    char            magic[8];
+    char            version[4];
+    /*! \brief How big each record after the header is: PLAYERDB_RECORD_SIZE, or a PLYRDB_INDEX_SLOT. */
+    char            record_size[4];
+    /*! \brief 0x01020304 as this machine lays it out, since the index's slots are kept as they are in memory. */
+    char            byte_order[4];
+    /*! \brief How many players there are. */
+    char            count[4];
+    /*! \brief How many slots the index has (the player file doesn't use this). */
+    char            slots[4];
+    /*! \brief Whether the index was put away properly when we last went down (the player file doesn't use this). */
+    char            clean[4];
+    /*! \brief Whether the player list and journals have been brought into the player file yet (likewise). */
+    char            imported[4];
+    char            reserved[28];
+} PLYRDB_FILE_HEADER;
 
 /*! \defgroup plyrdb_module_private
  * \brief Private functions and data internal to the player DB module.
@@ -22,13 +95,99 @@
 /*! \brief Tracks whether we've loaded the db or not - this needs to happen before we search or append... */
 static  BOOL    plyrdb_module_inited    = FALSE;
 
-/*! \brief The player list.*/
-static PLAYER_STRUCT *plyrdb_playerdb   = NULL;
+/*! \brief The player store: every player there is, in the order they were first seen, a slab at a time.  A
+ * player's ID is just where they are in it.  Slabs are only ever added, never moved or freed, so IDs and pointers
+ * to players both stay good for as long as the server's up (and the directory's a fixed size so other shards can
+ * look things up in it while one's being added).
+ *
+ * What's kept about each player is split in two.  The PLAYER_STRUCTs have everything that changes while they're
+ * playing; their names, which never change and are mostly only needed to find them by, live in slabs of their own
+ * alongside, so nothing that's just going through the stats has to drag those through the cache as well.
+ */
+static PLAYER_STRUCT *plyrdb_players[PLAYERDB_MAX_SLABS];
+static char (*plyrdb_names[PLAYERDB_MAX_SLABS])[MAX_NAME_LENGTH];
+
+/*! \brief How many players are in the store, which is also the ID the next one gets. */
+static uint32_t plyrdb_count            = 0;
+
+/*! \brief One slot in the name index.  The hash's kept alongside the ID, so a probe that lands on someone
+ * else can nearly always move on without going and looking at their name.
+ */
+typedef struct
+{
+    uint32_t        id;
+    uint32_t        hash;
+} PLYRDB_INDEX_SLOT;
+
+/*! \brief Every player, by name: an open-addressed table (with linear probing) whose size is always a power of
+ * two.  Nobody ever gets taken out of the store, so nothing ever gets taken out of this either.
+ */
+static PLYRDB_INDEX_SLOT *plyrdb_index  = NULL;
+static uint32_t plyrdb_index_size       = 0;
+
+/*! \brief Whether the store's mapped in (PLYRDB_STORE_MAPPED), rather than read in whole and journaled. */
+static BOOL plyrdb_mapped               = FALSE;
+
+/*! \brief The player file, mapped in: a header, then everyone's record, in ID order.  Wins, losses and ties are
+ * stored straight into it as games finish, and the kernel gets them onto the disk (or PLYRDB_checkpoint() does).
+ * The file's made longer a slab at a time as players are added (plyrdb_map_length is how long it is now); the
+ * mapping's as long as it can ever get, so it never moves, and names can point straight into it.
+ */
+static char *plyrdb_map                 = NULL;
+static int plyrdb_map_fd                = -1;
+static size_t plyrdb_map_length         = 0;
+
+/*! \brief Where the journal's open for appending. */
+static int plyrdb_journal_fd            = -1;
+
+/*! \brief How much has gone into the journal since it was last folded into the player list. */
+static uint64_t plyrdb_journal_bytes    = 0;
+
+/*! \brief Shards hold this for reading while they append to the journal (and wait for it to hit the disk), which
+ * they can all do at once; swapping in a new journal holds it for writing.
+ */
+static pthread_rwlock_t plyrdb_journal_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*! \brief This shard's journal records that haven't been written out yet. */
+static __thread char plyrdb_pending[PLAYERDB_BATCH_RECORDS * PLAYERDB_RECORD_SIZE];
+static __thread uint32_t plyrdb_pending_length = 0;
+
+/*! \brief Every shard shares the store, so anything that walks or changes it holds this.  It's recursive because
+ * the public functions call each other.
+ * \note It doesn't cover the win/loss/tie counters; only the shard the player's logged in on ever changes those,
+ *  and a save that catches one mid-game just writes it out as it was a moment earlier.
+ */
+static pthread_mutex_t plyrdb_lock      = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/*! \brief Where insertion actually happens. */
+static BOOL PLYRDB_insert_helper(PLAYER_STRUCT *tmp);
+
+static PLAYER_STRUCT *PLYRDB_new_record(void);
+
+static uint32_t PLYRDB_find_slot(const char *name, uint32_t hash);
+static BOOL PLYRDB_grow_index(void);
+static uint32_t PLYRDB_hash(const char *name);
+static void PLYRDB_commit(void *unused);
+static BOOL PLYRDB_replay(const char *path);
+static void PLYRDB_pack(char *out, const PLAYER_STRUCT *ps);
+static void PLYRDB_sync_dir(void);
+static void PLYRDB_store_counts(char *out, const PLAYER_STRUCT *ps);
 
-/*! \brief Where list insertion actually happens. */
-static void PLYRDB_insert_helper(PLAYER_STRUCT *tmp);
+static void PLYRDB_map(void);
+static BOOL PLYRDB_extend_map(uint32_t id);
+static char *PLYRDB_record(uint32_t id);
+static const char *PLYRDB_name(uint32_t id);
+static PLAYER_STRUCT *PLYRDB_materialize(uint32_t id);
+static void PLYRDB_checkpoint(void);
+static void PLYRDB_init_header(PLYRDB_FILE_HEADER *header, const char *magic, uint32_t record_size);
+static BOOL PLYRDB_check_header(const PLYRDB_FILE_HEADER *header, const char *magic, uint32_t record_size);
+static BOOL PLYRDB_open_index(void);
+static void PLYRDB_rebuild_index(void);
+static void PLYRDB_place(PLYRDB_INDEX_SLOT *index, uint32_t size, PLYRDB_INDEX_SLOT slot);
+static PLYRDB_INDEX_SLOT *PLYRDB_alloc_index(uint32_t size);
+static void PLYRDB_free_index(PLYRDB_INDEX_SLOT *index, uint32_t size);
 
-/*! \brief Frees up the memory used by the player list; designed to be called ONCE, on exit. */
+/*! \brief Frees up the memory used by the player store; designed to be called ONCE, on exit. */
 static void PLYRDB_cleanup(void);
 
 /*! \} */
@@ -40,47 +199,54 @@ static void PLYRDB_cleanup(void);
  */
 PLAYER_STRUCT *PLYRDB_find_by_name(const char *name)
 {
-    PLAYER_STRUCT *list_walk = NULL;
+    PLAYER_STRUCT *found = NULL;
+
+    pthread_mutex_lock(&plyrdb_lock);
 
     if (!plyrdb_module_inited)
     {
         PLYRDB_load_from_disk();
     }
 
-    // does it look like the player db list is empty?
-    if (plyrdb_playerdb != NULL)
+    // (there's no index at all until someone's been added)
+    if (plyrdb_index != NULL)
     {
-        list_walk = plyrdb_playerdb;
+        uint32_t id = plyrdb_index[PLYRDB_find_slot(name, PLYRDB_hash(name))].id;
 
-        while (list_walk != NULL)
-        {
-            // did we find 'em?
-            if (strcmp(name, list_walk->name) == 0)
-            {
-                // yep!
-                return list_walk;
-            }
-
-            list_walk = list_walk->next;
-        }
+        if (id != PLAYERDB_NO_ID)
+            found = PLYRDB_get(id);
     }
 
-    // nope, player list really is empty...
-    return list_walk;
+    pthread_mutex_unlock(&plyrdb_lock);
+
+    return found;
 }
 
 /****************************************************************************************************************/
-/*! \brief Loads the player db from disk.  If the file doesn't exist, it'll try to create it; if this fails, or
- * it has insufficient permissions, it terminates the program (as that's an unrecoverable state).
+/*! \brief Loads the player db from disk, then replays whatever the journal says has happened since it was written
+ * (or if the store's mapped, just maps it in; see PLYRDB_map()).  If the file doesn't exist, it'll try to create
+ * it; if this fails, or it has insufficient permissions, it terminates the program (as that's an unrecoverable
+ * state).
  * \note The db path is HARD-CODED, and whoever the server is running as MUST have permission to write to,
  * dir list, and read from wherever this gets executed.
  * \todo Accept a cmd line argument that tells us where the db file should live.
+ * \note main() calls this before any shards start; after that, it only ever gets called with plyrdb_lock held.
  */
 void PLYRDB_load_from_disk(void)
 {
+    BOOL replayed;
+
     if (plyrdb_module_inited) return;
 
     plyrdb_module_inited = TRUE;
+    plyrdb_mapped = (server_config.player_store == PLYRDB_STORE_MAPPED);
+
+    if (plyrdb_mapped)
+    {
+        PLYRDB_map();
+        atexit(PLYRDB_cleanup);
+        return;
+    }
 
     FILE *fin;
 
@@ -103,73 +269,106 @@ void PLYRDB_load_from_disk(void)
                     and try re-running the application.\n");
             exit(1);
         }
-        else
-        {
-            // we can read and write here, but there aren't any players (yet).
-            // notify the rest of the world...
-            plyrdb_module_inited = TRUE;
-            atexit(PLYRDB_cleanup);
-            plyrdb_playerdb = NULL;
-            fclose(fin);
-
-            // nothing else to do at this point.
-            return;
-        }
+
+        // we can read and write here, but there aren't any players (yet).
     }
-    else
+
+    fclose(fin);
+
+    // the player list's read just the same way as the journals are, as if everyone in it had just played
+    PLYRDB_replay(PLAYERDB_FILE_PATH);
+
+    // if there's an old journal, we went down partway through writing the list out last time
+    replayed = PLYRDB_replay(PLAYERDB_OLD_JOURNAL_PATH);
+    replayed = PLYRDB_replay(PLAYERDB_JOURNAL_PATH) || replayed;
+
+    plyrdb_journal_fd = open(PLAYERDB_JOURNAL_PATH, O_WRONLY | O_APPEND | O_CREAT, 0644);
+
+    if (plyrdb_journal_fd < 0)
     {
-        // we were able to open it - start reading player data.
-        // the format is:
-        // [0 ............... 29][30....33][34....37][38....41]
-        //   name, padded by       Wins     Losses     Ties
-        //   NULL bytes        all stored in Motorola byte order
-        while (!feof(fin))
-        {
-            PLAYER_STRUCT *tmp = (PLAYER_STRUCT *)malloc(sizeof(PLAYER_STRUCT));
+        OH_SMEG("\nCouldn't open the player journal (%s)!\n", strerror(errno));
+        exit(1);
+    }
 
-            if (tmp == NULL)
-            {
-                // on linux, it turns out you'll NEVER get here, since it'll occasionally lie about
-                // how much memory it has left, then cheerfully OOM-kill your process when you actually
-                // try to use it :^(
+    atexit(PLYRDB_cleanup);
 
-                OH_SMEG("\nWe may have possibly run out of memory while\n \
-                        loading the player list from disk.\n \
-                        Continuing, but bad things may happen from here on out...");
-                fclose(fin);
-                return;
-            }
-            else
-            {
-                bzero(tmp->name, MAX_NAME_LENGTH);
+    // fold in whatever the journals had in them now, so the old one's gone before anything can need its name
+    if (replayed)
+        PLYRDB_save_to_disk();
+}
 
-                // get name
-                fgets(tmp->name, MAX_NAME_LENGTH, fin);
-                fgetc(fin); // skip padding
+/****************************************************************************************************************/
+/*! \brief Reads every player in a file laid out like the player list (or a journal) into the store, adding them
+ * if they're not in it yet.
+ *
+ * Journal records hold a player's totals after a game, not how much they went up by, and totals only ever go up,
+ * so a record can be applied by keeping whichever's bigger of it and what's in the store already.  That makes
+ * it safe to apply the same one twice: if we went down just after writing the list out but before getting rid of
+ * the journal it had already taken in, replaying that journal again changes nothing.
+ * \return TRUE if there was anything in the file.
+ */
+static BOOL PLYRDB_replay(const char *path)
+{
+    char            record[PLAYERDB_RECORD_SIZE];
+    FILE            *fin    = fopen(path, "rb");
+    BOOL            found   = FALSE;
+    PLAYER_STRUCT   *tmp;
+    uint32_t        count;
+
+    if (fin == NULL)
+        return FALSE;
 
-                // get player stats (this part is kinda endian-specific)
-                tmp->games_won  = (fgetc(fin) << 24) | (fgetc(fin) << 16) | (fgetc(fin) << 8) | (fgetc(fin));
-                tmp->games_lost = (fgetc(fin) << 24) | (fgetc(fin) << 16) | (fgetc(fin) << 8) | (fgetc(fin));
-                tmp->games_tied = (fgetc(fin) << 24) | (fgetc(fin) << 16) | (fgetc(fin) << 8) | (fgetc(fin));
+    // (a record that's cut short was still being written when we went down, and never counted)
+    while (fread(record, PLAYERDB_RECORD_SIZE, 1, fin) == 1)
+    {
+        found = TRUE;
+        record[MAX_NAME_LENGTH - 1] = 0;
 
-                tmp->state      = GAMESTATE_NOT_CONNECTED;
-            }
+        // older servers would leave a blank player on the end of the list
+        if (record[0] == 0)
+            continue;
 
-            // filled out structure, insert it in the proper place in the list...
-            PLYRDB_insert_helper(tmp);
+        tmp = PLYRDB_create_new_player(record);
 
-        } // end while not end-of-file
+        if (tmp == NULL)
+        {
+            // on linux, it turns out you'll NEVER get here, since it'll occasionally lie about
+            // how much memory it has left, then cheerfully OOM-kill your process when you actually
+            // try to use it :^(
+
+            OH_SMEG("\nWe may have possibly run out of memory while\n \
+                    loading the player list from disk.\n \
+                    Continuing, but bad things may happen from here on out...");
+            break;
+        }
 
-        // should be done by the time we get here, so...
-        fclose(fin);
+        count = PROTO_get_u32(&record[MAX_NAME_LENGTH]);
+        if (count > tmp->games_won) tmp->games_won = count;
+
+        count = PROTO_get_u32(&record[MAX_NAME_LENGTH + sizeof(uint32_t)]);
+        if (count > tmp->games_lost) tmp->games_lost = count;
+
+        count = PROTO_get_u32(&record[MAX_NAME_LENGTH + (2 * sizeof(uint32_t))]);
+        if (count > tmp->games_tied) tmp->games_tied = count;
+
+        tmp->state = GAMESTATE_NOT_CONNECTED;
+
+        if (plyrdb_mapped)
+            PLYRDB_store_counts((char *)tmp->name, tmp);
     }
 
-    atexit(PLYRDB_cleanup);
-    return;
+    fclose(fin);
+
+    return found;
 }
 
 /****************************************************************************************************************/
-/*! \brief Serialize and save all players in the list out to disk.
+/*! \brief Serialize and save all players in the list out to disk, and start the journal over.
+ *
+ * The journal's moved aside first, so whatever's added from here on goes in a new one.  The list's written out to
+ * a file of its own and synced, and only then renamed over the old one, which is kept as the backup; so whatever
+ * happens, there's always a whole list on disk under its usual name.  Once the new one's there, the old journal
+ * can go: everything in it happened before we started, so it's all in the list.
  * \note The db path is HARD-CODED, and whoever the server is running as MUST have permission to write to,
  * dir list, and read from wherever this gets executed.
  * \bug Vulnerable to race condition: someone could change the permissions while the program is running, and
@@ -178,45 +377,238 @@ void PLYRDB_load_from_disk(void)
  */
 void PLYRDB_save_to_disk(void)
 {
+    pthread_mutex_lock(&plyrdb_lock);
+
     if (!plyrdb_module_inited)
         PLYRDB_load_from_disk();
 
-    char buf[1024];
+    // a mapped store's already got everything in the file; it just has to be made to stick
+    if (plyrdb_mapped)
+    {
+        PLYRDB_checkpoint();
+        pthread_mutex_unlock(&plyrdb_lock);
+        return;
+    }
+
+    // (if there's an old journal still, the last save didn't make it; the current one just carries on, and it's
+    // fine if some of what's in it ends up in the list as well)
+    pthread_rwlock_wrlock(&plyrdb_journal_lock);
+
+    if (access(PLAYERDB_OLD_JOURNAL_PATH, F_OK) != 0)
+    {
+        int new_fd;
+
+        rename(PLAYERDB_JOURNAL_PATH, PLAYERDB_OLD_JOURNAL_PATH);
+        new_fd = open(PLAYERDB_JOURNAL_PATH, O_WRONLY | O_APPEND | O_CREAT, 0644);
 
-    snprintf(buf, 1023, "cp %s %s", PLAYERDB_FILE_PATH, PLAYERDB_BKUP_PATH);
-    system(buf);
+        if (new_fd < 0)
+        {
+            // carry on with the old one under its new name; it'll be replayed either way
+            OH_SMEG("Couldn't start a new player journal (%s); the old one's staying put.", strerror(errno));
+            rename(PLAYERDB_OLD_JOURNAL_PATH, PLAYERDB_JOURNAL_PATH);
+        }
+        else
+        {
+            close(plyrdb_journal_fd);
+            plyrdb_journal_fd = new_fd;
+            PLYRDB_sync_dir();
+        }
+    }
 
-    FILE *fout;
+    __atomic_store_n(&plyrdb_journal_bytes, 0, __ATOMIC_RELAXED);
+    pthread_rwlock_unlock(&plyrdb_journal_lock);
 
-    PLAYER_STRUCT *list_walk = plyrdb_playerdb;
+    FILE        *fout;
+    uint32_t    id;
+    char        record[PLAYERDB_RECORD_SIZE];
+    BOOL        written;
 
-    fout = fopen(PLAYERDB_FILE_PATH, "wb");
+    fout = fopen(PLAYERDB_TEMP_PATH, "wb");
 
     if (fout == NULL)
     {
         OH_SMEG("Could not write to player db file!\nGonna continue, but saved stats are being lost...");
+        pthread_mutex_unlock(&plyrdb_lock);
+        return;
+    }
+
+    // straight through the store, a slab at a time
+    for (id = 0; id < plyrdb_count; id++)
+    {
+        PLYRDB_pack(record, &plyrdb_players[id >> PLAYERDB_SLAB_SHIFT][id & (PLAYERDB_SLAB_SIZE - 1)]);
+        fwrite(record, PLAYERDB_RECORD_SIZE, 1, fout);
+    }
+
+    written = (fflush(fout) == 0) && (fsync(fileno(fout)) == 0) && !ferror(fout);
+    written = (fclose(fout) == 0) && written;
+
+    if (!written)
+    {
+        OH_SMEG("Couldn't get the player list onto the disk (%s); keeping the old one.", strerror(errno));
+        unlink(PLAYERDB_TEMP_PATH);
+        pthread_mutex_unlock(&plyrdb_lock);
+        return;
+    }
+
+    // the list we're about to replace becomes the backup: it's linked under a name of its own, then that's
+    // renamed over the last backup, so there's never a moment without one
+    unlink(PLAYERDB_BKUP_TEMP_PATH);
+
+    if (link(PLAYERDB_FILE_PATH, PLAYERDB_BKUP_TEMP_PATH) == 0)
+        rename(PLAYERDB_BKUP_TEMP_PATH, PLAYERDB_BKUP_PATH);
+
+    if (rename(PLAYERDB_TEMP_PATH, PLAYERDB_FILE_PATH) != 0)
+    {
+        OH_SMEG("Couldn't put the new player list in place (%s); keeping the old one.", strerror(errno));
+        pthread_mutex_unlock(&plyrdb_lock);
+        return;
+    }
+
+    PLYRDB_sync_dir();
+
+    // the old journal can't go until we know the list's really there
+    unlink(PLAYERDB_OLD_JOURNAL_PATH);
+    PLYRDB_sync_dir();
+
+    pthread_mutex_unlock(&plyrdb_lock);
+}
+
+/****************************************************************************************************************/
+/*! \brief Writes the list out if the journal's got big enough to be worth folding in: big enough that replaying
+ * it would take a good part of what reading the list does.  That way, what saving costs goes with how much is
+ * being played, not how many players there are.  A mapped store has no journal, and is just checkpointed.
+ */
+void PLYRDB_compact(void)
+{
+    uint64_t journal = __atomic_load_n(&plyrdb_journal_bytes, __ATOMIC_RELAXED);
+
+    if (plyrdb_mapped)
+    {
+        PLYRDB_checkpoint();
         return;
     }
 
-    while (list_walk != NULL)
+    if ((journal < PLAYERDB_COMPACT_MIN_BYTES) ||
+        (journal * PLAYERDB_COMPACT_RATIO < (uint64_t)__atomic_load_n(&plyrdb_count, __ATOMIC_RELAXED) * PLAYERDB_RECORD_SIZE))
+        return;
+
+    DUH_WHERE_AM_I("folding %llu bytes of journal into the player list", (unsigned long long)journal);
+    PLYRDB_save_to_disk();
+}
+
+/****************************************************************************************************************/
+/*! \brief Sets up this shard's share of the journal; every shard calls it once, at start-up.
+ * \note Batch hooks run newest first, so this has to come after every module that sends from a hook of its own
+ *  (see RCTR_add_batch_hook()); that way the journal's synced before anyone hears how their game went.
+ */
+void PLYRDB_init(void)
+{
+    // whatever games finish during a trip around the loop are written out, and waited for, at the end of it (a
+    // mapped store has nothing to write out; its records are changed where they are)
+    if (!plyrdb_mapped)
+        RCTR_add_batch_hook(PLYRDB_commit, NULL);
+}
+
+/****************************************************************************************************************/
+/*! \brief Adds the outcome of a game to a player's totals, and journals it.  It's written out at the end of
+ * the current batch, along with anything else that happens in it, with one fdatasync() for the lot; so if we go
+ * down, the most that can be lost is the one batch.
+ *
+ * If the store's mapped, the totals are just stored into the player's record instead.  They're in the page cache
+ * from then on, so the server going down loses nothing; the machine going down can lose whatever's happened since
+ * the last checkpoint.
+ * \note Only the shard the player's logged in on calls this.
+ */
+void PLYRDB_count_game(PLAYER_STRUCT *ps, uint32_t won, uint32_t lost, uint32_t tied)
+{
+    ps->games_won   += won;
+    ps->games_lost  += lost;
+    ps->games_tied  += tied;
+
+    if (plyrdb_mapped)
     {
-        int tmp;
-        fwrite(list_walk->name, MAX_NAME_LENGTH, 1, fout);
+        PLYRDB_store_counts((char *)ps->name, ps);
+        return;
+    }
 
-        tmp = htonl(list_walk->games_won);
-        fwrite(&tmp, sizeof(uint32_t), 1, fout);
+    if (plyrdb_pending_length + PLAYERDB_RECORD_SIZE > sizeof(plyrdb_pending))
+        PLYRDB_commit(NULL);
 
-        tmp = htonl(list_walk->games_lost);
-        fwrite(&tmp, sizeof(uint32_t), 1, fout);
+    PLYRDB_pack(&plyrdb_pending[plyrdb_pending_length], ps);
+    plyrdb_pending_length += PLAYERDB_RECORD_SIZE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor at the end of every batch: writes out whatever this shard's journaled in it, and
+ * waits for it to hit the disk.
+ */
+static void PLYRDB_commit(void *unused)
+{
+    ssize_t     result;
+    uint32_t    written = 0;
+
+    if (plyrdb_pending_length == 0)
+        return;
 
-        tmp = htonl(list_walk->games_tied);
-        fwrite(&tmp, sizeof(uint32_t), 1, fout);
+    pthread_rwlock_rdlock(&plyrdb_journal_lock);
 
-        list_walk = list_walk->next;
+    // (it's opened for appending, so the shards' records don't tread on each other)
+    while (written < plyrdb_pending_length)
+    {
+        result = write(plyrdb_journal_fd, &plyrdb_pending[written], plyrdb_pending_length - written);
+
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // the totals are still right in memory, and the next save will have them
+            OH_SMEG("Couldn't write to the player journal (%s).", strerror(errno));
+            break;
+        }
+
+        written += result;
     }
 
-    fflush(fout);
-    fclose(fout);
+    if (fdatasync(plyrdb_journal_fd) != 0)
+        OH_SMEG("Couldn't sync the player journal (%s).", strerror(errno));
+
+    pthread_rwlock_unlock(&plyrdb_journal_lock);
+
+    __atomic_add_fetch(&plyrdb_journal_bytes, written, __ATOMIC_RELAXED);
+    plyrdb_pending_length = 0;
+}
+
+/****************************************************************************************************************/
+/*! \brief Lays a player out the way they're stored on disk (see PLAYERDB_RECORD_SIZE).
+ */
+static void PLYRDB_pack(char *out, const PLAYER_STRUCT *ps)
+{
+    memcpy(out, ps->name, MAX_NAME_LENGTH);
+    PLYRDB_store_counts(out, ps);
+}
+
+/****************************************************************************************************************/
+/*! \brief Lays out a player's wins, losses and ties after the name in a record that's laid out like that.
+ */
+static void PLYRDB_store_counts(char *out, const PLAYER_STRUCT *ps)
+{
+    PROTO_put_u32(&out[MAX_NAME_LENGTH], ps->games_won);
+    PROTO_put_u32(&out[MAX_NAME_LENGTH + sizeof(uint32_t)], ps->games_lost);
+    PROTO_put_u32(&out[MAX_NAME_LENGTH + (2 * sizeof(uint32_t))], ps->games_tied);
+}
+
+/****************************************************************************************************************/
+/*! \brief Makes sure files we've just made, renamed or deleted in the current directory stay that way. */
+static void PLYRDB_sync_dir(void)
+{
+    int fd = open(".", O_RDONLY | O_DIRECTORY);
+
+    if (fd < 0)
+        return;
+
+    fsync(fd);
+    close(fd);
 }
 
 /****************************************************************************************************************/
@@ -228,90 +620,643 @@ PLAYER_STRUCT * PLYRDB_create_new_player(const char *name)
 {
     PLAYER_STRUCT *tmp;
 
+    // hold the lock from the check right through to the insert, so two shards logging in the same new name at
+    // once can't both add it
+    pthread_mutex_lock(&plyrdb_lock);
+
     // check if this name's in there already
     tmp = PLYRDB_find_by_name(name);
 
     if (tmp != NULL)
     {
         // player exists already, just return them
+        pthread_mutex_unlock(&plyrdb_lock);
         return tmp;
     }
 
     // if we're here, this player didn't exist yet; create them
-    tmp = (PLAYER_STRUCT *)malloc(sizeof(PLAYER_STRUCT));
+    tmp = PLYRDB_new_record();
 
     // did we have trouble while allocating the player?
     if (tmp == NULL)
     {
-        OH_SMEG("failed to allocate %d bytes - the server may encounter problems later...",
-            sizeof(PLAYER_STRUCT));
-        return FALSE;
+        OH_SMEG("couldn't make room for player %u - the server may encounter problems later...", plyrdb_count);
+        pthread_mutex_unlock(&plyrdb_lock);
+        return NULL;
+    }
+
+    strncpy((char *)tmp->name, name, MAX_NAME_LENGTH - 1);
+
+    if (!PLYRDB_insert_helper(tmp))
+        tmp = NULL;
+
+    pthread_mutex_unlock(&plyrdb_lock);
+
+    return tmp;
+}
+
+/****************************************************************************************************************/
+/*! \brief Finds a player by their ID.
+ * \return The player, or NULL if there's nobody with that ID (yet).
+ * \note IDs are handed out in order and never reused, so once there's someone with a given ID, it's always them.
+ */
+PLAYER_STRUCT *PLYRDB_get(uint32_t id)
+{
+    PLAYER_STRUCT *players;
+
+    if (id >= __atomic_load_n(&plyrdb_count, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    players = __atomic_load_n(&plyrdb_players[id >> PLAYERDB_SLAB_SHIFT], __ATOMIC_ACQUIRE);
+
+    // (a mapped store only brings players in from the file the first time they're asked for)
+    if ((players != NULL) && (__atomic_load_n(&players[id & (PLAYERDB_SLAB_SIZE - 1)].name, __ATOMIC_ACQUIRE) != NULL))
+        return &players[id & (PLAYERDB_SLAB_SIZE - 1)];
+
+    return PLYRDB_materialize(id);
+}
+
+/****************************************************************************************************************/
+/*! \brief Makes a blank record at the end of the store, adding a slab if that's what it takes.  Nothing's
+ * committed to until PLYRDB_insert_helper() takes it; if that doesn't happen, the next one made just reuses it.
+ * \return The record, with its ID and name filled in (the name's all NULLs, ready to be written over), or NULL if
+ *  we're out of memory (or disk) or the store's full.
+ */
+static PLAYER_STRUCT *PLYRDB_new_record(void)
+{
+    uint32_t        id      = plyrdb_count;
+    uint32_t        slab    = id >> PLAYERDB_SLAB_SHIFT;
+    PLAYER_STRUCT   *tmp;
+    char            *name;
+
+    if (slab >= PLAYERDB_MAX_SLABS)
+        return NULL;
+
+    // a mapped store's names are in the player file, so there's no slab of them
+    if ((plyrdb_players[slab] == NULL) || (!plyrdb_mapped && (plyrdb_names[slab] == NULL)))
+    {
+        PLAYER_STRUCT   *players    = plyrdb_players[slab];
+        char            (*names)[MAX_NAME_LENGTH] = NULL;
+
+        if (players == NULL)
+            players = (PLAYER_STRUCT *)calloc(PLAYERDB_SLAB_SIZE, sizeof(PLAYER_STRUCT));
+
+        if (!plyrdb_mapped)
+            names = calloc(PLAYERDB_SLAB_SIZE, MAX_NAME_LENGTH);
+
+        if ((players == NULL) || (!plyrdb_mapped && (names == NULL)))
+        {
+            if (players != plyrdb_players[slab])
+                free(players);
+            free(names);
+            return NULL;
+        }
+
+        plyrdb_names[slab] = names;
+        __atomic_store_n(&plyrdb_players[slab], players, __ATOMIC_RELEASE);
+    }
+
+    if (plyrdb_mapped)
+    {
+        if (!PLYRDB_extend_map(id))
+            return NULL;
+
+        name = PLYRDB_record(id);
+        bzero(name, PLAYERDB_RECORD_SIZE);
+    }
+    else
+    {
+        name = plyrdb_names[slab][id & (PLAYERDB_SLAB_SIZE - 1)];
+        bzero(name, MAX_NAME_LENGTH);
     }
 
+    tmp = &plyrdb_players[slab][id & (PLAYERDB_SLAB_SIZE - 1)];
+
     bzero(tmp, sizeof(PLAYER_STRUCT));
 
-    strncpy(tmp->name, name, MAX_NAME_LENGTH - 1);
-    PLYRDB_insert_helper(tmp);
+    tmp->id         = id;
+    tmp->name       = name;
+    tmp->shard_id   = -1;
 
     return tmp;
 }
 
 /****************************************************************************************************************/
-/*! \brief A helper function to append a new player to the list. Should be considered module-private.
+/*! \brief A helper function to commit the record PLYRDB_new_record() just made, and put it in the name index.
+ * Should be considered module-private.
+ * \return FALSE if it couldn't be added.
+ */
+static BOOL PLYRDB_insert_helper(PLAYER_STRUCT *tmp)
+{
+    uint32_t hash = PLYRDB_hash(tmp->name);
+    uint32_t slot;
+
+    // make sure there's room for one more first, so there's always a free slot for the search to stop at
+    if (((plyrdb_count + 1) * 2 > plyrdb_index_size) && !PLYRDB_grow_index())
+        return FALSE;
+
+    slot = PLYRDB_find_slot(tmp->name, hash);
+
+    if (plyrdb_index[slot].id != PLAYERDB_NO_ID)
+    {
+        OH_SMEG("\nConstraint failure - we shouldn't have gotten asked to insert this player a second time...");
+        return FALSE;
+    }
+
+    plyrdb_index[slot].id   = tmp->id;
+    plyrdb_index[slot].hash = hash;
+
+    // (the record's in the file already; counting it is what makes it part of the store)
+    if (plyrdb_mapped)
+        PROTO_put_u32(((PLYRDB_FILE_HEADER *)plyrdb_map)->count, plyrdb_count + 1);
+
+    // (other shards can look people up by ID without the lock, so they mustn't see this before the record)
+    __atomic_store_n(&plyrdb_count, plyrdb_count + 1, __ATOMIC_RELEASE);
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Finds the slot in the name index that has the named player in it, or the empty one where they'd go.
+ * \param hash The name's PLYRDB_hash(), which the caller's usually worked out already.
+ * \note The index has to exist, and have at least one empty slot.
+ */
+static uint32_t PLYRDB_find_slot(const char *name, uint32_t hash)
+{
+    uint32_t mask       = plyrdb_index_size - 1;
+    uint32_t position   = hash & mask;
+
+    while (plyrdb_index[position].id != PLAYERDB_NO_ID)
+    {
+        if ((plyrdb_index[position].hash == hash) && (strcmp(name, PLYRDB_name(plyrdb_index[position].id)) == 0))
+            break;
+
+        position = (position + 1) & mask;
+    }
+
+    return position;
+}
+
+/****************************************************************************************************************/
+/*! \brief Doubles the size of the name index (or makes it, if there isn't one yet), and puts everyone back in.
+ * \return FALSE if we're out of memory, in which case the old index is left as it was.
  */
-static void PLYRDB_insert_helper(PLAYER_STRUCT *tmp)
+static BOOL PLYRDB_grow_index(void)
 {
-    PLAYER_STRUCT *list_walk        = plyrdb_playerdb;
-    PLAYER_STRUCT *list_walk_prev   = plyrdb_playerdb;
+    PLYRDB_INDEX_SLOT   *old_index  = plyrdb_index;
+    uint32_t            old_size    = plyrdb_index_size;
+    uint32_t            new_size    = (old_size == 0) ? PLAYERDB_INDEX_MIN_SIZE : old_size * 2;
+    uint32_t            index;
 
-    // ...was the list empty?
-    if (plyrdb_playerdb == NULL)
+    plyrdb_index = PLYRDB_alloc_index(new_size);
+
+    if (plyrdb_index == NULL)
     {
-        // yep, we get to be first in line :^D
-        plyrdb_playerdb =   tmp;
-        tmp->next       =   NULL;
-        tmp->prev       =   NULL;
+        OH_SMEG("Out of memory growing the player index past %u players.", plyrdb_count);
+        plyrdb_index = old_index;
+        return FALSE;
     }
+
+    plyrdb_index_size = new_size;
+
+    // the hashes are all still good, so this doesn't have to look at a single name
+    for (index = 0; index < old_size; index++)
+    {
+        if (old_index[index].id != PLAYERDB_NO_ID)
+            PLYRDB_place(plyrdb_index, new_size, old_index[index]);
+    }
+
+    PLYRDB_free_index(old_index, old_size);
+
+    // (a mapped store's index was built off to one side, and only now takes the old one's place)
+    if (plyrdb_mapped)
+        rename(PLAYERDB_INDEX_TEMP_PATH, PLAYERDB_INDEX_PATH);
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts a slot into the first empty one at or after where its hash would like it to be.
+ */
+static void PLYRDB_place(PLYRDB_INDEX_SLOT *index, uint32_t size, PLYRDB_INDEX_SLOT slot)
+{
+    uint32_t position = slot.hash & (size - 1);
+
+    while (index[position].id != PLAYERDB_NO_ID)
+        position = (position + 1) & (size - 1);
+
+    index[position] = slot;
+}
+
+/****************************************************************************************************************/
+/*! \brief Makes an empty name index with the given number of slots: just memory, for a journaled store, or a
+ * file of its own for a mapped one, at PLAYERDB_INDEX_TEMP_PATH until whoever asked for it renames it into place.
+ * \return The index, or NULL if there wasn't room for it.
+ */
+static PLYRDB_INDEX_SLOT *PLYRDB_alloc_index(uint32_t size)
+{
+    PLYRDB_INDEX_SLOT   *index;
+    uint32_t            slot;
+
+    if (!plyrdb_mapped)
+        index = (PLYRDB_INDEX_SLOT *)malloc(size * sizeof(PLYRDB_INDEX_SLOT));
     else
     {
-        // nope, find correct place
-        int name_comparison = (strcmp(tmp->name, ((PLAYER_STRUCT *)list_walk)->name));
+        size_t  length  = sizeof(PLYRDB_FILE_HEADER) + ((size_t)size * sizeof(PLYRDB_INDEX_SLOT));
+        char    *mapped = MAP_FAILED;
+        int     fd      = open(PLAYERDB_INDEX_TEMP_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+        if ((fd >= 0) && (posix_fallocate(fd, 0, length) == 0))
+            mapped = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (fd >= 0)
+            close(fd);
+
+        if (mapped == MAP_FAILED)
+            return NULL;
+
+        PLYRDB_init_header((PLYRDB_FILE_HEADER *)mapped, PLAYERDB_INDEX_MAGIC, sizeof(PLYRDB_INDEX_SLOT));
+        PROTO_put_u32(((PLYRDB_FILE_HEADER *)mapped)->slots, size);
+
+        index = (PLYRDB_INDEX_SLOT *)&mapped[sizeof(PLYRDB_FILE_HEADER)];
+    }
+
+    if (index == NULL)
+        return NULL;
+
+    for (slot = 0; slot < size; slot++)
+        index[slot].id = PLAYERDB_NO_ID;
+
+    return index;
+}
+
+/****************************************************************************************************************/
+/*! \brief Gets rid of a name index PLYRDB_alloc_index() made (which a mapped store's leaves in its file).
+ */
+static void PLYRDB_free_index(PLYRDB_INDEX_SLOT *index, uint32_t size)
+{
+    if (index == NULL)
+        return;
+
+    if (!plyrdb_mapped)
+        free(index);
+    else
+        munmap((char *)index - sizeof(PLYRDB_FILE_HEADER),
+            sizeof(PLYRDB_FILE_HEADER) + ((size_t)size * sizeof(PLYRDB_INDEX_SLOT)));
+}
+
+/****************************************************************************************************************/
+/*! \brief Where in the name index a player would like to be (FNV-1a).
+ */
+static uint32_t PLYRDB_hash(const char *name)
+{
+    uint32_t hash = 2166136261U;
+
+    while (*name != 0)
+    {
+        hash ^= (uint8_t)*name++;
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+/****************************************************************************************************************/
+/*! \brief Maps the player file in, making it if there isn't one yet; see plyrdb_map.
+ *
+ * Nothing's read from it here but the header, and the index is mapped in as it is, so this takes the same time
+ * however many players there are.  The index is only a cache, though: if the server didn't get to put it away
+ * properly last time, it's built again from the names in the file, which does take longer the more there are.
+ *
+ * The first time round, whatever the journaled store had is brought in (see PLYRDB_replay(); doing it twice is
+ * harmless, so it doesn't matter if we go down partway through).  Its files are left where they are.
+ */
+static void PLYRDB_map(void)
+{
+    struct stat         info;
+    PLYRDB_FILE_HEADER  *header;
+
+    plyrdb_map_fd = open(PLAYERDB_MAP_PATH, O_RDWR | O_CREAT, 0644);
+
+    if ((plyrdb_map_fd < 0) || (fstat(plyrdb_map_fd, &info) != 0))
+    {
+        OH_SMEG("\nCouldn't open the player file (%s)!\n", strerror(errno));
+        exit(1);
+    }
+
+    plyrdb_map_length = info.st_size;
+
+    if ((plyrdb_map_length == 0) && (posix_fallocate(plyrdb_map_fd, 0, sizeof(PLYRDB_FILE_HEADER)) != 0))
+    {
+        OH_SMEG("\nCouldn't make a new player file!\n");
+        exit(1);
+    }
+
+    // (past the end of the file, it's just address space until the file's made longer)
+    plyrdb_map = mmap(NULL, PLAYERDB_MAP_RESERVE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE,
+        plyrdb_map_fd, 0);
+
+    if (plyrdb_map == MAP_FAILED)
+    {
+        OH_SMEG("\nCouldn't map in the player file (%s)!\n", strerror(errno));
+        exit(1);
+    }
+
+    header = (PLYRDB_FILE_HEADER *)plyrdb_map;
+
+    if (plyrdb_map_length == 0)
+    {
+        plyrdb_map_length = sizeof(PLYRDB_FILE_HEADER);
+        PLYRDB_init_header(header, PLAYERDB_MAP_MAGIC, PLAYERDB_RECORD_SIZE);
+    }
+    else if ((plyrdb_map_length < sizeof(PLYRDB_FILE_HEADER)) ||
+        !PLYRDB_check_header(header, PLAYERDB_MAP_MAGIC, PLAYERDB_RECORD_SIZE) ||
+        (PROTO_get_u32(header->count) > (plyrdb_map_length - sizeof(PLYRDB_FILE_HEADER)) / PLAYERDB_RECORD_SIZE))
+    {
+        // it's somebody's stats, so it's not ours to write over
+        OH_SMEG("\n%s isn't a player file this server knows how to read!\n", PLAYERDB_MAP_PATH);
+        exit(1);
+    }
+
+    plyrdb_count = PROTO_get_u32(header->count);
+
+    if (!PLYRDB_open_index())
+        PLYRDB_rebuild_index();
+
+    if (PROTO_get_u32(header->imported) == 0)
+    {
+        PLYRDB_replay(PLAYERDB_FILE_PATH);
+        PLYRDB_replay(PLAYERDB_OLD_JOURNAL_PATH);
+        PLYRDB_replay(PLAYERDB_JOURNAL_PATH);
+
+        // (everything that's been brought in has to be on the disk before we say it has)
+        PLYRDB_checkpoint();
+        PROTO_put_u32(header->imported, 1);
+        PLYRDB_checkpoint();
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Makes sure the player file's long enough to hold the given player's record, making it a slab longer if
+ * it isn't.  The space is allocated on the disk up front, so storing into the record can't fail later on.
+ * \return FALSE if there wasn't room.
+ */
+static BOOL PLYRDB_extend_map(uint32_t id)
+{
+    size_t  wanted  = sizeof(PLYRDB_FILE_HEADER) + (((size_t)id + 1) * PLAYERDB_RECORD_SIZE);
+    size_t  length  = sizeof(PLYRDB_FILE_HEADER) +
+                      ((size_t)((id >> PLAYERDB_SLAB_SHIFT) + 1) * PLAYERDB_SLAB_SIZE * PLAYERDB_RECORD_SIZE);
+    int     result;
+
+    if (wanted <= plyrdb_map_length)
+        return TRUE;
+
+    result = posix_fallocate(plyrdb_map_fd, 0, length);
+
+    if (result != 0)
+    {
+        OH_SMEG("Couldn't make the player file any longer (%s).", strerror(result));
+        return FALSE;
+    }
+
+    plyrdb_map_length = length;
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Where a player's record is in the player file, which has to be mapped in.
+ */
+static char *PLYRDB_record(uint32_t id)
+{
+    return &plyrdb_map[sizeof(PLYRDB_FILE_HEADER) + ((size_t)id * PLAYERDB_RECORD_SIZE)];
+}
+
+/****************************************************************************************************************/
+/*! \brief A player's name, without bringing them in from the player file if they're not in yet.
+ */
+static const char *PLYRDB_name(uint32_t id)
+{
+    if (plyrdb_mapped)
+        return PLYRDB_record(id);
+
+    return plyrdb_names[id >> PLAYERDB_SLAB_SHIFT][id & (PLAYERDB_SLAB_SIZE - 1)];
+}
+
+/****************************************************************************************************************/
+/*! \brief Brings a player in from the player file, the first time they're needed: fills in their PLAYER_STRUCT
+ * from their record, making its slab if that's what it takes.  The name goes in last, since that's how
+ * PLYRDB_get() knows they're in.
+ * \return The player, or NULL if we're out of memory.
+ */
+static PLAYER_STRUCT *PLYRDB_materialize(uint32_t id)
+{
+    uint32_t        slab    = id >> PLAYERDB_SLAB_SHIFT;
+    const char      *record = PLYRDB_record(id);
+    PLAYER_STRUCT   *tmp;
 
-        while (list_walk != NULL)   // bug - apparently, Clint's too dumb to sort a linked list on 3 hours of sleep. will fix later :^)
+    pthread_mutex_lock(&plyrdb_lock);
+
+    if (plyrdb_players[slab] == NULL)
+    {
+        PLAYER_STRUCT *players = (PLAYER_STRUCT *)calloc(PLAYERDB_SLAB_SIZE, sizeof(PLAYER_STRUCT));
+
+        if (players == NULL)
         {
-            list_walk_prev = list_walk;
-            list_walk = ((PLAYER_STRUCT *)list_walk)->next;
-            if (list_walk != NULL) name_comparison = (strcmp(tmp->name, ((PLAYER_STRUCT *)list_walk)->name));
-
-            if (name_comparison == 0)
-            {
-                OH_SMEG("\nConstraint failure - we shouldn't have gotten asked to insert this player a second time...");
-                return;
-            }
+            OH_SMEG("couldn't make room to bring in player %u - the server may encounter problems later...", id);
+            pthread_mutex_unlock(&plyrdb_lock);
+            return NULL;
         }
 
-        tmp->next = NULL;
-        tmp->prev = list_walk_prev;
-        ((PLAYER_STRUCT *)list_walk_prev)->next = tmp;
+        __atomic_store_n(&plyrdb_players[slab], players, __ATOMIC_RELEASE);
     }
+
+    tmp = &plyrdb_players[slab][id & (PLAYERDB_SLAB_SIZE - 1)];
+
+    // (somebody else might've brought them in while we waited for the lock)
+    if (tmp->name == NULL)
+    {
+        tmp->id         = id;
+        tmp->games_won  = PROTO_get_u32(&record[MAX_NAME_LENGTH]);
+        tmp->games_lost = PROTO_get_u32(&record[MAX_NAME_LENGTH + sizeof(uint32_t)]);
+        tmp->games_tied = PROTO_get_u32(&record[MAX_NAME_LENGTH + (2 * sizeof(uint32_t))]);
+        tmp->state      = GAMESTATE_NOT_CONNECTED;
+        tmp->shard_id   = -1;
+
+        __atomic_store_n(&tmp->name, record, __ATOMIC_RELEASE);
+    }
+
+    pthread_mutex_unlock(&plyrdb_lock);
+
+    return tmp;
 }
 
 /****************************************************************************************************************/
-/*! \brief Cleanup the player list.  Should be considered module-private and should never be called manually.
+/*! \brief Waits for everything that's been stored into the player file to get onto the disk.  The index isn't
+ * included; it's only a cache, and it's put away when we go down (see PLYRDB_cleanup()).
+ */
+static void PLYRDB_checkpoint(void)
+{
+    size_t length = sizeof(PLYRDB_FILE_HEADER) +
+                    ((size_t)__atomic_load_n(&plyrdb_count, __ATOMIC_ACQUIRE) * PLAYERDB_RECORD_SIZE);
+
+    if (msync(plyrdb_map, length, MS_SYNC) != 0)
+        OH_SMEG("Couldn't get the player file onto the disk (%s).", strerror(errno));
+}
+
+/****************************************************************************************************************/
+/*! \brief Sets up a blank header for the player file or its index.
+ */
+static void PLYRDB_init_header(PLYRDB_FILE_HEADER *header, const char *magic, uint32_t record_size)
+{
+    uint32_t byte_order = 0x01020304;
+
+    bzero(header, sizeof(PLYRDB_FILE_HEADER));
+    memcpy(header->magic, magic, sizeof(header->magic));
+    PROTO_put_u32(header->version, PLAYERDB_MAP_VERSION);
+    PROTO_put_u32(header->record_size, record_size);
+    memcpy(header->byte_order, &byte_order, sizeof(header->byte_order));
+}
+
+/****************************************************************************************************************/
+/*! \brief Whether a header's one PLYRDB_init_header() would've made, on this machine, with this version.
+ */
+static BOOL PLYRDB_check_header(const PLYRDB_FILE_HEADER *header, const char *magic, uint32_t record_size)
+{
+    uint32_t byte_order = 0x01020304;
+
+    return (memcmp(header->magic, magic, sizeof(header->magic)) == 0) &&
+        (PROTO_get_u32(header->version) == PLAYERDB_MAP_VERSION) &&
+        (PROTO_get_u32(header->record_size) == record_size) &&
+        (memcmp(header->byte_order, &byte_order, sizeof(header->byte_order)) == 0);
+}
+
+/****************************************************************************************************************/
+/*! \brief Maps in the name index that was put away last time we went down, if it was, and it goes with the
+ * player file.  From here till we go down properly again, it's marked as not to be trusted.
+ * \return FALSE if there's no index that can be used.
+ */
+static BOOL PLYRDB_open_index(void)
+{
+    struct stat         info;
+    char                *mapped;
+    PLYRDB_FILE_HEADER  *header;
+    uint32_t            slots;
+    int                 fd      = open(PLAYERDB_INDEX_PATH, O_RDWR);
+
+    if (fd < 0)
+        return FALSE;
+
+    if ((fstat(fd, &info) != 0) || (info.st_size < (off_t)sizeof(PLYRDB_FILE_HEADER)))
+    {
+        close(fd);
+        return FALSE;
+    }
+
+    mapped = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED)
+        return FALSE;
+
+    header  = (PLYRDB_FILE_HEADER *)mapped;
+    slots   = PROTO_get_u32(header->slots);
+
+    if (!PLYRDB_check_header(header, PLAYERDB_INDEX_MAGIC, sizeof(PLYRDB_INDEX_SLOT)) ||
+        (PROTO_get_u32(header->clean) == 0) || (PROTO_get_u32(header->count) != plyrdb_count) ||
+        (slots == 0) || ((slots & (slots - 1)) != 0) || ((uint64_t)slots < (uint64_t)plyrdb_count * 2) ||
+        ((size_t)info.st_size != sizeof(PLYRDB_FILE_HEADER) + ((size_t)slots * sizeof(PLYRDB_INDEX_SLOT))))
+    {
+        munmap(mapped, info.st_size);
+        return FALSE;
+    }
+
+    PROTO_put_u32(header->clean, 0);
+    msync(mapped, sizeof(PLYRDB_FILE_HEADER), MS_SYNC);
+
+    plyrdb_index        = (PLYRDB_INDEX_SLOT *)&mapped[sizeof(PLYRDB_FILE_HEADER)];
+    plyrdb_index_size   = slots;
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Builds the name index again from the names in the player file, when there isn't one we can use.
+ */
+static void PLYRDB_rebuild_index(void)
+{
+    uint32_t            size    = PLAYERDB_INDEX_MIN_SIZE;
+    uint32_t            id;
+    PLYRDB_INDEX_SLOT   slot;
+
+    // (an empty store doesn't get one till someone's added, same as always)
+    if (plyrdb_count == 0)
+        return;
+
+    DUH_WHERE_AM_I("building the player index for %u players", plyrdb_count);
+
+    while (size < (plyrdb_count + 1) * 2)
+        size *= 2;
+
+    plyrdb_index = PLYRDB_alloc_index(size);
+
+    if (plyrdb_index == NULL)
+    {
+        OH_SMEG("\nCouldn't make an index for the player file (%s)!\n", strerror(errno));
+        exit(1);
+    }
+
+    plyrdb_index_size = size;
+
+    for (id = 0; id < plyrdb_count; id++)
+    {
+        slot.id     = id;
+        slot.hash   = PLYRDB_hash(PLYRDB_record(id));
+        PLYRDB_place(plyrdb_index, size, slot);
+    }
+
+    rename(PLAYERDB_INDEX_TEMP_PATH, PLAYERDB_INDEX_PATH);
+}
+
+/****************************************************************************************************************/
+/*! \brief Cleanup the player store.  Should be considered module-private and should never be called manually.
  */
 void PLYRDB_cleanup(void)
 {
+    uint32_t slab;
+
     if (!plyrdb_module_inited) return;
 
     PLYRDB_save_to_disk();
 
-    PLAYER_STRUCT *list_walk        = plyrdb_playerdb;
-    PLAYER_STRUCT *list_walk_next   = plyrdb_playerdb;
+    // the index can be trusted next time round, now it's all on the disk
+    if (plyrdb_mapped && (plyrdb_index != NULL))
+    {
+        PLYRDB_FILE_HEADER *header = (PLYRDB_FILE_HEADER *)((char *)plyrdb_index - sizeof(PLYRDB_FILE_HEADER));
+
+        PROTO_put_u32(header->count, plyrdb_count);
+
+        if (msync(header, sizeof(PLYRDB_FILE_HEADER) + ((size_t)plyrdb_index_size * sizeof(PLYRDB_INDEX_SLOT)),
+                MS_SYNC) == 0)
+        {
+            PROTO_put_u32(header->clean, 1);
+            msync(header, sizeof(PLYRDB_FILE_HEADER), MS_SYNC);
+        }
+    }
+
+    for (slab = 0; slab < PLAYERDB_MAX_SLABS; slab++)
+    {
+        free(plyrdb_players[slab]);
+        free(plyrdb_names[slab]);
+    }
+
+    PLYRDB_free_index(plyrdb_index, plyrdb_index_size);
 
-    while ((list_walk != NULL) && (list_walk_next->next != NULL))
+    if (plyrdb_mapped)
     {
-        list_walk_next = list_walk->next;
-        free(list_walk);
-        list_walk = list_walk_next;
+        munmap(plyrdb_map, PLAYERDB_MAP_RESERVE);
+        close(plyrdb_map_fd);
     }
+    else
+        close(plyrdb_journal_fd);
 }
@@ -10,21 +10,34 @@
 
     #include        "tictactwo-common.h"
 
+    /*! \defgroup plyrdb_stores
+     * \brief How the player stats are kept on disk; see SERVER_CONFIG.player_store.
+     * \{
+     */
+    #define         PLYRDB_STORE_JOURNAL    0   // a list written out whole now and then, and a journal in between
+    #define         PLYRDB_STORE_MAPPED     1   // one file of fixed-size records, mapped in and changed where it lies
+    /*! \} */
+
     /*! \brief Structure that maps to a representation of a player the
      *  server has seen before.
      * \todo Need a password field (and to make sure it's written out to disk and
      *  checked against on connection.
-     * \note This would scale better if the players got to live in a tree instead
-     * of a list...but then, if scalability is the goal, we should just use SQLite
-     * or something like that...
+     * \note They live in slabs that never move, so a pointer to one's good for as
+     * long as the server's up; see player_db.c.  If scalability is the goal, we
+     * should just use SQLite or something like that...
      */
     typedef struct
     {
-        unsigned char   name[MAX_NAME_LENGTH];
+        /*! \brief Points into the player store's names, which are kept apart from everything else (or if the store's
+         * mapped in, into the player's own record in the file).
+         */
+        const char      *name;
+        /*! \brief Where we are in the player store (see PLYRDB_get()); it never changes. */
+        uint32_t        id;
         /*! \brief This is a convenience to the login manager; it won't contain anything useful if
-         * this player isn't logged in.
+         * this player isn't logged in.  It's the handle of the connection that belongs to them (see CONN_get()).
          */
-        int             connection_fd;
+        int             connection_id;
         uint32_t        games_won;
         uint32_t        games_lost;
         uint32_t        games_tied;
@@ -32,16 +45,37 @@
          * Used during the lobby and gameplay. (and by 40, I mean 10 (deadlines))
          */
         uint8_t         avatar;
-        void            *next;
-        void            *prev;
         /*! \brief It's used by the active player manager to track whether we're in a game, the lobby, etc. */
         uint8_t         state;
         /*! \brief Tracks who we were challenged by */
         int             challenger_id;
+        /*! \brief Our handle in our shard's pool of active players; only meaningful while we're logged in. */
+        int             active_slot;
+        /*! \brief The handle of the game room we're playing in, or -1 if we're not in a game. */
+        int             gameroom_id;
+        /*! \brief Which shard is looking after us while we're logged in, or -1 if we're not logged in anywhere.
+         * Logging in claims us by swapping -1 for the shard's number (see PLYRMNGR_handle_new_connect()), so
+         * only one shard at a time can ever be looking after us; other shards only ever read this (with
+         * __atomic_load_n()), to work out where to send things meant for us.
+         */
+        int             shard_id;
+        /*! \brief Our handle in our shard's list of lobby subscribers, or -1 if we're not on it. */
+        int             lobby_subscription;
+        /*! \brief The chat channels we're in, as handles in our shard's channel pool (or -1 for a spare slot),
+         * and where we are in each one's list of members; see chat.h.
+         */
+        int             chat_channels[MAX_CHANNELS_JOINED];
+        uint32_t        chat_positions[MAX_CHANNELS_JOINED];
+        /*! \brief Which of chat_channels MSGTYPE_CHAT from the lobby goes to, or -1 if none of them. */
+        int             chat_talking;
     } PLAYER_STRUCT;
 
     PLAYER_STRUCT   *PLYRDB_find_by_name(const char *name);
+    PLAYER_STRUCT   *PLYRDB_get(uint32_t id);
     PLAYER_STRUCT   *PLYRDB_create_new_player(const char *name);
     void            PLYRDB_load_from_disk(void);
     void            PLYRDB_save_to_disk(void);
+    void            PLYRDB_compact(void);
+    void            PLYRDB_init(void);
+    void            PLYRDB_count_game(PLAYER_STRUCT *ps, uint32_t won, uint32_t lost, uint32_t tied);
 #endif
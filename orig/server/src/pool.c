@@ -0,0 +1,251 @@
+/*! \file pool.c
+ * \brief Slab-allocated object pools; see pool.h.
+ */
+#include    "pool.h"
+
+#define     POOL_INDEX_MASK         ((1U << POOL_INDEX_BITS) - 1)
+#define     POOL_GENERATION_MASK    ((1U << POOL_GENERATION_BITS) - 1)
+/*! \brief Marks the end of the free list; can't be a real index, since it's bigger than POOL_MAX_CAPACITY. */
+#define     POOL_NO_INDEX           UINT32_MAX
+
+#define     POOL_WORD_OF(index)     ((index) >> 6)
+#define     POOL_BIT_OF(index)      (1ULL << ((index) & 63))
+
+/*! \brief What goes in front of every object in a pool.  Padded out so the object after it is as well aligned as
+ * malloc() would have made it.
+ */
+typedef union
+{
+    struct
+    {
+        /*! \brief The next slot on the free list, while this one's on it. */
+        uint32_t    next_free;
+        uint8_t     generation;
+    } info;
+    long double align_as_malloc_would;
+} POOL_SLOT_HEADER;
+
+/*! \defgroup pool_private
+ * \brief Functions private to the pool module.
+ * \{
+ */
+static POOL_SLOT_HEADER *POOL_slot(const POOL_STRUCT *pool, uint32_t index);
+static BOOL POOL_is_in_use(const POOL_STRUCT *pool, uint32_t index);
+static BOOL POOL_grow(POOL_STRUCT *pool);
+/*! \} */
+
+/****************************************************************************************************************/
+/*! \brief Sets up an empty pool.  Nothing's allocated for the objects themselves until they're asked for.
+ * \param object_size How big each object is.
+ * \param slab_objects How many objects to make room for at a time, as the pool grows; rounded up to a power of
+ *  two.
+ * \param capacity The most objects the pool will ever hold, up to POOL_MAX_CAPACITY.
+ * \return FALSE if the capacity's out of range or we're out of memory.
+ */
+BOOL POOL_init(POOL_STRUCT *pool, uint32_t object_size, uint32_t slab_objects, uint32_t capacity)
+{
+    uint32_t slab_count;
+
+    if ((capacity == 0) || (capacity > POOL_MAX_CAPACITY))
+    {
+        OH_SMEG("A pool can't hold %u objects; it has to be between 1 and %u.", capacity, POOL_MAX_CAPACITY);
+        return FALSE;
+    }
+
+    bzero(pool, sizeof(POOL_STRUCT));
+
+    pool->stride    = sizeof(POOL_SLOT_HEADER) +
+                      (((object_size + sizeof(POOL_SLOT_HEADER) - 1) / sizeof(POOL_SLOT_HEADER)) *
+                        sizeof(POOL_SLOT_HEADER));
+    pool->capacity  = capacity;
+    pool->free_head = POOL_NO_INDEX;
+
+    while ((1U << pool->slab_shift) < slab_objects)
+        pool->slab_shift++;
+
+    slab_count      = (capacity + (1U << pool->slab_shift) - 1) >> pool->slab_shift;
+    pool->slabs     = (char **)calloc(slab_count, sizeof(char *));
+    pool->in_use    = (uint64_t *)calloc(POOL_WORD_OF(capacity - 1) + 1, sizeof(uint64_t));
+
+    if ((pool->slabs == NULL) || (pool->in_use == NULL))
+    {
+        OH_SMEG("Out of memory setting up a pool of %u objects.", capacity);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes an object out of the pool, growing it by a slab if there aren't any free.
+ * \param handle Gets the object's handle.
+ * \return The object (which is zeroed if it's brand new, but otherwise still holds whatever its last user left
+ *  in it), or NULL if the pool's at capacity.
+ */
+void *POOL_alloc(POOL_STRUCT *pool, POOL_HANDLE *handle)
+{
+    POOL_SLOT_HEADER    *slot;
+    uint32_t            index;
+
+    // full up?  start on a fresh slab, if we're allowed one
+    if ((pool->free_head == POOL_NO_INDEX) && (!POOL_grow(pool)))
+        return NULL;
+
+    index           = pool->free_head;
+    slot            = POOL_slot(pool, index);
+    pool->free_head = slot->info.next_free;
+
+    pool->in_use[POOL_WORD_OF(index)] |= POOL_BIT_OF(index);
+    *handle = (POOL_HANDLE)(((uint32_t)slot->info.generation << POOL_INDEX_BITS) | index);
+
+    pool->live++;
+
+    return slot + 1;
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts an object back in the pool.  Its handle goes stale; anything still holding on to it will get NULL
+ * back from POOL_get() from now on.
+ * \note Does nothing if the handle's stale already.
+ */
+void POOL_free(POOL_STRUCT *pool, POOL_HANDLE handle)
+{
+    POOL_SLOT_HEADER    *slot;
+    uint32_t            index = handle & POOL_INDEX_MASK;
+
+    if (POOL_get(pool, handle) == NULL)
+        return;
+
+    slot = POOL_slot(pool, index);
+
+    slot->info.generation   = (slot->info.generation + 1) & POOL_GENERATION_MASK;
+    pool->in_use[POOL_WORD_OF(index)] &= ~POOL_BIT_OF(index);
+
+    // last out, first back in; its cache lines are the likeliest to still be warm
+    slot->info.next_free    = pool->free_head;
+    pool->free_head         = index;
+
+    pool->live--;
+}
+
+/****************************************************************************************************************/
+/*! \brief Looks up an object by its handle.
+ * \return The object, or NULL if the handle's out of range or stale.
+ */
+void *POOL_get(const POOL_STRUCT *pool, POOL_HANDLE handle)
+{
+    POOL_SLOT_HEADER    *slot;
+    uint32_t            index = handle & POOL_INDEX_MASK;
+
+    if ((handle < 0) || (handle > POOL_HANDLE_MASK) || (index >= pool->extent) || (!POOL_is_in_use(pool, index)))
+        return NULL;
+
+    slot = POOL_slot(pool, index);
+
+    if (slot->info.generation != ((uint32_t)handle >> POOL_INDEX_BITS))
+        return NULL;
+
+    return slot + 1;
+}
+
+/****************************************************************************************************************/
+/*! \brief Walks through every object that's in use.
+ * \param cursor Where to carry on from; start it at 0.
+ * \return The next object in use, or NULL once there aren't any more.
+ */
+void *POOL_next(const POOL_STRUCT *pool, uint32_t *cursor)
+{
+    uint32_t    word;
+    uint32_t    index;
+    uint64_t    bits;
+
+    if (*cursor >= pool->extent)
+        return NULL;
+
+    // the bits for slots past the cursor in its own word, then whole words at a time until one's in use
+    word = POOL_WORD_OF(*cursor);
+    bits = pool->in_use[word] & (~0ULL << (*cursor & 63));
+
+    while (bits == 0)
+    {
+        if (++word > POOL_WORD_OF(pool->extent - 1))
+        {
+            *cursor = pool->extent;
+            return NULL;
+        }
+
+        bits = pool->in_use[word];
+    }
+
+    index   = (word << 6) + __builtin_ctzll(bits);
+    *cursor = index + 1;
+
+    return POOL_slot(pool, index) + 1;
+}
+
+/****************************************************************************************************************/
+/*! \brief How many objects are in use.
+ */
+uint32_t POOL_count(const POOL_STRUCT *pool)
+{
+    return pool->live;
+}
+
+/****************************************************************************************************************/
+/*! \brief Finds a slot's header by its index.
+ */
+static POOL_SLOT_HEADER *POOL_slot(const POOL_STRUCT *pool, uint32_t index)
+{
+    uint32_t slab_mask = (1U << pool->slab_shift) - 1;
+
+    return (POOL_SLOT_HEADER *)(pool->slabs[index >> pool->slab_shift] + ((size_t)(index & slab_mask) * pool->stride));
+}
+
+/****************************************************************************************************************/
+/*! \brief Whether a slot's in use.
+ */
+static BOOL POOL_is_in_use(const POOL_STRUCT *pool, uint32_t index)
+{
+    return (pool->in_use[POOL_WORD_OF(index)] & POOL_BIT_OF(index)) != 0;
+}
+
+/****************************************************************************************************************/
+/*! \brief Adds another slab's worth of slots to a pool, or as many as it has room left for, and puts them on the
+ * free list.
+ * \return FALSE if it's at capacity already, or we're out of memory.
+ */
+static BOOL POOL_grow(POOL_STRUCT *pool)
+{
+    uint32_t slab_size = 1U << pool->slab_shift;
+    uint32_t slab_index;
+    uint32_t added;
+    uint32_t index;
+
+    if (pool->extent >= pool->capacity)
+        return FALSE;
+
+    slab_index  = pool->extent >> pool->slab_shift;
+    added       = pool->capacity - pool->extent;
+
+    if (added > slab_size) added = slab_size;
+
+    // calloc() so a new slab's objects start out zeroed, and its pages only get touched as they're used
+    pool->slabs[slab_index] = (char *)calloc(slab_size, pool->stride);
+
+    if (pool->slabs[slab_index] == NULL)
+    {
+        OH_SMEG("Out of memory growing a pool past %u objects.", pool->extent);
+        return FALSE;
+    }
+
+    // backwards, so they come off the list in order
+    for (index = pool->extent + added; index > pool->extent; index--)
+    {
+        POOL_slot(pool, index - 1)->info.next_free = pool->free_head;
+        pool->free_head = index - 1;
+    }
+
+    pool->extent += added;
+
+    return TRUE;
+}
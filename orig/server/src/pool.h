@@ -0,0 +1,71 @@
+/*! \file pool.h
+ * \brief Fixed-size object pools that grow a slab at a time, for things there can be tens of thousands of at
+ * once (connections, active players, game rooms).
+ *
+ * Taking an object out and putting one back are constant time however big the pool is or however full it's got:
+ * free slots are kept on a list threaded through the slots themselves, and which slots are in use is kept in a
+ * bitmap, so walking the ones in use skips empty stretches a word at a time.
+ *
+ * Objects are addressed by handles rather than pointers.  A handle holds the object's index in the pool plus a
+ * generation count that changes every time the slot's freed, so a handle someone's held on to after the object
+ * went away is recognisably stale instead of quietly pointing at whatever's moved in since.  Slabs are never
+ * moved or freed, so pointers to objects stay good for as long as the objects are allocated - and once a pool's
+ * grown to fit the load, allocating from it never touches malloc().
+ *
+ * Like everything else that belongs to a shard, a pool is only ever used from the thread that made it.
+ */
+#ifndef         POOL_H
+    #define     POOL_H
+
+    #include    "tictactwo-common.h"
+
+    /*! \brief How many bits of a handle are the object's index, which caps how big a pool can get. */
+    #define     POOL_INDEX_BITS         20
+    /*! \brief How many bits of a handle are the generation count. */
+    #define     POOL_GENERATION_BITS    5
+    /*! \brief How many bits of a handle are used at all; callers are free to pack their own things in above it
+     * (and the top bit's always clear, so handles are never negative).
+     */
+    #define     POOL_HANDLE_BITS        (POOL_INDEX_BITS + POOL_GENERATION_BITS)
+    #define     POOL_HANDLE_MASK        ((1 << POOL_HANDLE_BITS) - 1)
+
+    /*! \brief The most objects a pool can hold. */
+    #define     POOL_MAX_CAPACITY       ((1U << POOL_INDEX_BITS) - 1)
+
+    /*! \brief What a handle's set to when it doesn't refer to anything. */
+    #define     POOL_NO_HANDLE          (-1)
+
+    typedef int POOL_HANDLE;
+
+    /*! \brief A pool.  Treat it as opaque; it's only out here so pools can be declared statically.
+     */
+    typedef struct
+    {
+        /*! \brief Where each slab starts; there's room for as many as capacity calls for, but they're only
+         * allocated as they're needed.
+         */
+        char        **slabs;
+        /*! \brief A bit per slot, set while it's in use; sized for the pool's whole capacity up front. */
+        uint64_t    *in_use;
+        /*! \brief How far apart slots are, header and all. */
+        uint32_t    stride;
+        /*! \brief Slots per slab, as a power of two. */
+        uint32_t    slab_shift;
+        /*! \brief The most slots the pool's allowed to have. */
+        uint32_t    capacity;
+        /*! \brief How many slots the slabs allocated so far add up to. */
+        uint32_t    extent;
+        /*! \brief How many of them are in use. */
+        uint32_t    live;
+        /*! \brief The first slot on the free list, or POOL_NO_INDEX if every slot there is is in use. */
+        uint32_t    free_head;
+    } POOL_STRUCT;
+
+    BOOL        POOL_init(POOL_STRUCT *pool, uint32_t object_size, uint32_t slab_objects, uint32_t capacity);
+    void        *POOL_alloc(POOL_STRUCT *pool, POOL_HANDLE *handle);
+    void        POOL_free(POOL_STRUCT *pool, POOL_HANDLE handle);
+    void        *POOL_get(const POOL_STRUCT *pool, POOL_HANDLE handle);
+    void        *POOL_next(const POOL_STRUCT *pool, uint32_t *cursor);
+    uint32_t    POOL_count(const POOL_STRUCT *pool);
+
+#endif
@@ -0,0 +1,217 @@
+/*! \file rank.c
+ * \brief The order-statistic trees; see rank.h.
+ */
+#include    "rank.h"
+
+/*! \brief How many nodes there are under a node (or 0 under nothing). */
+#define     RANK_SIZE(node)         (((node) == NULL) ? 0 : (node)->size)
+
+/*! \defgroup rank_private
+ * \brief Functions private to the order-statistic trees.
+ * \{
+ */
+static RANK_NODE *RANK_insert_under(const RANK_TREE *tree, RANK_NODE *root, RANK_NODE *node);
+static RANK_NODE *RANK_remove_under(const RANK_TREE *tree, RANK_NODE *root, RANK_NODE *node);
+static void RANK_split(const RANK_TREE *tree, RANK_NODE *root, const RANK_NODE *node, RANK_NODE **before,
+    RANK_NODE **after);
+static RANK_NODE *RANK_merge(RANK_NODE *before, RANK_NODE *after);
+static void RANK_walk(RANK_NODE *root, uint32_t *skip, uint32_t *remaining, RANK_VISITOR visitor, void *context);
+static void RANK_resize(RANK_NODE *node);
+/*! \} */
+
+/****************************************************************************************************************/
+/*! \brief Sets up an empty tree.
+ */
+void RANK_init(RANK_TREE *tree, RANK_COMPARE compare)
+{
+    tree->root      = NULL;
+    tree->compare   = compare;
+    tree->seed      = 0x9E3779B9;
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts a node in the tree, wherever it goes.
+ * \note If whatever it's sorted by is about to change, take it out first and put it back afterwards; the tree
+ *  can't find it again if it moves while it's in there.
+ */
+void RANK_insert(RANK_TREE *tree, RANK_NODE *node)
+{
+    // xorshift; it just has to be all over the place, not unpredictable
+    tree->seed ^= tree->seed << 13;
+    tree->seed ^= tree->seed >> 17;
+    tree->seed ^= tree->seed << 5;
+
+    node->left      = NULL;
+    node->right     = NULL;
+    node->size      = 1;
+    node->priority  = tree->seed;
+
+    tree->root = RANK_insert_under(tree, tree->root, node);
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes a node out of the tree.  It has to be in it.
+ */
+void RANK_remove(RANK_TREE *tree, RANK_NODE *node)
+{
+    tree->root = RANK_remove_under(tree, tree->root, node);
+}
+
+/****************************************************************************************************************/
+/*! \brief How many nodes are in the tree.
+ */
+uint32_t RANK_count(const RANK_TREE *tree)
+{
+    return RANK_SIZE(tree->root);
+}
+
+/****************************************************************************************************************/
+/*! \brief Calls a function for each of a run of nodes, in order; getting to the first of them only costs a trip
+ * down the tree, not a walk past everything before it.
+ * \param first Where the run starts (0 being the first node in the tree).
+ * \param count How long it is, at most.
+ * \return How many nodes were visited (less than count if the tree ran out first).
+ */
+uint32_t RANK_visit(const RANK_TREE *tree, uint32_t first, uint32_t count, RANK_VISITOR visitor, void *context)
+{
+    uint32_t remaining = count;
+
+    RANK_walk(tree->root, &first, &remaining, visitor, context);
+
+    return count - remaining;
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts a node into a subtree.
+ * \return The subtree's new root.
+ */
+static RANK_NODE *RANK_insert_under(const RANK_TREE *tree, RANK_NODE *root, RANK_NODE *node)
+{
+    if (root == NULL)
+        return node;
+
+    // it outranks everything here, so everything here gets split up either side of it
+    if (node->priority > root->priority)
+    {
+        RANK_split(tree, root, node, &node->left, &node->right);
+        RANK_resize(node);
+        return node;
+    }
+
+    if (tree->compare(node, root) < 0)
+        root->left = RANK_insert_under(tree, root->left, node);
+    else
+        root->right = RANK_insert_under(tree, root->right, node);
+
+    root->size++;
+    return root;
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes a node out of a subtree.
+ * \return The subtree's new root.
+ */
+static RANK_NODE *RANK_remove_under(const RANK_TREE *tree, RANK_NODE *root, RANK_NODE *node)
+{
+    // (can't happen, if it's really in the tree)
+    if (root == NULL)
+        return NULL;
+
+    if (root == node)
+        return RANK_merge(node->left, node->right);
+
+    if (tree->compare(node, root) < 0)
+        root->left = RANK_remove_under(tree, root->left, node);
+    else
+        root->right = RANK_remove_under(tree, root->right, node);
+
+    RANK_resize(root);
+    return root;
+}
+
+/****************************************************************************************************************/
+/*! \brief Splits a subtree in two: everything that goes before a node, and everything that goes after it.
+ */
+static void RANK_split(const RANK_TREE *tree, RANK_NODE *root, const RANK_NODE *node, RANK_NODE **before,
+    RANK_NODE **after)
+{
+    if (root == NULL)
+    {
+        *before = NULL;
+        *after  = NULL;
+        return;
+    }
+
+    if (tree->compare(root, node) < 0)
+    {
+        RANK_split(tree, root->right, node, &root->right, after);
+        *before = root;
+    }
+    else
+    {
+        RANK_split(tree, root->left, node, before, &root->left);
+        *after = root;
+    }
+
+    RANK_resize(root);
+}
+
+/****************************************************************************************************************/
+/*! \brief Joins two subtrees back together, where everything in the first goes before everything in the second.
+ * \return The root of the result.
+ */
+static RANK_NODE *RANK_merge(RANK_NODE *before, RANK_NODE *after)
+{
+    if (before == NULL) return after;
+    if (after == NULL)  return before;
+
+    if (before->priority > after->priority)
+    {
+        before->right = RANK_merge(before->right, after);
+        RANK_resize(before);
+        return before;
+    }
+
+    after->left = RANK_merge(before, after->left);
+    RANK_resize(after);
+    return after;
+}
+
+/****************************************************************************************************************/
+/*! \brief The guts of RANK_visit(): an in-order walk that skips whole subtrees while there's still skipping to do,
+ * and stops as soon as it's visited enough.
+ */
+static void RANK_walk(RANK_NODE *root, uint32_t *skip, uint32_t *remaining, RANK_VISITOR visitor, void *context)
+{
+    if ((root == NULL) || (*remaining == 0))
+        return;
+
+    if (*skip >= root->size)
+    {
+        *skip -= root->size;
+        return;
+    }
+
+    RANK_walk(root->left, skip, remaining, visitor, context);
+
+    if (*remaining == 0)
+        return;
+
+    if (*skip > 0)
+        (*skip)--;
+    else
+    {
+        visitor(root, context);
+        (*remaining)--;
+    }
+
+    RANK_walk(root->right, skip, remaining, visitor, context);
+}
+
+/****************************************************************************************************************/
+/*! \brief Recounts a node's subtree, from its children's counts.
+ */
+static void RANK_resize(RANK_NODE *node)
+{
+    node->size = 1 + RANK_SIZE(node->left) + RANK_SIZE(node->right);
+}
@@ -0,0 +1,52 @@
+/*! \file rank.h
+ * \brief Order-statistic trees: keep things sorted as they come, go and change, and find the nth one (and however
+ * many come after it) in logarithmic time, which is what paging through a sorted list needs.
+ *
+ * They're treaps - binary search trees in whatever order the compare function says, that are also heap-ordered
+ * by a random priority each node's given on the way in, which keeps them balanced (on average) without any
+ * rebalancing rules to get wrong.  Every node knows how many nodes there are under it, itself included, which is
+ * how finding the nth is quick.
+ *
+ * Like the wheel's timers, nodes are intrusive: embed a RANK_NODE in whatever's being sorted (one for every tree
+ * it goes in) and get back to it with offsetof().  The tree never allocates anything.
+ */
+#ifndef         RANK_H
+    #define     RANK_H
+
+    #include    "tictactwo-common.h"
+    #include    <stddef.h>  // offsetof(), to get from a node back to what it's in
+
+    typedef struct RANK_NODE
+    {
+        struct RANK_NODE    *left;
+        struct RANK_NODE    *right;
+        /*! \brief How many nodes there are in the subtree this is the root of. */
+        uint32_t            size;
+        uint32_t            priority;
+    } RANK_NODE;
+
+    /*! \brief The signature of a tree's ordering: less than 0 if a goes before b, more than 0 if it goes after.
+     * It mustn't ever say two different nodes are equal, so break ties with something unique.
+     */
+    typedef int (*RANK_COMPARE)(const RANK_NODE *a, const RANK_NODE *b);
+
+    /*! \brief The signature of the function RANK_visit() calls for each node it visits. */
+    typedef void (*RANK_VISITOR)(RANK_NODE *node, void *context);
+
+    /*! \brief A tree.  Treat it as opaque; it's only out here so trees can be declared statically. */
+    typedef struct
+    {
+        RANK_NODE           *root;
+        RANK_COMPARE        compare;
+        /*! \brief Where the next node's priority comes from. */
+        uint32_t            seed;
+    } RANK_TREE;
+
+    void        RANK_init(RANK_TREE *tree, RANK_COMPARE compare);
+    void        RANK_insert(RANK_TREE *tree, RANK_NODE *node);
+    void        RANK_remove(RANK_TREE *tree, RANK_NODE *node);
+    uint32_t    RANK_count(const RANK_TREE *tree);
+    uint32_t    RANK_visit(const RANK_TREE *tree, uint32_t first, uint32_t count, RANK_VISITOR visitor,
+                    void *context);
+
+#endif
@@ -0,0 +1,572 @@
+/*! \file reactor.c
+ * \brief The main loop, on epoll or io_uring.  Replaces the old tick-and-usleep() loop; see reactor.h.
+ */
+#include    "reactor.h"
+#include    "server-common.h"
+#include    "uring.h"
+#include    <sys/epoll.h>
+#include    <sys/timerfd.h>
+#include    <poll.h>
+#include    <unistd.h>
+#include    <errno.h>
+
+/*! \brief How many ready descriptors we'll pick up per call to epoll_wait(). */
+#define     RCTR_MAX_EVENTS     64
+
+_Static_assert(RCTR_MORE_TO_COME == IORING_CQE_F_MORE, "RCTR_MORE_TO_COME has to match io_uring's flag");
+
+/*! \defgroup reactor_private
+ * \brief Data and functions private to the reactor module.  Every shard runs its own reactor, so all of it is
+ * per-thread.
+ * \{
+ */
+static __thread int             rctr_backend            = RCTR_BACKEND_EPOLL;
+static __thread int             rctr_epoll_fd           = -1;
+static __thread BOOL            rctr_was_module_inited  = FALSE;
+
+/*! \brief What to call once every callback for a batch of events has run; see RCTR_add_batch_hook(). */
+static __thread RCTR_CALLBACK   rctr_batch_hooks[RCTR_MAX_BATCH_HOOKS];
+static __thread void            *rctr_batch_contexts[RCTR_MAX_BATCH_HOOKS];
+static __thread int             rctr_batch_hook_count   = 0;
+
+/*! \brief Every timer the shard has running, and the timerfd that goes off when the wheel next needs turning. */
+static __thread WHEEL_STRUCT    rctr_wheel;
+static __thread RCTR_WATCH      rctr_wheel_watch;
+/*! \brief What the timerfd's set for, by SERVER_now_ms(); UINT64_MAX if it isn't. */
+static __thread uint64_t        rctr_wheel_armed_ms     = UINT64_MAX;
+/*! \brief Set while the wheel's going round, since there's no point setting the timerfd until it's done. */
+static __thread BOOL            rctr_wheel_turning      = FALSE;
+
+static void RCTR_run_epoll(void);
+static void RCTR_run_uring(void);
+static void RCTR_arm_poll(RCTR_WATCH *watch);
+static void RCTR_on_poll(void *context, int result, uint32_t flags);
+static void RCTR_dispatch(RCTR_WATCH *watch, BOOL readable, BOOL writable);
+static BOOL RCTR_init_wheel(void);
+static void RCTR_turn_wheel(void *unused);
+static void RCTR_arm_wheel(void);
+static void RCTR_end_batch(void);
+static void RCTR_cleanup(void);
+/*! \} */
+
+/****************************************************************************************************************/
+/*! \brief Readies the module for use.
+ * \param backend RCTR_BACKEND_EPOLL or RCTR_BACKEND_URING.  If io_uring isn't available, we fall back to epoll;
+ *  RCTR_backend() says which we ended up with.
+ * \return TRUE if the epoll instance (or io_uring) could be created, FALSE otherwise.
+ */
+BOOL RCTR_init(int backend)
+{
+    if (rctr_was_module_inited) return TRUE;
+
+    if (backend == RCTR_BACKEND_URING)
+    {
+        if (URING_init())
+            rctr_backend = RCTR_BACKEND_URING;
+        else
+            DUH_WHERE_AM_I("WARNING: io_uring isn't available here; falling back to epoll.");
+    }
+
+    if (rctr_backend == RCTR_BACKEND_EPOLL)
+    {
+        rctr_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+        if (rctr_epoll_fd == -1)
+        {
+            OH_SMEG("Call to epoll_create1() failed.");
+            return FALSE;
+        }
+    }
+
+    atexit(RCTR_cleanup);
+    rctr_was_module_inited = TRUE;
+
+    return RCTR_init_wheel();
+}
+
+/****************************************************************************************************************/
+/*! \brief Which backend the calling shard's reactor is running on.
+ */
+int RCTR_backend(void)
+{
+    return rctr_backend;
+}
+
+/****************************************************************************************************************/
+/*! \brief Start watching a descriptor for readability, and optionally writability.
+ * \param watch The watch to fill out; it must stay valid until RCTR_unwatch() is called on it.
+ * \param fd The (non-blocking) descriptor to watch.
+ * \param on_readable What to call when fd has data (or a pending connection, or has hung up).
+ * \param on_writable What to call when fd can take more data after a write came up short, or NULL if we don't
+ *  care.  Being edge-triggered, this only fires after the socket buffer has actually filled up.
+ * \param context Passed through to both callbacks untouched.
+ * \return TRUE if the descriptor was added, FALSE if epoll wouldn't take it.
+ */
+BOOL RCTR_watch(RCTR_WATCH *watch, int fd, RCTR_CALLBACK on_readable, RCTR_CALLBACK on_writable, void *context)
+{
+    struct epoll_event ev;
+
+    watch->fd           = fd;
+    watch->on_readable  = on_readable;
+    watch->on_writable  = on_writable;
+    watch->context      = context;
+    watch->is_timer     = FALSE;
+
+    if (rctr_backend == RCTR_BACKEND_URING)
+    {
+        RCTR_arm_poll(watch);
+        return TRUE;
+    }
+
+    ev.events   = EPOLLIN | EPOLLRDHUP | EPOLLET;
+
+    if (on_writable != NULL)
+        ev.events |= EPOLLOUT;
+
+    ev.data.ptr = watch;
+
+    if (epoll_ctl(rctr_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+        OH_SMEG("Couldn't add fd %d to the epoll set.", fd);
+        watch->fd = -1;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Stop watching a descriptor.  Doesn't close it - that's up to whoever owns it.
+ * \note Any event for this watch that's already been collected this time around the loop is skipped.
+ */
+void RCTR_unwatch(RCTR_WATCH *watch)
+{
+    if (watch->fd == -1) return;
+
+    if (rctr_backend == RCTR_BACKEND_URING)
+    {
+        struct io_uring_sqe *sqe = URING_get_sqe();
+
+        // whatever the poll says on its way out gets ignored, since fd's -1 by then
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd     = -1;
+        sqe->addr   = (uint64_t)(uintptr_t)&watch->poll;
+    }
+    else
+    {
+        epoll_ctl(rctr_epoll_fd, EPOLL_CTL_DEL, watch->fd, NULL);
+    }
+
+    watch->fd = -1;
+}
+
+/****************************************************************************************************************/
+/*! \brief Starts a one-shot timer, or if it's running already, pushes it back (or forward).
+ * \param timer Has to be zeroed (or static) before it's first used, and stay put while it's running.
+ * \param delay_ms How long from now it should go off; it may be up to WHEEL_TICK_MS late, but never early.
+ */
+void RCTR_start_timer(RCTR_TIMER *timer, uint32_t delay_ms, RCTR_CALLBACK on_expiry, void *context)
+{
+    WHEEL_start(&rctr_wheel, timer, SERVER_now_ms() + delay_ms, 0, on_expiry, context);
+    RCTR_arm_wheel();
+}
+
+/****************************************************************************************************************/
+/*! \brief Starts a repeating timer.
+ * \param interval_ms How often it should fire, in milliseconds.
+ */
+void RCTR_add_timer(RCTR_TIMER *timer, uint32_t interval_ms, RCTR_CALLBACK on_fire, void *context)
+{
+    WHEEL_start(&rctr_wheel, timer, SERVER_now_ms() + interval_ms, interval_ms, on_fire, context);
+    RCTR_arm_wheel();
+}
+
+/****************************************************************************************************************/
+/*! \brief Stops a timer of either kind.  Does nothing if it isn't running.
+ */
+void RCTR_stop_timer(RCTR_TIMER *timer)
+{
+    // (if that was the one the timerfd's set for, it'll go off for nothing; cheaper than resetting it now)
+    WHEEL_stop(&rctr_wheel, timer);
+}
+
+/****************************************************************************************************************/
+/*! \brief Adds something to be called after each batch of events has been dealt with - the place to do anything
+ * that's cheaper done once per trip around the loop than once per event, like flushing output.
+ * \note The last one added gets called first, so a module that sends things from its hook should add it after
+ *  the connection module's been set up; that way whatever it sends goes out in the same batch.
+ */
+void RCTR_add_batch_hook(RCTR_CALLBACK on_batch_done, void *context)
+{
+    if (rctr_batch_hook_count >= RCTR_MAX_BATCH_HOOKS)
+    {
+        OH_SMEG("Too many batch hooks; raise RCTR_MAX_BATCH_HOOKS.");
+        exit(1);
+    }
+
+    rctr_batch_hooks[rctr_batch_hook_count]     = on_batch_done;
+    rctr_batch_contexts[rctr_batch_hook_count]  = context;
+    rctr_batch_hook_count++;
+}
+
+/****************************************************************************************************************/
+/*! \brief Calls every batch hook, newest first.
+ */
+static void RCTR_end_batch(void)
+{
+    int index;
+
+    for (index = rctr_batch_hook_count - 1; index >= 0; index--)
+        rctr_batch_hooks[index](rctr_batch_contexts[index]);
+}
+
+/****************************************************************************************************************/
+/*! \brief Runs the event loop.  Never returns; the server gets shut down from shard 0's loop, when a signal's
+ * asked it to (see SERVER_watch_for_shutdown()).
+ */
+void RCTR_run(void)
+{
+    if (rctr_backend == RCTR_BACKEND_URING)
+        RCTR_run_uring();
+    else
+        RCTR_run_epoll();
+}
+
+/****************************************************************************************************************/
+/*! \brief Starts accepting connections on a listening socket, and keeps at it; op gets a completion (with the
+ * new socket as its result) for every one, until one comes without RCTR_MORE_TO_COME.
+ * \note io_uring backend only, like everything that takes an RCTR_OP.
+ */
+void RCTR_accept(RCTR_OP *op, int listen_fd)
+{
+    struct io_uring_sqe *sqe = URING_get_sqe();
+
+    sqe->opcode         = IORING_OP_ACCEPT;
+    sqe->fd             = listen_fd;
+    sqe->ioprio         = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags   = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data      = (uint64_t)(uintptr_t)op;
+}
+
+/****************************************************************************************************************/
+/*! \brief Starts receiving on a socket, and keeps at it; op gets a completion for every chunk that comes in,
+ * sitting in one of the reactor's buffers (see RCTR_received()), until one comes without RCTR_MORE_TO_COME.
+ * That happens on hang-up, error, cancellation, or if the reactor runs out of buffers (-ENOBUFS), in which case
+ * nothing's been lost and it's fine to just start again.
+ */
+void RCTR_recv(RCTR_OP *op, int fd)
+{
+    struct io_uring_sqe *sqe = URING_get_sqe();
+
+    sqe->opcode     = IORING_OP_RECV;
+    sqe->fd         = fd;
+    sqe->ioprio     = IORING_RECV_MULTISHOT;
+    sqe->flags      = IOSQE_BUFFER_SELECT;
+    sqe->buf_group  = URING_BUFFER_GROUP;
+    sqe->user_data  = (uint64_t)(uintptr_t)op;
+}
+
+/****************************************************************************************************************/
+/*! \brief Sends a message on a socket; op's result is how much of it went.
+ * \param msg Has to stay valid, iovecs and all, until op completes.
+ * \param hold_next If set, whatever's queued next (say, an RCTR_close()) waits for this to finish first.
+ */
+void RCTR_sendmsg(RCTR_OP *op, int fd, const struct msghdr *msg, BOOL hold_next)
+{
+    struct io_uring_sqe *sqe = URING_get_sqe();
+
+    sqe->opcode     = IORING_OP_SENDMSG;
+    sqe->fd         = fd;
+    sqe->addr       = (uint64_t)(uintptr_t)msg;
+    sqe->len        = 1;
+    sqe->msg_flags  = MSG_NOSIGNAL;
+    sqe->user_data  = (uint64_t)(uintptr_t)op;
+
+    if (hold_next)
+        sqe->flags = IOSQE_IO_HARDLINK;
+}
+
+/****************************************************************************************************************/
+/*! \brief Closes a descriptor once the kernel's done with anything queued ahead of it.
+ * \param op May be NULL if nobody cares when it's done.
+ */
+void RCTR_close(RCTR_OP *op, int fd)
+{
+    struct io_uring_sqe *sqe = URING_get_sqe();
+
+    sqe->opcode     = IORING_OP_CLOSE;
+    sqe->fd         = fd;
+    sqe->user_data  = (uint64_t)(uintptr_t)op;
+}
+
+/****************************************************************************************************************/
+/*! \brief Asks the kernel to stop an operation.  It'll finish up with a last completion of its own (-ECANCELED,
+ * unless it beat us to it).
+ */
+void RCTR_cancel(RCTR_OP *op)
+{
+    struct io_uring_sqe *sqe = URING_get_sqe();
+
+    sqe->opcode     = IORING_OP_ASYNC_CANCEL;
+    sqe->fd         = -1;
+    sqe->addr       = (uint64_t)(uintptr_t)op;
+}
+
+/****************************************************************************************************************/
+/*! \brief Hurries along a single-shot operation that was queued or submitted earlier: submits whatever's queued,
+ * and if op has finished by then, calls its completion now rather than when the loop gets around to it.
+ * \return TRUE if op completed.
+ */
+BOOL RCTR_reap(RCTR_OP *op)
+{
+    struct io_uring_cqe cqe;
+
+    URING_submit(0);
+    server_stats.loop_syscalls++;
+
+    if (!URING_take_cqe((uint64_t)(uintptr_t)op, &cqe))
+        return FALSE;
+
+    op->on_complete(op->context, cqe.res, cqe.flags);
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Finds the data an RCTR_recv() completion brought in.
+ * \param flags The completion's flags.
+ * \return The data (as much of it as the completion's result says), or NULL if it didn't bring any.
+ */
+const char *RCTR_received(uint32_t flags)
+{
+    if (!(flags & IORING_CQE_F_BUFFER))
+        return NULL;
+
+    return URING_buffer(flags >> IORING_CQE_BUFFER_SHIFT);
+}
+
+/****************************************************************************************************************/
+/*! \brief Hands the buffer an RCTR_recv() completion came in back to the reactor.  Every completion that had one
+ * has to do this, once it's done with what's in it.
+ */
+void RCTR_release(uint32_t flags)
+{
+    if (flags & IORING_CQE_F_BUFFER)
+        URING_release_buffer(flags >> IORING_CQE_BUFFER_SHIFT);
+}
+
+/****************************************************************************************************************/
+/*! \brief The event loop, epoll style.
+ */
+static void RCTR_run_epoll(void)
+{
+    struct epoll_event  events[RCTR_MAX_EVENTS];
+    int                 count;
+    int                 index;
+
+    while (TRUE)
+    {
+        count = epoll_wait(rctr_epoll_fd, events, RCTR_MAX_EVENTS, -1);
+        server_stats.loop_syscalls++;
+
+        if (count == -1)
+        {
+            if (errno == EINTR) continue;
+
+            OH_SMEG("epoll_wait() failed, bailing out.");
+            exit(1);
+        }
+
+        for (index = 0; index < count; index++)
+        {
+            uint32_t what = events[index].events;
+
+            RCTR_dispatch((RCTR_WATCH *)events[index].data.ptr, (what & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)),
+                (what & EPOLLOUT));
+        }
+
+        RCTR_end_batch();
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief The event loop, io_uring style.  Each trip around submits everything queued during the last one and
+ * waits for something to finish in the same syscall, then deals with everything that has.
+ */
+static void RCTR_run_uring(void)
+{
+    struct io_uring_cqe cqe;
+
+    while (TRUE)
+    {
+        if (URING_submit(1) == -1)
+        {
+            // EBUSY means the completion queue's backed up; draining it is exactly what we're about to do
+            if ((errno != EINTR) && (errno != EBUSY) && (errno != EAGAIN))
+            {
+                OH_SMEG("io_uring_enter() failed, bailing out.");
+                exit(1);
+            }
+        }
+
+        server_stats.loop_syscalls++;
+
+        while (URING_pop_cqe(&cqe))
+        {
+            RCTR_OP *op = (RCTR_OP *)(uintptr_t)cqe.user_data;
+
+            // fire-and-forget, or already dealt with by RCTR_reap()
+            if (op != NULL)
+                op->on_complete(op->context, cqe.res, cqe.flags);
+        }
+
+        RCTR_end_batch();
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief With the io_uring backend, starts the poll request that does for a watch what epoll would have.
+ */
+static void RCTR_arm_poll(RCTR_WATCH *watch)
+{
+    struct io_uring_sqe *sqe = URING_get_sqe();
+
+    watch->poll.on_complete = RCTR_on_poll;
+    watch->poll.context     = watch;
+
+    sqe->opcode         = IORING_OP_POLL_ADD;
+    sqe->fd             = watch->fd;
+    sqe->len            = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events  = POLLIN | POLLRDHUP | ((watch->on_writable != NULL) ? POLLOUT : 0);
+    sqe->user_data      = (uint64_t)(uintptr_t)&watch->poll;
+}
+
+/****************************************************************************************************************/
+/*! \brief Called when a watch's poll request completes.
+ */
+static void RCTR_on_poll(void *context, int result, uint32_t flags)
+{
+    RCTR_WATCH *watch = (RCTR_WATCH *)context;
+
+    // unwatched, and this is the poll request going away
+    if ((watch->fd == -1) || (result == -ECANCELED))
+        return;
+
+    if (result > 0)
+        RCTR_dispatch(watch, (result & (POLLIN | POLLRDHUP | POLLHUP | POLLERR)), (result & POLLOUT));
+
+    // multishot polls can be dropped by the kernel whenever it likes; if the watch still wants it, start over
+    if ((!(flags & IORING_CQE_F_MORE)) && (watch->fd != -1))
+        RCTR_arm_poll(watch);
+}
+
+/****************************************************************************************************************/
+/*! \brief Calls whichever of a watch's callbacks its descriptor is ready for.
+ */
+static void RCTR_dispatch(RCTR_WATCH *watch, BOOL readable, BOOL writable)
+{
+    // unwatched by an earlier callback in this same batch?
+    if (watch->fd == -1) return;
+
+    if (watch->is_timer)
+    {
+        uint64_t expirations;
+
+        // we don't care how many times it went off while we were busy, just that it did
+        if (read(watch->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+            return;
+    }
+
+    if (writable && (watch->on_writable != NULL))
+        watch->on_writable(watch->context);
+
+    // the writable callback may have given up on it
+    if (watch->fd == -1) return;
+
+    if (readable)
+        watch->on_readable(watch->context);
+}
+
+/****************************************************************************************************************/
+/*! \brief Sets up the shard's timer wheel, and the timerfd that keeps it turning.
+ */
+static BOOL RCTR_init_wheel(void)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    WHEEL_init(&rctr_wheel, SERVER_now_ms());
+
+    if ((fd == -1) || (!RCTR_watch(&rctr_wheel_watch, fd, RCTR_turn_wheel, NULL, NULL)))
+    {
+        OH_SMEG("Couldn't set up a timerfd for the timer wheel.");
+
+        if (fd != -1)
+            close(fd);
+
+        return FALSE;
+    }
+
+    rctr_wheel_watch.is_timer = TRUE;
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Called when the timerfd goes off, to set off whatever timers are due and set it for the next lot.
+ */
+static void RCTR_turn_wheel(void *unused)
+{
+    // it's not set for anything any more
+    rctr_wheel_armed_ms = UINT64_MAX;
+
+    rctr_wheel_turning = TRUE;
+    WHEEL_advance(&rctr_wheel, SERVER_now_ms());
+    rctr_wheel_turning = FALSE;
+
+    RCTR_arm_wheel();
+}
+
+/****************************************************************************************************************/
+/*! \brief Sets the timerfd for whenever the wheel next needs turning, if that's sooner than it's set for already.
+ */
+static void RCTR_arm_wheel(void)
+{
+    struct itimerspec   spec;
+    uint64_t            deadline_ms;
+
+    if (rctr_wheel_turning) return;
+
+    deadline_ms = WHEEL_next_deadline_ms(&rctr_wheel);
+
+    // set for later than it needs to be is the only thing that matters; set for sooner just means a wasted wakeup
+    if (deadline_ms >= rctr_wheel_armed_ms)
+        return;
+
+    bzero(&spec, sizeof(spec));
+
+    // SERVER_now_ms() is CLOCK_MONOTONIC, same as the timerfd
+    spec.it_value.tv_sec    = deadline_ms / 1000;
+    spec.it_value.tv_nsec   = (deadline_ms % 1000) * 1000000L;
+
+    if (timerfd_settime(rctr_wheel_watch.fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+    {
+        OH_SMEG("Couldn't set the timer wheel's timerfd; timers will be late.");
+        return;
+    }
+
+    rctr_wheel_armed_ms = deadline_ms;
+}
+
+/****************************************************************************************************************/
+/*! \brief Closes the epoll instance (or io_uring).  Designed to be called automagically on exit.
+ */
+static void RCTR_cleanup(void)
+{
+    if (rctr_epoll_fd != -1)
+        close(rctr_epoll_fd);
+
+    // every shard registers this, but they all run on the thread that's exiting
+    rctr_epoll_fd = -1;
+
+    URING_exit();
+}
@@ -0,0 +1,101 @@
+/*! \file reactor.h
+ * \brief A small edge-triggered epoll event loop.  Sockets and timers get registered with it, and it calls
+ * back into whichever module owns them when there's something to do, so the server only wakes up when a
+ * listening socket or player socket becomes readable or a timer expires.
+ *
+ * Timers all run off one timer wheel (see wheel.h), which the reactor keeps to time with a single timerfd that's
+ * only ever set for when the wheel next needs it; however many timers are running, it's one wakeup per
+ * deadline, and nothing at all in between.
+ *
+ * It can run on io_uring instead (see RCTR_BACKEND_URING).  Watches and timers work exactly the same either way,
+ * but with io_uring there's also the option of handing the kernel the I/O itself - accepting, receiving,
+ * sending and closing - as RCTR_OPs, and being called back once it's done rather than when it could be done.
+ * That's how the connection module talks to player sockets when it's in use, which saves a syscall per
+ * socket per trip around the loop: everything queued during a batch goes to the kernel in the same
+ * io_uring_enter() that waits for the next one.
+ */
+#ifndef         REACTOR_H
+    #define     REACTOR_H
+
+    #include    "tictactwo-common.h"
+    #include    "wheel.h"
+    #include    <sys/socket.h>
+
+    /*! \defgroup reactor_backends
+     * \brief What the reactor can run on; see RCTR_init().
+     * \{
+     */
+    #define     RCTR_BACKEND_EPOLL      0
+    #define     RCTR_BACKEND_URING      1
+    /*! \} */
+
+    /*! \brief Set in the flags an RCTR_OP completes with if there are more completions to come from it. */
+    #define     RCTR_MORE_TO_COME       (1U << 1)
+
+    /*! \brief How many batch hooks there's room for; see RCTR_add_batch_hook(). */
+    #define     RCTR_MAX_BATCH_HOOKS    4
+
+    /*! \brief The signature of the function a watch calls when its descriptor is ready. */
+    typedef void (*RCTR_CALLBACK)(void *context);
+
+    /*! \brief The signature of the function an RCTR_OP calls when it completes.
+     * \param result What the equivalent syscall would have returned, except errors come back as -errno.
+     * \param flags The completion's flags; see RCTR_MORE_TO_COME and RCTR_received().
+     */
+    typedef void (*RCTR_COMPLETION)(void *context, int result, uint32_t flags);
+
+    /*! \brief One operation handed to the kernel with the io_uring backend.
+     * \note Like a watch, the reactor hands the kernel a pointer to this, so it must stay put until its last
+     *  completion has come in.
+     */
+    typedef struct
+    {
+        RCTR_COMPLETION on_complete;
+        void            *context;
+    } RCTR_OP;
+
+    /*! \brief A timer; see RCTR_start_timer() and RCTR_add_timer(). */
+    typedef WHEEL_TIMER RCTR_TIMER;
+
+    /*! \brief Represents one descriptor the reactor is keeping an eye on.
+     * \note The reactor holds on to a pointer to this, so it must outlive its registration (in practice,
+     * they're all static or live in module-owned tables).
+     */
+    typedef struct
+    {
+        int             fd;
+        /*! \brief Called when fd becomes readable. Since the reactor is edge-triggered, the callback has to drain
+         * the descriptor until it would block.
+         */
+        RCTR_CALLBACK   on_readable;
+        /*! \brief Called when fd has room to write into again after filling up; NULL if we never write to it. */
+        RCTR_CALLBACK   on_writable;
+        void            *context;
+        /*! \brief Set for the reactor's own timerfd; the reactor acknowledges the expiry itself. */
+        BOOL            is_timer;
+        /*! \brief With the io_uring backend, the poll request that stands in for epoll. */
+        RCTR_OP         poll;
+    } RCTR_WATCH;
+
+    BOOL        RCTR_init(int backend);
+    int         RCTR_backend(void);
+    BOOL        RCTR_watch(RCTR_WATCH *watch, int fd, RCTR_CALLBACK on_readable, RCTR_CALLBACK on_writable,
+                    void *context);
+    void        RCTR_unwatch(RCTR_WATCH *watch);
+    void        RCTR_start_timer(RCTR_TIMER *timer, uint32_t delay_ms, RCTR_CALLBACK on_expiry, void *context);
+    void        RCTR_add_timer(RCTR_TIMER *timer, uint32_t interval_ms, RCTR_CALLBACK on_fire, void *context);
+    void        RCTR_stop_timer(RCTR_TIMER *timer);
+    void        RCTR_add_batch_hook(RCTR_CALLBACK on_batch_done, void *context);
+    void        RCTR_run(void);
+
+    // io_uring backend only
+    void        RCTR_accept(RCTR_OP *op, int listen_fd);
+    void        RCTR_recv(RCTR_OP *op, int fd);
+    void        RCTR_sendmsg(RCTR_OP *op, int fd, const struct msghdr *msg, BOOL hold_next);
+    void        RCTR_close(RCTR_OP *op, int fd);
+    void        RCTR_cancel(RCTR_OP *op);
+    BOOL        RCTR_reap(RCTR_OP *op);
+    const char  *RCTR_received(uint32_t flags);
+    void        RCTR_release(uint32_t flags);
+
+#endif
@@ -1,30 +1,231 @@
 #include "server-common.h"
+#include "shard.h"
+#include "reactor.h"
+#include "connection.h"
+#include "pool.h"
+#include "player_db.h"
+#include <time.h>
+#include <getopt.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+
+#define DEFAULT_LOGIN_DEADLINE_MS   5000
+#define DEFAULT_LISTEN_BACKLOG      SOMAXCONN
+#define DEFAULT_SHARD_COUNT         1
+#define DEFAULT_IO_BACKEND          RCTR_BACKEND_EPOLL
+#define DEFAULT_MAX_PLAYERS         16384
+#define DEFAULT_MAX_ROOMS           (DEFAULT_MAX_PLAYERS / 2)
+#define DEFAULT_CHAT_RATE           4
+#define DEFAULT_CHAT_BURST          8
+#define DEFAULT_INVITE_RATE         1
+#define DEFAULT_INVITE_BURST        3
+#define DEFAULT_PLAYER_STORE        PLYRDB_STORE_JOURNAL
+#define DEFAULT_STATS_INTERVAL_MS   60000
 
 /*! \defgroup server_common_priv
  * \brief Private data and functions for use by the server module.
  * \{
  */
 static BOOL server_was_inited_yet = FALSE;
+/*! \brief What the signal handler pokes to ask shard 0 to shut the server down; see SERVER_watch_for_shutdown(). */
+static int server_shutdown_fd = -1;
+/*! \brief Shard 0's watch on server_shutdown_fd. */
+static RCTR_WATCH server_shutdown_watch;
 static void SERVER_signal_handler(int signal_num);
+static void SERVER_shut_down(void *unused);
 static void SERVER_cleanup(void);
 /*! \} */
 
 /*! \brief The socket the application listens for incoming player connections on.
- * \note Public because both the active-player manager and the game manager will need it.
+ * \note Public because both the active-player manager and the game manager will need it.  Every shard has its
+ *  own; see SERVER_listen().
  */
-int server_listenfd_game = -1;
+__thread int server_listenfd_game = -1;
 
 /*! \brief The socket the application listens for requests for an html list of logged-in players on.
  * \note Public because the active-player manager and player-db modules need it.
  */
 int server_listenfd_http = -1;
 
+/*! \brief The server's settings.  Filled out with defaults here; SERVER_parse_args() overrides them.
+ */
+SERVER_CONFIG server_config =
+{
+    DEFAULT_LOGIN_DEADLINE_MS,
+    DEFAULT_LISTEN_BACKLOG,
+    DEFAULT_SHARD_COUNT,
+    FALSE,
+    DEFAULT_IO_BACKEND,
+    DEFAULT_MAX_PLAYERS,
+    DEFAULT_MAX_ROOMS,
+    DEFAULT_CHAT_RATE,
+    DEFAULT_CHAT_BURST,
+    DEFAULT_INVITE_RATE,
+    DEFAULT_INVITE_BURST,
+    DEFAULT_PLAYER_STORE,
+    DEFAULT_STATS_INTERVAL_MS
+};
+
+/*! \brief The server's running totals; one set per shard. */
+__thread SERVER_STATS server_stats;
+
 /****************************************************************************************************************/
-/*! \brief Tries to set up the game and http listening socket for use.
- *  \return TRUE if it was successful and we're ready to start accepting players and serving stats, or FALSE if
- *      it failed for any reason.
- *  \note As the port numbers is hard-coded (by design), this will return FALSE if it can't get the port numbers
- *      it wants.  Future versions may relax this restriction and accept ports number on the cmd line.
+/*! \brief Reads settings off the command line into server_config.
+ *  \return TRUE if everything made sense, or FALSE (after printing usage) if it didn't.
+ */
+BOOL SERVER_parse_args(int argc, char **argv)
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "l:b:t:pi:m:r:c:C:v:V:d:s:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l':
+                server_config.login_deadline_ms = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'b':
+                server_config.listen_backlog = atoi(optarg);
+            break;
+
+            case 't':
+                server_config.shard_count = atoi(optarg);
+            break;
+
+            case 'p':
+                server_config.pin_shards = TRUE;
+            break;
+
+            case 'i':
+                if (strcmp(optarg, "epoll") == 0)
+                    server_config.io_backend = RCTR_BACKEND_EPOLL;
+                else if (strcmp(optarg, "uring") == 0)
+                    server_config.io_backend = RCTR_BACKEND_URING;
+                else
+                {
+                    OH_SMEG("Don't know of an I/O backend called '%s'; try epoll or uring.", optarg);
+                    return FALSE;
+                }
+            break;
+
+            case 'm':
+                server_config.max_players = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'r':
+                server_config.max_rooms = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'c':
+                server_config.chat_rate = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'C':
+                server_config.chat_burst = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'v':
+                server_config.invite_rate = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'V':
+                server_config.invite_burst = strtoul(optarg, NULL, 10);
+            break;
+
+            case 'd':
+                if (strcmp(optarg, "journal") == 0)
+                    server_config.player_store = PLYRDB_STORE_JOURNAL;
+                else if (strcmp(optarg, "mmap") == 0)
+                    server_config.player_store = PLYRDB_STORE_MAPPED;
+                else
+                {
+                    OH_SMEG("Don't know of a way to keep players called '%s'; try journal or mmap.", optarg);
+                    return FALSE;
+                }
+            break;
+
+            case 's':
+                server_config.stats_interval_ms = strtoul(optarg, NULL, 10);
+            break;
+
+            default:
+                fprintf(stderr, "usage: %s [-l login deadline in ms (default %d)] [-b listen backlog (default %d)]\n"
+                    "    [-t shard threads (default %d)] [-p (pin each shard thread to a core)]\n"
+                    "    [-i I/O backend, epoll or uring (default epoll)]\n"
+                    "    [-m players per shard (default %d)] [-r game rooms per shard (default %d)]\n"
+                    "    [-c chat messages per second per player, 0 for no limit (default %d)]\n"
+                    "    [-C chat messages a player can send in one burst (default %d)]\n"
+                    "    [-v invitations per second per player, 0 for no limit (default %d)]\n"
+                    "    [-V invitations a player can send in one burst (default %d)]\n"
+                    "    [-d how to keep player stats on disk, journal or mmap (default journal)]\n"
+                    "    [-s how often to log the running totals, in ms (default %d)]\n",
+                    argv[0], DEFAULT_LOGIN_DEADLINE_MS, DEFAULT_LISTEN_BACKLOG, DEFAULT_SHARD_COUNT,
+                    DEFAULT_MAX_PLAYERS, DEFAULT_MAX_ROOMS, DEFAULT_CHAT_RATE, DEFAULT_CHAT_BURST,
+                    DEFAULT_INVITE_RATE, DEFAULT_INVITE_BURST, DEFAULT_STATS_INTERVAL_MS);
+                return FALSE;
+        }
+    }
+
+    if (server_config.login_deadline_ms == 0)
+    {
+        OH_SMEG("The login deadline has to be at least 1 ms.");
+        return FALSE;
+    }
+
+    if (server_config.stats_interval_ms == 0)
+    {
+        OH_SMEG("The running totals can't be logged more often than once a ms.");
+        return FALSE;
+    }
+
+    if (server_config.listen_backlog <= 0)
+    {
+        OH_SMEG("The listen backlog has to be at least 1.");
+        return FALSE;
+    }
+
+    if (server_config.shard_count <= 0)
+    {
+        OH_SMEG("There has to be at least 1 shard.");
+        return FALSE;
+    }
+
+    // every player needs a connection too, on top of the ones still logging in
+    if ((server_config.max_players == 0) || (server_config.max_players > (POOL_MAX_CAPACITY - MAX_PENDING_LOGINS)))
+    {
+        OH_SMEG("Each shard can have between 1 and %u players.", POOL_MAX_CAPACITY - MAX_PENDING_LOGINS);
+        return FALSE;
+    }
+
+    if ((server_config.max_rooms == 0) || (server_config.max_rooms > POOL_MAX_CAPACITY))
+    {
+        OH_SMEG("Each shard can have between 1 and %u game rooms.", POOL_MAX_CAPACITY);
+        return FALSE;
+    }
+
+    // the buckets count in thousandths of a message, in 32 bits
+    if ((server_config.chat_rate > 1000) || (server_config.invite_rate > 1000))
+    {
+        OH_SMEG("Nobody needs to send more than 1000 of anything a second; use 0 to turn the limit off.");
+        return FALSE;
+    }
+
+    if ((server_config.chat_burst == 0) || (server_config.chat_burst > 1000) ||
+        (server_config.invite_burst == 0) || (server_config.invite_burst > 1000))
+    {
+        OH_SMEG("Bursts have to be between 1 and 1000 messages.");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Sets up signal handling and cleanup; the listening sockets come later, from SERVER_listen().
+ *  \return TRUE if it was successful, or FALSE if it failed for any reason.
+ *  \note As the port numbers is hard-coded (by design), SERVER_listen() will return FALSE if it can't get the
+ *      port numbers it wants.  Future versions may relax this restriction and accept ports number on the cmd line.
  */
 BOOL SERVER_init(void)
 {
@@ -33,16 +234,33 @@ BOOL SERVER_init(void)
 
     server_was_inited_yet = TRUE;
 
+    server_shutdown_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (server_shutdown_fd == -1)
+    {
+        OH_SMEG("Call to eventfd() failed.");
+        return FALSE;
+    }
+
     signal(SIGINT, SERVER_signal_handler);
     signal(SIGTERM, SERVER_signal_handler);
     signal(SIGHUP, SERVER_signal_handler);
 
     // we close all the sockets and such in SERVER_cleanup(),
-    // which will get called if SERVER_init() fails, so the
-    // multiple return paths below are safe...
+    // which will get called if SERVER_listen() fails, so its
+    // multiple return paths are safe...
     atexit(SERVER_cleanup);
 
-    // On to the actual socket creation.
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Opens the calling shard's own listening socket on the gameplay port.  With more than one shard, they
+ * all bind the same port with SO_REUSEPORT, and the kernel spreads incoming connections across them.
+ * \return TRUE if we're ready to start accepting players, FALSE if we couldn't get the port.
+ */
+BOOL SERVER_listen(void)
+{
     struct sockaddr_in my_address;
 
     //------- gameplay port
@@ -50,14 +268,24 @@ BOOL SERVER_init(void)
     my_address.sin_addr.s_addr  = INADDR_ANY;
     my_address.sin_port         = htons(TICTACTWO_GAMEPLAY_PORT);
 
-    server_listenfd_game = socket(AF_INET, SOCK_STREAM, 0);
+    server_listenfd_game = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (server_listenfd_game == -1)
     {
         OH_SMEG("Call to socket() failed.");
         return FALSE;
     }
 
-    fcntl(server_listenfd_game, F_SETFL, O_NONBLOCK);
+    // so a restarted server can get its port back right away, rather than waiting out TIME_WAIT
+    // while everyone who was logged in hammers on the door
+    int reuse = 1;
+    setsockopt(server_listenfd_game, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if ((server_config.shard_count > 1) &&
+        (setsockopt(server_listenfd_game, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1))
+    {
+        OH_SMEG("Can't share the gameplay port between shards.");
+        return FALSE;
+    }
 
     if (bind(server_listenfd_game, (struct sockaddr *) &my_address, sizeof(my_address)) == -1)
     {
@@ -65,7 +293,7 @@ BOOL SERVER_init(void)
         return FALSE;
     }
 
-    if (listen(server_listenfd_game, 0) == -1)
+    if (listen(server_listenfd_game, server_config.listen_backlog) == -1)
     {
         OH_SMEG("It won't let me listen on the gameplay port.");
         return FALSE;
@@ -102,20 +330,98 @@ BOOL SERVER_init(void)
 }
 
 /****************************************************************************************************************/
-/*! \brief Cleans up and closes any ports we were listening on.  Designed to be called automagically on exit.
+/*! \brief Gets the current time from a clock that never jumps backwards.
+ * \return Milliseconds since some arbitrary, fixed point in the past; only useful for measuring intervals.
+ */
+uint64_t SERVER_now_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000) + (now.tv_nsec / 1000000);
+}
+
+/****************************************************************************************************************/
+/*! \brief Writes the running totals out to the console.
+ */
+void SERVER_log_stats(void)
+{
+    DUH_WHERE_AM_I("shard %d connections: %llu accepted, %llu refused", SHARD_self(),
+        (unsigned long long)server_stats.connections_accepted,
+        (unsigned long long)server_stats.connections_refused);
+
+    DUH_WHERE_AM_I("shard %d syscalls: %llu loop, %llu read, %llu send for %llu messages in and %llu out",
+        SHARD_self(),
+        (unsigned long long)server_stats.loop_syscalls,
+        (unsigned long long)server_stats.rx_syscalls,
+        (unsigned long long)server_stats.tx_syscalls,
+        (unsigned long long)server_stats.messages_received,
+        (unsigned long long)server_stats.messages_queued);
+
+    DUH_WHERE_AM_I("shard %d output: %llu messages in %llu sends, %llu stalls, %llu overflows, "
+        "%llu bytes queued (peak %llu), %llu bytes shared", SHARD_self(),
+        (unsigned long long)server_stats.messages_queued,
+        (unsigned long long)server_stats.tx_syscalls,
+        (unsigned long long)server_stats.tx_stalls,
+        (unsigned long long)server_stats.tx_overflows,
+        (unsigned long long)server_stats.tx_bytes_queued,
+        (unsigned long long)server_stats.tx_queue_high_water,
+        (unsigned long long)server_stats.tx_bytes_shared);
+
+    DUH_WHERE_AM_I("shard %d flood control: %llu chat messages and %llu invitations dropped", SHARD_self(),
+        (unsigned long long)server_stats.chat_dropped,
+        (unsigned long long)server_stats.invites_dropped);
+}
+
+/****************************************************************************************************************/
+/*! \brief Has shard 0 shut the server down once it's between batches (see SERVER_shut_down()).  Called from shard
+ * 0's reactor, after RCTR_init(); a signal that came in before then is waiting in the eventfd, and gets acted on
+ * as soon as the reactor starts.
+ */
+void SERVER_watch_for_shutdown(void)
+{
+    if (!RCTR_watch(&server_shutdown_watch, server_shutdown_fd, SERVER_shut_down, NULL, NULL))
+    {
+        OH_SMEG("Couldn't watch for being asked to shut down.");
+        exit(1);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Asks shard 0 to shut down, and that's all.  Shutting down means saving the player store and joining the
+ * other shards, none of which is safe from inside a signal handler - shard 0 could be anywhere when the signal
+ * lands, from the middle of malloc() to halfway through adding a player - so it's left to SERVER_shut_down().
  */
 static void SERVER_signal_handler(int signal_num)
 {
+    uint64_t    one     = 1;
+    int         saved   = errno;
+
     switch (signal_num)
     {
         case SIGINT:
         case SIGHUP:
         case SIGTERM:
-        {
-            DUH_WHERE_AM_I("We've been asked to shut down...");
-            exit(0); // the individual modules' cleanup functions will run automatically at this point.
-        }
+            write(server_shutdown_fd, &one, sizeof(one));
+        break;
     }
+
+    errno = saved;
+}
+
+/****************************************************************************************************************/
+/*! \brief Reactor callback for when a signal's asked us to shut down; we're on shard 0, between messages, with
+ * nothing half done.
+ */
+static void SERVER_shut_down(void *unused)
+{
+    uint64_t count;
+
+    read(server_shutdown_fd, &count, sizeof(count));
+
+    DUH_WHERE_AM_I("We've been asked to shut down...");
+    exit(0); // the individual modules' cleanup functions will run automatically at this point.
 }
 
 /****************************************************************************************************************/
@@ -7,10 +7,94 @@
     #include    "tictactwo-common.h"
     #include    <signal.h>
     #include    <fcntl.h>
+    #include    <unistd.h>
 
+    /*! \brief Knobs that can be set from the command line; see SERVER_parse_args().
+     */
+    typedef struct
+    {
+        /*! \brief How long a new connection gets to send MSGTYPE_LOGIN before we hang up on it. */
+        uint32_t    login_deadline_ms;
+        /*! \brief How many not-yet-accepted connections the kernel should queue up on the gameplay port. */
+        int         listen_backlog;
+        /*! \brief How many shards (threads, each with their own players and rooms) to run; see shard.h. */
+        int         shard_count;
+        /*! \brief Whether each shard's thread should be pinned to a core of its own. */
+        BOOL        pin_shards;
+        /*! \brief What each shard's reactor runs on: RCTR_BACKEND_EPOLL or RCTR_BACKEND_URING. */
+        int         io_backend;
+        /*! \brief How many players each shard can have logged in at once. */
+        uint32_t    max_players;
+        /*! \brief How many games each shard can have going at once. */
+        uint32_t    max_rooms;
+        /*! \brief How many chat messages (whispers, channel joins and leaves, and history requests included) each
+         * player can send a second, on average; 0 for no limit.
+         */
+        uint32_t    chat_rate;
+        /*! \brief How many chat messages each player can get away with sending in one go. */
+        uint32_t    chat_burst;
+        /*! \brief How many invitations each player can send a second, on average; 0 for no limit. */
+        uint32_t    invite_rate;
+        /*! \brief How many invitations each player can get away with sending in one go. */
+        uint32_t    invite_burst;
+        /*! \brief How the player stats are kept on disk: PLYRDB_STORE_JOURNAL or PLYRDB_STORE_MAPPED. */
+        int         player_store;
+        /*! \brief How often each shard logs its running totals (see SERVER_log_stats()). */
+        uint32_t    stats_interval_ms;
+    } SERVER_CONFIG;
+
+    /*! \brief Running totals, for keeping an eye on how the server's holding up; see SERVER_log_stats().
+     * \note Each shard keeps its own.
+     */
+    typedef struct
+    {
+        /*! \brief Connections taken off the gameplay port's accept queue. */
+        uint64_t    connections_accepted;
+        /*! \brief Connections we hung up on straight away because we had no room for them. */
+        uint64_t    connections_refused;
+        /*! \brief Complete messages that have come in from clients. */
+        uint64_t    messages_received;
+        /*! \brief Trips to the kernel to wait for (and, with io_uring, submit) work: epoll_wait() or
+         * io_uring_enter().
+         */
+        uint64_t    loop_syscalls;
+        /*! \brief Calls made to the kernel to read from player sockets.  Always 0 with io_uring, which reads
+         * without being asked each time.
+         */
+        uint64_t    rx_syscalls;
+        /*! \brief Messages handed to CONN_send() that made it into an output queue. */
+        uint64_t    messages_queued;
+        /*! \brief Calls made to the kernel to actually send them; the lower this is next to messages_queued, the
+         * better the coalescing's working.  With io_uring, sends normally ride along with the loop's own
+         * io_uring_enter(), so this only counts the ones that couldn't wait.
+         */
+        uint64_t    tx_syscalls;
+        /*! \brief Times a flush filled a socket buffer and had to wait for the client to catch up. */
+        uint64_t    tx_stalls;
+        /*! \brief Clients dropped because their output queue filled up. */
+        uint64_t    tx_overflows;
+        /*! \brief How many bytes are sitting in output queues right now, across every connection. */
+        uint64_t    tx_bytes_queued;
+        /*! \brief Bytes queued by reference to a shared frame rather than copied in; see CONN_send_shared(). */
+        uint64_t    tx_bytes_shared;
+        /*! \brief The most any one connection has ever had queued. */
+        uint64_t    tx_queue_high_water;
+        /*! \brief Chat messages thrown away because whoever sent them was sending them faster than chat_rate. */
+        uint64_t    chat_dropped;
+        /*! \brief Invitations turned down because whoever sent them was sending them faster than invite_rate. */
+        uint64_t    invites_dropped;
+    } SERVER_STATS;
+
+    BOOL        SERVER_parse_args(int argc, char **argv);
     BOOL        SERVER_init(void);
+    BOOL        SERVER_listen(void);
+    void        SERVER_watch_for_shutdown(void);
+    uint64_t    SERVER_now_ms(void);
+    void        SERVER_log_stats(void);
 
-    extern int  server_listenfd_game;
-    extern int  server_listenfd_http;
+    extern __thread int             server_listenfd_game;
+    extern int                      server_listenfd_http;
+    extern SERVER_CONFIG            server_config;
+    extern __thread SERVER_STATS    server_stats;
 
 #endif
@@ -0,0 +1,361 @@
+/*! \file shard.c
+ * \brief Shard threads and the queues between them; see shard.h.
+ */
+#include    "shard.h"
+#include    <pthread.h>
+#include    <sched.h>
+#include    <signal.h>
+#include    <unistd.h>
+#include    <sys/eventfd.h>
+
+/*! \brief A function posted from one shard to another, along with its payload, which lives right after it. */
+typedef struct SHARD_MSG_TAG
+{
+    struct SHARD_MSG_TAG    *next;
+    SHARD_HANDLER           handler;
+    int                     from_shard;
+    uint32_t                length;
+} SHARD_MSG;
+
+/*! \brief Everything about one shard that other shards need to get at.
+ *
+ * The queue is a linked list that any number of shards can push onto without locking, and only the owning
+ * shard pops from (it's the one Dmitry Vyukov describes as an 'intrusive MPSC node-based queue').  Producers
+ * swap themselves in at head; the owner follows the next pointers from tail.  stub is a dummy message that
+ * keeps the list from ever being empty, which is what lets push and pop avoid stepping on each other.
+ */
+typedef struct
+{
+    /*! \brief The last message pushed.  Every producer hammers on this, so it gets a cache line to itself. */
+    SHARD_MSG   *head __attribute__((aligned(64)));
+    /*! \brief The next message to pop; only ever touched by the owning shard. */
+    SHARD_MSG   *tail __attribute__((aligned(64)));
+    SHARD_MSG   stub;
+    /*! \brief Written to whenever the queue goes from idle to having something in it. */
+    int         wake_fd;
+    /*! \brief Set by the first producer to write to wake_fd; saves everyone after it the syscall until the owner
+     * gets around to draining the queue.
+     */
+    int         signalled;
+    RCTR_WATCH  watch;
+    pthread_t   thread;
+} SHARD_STRUCT;
+
+/*! \defgroup shard_private
+ * \brief Data and functions private to the shard module.
+ * \{
+ */
+static SHARD_STRUCT     shards[MAX_SHARDS];
+static int              shard_count         = 1;
+static BOOL             shard_pin_to_cpus   = FALSE;
+static void             (*shard_main)(void) = NULL;
+
+/*! \brief Which shard the calling thread is running. */
+static __thread int     shard_self          = 0;
+
+static void             *SHARD_thread(void *index);
+static void             SHARD_pin(int index);
+static void             SHARD_push(SHARD_STRUCT *shard, SHARD_MSG *msg);
+static SHARD_MSG        *SHARD_pop(SHARD_STRUCT *shard);
+static void             SHARD_drain(void *context);
+static void             SHARD_stop_here(int from_shard, void *payload, uint32_t length);
+static void             SHARD_stop_all(void);
+/*! \} */
+
+/****************************************************************************************************************/
+/*! \brief Starts up the shards.  The calling thread becomes shard 0, so this only comes back if something went
+ * wrong before it got that far.
+ * \param count How many shards to run, 1 to MAX_SHARDS.
+ * \param pin_to_cpus If set, each shard's thread gets pinned to a core of its own (well, shard n gets core n,
+ *  wrapping around if there are more shards than cores).
+ * \param run_shard What each shard's thread runs; it sets up that shard's modules and runs its reactor.
+ * \return FALSE if the shards couldn't be started.
+ */
+BOOL SHARD_start(int count, BOOL pin_to_cpus, void (*run_shard)(void))
+{
+    sigset_t    all_signals;
+    sigset_t    old_signals;
+    int         index;
+
+    if ((count < 1) || (count > MAX_SHARDS))
+    {
+        OH_SMEG("Can't run %d shards; it has to be between 1 and %d.", count, MAX_SHARDS);
+        return FALSE;
+    }
+
+    shard_count         = count;
+    shard_pin_to_cpus   = pin_to_cpus;
+    shard_main          = run_shard;
+
+    // every queue has to exist before anyone can post to it
+    for (index = 0; index < shard_count; index++)
+    {
+        shards[index].stub.next = NULL;
+        shards[index].head      = &shards[index].stub;
+        shards[index].tail      = &shards[index].stub;
+        shards[index].signalled = 0;
+        shards[index].wake_fd   = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (shards[index].wake_fd == -1)
+        {
+            OH_SMEG("Call to eventfd() failed.");
+            return FALSE;
+        }
+    }
+
+    atexit(SHARD_stop_all);
+
+    // signals should land on shard 0, which is the thread that knows how to shut everyone down; the other
+    // shards inherit a mask that blocks them
+    sigfillset(&all_signals);
+    pthread_sigmask(SIG_BLOCK, &all_signals, &old_signals);
+
+    for (index = 1; index < shard_count; index++)
+    {
+        if (pthread_create(&shards[index].thread, NULL, SHARD_thread, (void *)(intptr_t)index) != 0)
+        {
+            OH_SMEG("Couldn't start a thread for shard %d.", index);
+            exit(1);
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    shards[0].thread = pthread_self();
+    SHARD_pin(0);
+    shard_main();
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Starts the calling shard listening for messages from the others.  Its reactor has to be up already.
+ * \note Anything posted before this is called is waiting in the queue, and gets picked up straight away.
+ */
+void SHARD_attach(void)
+{
+    SHARD_STRUCT *me = &shards[shard_self];
+
+    if (!RCTR_watch(&me->watch, me->wake_fd, SHARD_drain, NULL, me))
+    {
+        OH_SMEG("Shard %d can't watch its queue; it'd never hear from the others.", shard_self);
+        exit(1);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Which shard the caller's running on.
+ */
+int SHARD_self(void)
+{
+    return shard_self;
+}
+
+/****************************************************************************************************************/
+/*! \brief How many shards there are.
+ */
+int SHARD_count(void)
+{
+    return shard_count;
+}
+
+/****************************************************************************************************************/
+/*! \brief Asks another shard to run a function.  It'll get run the next time that shard's reactor comes around,
+ * after anything else this shard has posted to it.
+ * \param payload Copied, so it can go away as soon as this returns.
+ * \return FALSE if there's no such shard or we're out of memory, in which case nothing gets run.
+ */
+BOOL SHARD_post(int shard, SHARD_HANDLER handler, const void *payload, uint32_t length)
+{
+    SHARD_STRUCT    *target;
+    SHARD_MSG       *msg;
+    uint64_t        one = 1;
+
+    if ((shard < 0) || (shard >= shard_count))
+        return FALSE;
+
+    msg = (SHARD_MSG *)malloc(sizeof(SHARD_MSG) + length);
+
+    if (msg == NULL)
+    {
+        OH_SMEG("Out of memory posting %u bytes to shard %d.", length, shard);
+        return FALSE;
+    }
+
+    msg->handler    = handler;
+    msg->from_shard = shard_self;
+    msg->length     = length;
+
+    if (length > 0)
+        memcpy(msg + 1, payload, length);
+
+    target = &shards[shard];
+    SHARD_push(target, msg);
+
+    // only the first one in since the last drain needs to wake it
+    if (__atomic_exchange_n(&target->signalled, 1, __ATOMIC_ACQ_REL) == 0)
+        write(target->wake_fd, &one, sizeof(one));
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Posts the same function and payload to every shard but this one.
+ */
+void SHARD_post_to_others(SHARD_HANDLER handler, const void *payload, uint32_t length)
+{
+    int index;
+
+    for (index = 0; index < shard_count; index++)
+    {
+        if (index != shard_self)
+            SHARD_post(index, handler, payload, length);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief What each shard's thread (other than shard 0, which is the main thread) starts off running.
+ */
+static void *SHARD_thread(void *index)
+{
+    shard_self = (int)(intptr_t)index;
+
+    SHARD_pin(shard_self);
+    shard_main();
+
+    return NULL;
+}
+
+/****************************************************************************************************************/
+/*! \brief Pins the calling thread to its core, if we were asked to.
+ */
+static void SHARD_pin(int index)
+{
+    cpu_set_t   cpus;
+    long        cores;
+
+    if (!shard_pin_to_cpus) return;
+
+    cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cores < 1) cores = 1;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(index % cores, &cpus);
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+    {
+        DUH_WHERE_AM_I("WARNING: Couldn't pin shard %d to core %ld; it'll float.", index, index % cores);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Adds a message to the front of a shard's queue.  Safe to call from any thread.
+ */
+static void SHARD_push(SHARD_STRUCT *shard, SHARD_MSG *msg)
+{
+    SHARD_MSG *prev;
+
+    msg->next = NULL;
+
+    prev = __atomic_exchange_n(&shard->head, msg, __ATOMIC_ACQ_REL);
+
+    // between the exchange and this store, the list's briefly broken in two; SHARD_pop() copes with that
+    __atomic_store_n(&prev->next, msg, __ATOMIC_RELEASE);
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes the oldest message off a shard's queue.  Only the owning shard may call this.
+ * \return The message, or NULL if there isn't one - or if the only one left is still being pushed, in which
+ *  case its producer hasn't signalled yet and will wake us again once it has.
+ */
+static SHARD_MSG *SHARD_pop(SHARD_STRUCT *shard)
+{
+    SHARD_MSG *tail = shard->tail;
+    SHARD_MSG *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    // skip over the stub
+    if (tail == &shard->stub)
+    {
+        if (next == NULL)
+            return NULL;
+
+        shard->tail = next;
+        tail        = next;
+        next        = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next != NULL)
+    {
+        shard->tail = next;
+        return tail;
+    }
+
+    // tail looks like the last one, but a push may be half done
+    if (tail != __atomic_load_n(&shard->head, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    // it really is the last one; put the stub back behind it so we can take it without emptying the list
+    SHARD_push(shard, &shard->stub);
+
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (next != NULL)
+    {
+        shard->tail = next;
+        return tail;
+    }
+
+    return NULL;
+}
+
+/****************************************************************************************************************/
+/*! \brief Called by the reactor when another shard's posted us something; runs everything that's waiting.
+ */
+static void SHARD_drain(void *context)
+{
+    SHARD_STRUCT    *me = (SHARD_STRUCT *)context;
+    SHARD_MSG       *msg;
+    uint64_t        count;
+
+    read(me->wake_fd, &count, sizeof(count));
+
+    // has to happen before we look at the queue, so anything pushed from here on wakes us again
+    __atomic_store_n(&me->signalled, 0, __ATOMIC_SEQ_CST);
+
+    while ((msg = SHARD_pop(me)) != NULL)
+    {
+        msg->handler(msg->from_shard, msg + 1, msg->length);
+        free(msg);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Posted to a shard to make its thread stop where it is.
+ */
+static void SHARD_stop_here(int from_shard, void *payload, uint32_t length)
+{
+    pthread_exit(NULL);
+}
+
+/****************************************************************************************************************/
+/*! \brief Stops every other shard before the rest of the exit handlers (in particular, the player DB's) tear
+ * down things they might still be using.  Designed to be called automagically on exit.
+ */
+static void SHARD_stop_all(void)
+{
+    int index;
+
+    for (index = 0; index < shard_count; index++)
+    {
+        if (index != shard_self)
+            SHARD_post(index, SHARD_stop_here, NULL, 0);
+    }
+
+    // shard 0 is the main thread, which can't be joined; if it isn't us, it's stopping anyway
+    for (index = 1; index < shard_count; index++)
+    {
+        if (index != shard_self)
+            pthread_join(shards[index].thread, NULL);
+    }
+}
@@ -0,0 +1,36 @@
+/*! \file shard.h
+ * \brief Runs the server as several independent shards, one per thread, and lets them talk to each other.
+ *
+ * Each shard has its own reactor, its own listening socket on the gameplay port (the kernel spreads new
+ * connections across them, courtesy of SO_REUSEPORT) and its own connections, players and game rooms; the
+ * modules that own those keep them in thread-local storage, so a shard never touches another's.  The only way
+ * for shards to affect each other is to post a message: a function to run on the other shard, plus a copy of
+ * whatever it needs to work on.  Each shard has a lock-free queue that any other shard can push onto, and an
+ * eventfd its reactor watches so it wakes up to drain it.
+ *
+ * With the default of one shard, everything runs on the main thread just like it always has.
+ */
+#ifndef         SHARD_H
+    #define     SHARD_H
+
+    #include    "tictactwo-common.h"
+    #include    "reactor.h"
+
+    /*! \brief The most shards we'll run, however many cores the host has. */
+    #define     MAX_SHARDS      64
+
+    /*! \brief The signature of a function posted to another shard.
+     * \param from_shard Which shard posted it.
+     * \param payload The posting shard's copy of whatever it wanted the function to have; only valid until the
+     *  function returns.
+     */
+    typedef void (*SHARD_HANDLER)(int from_shard, void *payload, uint32_t length);
+
+    BOOL    SHARD_start(int count, BOOL pin_to_cpus, void (*shard_main)(void));
+    void    SHARD_attach(void);
+    int     SHARD_self(void);
+    int     SHARD_count(void);
+    BOOL    SHARD_post(int shard, SHARD_HANDLER handler, const void *payload, uint32_t length);
+    void    SHARD_post_to_others(SHARD_HANDLER handler, const void *payload, uint32_t length);
+
+#endif
@@ -0,0 +1,300 @@
+/*! \file uring.c
+ * \brief The bare-bones io_uring wrapper; see uring.h.
+ */
+#include    "uring.h"
+#include    <sys/mman.h>
+#include    <sys/syscall.h>
+#include    <unistd.h>
+#include    <errno.h>
+
+#define     URING_BUFFER_MASK       (URING_BUFFER_COUNT - 1)
+
+/*! \brief Where everything the kernel shares with us ended up after mmap()ing it. */
+typedef struct
+{
+    int                     fd;
+
+    // submission ring
+    uint32_t                *sq_head;
+    uint32_t                *sq_tail;
+    uint32_t                sq_mask;
+    uint32_t                sq_entries;
+    struct io_uring_sqe     *sqes;
+    /*! \brief How many SQEs we've handed out, and how many of those the kernel's been told about. */
+    uint32_t                sqe_tail;
+    uint32_t                sqe_submitted;
+
+    // completion ring
+    uint32_t                *cq_head;
+    uint32_t                *cq_tail;
+    uint32_t                cq_mask;
+    struct io_uring_cqe     *cqes;
+
+    void                    *ring_map;
+    size_t                  ring_map_size;
+    size_t                  sqes_map_size;
+
+    // receive buffers
+    struct io_uring_buf_ring *buf_ring;
+    char                    *buffers;
+    uint16_t                buf_tail;
+} URING_STRUCT;
+
+/*! \defgroup uring_private
+ * \brief Data and functions private to the io_uring wrapper.
+ * \{
+ */
+static __thread URING_STRUCT    uring   = { -1 };
+
+static BOOL URING_setup_buffers(void);
+/*! \} */
+
+/****************************************************************************************************************/
+/*! \brief Creates the calling thread's ring and its receive buffers.
+ * \return TRUE if it's ready to go, FALSE if the kernel doesn't do io_uring (or won't let us use it).
+ */
+BOOL URING_init(void)
+{
+    struct io_uring_params  params;
+    uint32_t                *sq_array;
+    uint32_t                index;
+    char                    *ring;
+
+    bzero(&params, sizeof(params));
+
+    // each ring only ever gets used by the shard that made it, so let the kernel skip the cross-thread stuff
+    params.flags        = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN |
+                          IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    params.cq_entries   = URING_CQ_ENTRIES;
+
+    uring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+
+    if ((uring.fd == -1) && (errno == EINVAL))
+    {
+        // older kernel; plain will do
+        bzero(&params, sizeof(params));
+        params.flags        = IORING_SETUP_CQSIZE;
+        params.cq_entries   = URING_CQ_ENTRIES;
+
+        uring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    }
+
+    if (uring.fd == -1)
+    {
+        OH_SMEG("Call to io_uring_setup() failed: %s", strerror(errno));
+        return FALSE;
+    }
+
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        OH_SMEG("This kernel's io_uring is too old for us.");
+        URING_exit();
+        return FALSE;
+    }
+
+    // the submission and completion rings share one mapping; the SQEs get another
+    uring.ring_map_size = params.sq_off.array + (params.sq_entries * sizeof(uint32_t));
+
+    if (uring.ring_map_size < (params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe))))
+        uring.ring_map_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+
+    uring.sqes_map_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    uring.ring_map  = mmap(NULL, uring.ring_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            uring.fd, IORING_OFF_SQ_RING);
+    uring.sqes      = mmap(NULL, uring.sqes_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            uring.fd, IORING_OFF_SQES);
+
+    if ((uring.ring_map == MAP_FAILED) || (uring.sqes == MAP_FAILED))
+    {
+        OH_SMEG("Couldn't map the io_uring rings.");
+        URING_exit();
+        return FALSE;
+    }
+
+    ring = (char *)uring.ring_map;
+
+    uring.sq_head       = (uint32_t *)(ring + params.sq_off.head);
+    uring.sq_tail       = (uint32_t *)(ring + params.sq_off.tail);
+    uring.sq_mask       = *(uint32_t *)(ring + params.sq_off.ring_mask);
+    uring.sq_entries    = params.sq_entries;
+    uring.sqe_tail      = *uring.sq_tail;
+    uring.sqe_submitted = uring.sqe_tail;
+
+    uring.cq_head       = (uint32_t *)(ring + params.cq_off.head);
+    uring.cq_tail       = (uint32_t *)(ring + params.cq_off.tail);
+    uring.cq_mask       = *(uint32_t *)(ring + params.cq_off.ring_mask);
+    uring.cqes          = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+
+    // SQE n always goes in slot n, so the indirection array never has to change
+    sq_array = (uint32_t *)(ring + params.sq_off.array);
+
+    for (index = 0; index < uring.sq_entries; index++)
+        sq_array[index] = index;
+
+    if (!URING_setup_buffers())
+    {
+        URING_exit();
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Hands out a blank SQE to fill in.  It goes to the kernel with the next URING_submit().
+ * \note If the ring's full, what's already in it gets submitted first to make room, so this never fails.
+ */
+struct io_uring_sqe *URING_get_sqe(void)
+{
+    struct io_uring_sqe *sqe;
+
+    while ((uring.sqe_tail - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE)) >= uring.sq_entries)
+        URING_submit(0);
+
+    sqe = &uring.sqes[uring.sqe_tail & uring.sq_mask];
+    uring.sqe_tail++;
+
+    bzero(sqe, sizeof(struct io_uring_sqe));
+
+    return sqe;
+}
+
+/****************************************************************************************************************/
+/*! \brief Tells the kernel about every SQE handed out since last time, and optionally waits for completions.
+ * \param wait_for How many completions to wait for; 0 just submits (and posts whatever's already finished).
+ * \return Whatever io_uring_enter() returned; -1 with errno set if it failed (EINTR just means try again).
+ */
+int URING_submit(uint32_t wait_for)
+{
+    uint32_t    to_submit   = uring.sqe_tail - uring.sqe_submitted;
+    int         result;
+
+    __atomic_store_n(uring.sq_tail, uring.sqe_tail, __ATOMIC_RELEASE);
+
+    // GETEVENTS even when not waiting; with deferred task running, it's what gets finished work posted
+    result = syscall(__NR_io_uring_enter, uring.fd, to_submit, wait_for, IORING_ENTER_GETEVENTS, NULL, 0);
+
+    if (result >= 0)
+        uring.sqe_submitted += result;
+
+    return result;
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes the next completion off the ring, if there is one.
+ * \param cqe Gets a copy of it, so the slot can be handed straight back to the kernel.
+ * \return TRUE if there was one.
+ */
+BOOL URING_pop_cqe(struct io_uring_cqe *cqe)
+{
+    uint32_t head = *uring.cq_head;
+
+    if (head == __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE))
+        return FALSE;
+
+    *cqe = uring.cqes[head & uring.cq_mask];
+
+    __atomic_store_n(uring.cq_head, head + 1, __ATOMIC_RELEASE);
+
+    return TRUE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Picks one particular completion out of the ring, ahead of any others waiting in front of it.
+ * \param user_data Which operation's completion to look for.
+ * \return TRUE if it was there, in which case it's copied to cqe, and URING_pop_cqe() will later hand back what's
+ *  left of it with user_data zeroed.
+ */
+BOOL URING_take_cqe(uint64_t user_data, struct io_uring_cqe *cqe)
+{
+    uint32_t head = *uring.cq_head;
+    uint32_t tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+
+    // everything between head and tail is ours until head moves past it, so it's fine to scribble on
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe *candidate = &uring.cqes[head & uring.cq_mask];
+
+        if (candidate->user_data == user_data)
+        {
+            *cqe                    = *candidate;
+            candidate->user_data    = 0;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/****************************************************************************************************************/
+/*! \brief Finds the receive buffer the kernel picked for a completion (its id is in the top of cqe->flags).
+ */
+char *URING_buffer(uint16_t buffer_id)
+{
+    return &uring.buffers[(uint32_t)buffer_id * URING_BUFFER_SIZE];
+}
+
+/****************************************************************************************************************/
+/*! \brief Gives a receive buffer back to the kernel once we're done with what's in it.
+ */
+void URING_release_buffer(uint16_t buffer_id)
+{
+    struct io_uring_buf *buf = &uring.buf_ring->bufs[uring.buf_tail & URING_BUFFER_MASK];
+
+    buf->addr   = (uint64_t)(uintptr_t)URING_buffer(buffer_id);
+    buf->len    = URING_BUFFER_SIZE;
+    buf->bid    = buffer_id;
+
+    uring.buf_tail++;
+
+    __atomic_store_n(&uring.buf_ring->tail, uring.buf_tail, __ATOMIC_RELEASE);
+}
+
+/****************************************************************************************************************/
+/*! \brief Tears down the calling thread's ring.
+ */
+void URING_exit(void)
+{
+    if (uring.fd == -1) return;
+
+    close(uring.fd);
+    uring.fd = -1;
+}
+
+/****************************************************************************************************************/
+/*! \brief Registers a ring of receive buffers with the kernel, so multishot receives can pick their own.
+ */
+static BOOL URING_setup_buffers(void)
+{
+    struct io_uring_buf_reg reg;
+    uint32_t                index;
+
+    uring.buf_ring  = mmap(NULL, URING_BUFFER_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uring.buffers   = (char *)malloc((size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+
+    if ((uring.buf_ring == MAP_FAILED) || (uring.buffers == NULL))
+    {
+        OH_SMEG("Couldn't allocate io_uring receive buffers.");
+        return FALSE;
+    }
+
+    bzero(&reg, sizeof(reg));
+    reg.ring_addr       = (uint64_t)(uintptr_t)uring.buf_ring;
+    reg.ring_entries    = URING_BUFFER_COUNT;
+    reg.bgid            = URING_BUFFER_GROUP;
+
+    if (syscall(__NR_io_uring_register, uring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+    {
+        OH_SMEG("Couldn't register io_uring receive buffers: %s", strerror(errno));
+        return FALSE;
+    }
+
+    uring.buf_tail = 0;
+
+    for (index = 0; index < URING_BUFFER_COUNT; index++)
+        URING_release_buffer(index);
+
+    return TRUE;
+}
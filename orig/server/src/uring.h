@@ -0,0 +1,40 @@
+/*! \file uring.h
+ * \brief Just enough of an io_uring wrapper for the reactor's io_uring backend, talking to the kernel directly
+ * rather than through liburing.
+ *
+ * Every shard that uses it gets its own ring (and its own pool of receive buffers), kept in thread-local storage,
+ * so none of this is ever shared between threads.
+ */
+#ifndef         URING_H
+    #define     URING_H
+
+    #include    "tictactwo-common.h"
+    #include    <linux/io_uring.h>
+
+    /*! \brief How many submissions fit in the ring at once. */
+    #define     URING_ENTRIES           256
+    /*! \brief How many completions fit.  Every receive buffer can have one waiting, and there has to be plenty of
+     * room left over on top of that; one that doesn't fit ends up on the kernel's overflow list, where
+     * URING_take_cqe() can't see it.
+     */
+    #define     URING_CQ_ENTRIES        4096
+
+    /*! \brief The buffer group multishot receives take their buffers from. */
+    #define     URING_BUFFER_GROUP      0
+    /*! \brief How many receive buffers each ring has.  Has to be a power of two, and well short of
+     * URING_CQ_ENTRIES.
+     */
+    #define     URING_BUFFER_COUNT      512
+    /*! \brief How big each receive buffer is; this is the most a single receive completion can hand us. */
+    #define     URING_BUFFER_SIZE       2048
+
+    BOOL                    URING_init(void);
+    struct io_uring_sqe     *URING_get_sqe(void);
+    int                     URING_submit(uint32_t wait_for);
+    BOOL                    URING_pop_cqe(struct io_uring_cqe *cqe);
+    BOOL                    URING_take_cqe(uint64_t user_data, struct io_uring_cqe *cqe);
+    char                    *URING_buffer(uint16_t buffer_id);
+    void                    URING_release_buffer(uint16_t buffer_id);
+    void                    URING_exit(void);
+
+#endif
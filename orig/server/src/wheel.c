@@ -0,0 +1,265 @@
+/*! \file wheel.c
+ * \brief The hierarchical timer wheel; see wheel.h.
+ */
+#include    "wheel.h"
+
+#define     WHEEL_SLOT_MASK         (WHEEL_SLOTS - 1)
+/*! \brief How many ticks one bucket on a level spans. */
+#define     WHEEL_SPAN(level)       (1ULL << ((level) * WHEEL_SLOT_BITS))
+/*! \brief How far ahead the wheel reaches, in ticks. */
+#define     WHEEL_REACH             (WHEEL_SPAN(WHEEL_LEVELS) - 1)
+
+/*! \defgroup wheel_private
+ * \brief Functions private to the timer wheel.
+ * \{
+ */
+static void WHEEL_insert(WHEEL_STRUCT *wheel, WHEEL_TIMER *timer);
+static void WHEEL_unlink(WHEEL_STRUCT *wheel, WHEEL_TIMER *timer);
+static uint64_t WHEEL_next_event(const WHEEL_STRUCT *wheel);
+static void WHEEL_cascade(WHEEL_STRUCT *wheel, int level);
+static void WHEEL_expire(WHEEL_STRUCT *wheel);
+static uint64_t WHEEL_rotate(uint64_t bits, uint32_t by);
+/*! \} */
+
+/****************************************************************************************************************/
+/*! \brief Sets up an empty wheel.
+ * \param now_ms What time it is, by whatever clock the wheel's going to be kept to (SERVER_now_ms(), say).
+ */
+void WHEEL_init(WHEEL_STRUCT *wheel, uint64_t now_ms)
+{
+    bzero(wheel, sizeof(WHEEL_STRUCT));
+
+    wheel->now = now_ms / WHEEL_TICK_MS;
+}
+
+/****************************************************************************************************************/
+/*! \brief Starts a timer, or if it's running already, reschedules it.
+ * \param due_ms When it should first go off.
+ * \param interval_ms How often it should go off after that, or 0 for just the once.
+ */
+void WHEEL_start(WHEEL_STRUCT *wheel, WHEEL_TIMER *timer, uint64_t due_ms, uint32_t interval_ms,
+    WHEEL_CALLBACK on_expiry, void *context)
+{
+    WHEEL_stop(wheel, timer);
+
+    // rounded up, so it never goes off early; and never in the tick that's already been dealt with
+    timer->expires      = (due_ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    timer->interval     = (interval_ms + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+    timer->on_expiry    = on_expiry;
+    timer->context      = context;
+
+    if (timer->expires <= wheel->now)
+        timer->expires = wheel->now + 1;
+
+    if ((interval_ms > 0) && (timer->interval == 0))
+        timer->interval = 1;
+
+    WHEEL_insert(wheel, timer);
+}
+
+/****************************************************************************************************************/
+/*! \brief Stops a timer.  Does nothing if it isn't running.
+ */
+void WHEEL_stop(WHEEL_STRUCT *wheel, WHEEL_TIMER *timer)
+{
+    if (timer->pprev != NULL)
+        WHEEL_unlink(wheel, timer);
+}
+
+/****************************************************************************************************************/
+/*! \brief Whether a timer's waiting to go off.
+ */
+BOOL WHEEL_is_running(const WHEEL_TIMER *timer)
+{
+    return timer->pprev != NULL;
+}
+
+/****************************************************************************************************************/
+/*! \brief Brings the wheel up to the current time, setting off every timer that's come due along the way, in the
+ * order they came due.  They're free to start and stop timers, themselves included.
+ */
+void WHEEL_advance(WHEEL_STRUCT *wheel, uint64_t now_ms)
+{
+    uint64_t    target = now_ms / WHEEL_TICK_MS;
+    uint64_t    next;
+    int         level;
+
+    while (wheel->now < target)
+    {
+        // skip straight over any stretch where there's nothing to do
+        next = WHEEL_next_event(wheel);
+
+        if (next > target)
+        {
+            wheel->now = target;
+            return;
+        }
+
+        wheel->now = next;
+
+        // top down, so anything that comes down more than one level on this tick gets all the way down
+        for (level = WHEEL_LEVELS - 1; level > 0; level--)
+        {
+            if ((wheel->now & (WHEEL_SPAN(level) - 1)) == 0)
+                WHEEL_cascade(wheel, level);
+        }
+
+        WHEEL_expire(wheel);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief When the wheel next needs to be advanced: either some timer's due then, or a bucket of them needs to be
+ * spread out.  It's fine to advance it sooner (or later, but then whatever's due goes off late).
+ * \return The time, by the wheel's clock, or UINT64_MAX if there aren't any timers running.
+ */
+uint64_t WHEEL_next_deadline_ms(const WHEEL_STRUCT *wheel)
+{
+    uint64_t next = WHEEL_next_event(wheel);
+
+    return (next == UINT64_MAX) ? UINT64_MAX : (next * WHEEL_TICK_MS);
+}
+
+/****************************************************************************************************************/
+/*! \brief Puts a timer in whichever bucket it belongs in, given what time the wheel says it is.
+ */
+static void WHEEL_insert(WHEEL_STRUCT *wheel, WHEEL_TIMER *timer)
+{
+    uint64_t    delta;
+    uint32_t    slot;
+    int         level;
+
+    if (timer->expires < wheel->now)
+        timer->expires = wheel->now;
+
+    delta = timer->expires - wheel->now;
+
+    if (delta > WHEEL_REACH)
+    {
+        timer->expires  = wheel->now + WHEEL_REACH;
+        delta           = WHEEL_REACH;
+    }
+
+    // the lowest level whose buckets, all together, reach far enough out
+    for (level = 0; level < (WHEEL_LEVELS - 1); level++)
+    {
+        if (delta < WHEEL_SPAN(level + 1))
+            break;
+    }
+
+    slot            = (timer->expires >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK;
+    timer->bucket   = (level * WHEEL_SLOTS) + slot;
+
+    // on to the front of the bucket
+    timer->next     = wheel->buckets[timer->bucket];
+    timer->pprev    = &wheel->buckets[timer->bucket];
+
+    if (timer->next != NULL)
+        timer->next->pprev = &timer->next;
+
+    wheel->buckets[timer->bucket]   = timer;
+    wheel->occupied[level]          |= (1ULL << slot);
+}
+
+/****************************************************************************************************************/
+/*! \brief Takes a timer out of whatever list it's on.
+ */
+static void WHEEL_unlink(WHEEL_STRUCT *wheel, WHEEL_TIMER *timer)
+{
+    *timer->pprev = timer->next;
+
+    if (timer->next != NULL)
+        timer->next->pprev = timer->pprev;
+
+    timer->next     = NULL;
+    timer->pprev    = NULL;
+
+    // (if it was on the list of ones going off right now, the bucket's already been emptied, and so has its bit)
+    if (wheel->buckets[timer->bucket] == NULL)
+        wheel->occupied[timer->bucket / WHEEL_SLOTS] &= ~(1ULL << (timer->bucket & WHEEL_SLOT_MASK));
+}
+
+/****************************************************************************************************************/
+/*! \brief The next tick where there's anything to do, or UINT64_MAX if there's nothing running at all.
+ * \note A bucket on level n gets spread out on the first tick of the span it covers, which with WHEEL_SLOTS
+ *  buckets to a level is the next tick whose level-n bucket number is its.
+ */
+static uint64_t WHEEL_next_event(const WHEEL_STRUCT *wheel)
+{
+    uint64_t    next = UINT64_MAX;
+    uint64_t    span_now;
+    uint64_t    candidate;
+    int         level;
+
+    for (level = 0; level < WHEEL_LEVELS; level++)
+    {
+        if (wheel->occupied[level] == 0)
+            continue;
+
+        // the first occupied bucket after the one we're in, counting around from it
+        span_now    = wheel->now >> (level * WHEEL_SLOT_BITS);
+        candidate   = span_now + 1 +
+                      __builtin_ctzll(WHEEL_rotate(wheel->occupied[level], (span_now + 1) & WHEEL_SLOT_MASK));
+        candidate <<= (level * WHEEL_SLOT_BITS);
+
+        if (candidate < next)
+            next = candidate;
+    }
+
+    return next;
+}
+
+/****************************************************************************************************************/
+/*! \brief Spreads out the bucket on a level that the current tick's just reached, over the levels below.
+ */
+static void WHEEL_cascade(WHEEL_STRUCT *wheel, int level)
+{
+    uint32_t    slot    = (wheel->now >> (level * WHEEL_SLOT_BITS)) & WHEEL_SLOT_MASK;
+    WHEEL_TIMER **bucket = &wheel->buckets[(level * WHEEL_SLOTS) + slot];
+    WHEEL_TIMER *timer;
+
+    while ((timer = *bucket) != NULL)
+    {
+        WHEEL_unlink(wheel, timer);
+        WHEEL_insert(wheel, timer);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Sets off everything due on the current tick.
+ */
+static void WHEEL_expire(WHEEL_STRUCT *wheel)
+{
+    uint32_t    slot        = wheel->now & WHEEL_SLOT_MASK;
+    WHEEL_TIMER *expiring   = wheel->buckets[slot];
+    WHEEL_TIMER *timer;
+
+    if (expiring == NULL) return;
+
+    // moved off to a list of its own, so anything started from the callbacks can't end up on it; anything
+    // stopped from them comes off it just the same
+    wheel->buckets[slot]    = NULL;
+    wheel->occupied[0]      &= ~(1ULL << slot);
+    expiring->pprev         = &expiring;
+
+    while ((timer = expiring) != NULL)
+    {
+        WHEEL_unlink(wheel, timer);
+
+        if (timer->interval > 0)
+        {
+            timer->expires += timer->interval;
+            WHEEL_insert(wheel, timer);
+        }
+
+        timer->on_expiry(timer->context);
+    }
+}
+
+/****************************************************************************************************************/
+/*! \brief Rotates a bucket bitmap so bit n becomes bit 0.
+ */
+static uint64_t WHEEL_rotate(uint64_t bits, uint32_t by)
+{
+    return (bits >> by) | (bits << ((64 - by) & 63));
+}
@@ -0,0 +1,70 @@
+/*! \file wheel.h
+ * \brief A hierarchical timer wheel: any number of one-shot or repeating timers, where starting or stopping one
+ * is constant time and the cost of keeping time is proportional to how many actually go off, not how many are
+ * waiting.
+ *
+ * Timers are bucketed by when they're due, WHEEL_SLOTS buckets to a level; each level's buckets span
+ * WHEEL_SLOTS times as long as the level below's, and a bucket gets spread out over the level below as time
+ * reaches it.  Nothing's ever looked at before then, so a timer that gets stopped or pushed back before it's due
+ * (say, a room's idle timeout) costs nothing beyond the starting and stopping.
+ *
+ * This is just the data structure; it doesn't know what time it is unless it's told.  The reactor runs one per
+ * shard (see RCTR_start_timer()), which is what everything else should use.
+ */
+#ifndef         WHEEL_H
+    #define     WHEEL_H
+
+    #include    "tictactwo-common.h"
+
+    /*! \brief How finely the wheel keeps time; nothing goes off early, but it can go off up to this late. */
+    #define     WHEEL_TICK_MS           10
+    #define     WHEEL_SLOT_BITS         6
+    #define     WHEEL_SLOTS             (1 << WHEEL_SLOT_BITS)
+    /*! \brief How many levels there are; with 10 ms ticks, the top one reaches out a couple of days, and anything
+     * due later than that is treated as due then.
+     */
+    #define     WHEEL_LEVELS            4
+
+    /*! \brief The signature of the function a timer calls when it goes off. */
+    typedef void (*WHEEL_CALLBACK)(void *context);
+
+    /*! \brief One timer.  Zero it (or just make it static) before first use; after that, it's fine to start,
+     * restart or stop it as often as you like.
+     * \note While it's running, the wheel holds on to a pointer to this, so it has to stay put until it's gone off
+     *  (if it's one-shot) or been stopped.
+     */
+    typedef struct WHEEL_TIMER
+    {
+        struct WHEEL_TIMER  *next;
+        /*! \brief Whatever points at this timer in its bucket, or NULL if it's not running. */
+        struct WHEEL_TIMER  **pprev;
+        /*! \brief Which bucket it's in: level * WHEEL_SLOTS + slot. */
+        uint32_t            bucket;
+        /*! \brief When it's due, in ticks. */
+        uint64_t            expires;
+        /*! \brief How often it repeats, in ticks; 0 if it's one-shot. */
+        uint64_t            interval;
+        WHEEL_CALLBACK      on_expiry;
+        void                *context;
+    } WHEEL_TIMER;
+
+    /*! \brief A wheel.  Treat it as opaque; it's only out here so wheels can be declared statically.
+     */
+    typedef struct
+    {
+        /*! \brief The last tick that's been dealt with. */
+        uint64_t            now;
+        WHEEL_TIMER         *buckets[WHEEL_LEVELS * WHEEL_SLOTS];
+        /*! \brief A bit per bucket on each level, set while there's anything in it. */
+        uint64_t            occupied[WHEEL_LEVELS];
+    } WHEEL_STRUCT;
+
+    void        WHEEL_init(WHEEL_STRUCT *wheel, uint64_t now_ms);
+    void        WHEEL_start(WHEEL_STRUCT *wheel, WHEEL_TIMER *timer, uint64_t due_ms, uint32_t interval_ms,
+                    WHEEL_CALLBACK on_expiry, void *context);
+    void        WHEEL_stop(WHEEL_STRUCT *wheel, WHEEL_TIMER *timer);
+    BOOL        WHEEL_is_running(const WHEEL_TIMER *timer);
+    void        WHEEL_advance(WHEEL_STRUCT *wheel, uint64_t now_ms);
+    uint64_t    WHEEL_next_deadline_ms(const WHEEL_STRUCT *wheel);
+
+#endif